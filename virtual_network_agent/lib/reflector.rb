@@ -94,7 +94,7 @@ class Reflector
       end
       tunnel_endpoints.each_pair do | vni, teps |
         vni = convert_vni vni.to_s
-        teps.each do | tep |
+        updates = teps.collect do | tep |
           raise BadRequestError.new "IP address must be specified." if tep[ :ip ].nil?
           raise BadRequestError.new "Port number must be specified." if tep[ :port ].nil?
 
@@ -105,11 +105,9 @@ class Reflector
           end
           logger.debug "vni = #{ vni } address = #{ address } port = #{ port }"
 
-          if tunnel_endpoint.exists?( vni, address )
-            tunnel_endpoint.delete vni, address
-          end
-          tunnel_endpoint.add vni, address, port
+          [ :add, address, port ]
         end
+        tunnel_endpoint.update vni, updates, true
       end
     end
 
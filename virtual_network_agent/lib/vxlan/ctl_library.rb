@@ -0,0 +1,245 @@
+#
+# Copyright (C) 2013 NEC Corporation
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License, version 2, as
+# published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+begin
+  require 'fiddle'
+  require 'fiddle/import'
+rescue LoadError
+end
+
+module Vxlan
+
+  # Bindings to libvxlanctl and libreflectorctl. Requests are sent over a
+  # connection kept open by the library instead of spawning vxlanctl or
+  # reflectorctl for each of them. Callers fall back to the commands if a
+  # library cannot be loaded.
+  module CtlLibrary
+
+    SUCCEEDED = 0
+    UPDATE_ADD = 1
+    UPDATE_DELETE = 2
+
+    # Stands in for Process::Status so that failures are raised with the
+    # same error classes and exit status as the commands.
+    class Status
+      attr_reader :exitstatus
+
+      def initialize exitstatus
+        @exitstatus = exitstatus
+      end
+
+      def exited?
+        true
+      end
+
+      def success?
+        @exitstatus == SUCCEEDED
+      end
+
+      def inspect
+        "#<#{ self.class.name } exit #{ @exitstatus }>"
+      end
+
+    end
+
+    class << self
+      def available?
+        defined?( Fiddle::Importer ) and true or false
+      end
+
+      def string chars
+        chars.pack( 'c*' ).unpack( 'Z*' ).first
+      end
+
+      def chars string, length
+        bytes = string.to_s.unpack( 'c*' )[ 0, length - 1 ]
+        bytes + [ 0 ] * ( length - bytes.length )
+      end
+
+      # Calls the block with a pointer to each record of a reply.
+      def handler &block
+        Fiddle::Closure::BlockCaller.new( Fiddle::TYPE_VOID, [ Fiddle::TYPE_VOIDP, Fiddle::TYPE_VOIDP ] ) do | record, user_data |
+          block.call record
+        end
+      end
+
+      # Returns records of type in an array allocated by the library.
+      def records type, count
+        buffer = Fiddle::Pointer.malloc( type.size * [ count, 1 ].max, Fiddle::RUBY_FREE )
+        entries = ( 0...count ).collect { | i | type.new( buffer.to_i + type.size * i ) }
+        [ buffer, entries ]
+      end
+
+    end
+
+    module Libvxlanctl
+      STATES = { 0 => 'Inactive', 1 => 'Active', 2 => 'Dormant' }
+      DEFAULT = -1
+      INSTANCE_NOT_FOUND = 6
+
+      class << self
+        # Returns true if the library at path is loaded.
+        def load path
+          return @loaded unless @loaded.nil?
+          @loaded = false
+          return false if path.nil? or not CtlLibrary.available? or not File.exist?( path )
+          extend Fiddle::Importer
+          dlload path
+          extern 'int vxlanctl_add_instance(unsigned int, char *, unsigned short, int, int, int, int, int, unsigned short, unsigned short)'
+          extern 'int vxlanctl_delete_instance(unsigned int)'
+          extern 'int vxlanctl_list_instances(void *, void *)'
+          extern 'int vxlanctl_show_instance(unsigned int, void *)'
+          extern 'int vxlanctl_update_fdb(unsigned int, void *, unsigned int, int)'
+          extern 'int vxlanctl_update_neighbors(unsigned int, void *, unsigned int)'
+          extern 'int vxlanctl_add_remote(unsigned int, char *)'
+          extern 'int vxlanctl_delete_remote(unsigned int, char *)'
+          @instance = struct [ 'unsigned int vni', 'unsigned char state', 'char flooding_addr[16]',
+                               'unsigned short port', 'unsigned short vlan', 'unsigned short inner_vlan',
+                               'unsigned int aging_time', 'unsigned int max_fdb_entries', 'unsigned int n_fdb_entries',
+                               'unsigned long long fdb_memory_usage', 'unsigned char learning', 'int flood_rate',
+                               'unsigned char neighbor_suppression', 'unsigned long long unknown_unicast_flooded',
+                               'unsigned long long unknown_unicast_dropped', 'unsigned long long neighbor_suppression_hits',
+                               'unsigned long long neighbor_suppression_misses', 'unsigned long long egress_dropped' ]
+          @fdb_update = struct [ 'unsigned char op', 'char eth_addr[18]', 'char ip_addr[16]' ]
+          @neighbor_update = struct [ 'unsigned char op', 'char ip_addr[46]', 'char eth_addr[18]' ]
+          @loaded = true
+        rescue Fiddle::DLError
+          @loaded = false
+        end
+
+        def add_instance vni, address, neighbor_suppression
+          vxlanctl_add_instance vni.to_i, address, 0, DEFAULT, DEFAULT, 1, DEFAULT,
+                                neighbor_suppression ? 1 : 0, 0, 0
+        end
+
+        def delete_instance vni
+          vxlanctl_delete_instance vni.to_i
+        end
+
+        # Returns [ status, { vni => { :address, :port, :aging_time, :state } } ].
+        def list_instances vni = nil
+          list = {}
+          if vni.nil?
+            status = vxlanctl_list_instances CtlLibrary.handler { | record | add_instance_to list, @instance.new( record ) }, nil
+          else
+            buffer, instances = CtlLibrary.records @instance, 1
+            status = vxlanctl_show_instance vni.to_i, buffer
+            add_instance_to list, instances.first if status == SUCCEEDED
+            status = SUCCEEDED if status == INSTANCE_NOT_FOUND
+          end
+          [ status, list ]
+        end
+
+        def update_fdb vni, updates, replace
+          buffer, entries = CtlLibrary.records @fdb_update, updates.length
+          updates.each_with_index do | ( op, mac, address ), i |
+            entries[ i ].op = op == :add ? UPDATE_ADD : UPDATE_DELETE
+            entries[ i ].eth_addr = CtlLibrary.chars( mac, 18 )
+            entries[ i ].ip_addr = CtlLibrary.chars( address, 16 )
+          end
+          vxlanctl_update_fdb vni.to_i, buffer, updates.length, replace ? 1 : 0
+        end
+
+        def update_neighbors vni, updates
+          buffer, entries = CtlLibrary.records @neighbor_update, updates.length
+          updates.each_with_index do | ( op, address, mac ), i |
+            entries[ i ].op = op == :add ? UPDATE_ADD : UPDATE_DELETE
+            entries[ i ].ip_addr = CtlLibrary.chars( address, 46 )
+            entries[ i ].eth_addr = CtlLibrary.chars( mac, 18 )
+          end
+          vxlanctl_update_neighbors vni.to_i, buffer, updates.length
+        end
+
+        def add_remote vni, address
+          vxlanctl_add_remote vni.to_i, address.to_s
+        end
+
+        def delete_remote vni, address = nil
+          vxlanctl_delete_remote vni.to_i, address.nil? ? nil : address.to_s
+        end
+
+        private
+
+        def add_instance_to list, instance
+          list[ instance.vni ] = { :address => CtlLibrary.string( instance.flooding_addr ), :port => instance.port,
+                                   :aging_time => instance.aging_time, :state => STATES[ instance.state ] }
+        end
+
+      end
+
+    end
+
+    module Libreflectorctl
+      ALL_VNIS = 0xffffffff
+
+      class << self
+        # Returns true if the library at path is loaded.
+        def load path
+          return @loaded unless @loaded.nil?
+          @loaded = false
+          return false if path.nil? or not CtlLibrary.available? or not File.exist?( path )
+          extend Fiddle::Importer
+          dlload path
+          extern 'int reflectorctl_add_tep(unsigned int, char *, unsigned short)'
+          extern 'int reflectorctl_delete_tep(unsigned int, char *)'
+          extern 'int reflectorctl_list_teps(unsigned int, void *, void *)'
+          extern 'int reflectorctl_update_teps(unsigned int, void *, unsigned int, int)'
+          @tunnel_endpoint = struct [ 'unsigned int vni', 'char ip_addr[16]', 'unsigned short port',
+                                      'unsigned long long packet_count', 'unsigned long long octet_count' ]
+          @tep_update = struct [ 'unsigned char op', 'char ip_addr[16]', 'unsigned short port' ]
+          @loaded = true
+        rescue Fiddle::DLError
+          @loaded = false
+        end
+
+        def add_tep vni, address, port = nil
+          reflectorctl_add_tep vni.to_i, address.to_s, port.to_i
+        end
+
+        def delete_tep vni, address
+          reflectorctl_delete_tep vni.to_i, address.to_s
+        end
+
+        # Returns [ status, [ [ vni, { :ip, :port, :packet_count, :octet_count } ], ... ] ].
+        def list_teps vni = nil
+          tunnel_endpoints = []
+          callback = CtlLibrary.handler do | record |
+            tep = @tunnel_endpoint.new( record )
+            tunnel_endpoints << [ tep.vni, { :ip => CtlLibrary.string( tep.ip_addr ), :port => tep.port,
+                                             :packet_count => tep.packet_count, :octet_count => tep.octet_count } ]
+          end
+          status = reflectorctl_list_teps vni.nil? ? ALL_VNIS : vni.to_i, callback, nil
+          [ status, tunnel_endpoints ]
+        end
+
+        def update_teps vni, updates, replace
+          buffer, entries = CtlLibrary.records @tep_update, updates.length
+          updates.each_with_index do | ( op, address, port ), i |
+            entries[ i ].op = op == :add ? UPDATE_ADD : UPDATE_DELETE
+            entries[ i ].ip_addr = CtlLibrary.chars( address, 16 )
+            entries[ i ].port = port.to_i
+          end
+          reflectorctl_update_teps vni.to_i, buffer, updates.length, replace ? 1 : 0
+        end
+
+      end
+
+    end
+
+  end
+
+end
@@ -17,6 +17,7 @@
 
 require 'systemu'
 require 'vxlan/configure'
+require 'vxlan/ctl_library'
 require 'vxlan/log'
 
 module Vxlan
@@ -46,6 +47,11 @@ module Vxlan
           Ctl.delete_tunnel_endpoint vni, address
         end
 
+        # updates: [ [ :add, address, port ], [ :delete, address ], ... ]
+        def update vni, updates, replace = false
+          Ctl.update_tunnel_endpoints vni, updates, replace
+        end
+
         def list vni
           tunnel_endpoints = Ctl.list_tunnel_endpoints vni
           tunnel_endpoints.has_key?( vni ) and tunnel_endpoints[ vni ] or nil
@@ -93,9 +99,12 @@ module Vxlan
 
     end
 
+    Libreflectorctl = CtlLibrary::Libreflectorctl
+
     class Ctl
       class << self
         def add_tunnel_endpoint vni, address, port = nil
+          return libreflectorctl( 'add_tep' ) { Libreflectorctl.add_tep vni, address, port } if library?
           options = [ '--vni', vni, '--ip', address ]
           if not port.nil?
             options = options + [ '--port', port ]
@@ -104,14 +113,39 @@ module Vxlan
         end
 
         def delete_tunnel_endpoint vni, address
+          return libreflectorctl( 'delete_tep' ) { Libreflectorctl.delete_tep vni, address } if library?
           options = [ '--vni', vni, '--ip', address ]
           reflectorctl '--del_tep', options
         end
 
+        # Applies all updates in a single request. With replace, tunnel
+        # endpoints of the vni that are not added are removed.
+        def update_tunnel_endpoints vni, updates, replace = false
+          if library?
+            return libreflectorctl( 'update_teps' ) { Libreflectorctl.update_teps vni, updates, replace }
+          end
+          input = updates.collect do | op, address, port |
+            op == :add ? "add #{ address } #{ port }".rstrip + "\n" : "del #{ address }\n"
+          end.join
+          options = [ '--vni', vni ]
+          options << '--replace' if replace
+          reflectorctl '--update_tep', options, input
+        end
+
         def list_tunnel_endpoints vni = nil
           tunnel_endpoints = Hash.new do | hash, key |
             hash[ key ] = []
           end
+          if library?
+            begin
+              libreflectorctl( 'list_teps' ) { Libreflectorctl.list_teps vni }.each do | key, tunnel_endpoint |
+                tunnel_endpoints[ key ].push tunnel_endpoint
+              end
+            rescue CtlError => e
+              raise unless e.tep_entry_not_found?
+            end
+            return tunnel_endpoints
+          end
           line_no = 0
           options = []
           if not vni.nil?
@@ -138,14 +172,31 @@ module Vxlan
           Vxlan::Configure.instance[ 'vxlan_tunnel_endpoint' ]
         end
 
-        def reflectorctl command, options = []
+        # Talks to reflectord through libreflectorctl if it is configured and
+        # can be loaded, otherwise through reflectorctl.
+        def library?
+          path = config[ 'libreflectorctl' ]
+          if not path.nil? and %r,^/, !~ path
+            path = File.dirname( __FILE__ ) + '/../../' + path
+          end
+          Libreflectorctl.load path
+        end
+
+        def libreflectorctl function
+          status, result = yield
+          logger.debug "libreflectorctl: '#{ function }' ( status = #{ status } )"
+          raise CtlError.new( CtlLibrary::Status.new( status ), '', '', "libreflectorctl #{ function }" ) unless status == CtlLibrary::SUCCEEDED
+          result
+        end
+
+        def reflectorctl command, options = [], input = nil
           full_path = config[ 'reflectorctl' ]
           if %r,^/, !~ full_path
             full_path = File.dirname( __FILE__ ) + '/../../' + full_path
           end
           command_options = "#{ full_path } #{ command } #{ options.join ' ' }"
           logger.debug "reflectorctl: '#{ command_options }'"
-          status, result, error = systemu command_options
+          status, result, error = systemu command_options, 'stdin' => input
           raise CtlError.new( status, result, error, command_options ) unless status.success?
           result
         end
@@ -17,6 +17,7 @@
 
 require 'systemu'
 require 'vxlan/configure'
+require 'vxlan/ctl_library'
 require 'vxlan/log'
 
 module Vxlan
@@ -41,6 +42,22 @@ module Vxlan
           VxlanCtl.list_instances vni
         end
 
+        def update_fdb vni, updates, replace = false
+          VxlanCtl.update_fdb vni, updates, replace
+        end
+
+        def update_neighbors vni, updates
+          VxlanCtl.update_neighbors vni, updates
+        end
+
+        def add_remote vni, address
+          VxlanCtl.add_remote vni, address
+        end
+
+        def delete_remote vni, address = nil
+          VxlanCtl.delete_remote vni, address
+        end
+
         def exists? vni
           list( vni ).has_key? vni
         end
@@ -83,6 +100,8 @@ module Vxlan
 
     end
 
+    Libvxlanctl = CtlLibrary::Libvxlanctl
+
     class VxlanCtl
       class << self
         def name vni
@@ -90,47 +109,109 @@ module Vxlan
         end
 
         def add_instance vni, address
+          if library?
+            return libvxlanctl( 'add_instance' ) do
+              Libvxlanctl.add_instance vni, address, config[ 'neighbor_suppression' ] == true
+            end
+          end
           options = [ '--vni', vni ]
           if not address.nil?
             options = options + [ '--ip', address ]
           end
+          if config[ 'neighbor_suppression' ] == true
+            options = options + [ '--neighbor_suppression', 'on' ]
+          end
           vxlanctl '--add_instance', options
         end
 
         def delete_instance vni
+          return libvxlanctl( 'delete_instance' ) { Libvxlanctl.delete_instance vni } if library?
           options = [ '--vni', vni ]
           vxlanctl '--del_instance', options
         end
 
         def list_instances vni = nil
+          return libvxlanctl( 'list_instances' ) { Libvxlanctl.list_instances vni } if library?
           list = {}
           options = [ '--quiet' ]
           if not vni.nil?
-            options = [ '--vni', vni ]
+            options = options + [ '--vni', vni ]
           end
           vxlanctl( '--list_instances', options ).split( "\n").each do | row |
             row = $1 if /^\s*(\S+(?:\s+\S+)*)\s*$/ =~ row
-            vni, address, port, aging_time, state = row.split( /\s*\|\s*/, 5 )
+            vni, address, port, aging_time, state = row.split( /\s*\|\s*/, 7 )
             port = 0 if port == '-'
             list [ vni.hex ] = { :address => address, :port => port.to_i, :aging_time => aging_time.to_i, :state => state }
           end
           list
         end
 
+        # updates: [ [ :add, mac, address ], [ :delete, mac ], ... ]
+        # With replace, static entries that are not added are removed.
+        def update_fdb vni, updates, replace = false
+          return libvxlanctl( 'update_fdb' ) { Libvxlanctl.update_fdb vni, updates, replace } if library?
+          input = updates.collect do | op, mac, address |
+            op == :add ? "add #{ mac } #{ address }\n" : "del #{ mac }\n"
+          end.join
+          options = [ '--vni', vni ]
+          options << '--replace' if replace
+          vxlanctl '--update_fdb', options, input
+        end
+
+        # updates: [ [ :add, address, mac ], [ :delete, address ], ... ]
+        def update_neighbors vni, updates
+          return libvxlanctl( 'update_neighbors' ) { Libvxlanctl.update_neighbors vni, updates } if library?
+          input = updates.collect do | op, address, mac |
+            op == :add ? "add #{ address } #{ mac }\n" : "del #{ address }\n"
+          end.join
+          options = [ '--vni', vni ]
+          vxlanctl '--update_neighbors', options, input
+        end
+
+        def add_remote vni, address
+          return libvxlanctl( 'add_remote' ) { Libvxlanctl.add_remote vni, address } if library?
+          options = [ '--vni', vni, '--ip', address ]
+          vxlanctl '--add_remote', options
+        end
+
+        def delete_remote vni, address = nil
+          return libvxlanctl( 'delete_remote' ) { Libvxlanctl.delete_remote vni, address } if library?
+          options = [ '--vni', vni ]
+          options += [ '--ip', address ] unless address.nil?
+          vxlanctl '--del_remote', options
+        end
+
         private
 
         def config
           Vxlan::Configure.instance[ 'vxlan_tunnel_endpoint' ]
         end
 
-        def vxlanctl command, options = []
+        # Talks to vxland through libvxlanctl if it is configured and can be
+        # loaded, otherwise through vxlanctl.
+        def library?
+          path = config[ 'libvxlanctl' ]
+          if not path.nil? and %r,^/, !~ path
+            path = File.dirname( __FILE__ ) + '/../../' + path
+          end
+          Libvxlanctl.load path
+        end
+
+        def libvxlanctl function
+          status, result = yield
+          logger.debug "libvxlanctl: '#{ function }' ( status = #{ status } )"
+          raise VxlanCtlError.new( CtlLibrary::Status.new( status ), '', '', "libvxlanctl #{ function }" ) unless status == CtlLibrary::SUCCEEDED
+          result
+        end
+
+        def vxlanctl command, options = [], input = nil
           full_path = config[ 'vxlanctl' ]
           if %r,^/, !~ full_path
             full_path = File.dirname( __FILE__ ) + '/../../' + full_path
           end
           command_options = "#{ full_path } #{ command } #{ options.join ' ' }"
           logger.debug "vxlanctl: '#{ command_options }'"
-          status, result, error = systemu command_options
+          status, result, error = systemu command_options, 'stdin' => input
           raise VxlanCtlError.new( status, result, error, command_options ) unless status.success?
           result
         end
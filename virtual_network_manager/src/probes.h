@@ -0,0 +1,58 @@
+/*
+ * Author: Yasunobu Chiba
+ *
+ * Copyright (C) 2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef PROBES_H
+#define PROBES_H
+
+
+/*
+ * Static tracepoints ( USDT ) for bpftrace and perf. Probes are compiled
+ * out if <sys/sdt.h> is not available or NO_PROBES is defined. Arguments
+ * are listed in doc/probes.md of vxlan_tunnel_endpoint and are only ever
+ * appended.
+ */
+
+#if !defined( NO_PROBES ) && defined( __has_include )
+#if __has_include( <sys/sdt.h> )
+#include <sys/sdt.h>
+#define PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef PROBES_ENABLED
+#define PROBE2( _provider, _name, _a1, _a2 ) DTRACE_PROBE2( _provider, _name, _a1, _a2 )
+#define PROBE3( _provider, _name, _a1, _a2, _a3 ) DTRACE_PROBE3( _provider, _name, _a1, _a2, _a3 )
+#define PROBE4( _provider, _name, _a1, _a2, _a3, _a4 ) DTRACE_PROBE4( _provider, _name, _a1, _a2, _a3, _a4 )
+#else
+#define PROBE2( _provider, _name, _a1, _a2 )
+#define PROBE3( _provider, _name, _a1, _a2, _a3 )
+#define PROBE4( _provider, _name, _a1, _a2, _a3, _a4 )
+#endif
+
+
+#endif // PROBES_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
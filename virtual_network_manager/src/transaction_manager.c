@@ -23,6 +23,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <time.h>
+#include "probes.h"
 #include "transaction_manager.h"
 #include "trema.h"
 #ifdef UNIT_TEST
@@ -362,6 +363,7 @@ age_transaction_entries( void *user_data ) {
           continue;
         }
         else {
+          PROBE3( vnet_manager, transaction_timeout, entry->datapath_id, entry->xid, entry->original_xid );
           warn( "Transaction timeout ( xid = %#x, barrier_xid = %#x, original_xid = %#x, expires_at = %d.%09d ).",
                 entry->xid, entry->barrier_xid, entry->original_xid,
                 ( int ) entry->expires_at.tv_sec, ( int ) entry->expires_at.tv_nsec );
@@ -407,6 +409,7 @@ execute_transaction( uint64_t datapath_id, const buffer *message,
     // FIXME: send queue may be full. We may need to retry for sending the message.
     error( "Failed to send an OpenFlow message ( datapath_id = %#" PRIx64 ", transaction_id = %#x ).",
            datapath_id, entry->original_xid );
+    PROBE3( vnet_manager, transaction_send_failed, datapath_id, entry->xid, entry->original_xid );
     free_transaction_entry( entry );
     return false;
   }
@@ -417,6 +420,7 @@ execute_transaction( uint64_t datapath_id, const buffer *message,
   if ( !ret ) {
     error( "Failed to send a barrier request ( datapath_id = %#" PRIx64 ", transaction_id = %#x ).",
            datapath_id, entry->barrier_xid );
+    PROBE3( vnet_manager, transaction_send_failed, datapath_id, entry->xid, entry->original_xid );
     free_transaction_entry( entry );
     return false;
   }
@@ -434,6 +438,8 @@ execute_transaction( uint64_t datapath_id, const buffer *message,
     return false;
   }
 
+  PROBE4( vnet_manager, transaction_start, datapath_id, entry->xid, entry->barrier_xid, entry->original_xid );
+
   debug( "OpenFlow messages are put into a send queue and a transaction entry is saved." );
 
   return true;
@@ -453,6 +459,8 @@ handle_barrier_reply( uint64_t datapath_id, uint32_t transaction_id, void *user_
     return;
   }
 
+  PROBE3( vnet_manager, transaction_barrier_reply, datapath_id, entry->xid, entry->original_xid );
+
   entry->completed = true;
   bool ret = get_monotonic_time( &entry->expires_at );
   if ( !ret ) {
@@ -485,6 +493,8 @@ handle_error( uint64_t datapath_id, uint32_t transaction_id, uint16_t type, uint
     entry->completed = true;
   }
 
+  PROBE4( vnet_manager, transaction_error, datapath_id, entry->xid, type, code );
+
   entry->error_received = true;
   bool ret = get_monotonic_time( &entry->expires_at );
   if ( !ret ) {
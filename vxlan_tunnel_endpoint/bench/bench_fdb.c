@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fdb.h"
+#include "microbench.h"
+#include "qsbr.h"
+
+
+#define AGING_TIMEOUT 10 // Seconds to wait for all entries to be aged out
+
+
+struct fdb_bench {
+  struct fdb *fdb;
+  uint32_t size;
+  uint8_t ( *macs )[ ETH_ALEN ];
+  uint32_t *order;
+  uint32_t rounds;
+  int n_threads;
+  struct in_addr vtep_addr;
+};
+
+
+static void
+learn_entries( int index, void *user_data ) {
+  struct fdb_bench *bench = user_data;
+  for ( uint32_t i = ( uint32_t ) index; i < bench->size; i += ( uint32_t ) bench->n_threads ) {
+    fdb_add_entry( bench->fdb, bench->macs[ bench->order[ i ] ], bench->vtep_addr );
+  }
+}
+
+
+// Looks up and refreshes entries as done for every frame received.
+static void
+refresh_entries( int index, void *user_data ) {
+  struct fdb_bench *bench = user_data;
+  uint32_t start = ( uint32_t ) ( ( uint64_t ) bench->size * ( uint32_t ) index / ( uint32_t ) bench->n_threads );
+  for ( uint32_t r = 0; r < bench->rounds; r++ ) {
+    for ( uint32_t i = 0; i < bench->size; i++ ) {
+      struct fdb_entry *entry = fdb_search_entry( bench->fdb, bench->macs[ bench->order[ ( start + i ) % bench->size ] ] );
+      if ( entry == NULL ) {
+        abort();
+      }
+      refresh_fdb_entry( entry );
+    }
+  }
+}
+
+
+static pid_t
+find_thread( const char *name ) {
+  DIR *dir = opendir( "/proc/self/task" );
+  if ( dir == NULL ) {
+    return 0;
+  }
+  pid_t tid = 0;
+  struct dirent *e;
+  while ( tid == 0 && ( e = readdir( dir ) ) != NULL ) {
+    char path[ 300 ];
+    char comm[ 32 ];
+    snprintf( path, sizeof( path ), "/proc/self/task/%s/comm", e->d_name );
+    FILE *fp = fopen( path, "r" );
+    if ( fp == NULL ) {
+      continue;
+    }
+    if ( fgets( comm, sizeof( comm ), fp ) != NULL ) {
+      comm[ strcspn( comm, "\n" ) ] = '\0';
+      if ( strcmp( comm, name ) == 0 ) {
+        tid = ( pid_t ) atoi( e->d_name );
+      }
+    }
+    fclose( fp );
+  }
+  closedir( dir );
+
+  return tid;
+}
+
+
+static uint32_t
+count_entries( struct fdb *fdb ) {
+  struct fdb_stats stats;
+  get_fdb_stats( fdb, &stats );
+
+  return stats.n_entries;
+}
+
+
+/*
+ * Entries are aged out by the aging thread, so that its CPU time is
+ * measured instead of wall clock time.
+ */
+static void
+bench_aging( struct fdb_bench *bench ) {
+  pid_t tid = find_thread( "fdb_aging" );
+  if ( tid == 0 ) {
+    return;
+  }
+
+  bench->fdb = init_fdb( 1, bench->size );
+  bench->n_threads = 1;
+  learn_entries( 0, bench );
+  uint32_t n_entries = count_entries( bench->fdb );
+
+  struct measurement m;
+  start_measurement( &m, tid );
+  uint64_t deadline = bench_clock() + ( uint64_t ) AGING_TIMEOUT * 1000000000;
+  while ( count_entries( bench->fdb ) > 0 && bench_clock() < deadline ) {
+    struct timespec req = { 0, 10000000 };
+    nanosleep( &req, NULL );
+  }
+  stop_measurement( &m );
+  if ( count_entries( bench->fdb ) == 0 ) {
+    report_measurement( "fdb_age", bench->size, 1, n_entries, &m );
+  }
+
+  destroy_fdb( bench->fdb );
+  qsbr_reclaim();
+}
+
+
+static void
+bench_size( uint32_t size, const int *threads, int n_threads ) {
+  struct fdb_bench bench;
+  memset( &bench, 0, sizeof( bench ) );
+  bench.size = size;
+  bench.macs = malloc( ( size_t ) size * ETH_ALEN );
+  for ( uint32_t i = 0; i < size; i++ ) {
+    uint8_t mac[ ETH_ALEN ] = { 0x02, 0x00, ( uint8_t ) ( i >> 24 ), ( uint8_t ) ( i >> 16 ),
+                                ( uint8_t ) ( i >> 8 ), ( uint8_t ) i };
+    memcpy( bench.macs[ i ], mac, ETH_ALEN );
+  }
+  bench.order = create_permutation( size, size + 1 );
+  bench.vtep_addr.s_addr = htonl( 0x0a000001 );
+
+  bench.rounds = bench_rounds( size );
+  uint64_t n_ops = ( uint64_t ) size * bench.rounds;
+
+  struct measurement m;
+  for ( int t = 0; t < n_threads; t++ ) {
+    bench.n_threads = threads[ t ];
+
+    struct measurement learns;
+    memset( &learns, 0, sizeof( learns ) );
+    for ( uint32_t r = 0; r < bench.rounds; r++ ) {
+      bench.fdb = init_fdb( 300, size );
+      run_bench_threads( bench.n_threads, learn_entries, &bench, &m );
+      add_measurement( &learns, &m );
+      if ( r == 0 && bench_enabled( "fdb_refresh" ) ) {
+        run_bench_threads( bench.n_threads, refresh_entries, &bench, &m );
+        report_measurement( "fdb_refresh", size, bench.n_threads, n_ops * ( uint32_t ) bench.n_threads, &m );
+      }
+      destroy_fdb( bench.fdb );
+      qsbr_reclaim();
+    }
+    if ( bench_enabled( "fdb_learn" ) ) {
+      report_measurement( "fdb_learn", size, bench.n_threads, n_ops, &learns );
+    }
+  }
+
+  // Half of the entries learned evict older ones.
+  if ( bench_enabled( "fdb_learn_evict" ) && size >= 2 ) {
+    bench.n_threads = 1;
+    struct measurement learns;
+    memset( &learns, 0, sizeof( learns ) );
+    for ( uint32_t r = 0; r < bench.rounds; r++ ) {
+      bench.fdb = init_fdb( 300, size / 2 );
+      run_bench_threads( 1, learn_entries, &bench, &m );
+      add_measurement( &learns, &m );
+      destroy_fdb( bench.fdb );
+      qsbr_reclaim();
+    }
+    report_measurement( "fdb_learn_evict", size, 1, n_ops, &learns );
+  }
+
+  if ( bench_enabled( "fdb_age" ) ) {
+    bench_aging( &bench );
+  }
+
+  free( bench.order );
+  free( bench.macs );
+}
+
+
+void
+bench_fdb( const uint32_t *sizes, int n_sizes, const int *threads, int n_threads ) {
+  if ( !bench_group_enabled( "fdb_" ) ) {
+    return;
+  }
+
+  init_fdb_aging();
+  for ( int i = 0; i < n_sizes; i++ ) {
+    bench_size( sizes[ i ], threads, n_threads );
+  }
+  finalize_fdb_aging();
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "microbench.h"
+
+
+#define KEY_LENGTH 6 // Keys are as long as MAC addresses as in forwarding databases.
+
+
+struct hash_bench {
+  struct hash hash;
+  uint32_t size;
+  uint8_t ( *keys )[ KEY_LENGTH ];
+  uint32_t *order;
+  uint32_t rounds;
+  int n_threads;
+  bool lockless;
+};
+
+
+static void
+make_key( uint8_t *key, uint32_t index, uint8_t prefix ) {
+  key[ 0 ] = 0x02;
+  key[ 1 ] = prefix;
+  key[ 2 ] = ( uint8_t ) ( index >> 24 );
+  key[ 3 ] = ( uint8_t ) ( index >> 16 );
+  key[ 4 ] = ( uint8_t ) ( index >> 8 );
+  key[ 5 ] = ( uint8_t ) index;
+}
+
+
+static void
+insert_keys( int index, void *user_data ) {
+  struct hash_bench *bench = user_data;
+  for ( uint32_t i = ( uint32_t ) index; i < bench->size; i += ( uint32_t ) bench->n_threads ) {
+    uint32_t k = bench->order[ i ];
+    insert_hash( &bench->hash, bench->keys[ k ], bench->keys[ k ] );
+  }
+}
+
+
+static void
+lookup_keys( int index, void *user_data ) {
+  struct hash_bench *bench = user_data;
+  // Every thread looks up all keys starting at a different position.
+  uint32_t start = ( uint32_t ) ( ( uint64_t ) bench->size * ( uint32_t ) index / ( uint32_t ) bench->n_threads );
+  for ( uint32_t r = 0; r < bench->rounds; r++ ) {
+    for ( uint32_t i = 0; i < bench->size; i++ ) {
+      uint32_t k = bench->order[ ( start + i ) % bench->size ];
+      void *data = bench->lockless ? search_hash_lockless( &bench->hash, bench->keys[ k ] )
+                                   : search_hash( &bench->hash, bench->keys[ k ] );
+      if ( data == NULL ) {
+        abort();
+      }
+    }
+  }
+}
+
+
+static void
+lookup_missing_keys( int index, void *user_data ) {
+  struct hash_bench *bench = user_data;
+  uint8_t key[ KEY_LENGTH ];
+  for ( uint32_t r = 0; r < bench->rounds; r++ ) {
+    for ( uint32_t i = 0; i < bench->size; i++ ) {
+      make_key( key, bench->order[ i ], ( uint8_t ) ( 0x80 + index ) );
+      if ( search_hash_lockless( &bench->hash, key ) != NULL ) {
+        abort();
+      }
+    }
+  }
+}
+
+
+static void
+delete_keys( int index, void *user_data ) {
+  struct hash_bench *bench = user_data;
+  for ( uint32_t i = ( uint32_t ) index; i < bench->size; i += ( uint32_t ) bench->n_threads ) {
+    uint32_t k = bench->order[ i ];
+    if ( delete_hash( &bench->hash, bench->keys[ k ] ) == NULL ) {
+      abort();
+    }
+  }
+}
+
+
+static void
+count_entry( void *data, void *user_data ) {
+  if ( data != NULL ) {
+    ( *( uint64_t * ) user_data )++;
+  }
+}
+
+
+static void
+iterate_entries( int index, void *user_data ) {
+  struct hash_bench *bench = user_data;
+  for ( uint32_t r = 0; r < bench->rounds; r++ ) {
+    uint64_t count = 0;
+    foreach_hash( &bench->hash, count_entry, &count );
+    if ( index == 0 && count != bench->size ) {
+      abort();
+    }
+  }
+}
+
+
+static void
+bench_size( uint32_t size, const int *threads, int n_threads ) {
+  struct hash_bench bench;
+  memset( &bench, 0, sizeof( bench ) );
+  bench.size = size;
+  bench.keys = malloc( ( size_t ) size * KEY_LENGTH );
+  for ( uint32_t i = 0; i < size; i++ ) {
+    make_key( bench.keys[ i ], i, 0x00 );
+  }
+  bench.order = create_permutation( size, size );
+
+  bench.rounds = bench_rounds( size );
+  uint64_t n_lookups = ( uint64_t ) size * bench.rounds;
+
+  struct measurement m;
+  for ( int t = 0; t < n_threads; t++ ) {
+    bench.n_threads = threads[ t ];
+
+    // Tables are built and torn down again until enough entries are
+    // inserted and deleted. Lookups and iteration are measured on the first
+    // table only since they are repeated by themselves.
+    struct measurement inserts;
+    struct measurement deletes;
+    memset( &inserts, 0, sizeof( inserts ) );
+    memset( &deletes, 0, sizeof( deletes ) );
+    for ( uint32_t r = 0; r < bench.rounds; r++ ) {
+      init_hash( &bench.hash, KEY_LENGTH );
+
+      // Tables grow from the initial size while inserting.
+      run_bench_threads( bench.n_threads, insert_keys, &bench, &m );
+      add_measurement( &inserts, &m );
+
+      if ( r == 0 && bench_enabled( "hash_lookup" ) ) {
+        bench.lockless = false;
+        run_bench_threads( bench.n_threads, lookup_keys, &bench, &m );
+        report_measurement( "hash_lookup", size, bench.n_threads, n_lookups * ( uint32_t ) bench.n_threads, &m );
+      }
+      if ( r == 0 && bench_enabled( "hash_lookup_lockless" ) ) {
+        bench.lockless = true;
+        run_bench_threads( bench.n_threads, lookup_keys, &bench, &m );
+        report_measurement( "hash_lookup_lockless", size, bench.n_threads, n_lookups * ( uint32_t ) bench.n_threads, &m );
+      }
+      if ( r == 0 && bench_enabled( "hash_lookup_miss" ) ) {
+        run_bench_threads( bench.n_threads, lookup_missing_keys, &bench, &m );
+        report_measurement( "hash_lookup_miss", size, bench.n_threads, n_lookups * ( uint32_t ) bench.n_threads, &m );
+      }
+      if ( r == 0 && bench_enabled( "hash_iterate" ) ) {
+        run_bench_threads( bench.n_threads, iterate_entries, &bench, &m );
+        report_measurement( "hash_iterate", size, bench.n_threads, n_lookups * ( uint32_t ) bench.n_threads, &m );
+      }
+
+      run_bench_threads( bench.n_threads, delete_keys, &bench, &m );
+      add_measurement( &deletes, &m );
+
+      destroy_hash( &bench.hash );
+    }
+    if ( bench_enabled( "hash_insert" ) ) {
+      report_measurement( "hash_insert", size, bench.n_threads, n_lookups, &inserts );
+    }
+    if ( bench_enabled( "hash_delete" ) ) {
+      report_measurement( "hash_delete", size, bench.n_threads, n_lookups, &deletes );
+    }
+  }
+
+  free( bench.order );
+  free( bench.keys );
+}
+
+
+void
+bench_hash( const uint32_t *sizes, int n_sizes, const int *threads, int n_threads ) {
+  if ( !bench_group_enabled( "hash_" ) ) {
+    return;
+  }
+  for ( int i = 0; i < n_sizes; i++ ) {
+    bench_size( sizes[ i ], threads, n_threads );
+  }
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
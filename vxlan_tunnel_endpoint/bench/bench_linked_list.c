@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include "linked_list.h"
+#include "microbench.h"
+
+
+struct tep {
+  struct in_addr ip_addr;
+  uint16_t port;
+};
+
+
+static struct tep *
+find_tep( list *l, struct in_addr ip_addr ) {
+  for ( list_element *e = l->head; e != NULL; e = e->next ) {
+    struct tep *tep = e->data;
+    if ( tep->ip_addr.s_addr == ip_addr.s_addr ) {
+      return tep;
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Tunnel end points are added and removed as reflectord does: a list is
+ * searched for a duplicate under its lock before an end point is
+ * appended, and searched again to remove one.
+ */
+void
+bench_linked_list( const uint32_t *sizes, int n_sizes ) {
+  if ( !bench_group_enabled( "list_" ) ) {
+    return;
+  }
+
+  for ( int i = 0; i < n_sizes; i++ ) {
+    // Lists are searched linearly, so that sizes are capped.
+    uint32_t size = sizes[ i ] < 16384 ? sizes[ i ] : 16384;
+    struct tep *teps = calloc( size, sizeof( struct tep ) );
+    uint32_t *order = create_permutation( size, size + 2 );
+    for ( uint32_t j = 0; j < size; j++ ) {
+      teps[ j ].ip_addr.s_addr = htonl( 0x0a000000 + j );
+      teps[ j ].port = 4789;
+    }
+
+    list *l = create_list();
+    struct measurement m;
+    start_measurement( &m, 0 );
+    for ( uint32_t j = 0; j < size; j++ ) {
+      pthread_mutex_lock( &l->mutex );
+      if ( find_tep( l, teps[ j ].ip_addr ) == NULL ) {
+        append_to_tail( l, &teps[ j ] );
+      }
+      pthread_mutex_unlock( &l->mutex );
+    }
+    stop_measurement( &m );
+    if ( bench_enabled( "list_tep_add" ) ) {
+      report_measurement( "list_tep_add", size, 1, size, &m );
+    }
+
+    if ( bench_enabled( "list_tep_iterate" ) ) {
+      uint64_t count = 0;
+      start_measurement( &m, 0 );
+      for ( uint32_t j = 0; j < 16; j++ ) {
+        pthread_mutex_lock( &l->mutex );
+        for ( list_element *e = l->head; e != NULL; e = e->next ) {
+          count += ( ( struct tep * ) e->data )->port != 0 ? 1 : 0;
+        }
+        pthread_mutex_unlock( &l->mutex );
+      }
+      stop_measurement( &m );
+      report_measurement( "list_tep_iterate", size, 1, count, &m );
+    }
+
+    start_measurement( &m, 0 );
+    for ( uint32_t j = 0; j < size; j++ ) {
+      struct tep *tep = find_tep( l, teps[ order[ j ] ].ip_addr );
+      if ( tep != NULL ) {
+        delete_element( l, tep );
+      }
+    }
+    stop_measurement( &m );
+    if ( bench_enabled( "list_tep_remove" ) ) {
+      report_measurement( "list_tep_remove", size, 1, size, &m );
+    }
+
+    delete_list( l );
+    free( order );
+    free( teps );
+  }
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
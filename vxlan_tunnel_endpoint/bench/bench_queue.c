@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "microbench.h"
+#include "queue.h"
+
+
+struct queue_bench {
+  queue *queue;
+  uint32_t size;
+  uint32_t n_ops;
+  uint32_t *items;
+};
+
+
+/*
+ * The receiver thread of reflectord enqueues and the distributor dequeues.
+ * Up to size items are queued as packet buffers are limited.
+ */
+static void
+produce_or_consume( int index, void *user_data ) {
+  struct queue_bench *bench = user_data;
+  if ( index == 0 ) {
+    for ( uint32_t i = 0; i < bench->n_ops; i++ ) {
+      while ( bench->queue->length >= ( int ) bench->size ) {
+        sched_yield();
+      }
+      enqueue( bench->queue, &bench->items[ i % bench->size ] );
+    }
+    return;
+  }
+  for ( uint32_t i = 0; i < bench->n_ops; ) {
+    if ( dequeue( bench->queue ) != NULL ) {
+      i++;
+    }
+    else {
+      sched_yield();
+    }
+  }
+}
+
+
+static void
+enqueue_and_dequeue( int index, void *user_data ) {
+  struct queue_bench *bench = user_data;
+  ( void ) index;
+  for ( uint32_t i = 0; i < bench->n_ops; i++ ) {
+    enqueue( bench->queue, &bench->items[ i % bench->size ] );
+    if ( dequeue( bench->queue ) == NULL ) {
+      abort();
+    }
+  }
+}
+
+
+void
+bench_queue( const uint32_t *sizes, int n_sizes ) {
+  if ( !bench_group_enabled( "queue_" ) ) {
+    return;
+  }
+
+  for ( int i = 0; i < n_sizes; i++ ) {
+    struct queue_bench bench;
+    bench.size = sizes[ i ];
+    bench.n_ops = bench.size * bench_rounds( bench.size );
+    bench.items = calloc( bench.size, sizeof( uint32_t ) );
+
+    struct measurement m;
+    if ( bench_enabled( "queue_pingpong" ) && i == 0 ) {
+      bench.queue = create_queue();
+      run_bench_threads( 1, enqueue_and_dequeue, &bench, &m );
+      report_measurement( "queue_pingpong", 1, 1, bench.n_ops, &m );
+      delete_queue( bench.queue );
+    }
+    if ( bench_enabled( "queue_spsc" ) ) {
+      bench.queue = create_queue();
+      run_bench_threads( 2, produce_or_consume, &bench, &m );
+      report_measurement( "queue_spsc", bench.size, 2, bench.n_ops, &m );
+      delete_queue( bench.queue );
+    }
+
+    free( bench.items );
+  }
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
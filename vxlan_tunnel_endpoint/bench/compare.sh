@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Copyright (C) 2013 NEC Corporation
+#
+# Compares results of microbench written with -o against a baseline and
+# prints the change of ns/op and cache misses/op of each benchmark.
+#
+# Usage: compare.sh BASELINE.json RESULTS.json
+#
+
+if [ $# -ne 2 ]; then
+  echo "Usage: $0 BASELINE.json RESULTS.json" >&2
+  exit 1
+fi
+
+awk '
+  function field( line, name,    pattern ) {
+    pattern = "\"" name "\": \"?[^,\" }]*"
+    if ( match( line, pattern ) == 0 ) {
+      return ""
+    }
+    value = substr( line, RSTART, RLENGTH )
+    sub( /^"[^"]*": "?/, "", value )
+    return value
+  }
+  function change( old, new ) {
+    if ( old == "" || new == "" || old + 0 == 0 ) {
+      return "-"
+    }
+    return sprintf( "%+.1f%%", ( new - old ) * 100 / old )
+  }
+  FNR == 1 {
+    n_files++
+  }
+  /"name":/ {
+    key = field( $0, "name" ) " " field( $0, "size" ) " " field( $0, "threads" )
+    if ( n_files == 1 ) {
+      ns[ key ] = field( $0, "ns_per_op" )
+      misses[ key ] = field( $0, "cache_misses_per_op" )
+      next
+    }
+    if ( !( key in ns ) ) {
+      next
+    }
+    if ( !header++ ) {
+      printf( "%-28s %9s %7s %10s %10s %8s %12s\n", "benchmark", "size", "threads", "base ns", "ns/op", "change", "cache-miss" )
+    }
+    split( key, k, " " )
+    printf( "%-28s %9s %7s %10s %10s %8s %12s\n", k[ 1 ], k[ 2 ], k[ 3 ], ns[ key ], field( $0, "ns_per_op" ),
+            change( ns[ key ], field( $0, "ns_per_op" ) ), change( misses[ key ], field( $0, "cache_misses_per_op" ) ) )
+  }
+' "$1" "$2"
@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Microbenchmarks of the data structures of vxland and reflectord. Each
+ * benchmark reports nanoseconds per operation, and cache misses and
+ * instructions per operation if hardware counters are available through
+ * perf_event_open(2). Results can be written in JSON to be compared with
+ * compare.sh against results of a baseline.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "microbench.h"
+
+
+#define MAX_SIZES 16
+
+
+volatile bool running = true;
+
+static const char *filter = NULL;
+static FILE *output = NULL;
+static bool first_record = true;
+
+
+static void
+usage( const char *name ) {
+  printf( "Usage: %s [OPTION]...\n"
+          "  -s, --sizes    Comma separated numbers of entries ( default 1024,65536 )\n"
+          "  -t, --threads  Comma separated numbers of threads ( default 1,2,4 )\n"
+          "  -f, --filter   Run benchmarks whose names start with this string only\n"
+          "  -o, --output   Write results in JSON to this file\n"
+          "  -h, --help     Show this help and exit.\n",
+          name );
+}
+
+
+bool
+bench_enabled( const char *name ) {
+  return filter == NULL || strncmp( name, filter, strlen( filter ) ) == 0;
+}
+
+
+// Returns true if any benchmark whose name starts with prefix may be run.
+bool
+bench_group_enabled( const char *prefix ) {
+  if ( filter == NULL ) {
+    return true;
+  }
+  size_t length = strlen( prefix ) < strlen( filter ) ? strlen( prefix ) : strlen( filter );
+
+  return strncmp( prefix, filter, length ) == 0;
+}
+
+
+uint64_t
+bench_clock() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ( uint64_t ) ts.tv_sec * 1000000000 + ( uint64_t ) ts.tv_nsec;
+}
+
+
+// CPU time of a thread in nanoseconds.
+static uint64_t
+thread_cpu_time( pid_t tid ) {
+  char path[ 64 ];
+  snprintf( path, sizeof( path ), "/proc/self/task/%d/schedstat", tid );
+  FILE *fp = fopen( path, "r" );
+  if ( fp == NULL ) {
+    return 0;
+  }
+  unsigned long long ns = 0;
+  if ( fscanf( fp, "%llu", &ns ) != 1 ) {
+    ns = 0;
+  }
+  fclose( fp );
+
+  return ( uint64_t ) ns;
+}
+
+
+static int
+open_counter( uint64_t config, pid_t tid ) {
+  struct perf_event_attr attr;
+  memset( &attr, 0, sizeof( attr ) );
+  attr.size = sizeof( attr );
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // Threads started by the benchmark after the counter is opened are counted too.
+  attr.inherit = tid == 0 ? 1 : 0;
+
+  return ( int ) syscall( __NR_perf_event_open, &attr, tid, -1, -1, 0 );
+}
+
+
+static uint64_t
+read_counter( int fd ) {
+  uint64_t value = 0;
+  if ( read( fd, &value, sizeof( value ) ) != sizeof( value ) ) {
+    return 0;
+  }
+
+  return value;
+}
+
+
+/*
+ * Measures the calling thread and threads started by it on wall clock
+ * time if tid is 0, or CPU time of another thread of this process.
+ */
+void
+start_measurement( struct measurement *m, pid_t tid ) {
+  memset( m, 0, sizeof( struct measurement ) );
+  m->cache_miss_fd = open_counter( PERF_COUNT_HW_CACHE_MISSES, tid );
+  m->instruction_fd = open_counter( PERF_COUNT_HW_INSTRUCTIONS, tid );
+  m->has_counters = m->cache_miss_fd >= 0 && m->instruction_fd >= 0;
+  if ( m->has_counters ) {
+    ioctl( m->cache_miss_fd, PERF_EVENT_IOC_ENABLE, 0 );
+    ioctl( m->instruction_fd, PERF_EVENT_IOC_ENABLE, 0 );
+  }
+  m->tid = tid;
+  m->started_at = tid == 0 ? bench_clock() : thread_cpu_time( tid );
+}
+
+
+void
+stop_measurement( struct measurement *m ) {
+  m->ns = ( m->tid == 0 ? bench_clock() : thread_cpu_time( m->tid ) ) - m->started_at;
+  if ( m->has_counters ) {
+    ioctl( m->cache_miss_fd, PERF_EVENT_IOC_DISABLE, 0 );
+    ioctl( m->instruction_fd, PERF_EVENT_IOC_DISABLE, 0 );
+    m->cache_misses = read_counter( m->cache_miss_fd );
+    m->instructions = read_counter( m->instruction_fd );
+  }
+  if ( m->cache_miss_fd >= 0 ) {
+    close( m->cache_miss_fd );
+  }
+  if ( m->instruction_fd >= 0 ) {
+    close( m->instruction_fd );
+  }
+}
+
+
+void
+add_measurement( struct measurement *total, const struct measurement *m ) {
+  total->ns += m->ns;
+  total->cache_misses += m->cache_misses;
+  total->instructions += m->instructions;
+  total->has_counters = m->has_counters;
+}
+
+
+uint32_t
+bench_rounds( uint32_t size ) {
+  return size < MIN_BENCH_OPS ? MIN_BENCH_OPS / size : 1;
+}
+
+
+void
+report_measurement( const char *name, uint32_t size, int n_threads, uint64_t n_ops, const struct measurement *m ) {
+  if ( n_ops == 0 ) {
+    return;
+  }
+  double ns_per_op = ( double ) m->ns / ( double ) n_ops;
+  double mops = ( double ) n_ops * 1e3 / ( double ) ( m->ns > 0 ? m->ns : 1 );
+  if ( m->has_counters ) {
+    double misses = ( double ) m->cache_misses / ( double ) n_ops;
+    double instructions = ( double ) m->instructions / ( double ) n_ops;
+    printf( "%-28s %9u %7d %10.1f %9.2f %13.2f %12.1f\n",
+            name, size, n_threads, ns_per_op, mops, misses, instructions );
+  }
+  else {
+    printf( "%-28s %9u %7d %10.1f %9.2f %13s %12s\n", name, size, n_threads, ns_per_op, mops, "-", "-" );
+  }
+  fflush( stdout );
+
+  if ( output == NULL ) {
+    return;
+  }
+  fprintf( output, "%s    { \"name\": \"%s\", \"size\": %u, \"threads\": %d, \"ops\": %" PRIu64 ", \"ns_per_op\": %.2f",
+           first_record ? "" : ",\n", name, size, n_threads, n_ops, ns_per_op );
+  if ( m->has_counters ) {
+    fprintf( output, ", \"cache_misses_per_op\": %.3f, \"instructions_per_op\": %.1f",
+             ( double ) m->cache_misses / ( double ) n_ops, ( double ) m->instructions / ( double ) n_ops );
+  }
+  fprintf( output, " }" );
+  first_record = false;
+}
+
+
+struct bench_thread_args {
+  struct bench_threads *threads;
+  int index;
+  uint64_t started_at;
+  uint64_t finished_at;
+};
+
+
+static void *
+run_bench_thread( void *args ) {
+  struct bench_thread_args *thread_args = args;
+  struct bench_threads *threads = thread_args->threads;
+
+  pthread_barrier_wait( &threads->barrier );
+  thread_args->started_at = bench_clock();
+  threads->function( thread_args->index, threads->user_data );
+  thread_args->finished_at = bench_clock();
+
+  return NULL;
+}
+
+
+/*
+ * Measures a function run on threads from when the first one starts
+ * running it until the last one returns.
+ */
+void
+run_bench_threads( int n_threads, void ( *function )( int index, void *user_data ), void *user_data,
+                   struct measurement *m ) {
+  if ( n_threads > MAX_BENCH_THREADS ) {
+    n_threads = MAX_BENCH_THREADS;
+  }
+
+  struct bench_threads threads;
+  struct bench_thread_args args[ MAX_BENCH_THREADS ];
+  memset( &threads, 0, sizeof( threads ) );
+  threads.n_threads = n_threads;
+  threads.function = function;
+  threads.user_data = user_data;
+  pthread_barrier_init( &threads.barrier, NULL, ( unsigned int ) n_threads + 1 );
+
+  start_measurement( m, 0 );
+  for ( int i = 0; i < n_threads; i++ ) {
+    args[ i ].threads = &threads;
+    args[ i ].index = i;
+    pthread_create( &threads.threads[ i ], NULL, run_bench_thread, &args[ i ] );
+  }
+  pthread_barrier_wait( &threads.barrier );
+  for ( int i = 0; i < n_threads; i++ ) {
+    pthread_join( threads.threads[ i ], NULL );
+  }
+  stop_measurement( m );
+
+  // Thread creation is not measured except by hardware counters.
+  uint64_t started_at = UINT64_MAX;
+  uint64_t finished_at = 0;
+  for ( int i = 0; i < n_threads; i++ ) {
+    started_at = args[ i ].started_at < started_at ? args[ i ].started_at : started_at;
+    finished_at = args[ i ].finished_at > finished_at ? args[ i ].finished_at : finished_at;
+  }
+  m->ns = finished_at - started_at;
+
+  pthread_barrier_destroy( &threads.barrier );
+}
+
+
+// Returns a random permutation of [ 0, n ) so that accesses are not sequential.
+uint32_t *
+create_permutation( uint32_t n, uint32_t seed ) {
+  uint32_t *permutation = malloc( sizeof( uint32_t ) * ( n > 0 ? n : 1 ) );
+  for ( uint32_t i = 0; i < n; i++ ) {
+    permutation[ i ] = i;
+  }
+  uint64_t state = seed * 2654435761u + 1;
+  for ( uint32_t i = n; i > 1; i-- ) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    uint32_t j = ( uint32_t ) ( ( state >> 33 ) % i );
+    uint32_t tmp = permutation[ i - 1 ];
+    permutation[ i - 1 ] = permutation[ j ];
+    permutation[ j ] = tmp;
+  }
+
+  return permutation;
+}
+
+
+static int
+parse_list( char *arg, uint32_t *values, int max_values ) {
+  int n = 0;
+  char *saveptr = NULL;
+  for ( char *token = strtok_r( arg, ",", &saveptr ); token != NULL && n < max_values;
+        token = strtok_r( NULL, ",", &saveptr ) ) {
+    long value = atol( token );
+    if ( value <= 0 ) {
+      return -1;
+    }
+    values[ n++ ] = ( uint32_t ) value;
+  }
+
+  return n;
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  static struct option long_options[] = {
+    { "sizes", required_argument, NULL, 's' },
+    { "threads", required_argument, NULL, 't' },
+    { "filter", required_argument, NULL, 'f' },
+    { "output", required_argument, NULL, 'o' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+
+  uint32_t sizes[ MAX_SIZES ] = { 1024, 65536 };
+  int n_sizes = 2;
+  uint32_t thread_values[ MAX_SIZES ] = { 1, 2, 4 };
+  int n_threads = 3;
+  const char *output_file = NULL;
+
+  int c;
+  while ( ( c = getopt_long( argc, argv, "s:t:f:o:h", long_options, NULL ) ) != -1 ) {
+    switch ( c ) {
+      case 's':
+        n_sizes = parse_list( optarg, sizes, MAX_SIZES );
+        break;
+      case 't':
+        n_threads = parse_list( optarg, thread_values, MAX_SIZES );
+        break;
+      case 'f':
+        filter = optarg;
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'h':
+      default:
+        usage( argv[ 0 ] );
+        return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if ( n_sizes <= 0 || n_threads <= 0 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  if ( output_file != NULL ) {
+    output = fopen( output_file, "w" );
+    if ( output == NULL ) {
+      fprintf( stderr, "Failed to open %s ( errno = %s [%d] ).\n", output_file, strerror( errno ), errno );
+      return EXIT_FAILURE;
+    }
+    fprintf( output, "{\n  \"benchmark\": \"microbench\",\n  \"results\": [\n" );
+  }
+
+  int threads[ MAX_SIZES ];
+  for ( int i = 0; i < n_threads; i++ ) {
+    threads[ i ] = ( int ) thread_values[ i ];
+  }
+
+  printf( "%-28s %9s %7s %10s %9s %13s %12s\n",
+          "benchmark", "size", "threads", "ns/op", "Mops/s", "cache-miss/op", "instr/op" );
+  bench_hash( sizes, n_sizes, threads, n_threads );
+  bench_fdb( sizes, n_sizes, threads, n_threads );
+  bench_queue( sizes, n_sizes );
+  bench_linked_list( sizes, n_sizes );
+
+  if ( output != NULL ) {
+    fprintf( output, "\n  ]\n}\n" );
+    fclose( output );
+  }
+
+  return EXIT_SUCCESS;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+#define MAX_BENCH_THREADS 64
+
+// Operations are repeated at least this many times to reduce noise.
+#define MIN_BENCH_OPS ( 1 << 18 )
+
+
+struct measurement {
+  pid_t tid;
+  uint64_t started_at;
+  uint64_t ns;
+  int cache_miss_fd;
+  int instruction_fd;
+  uint64_t cache_misses;
+  uint64_t instructions;
+  bool has_counters;
+};
+
+// Runs a function on threads which are started together.
+struct bench_threads {
+  int n_threads;
+  pthread_t threads[ MAX_BENCH_THREADS ];
+  pthread_barrier_t barrier;
+  void ( *function )( int index, void *user_data );
+  void *user_data;
+};
+
+
+bool bench_enabled( const char *name );
+bool bench_group_enabled( const char *prefix );
+uint64_t bench_clock();
+void start_measurement( struct measurement *m, pid_t tid );
+void stop_measurement( struct measurement *m );
+void add_measurement( struct measurement *total, const struct measurement *m );
+uint32_t bench_rounds( uint32_t size );
+void report_measurement( const char *name, uint32_t size, int n_threads, uint64_t n_ops,
+                         const struct measurement *m );
+void run_bench_threads( int n_threads, void ( *function )( int index, void *user_data ), void *user_data,
+                        struct measurement *m );
+uint32_t *create_permutation( uint32_t n, uint32_t seed );
+
+void bench_hash( const uint32_t *sizes, int n_sizes, const int *threads, int n_threads );
+void bench_fdb( const uint32_t *sizes, int n_sizes, const int *threads, int n_threads );
+void bench_queue( const uint32_t *sizes, int n_sizes );
+void bench_linked_list( const uint32_t *sizes, int n_sizes );
+
+
+#endif // MICROBENCH_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
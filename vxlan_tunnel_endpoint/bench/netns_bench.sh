@@ -0,0 +1,257 @@
+#!/bin/bash
+#
+# Copyright (C) 2013 NEC Corporation
+#
+# End-to-end benchmark of vxland. Two vxland processes run in network
+# namespaces joined by a veth pair, and tapgen sends frames to the taps
+# of one side ( uni ) or both sides ( bi ) and counts frames coming out
+# of the taps on the other side. Results of all combinations of frame
+# sizes, numbers of VNIs and FDB sizes are written in JSON together with
+# CPU usage per vxland thread.
+#
+# Needs root, iproute2 and util-linux ( unshare and nsenter ).
+#
+
+set -e
+
+BENCHDIR=$( cd $( dirname $0 ) && pwd )
+SRCDIR=$BENCHDIR/../src
+VXLAND=$SRCDIR/vxland
+VXLANCTL=$SRCDIR/vxlanctl
+TAPGEN=$BENCHDIR/tapgen
+
+SIZES="64 512 1500"
+VNIS="1 16"
+FDB_ENTRIES="1 16384"
+MODES="uni bi"
+DURATION=5
+ENGINE=select
+OUTPUT=-
+
+NS=( vxbench-a vxbench-b )
+VETH=( vxbench-a0 vxbench-b0 )
+ADDR=( 10.254.0.1 10.254.0.2 )
+FIRST_VNI=100
+
+usage() {
+  cat <<EOT
+Usage: $0 [OPTION]...
+  -s SIZES     Frame sizes in octets ( default "$SIZES" )
+  -n VNIS      Numbers of VNIs ( default "$VNIS" )
+  -f ENTRIES   Numbers of static FDB entries per VNI ( default "$FDB_ENTRIES" )
+  -m MODES     uni and/or bi ( default "$MODES" )
+  -d SECONDS   Duration of each run ( default $DURATION )
+  -e ENGINE    I/O engine of vxland ( default $ENGINE )
+  -o FILE      Output file ( default stdout )
+  -h           Show this help and exit
+EOT
+}
+
+while getopts "s:n:f:m:d:e:o:h" opt; do
+  case $opt in
+    s) SIZES=$OPTARG ;;
+    n) VNIS=$OPTARG ;;
+    f) FDB_ENTRIES=$OPTARG ;;
+    m) MODES=$OPTARG ;;
+    d) DURATION=$OPTARG ;;
+    e) ENGINE=$OPTARG ;;
+    o) OUTPUT=$OPTARG ;;
+    h) usage; exit 0 ;;
+    *) usage; exit 1 ;;
+  esac
+done
+
+for f in $VXLAND $VXLANCTL $TAPGEN; do
+  if [ ! -x $f ]; then
+    echo "$f is not found. Run make first." >&2
+    exit 1
+  fi
+done
+
+PIDS=( 0 0 )
+
+# Each vxland gets its own /tmp and /var/run since the control socket
+# and the pid file are at fixed paths.
+start_vxland() {
+  local i=$1
+  ip netns exec ${NS[$i]} unshare -m sh -c \
+    'mount -t tmpfs none /tmp && mount -t tmpfs none /var/run && exec "$@"' sh \
+    $VXLAND -i ${VETH[$i]} -a ${ADDR[$(( 1 - i ))]} -e $ENGINE > /dev/null 2>&1 &
+  PIDS[$i]=$!
+  for n in $( seq 50 ); do
+    if vxlanctl $i -g -q > /dev/null 2>&1; then
+      return 0
+    fi
+    sleep 0.1
+  done
+  echo "vxland in ${NS[$i]} is not started." >&2
+  return 1
+}
+
+vxlanctl() {
+  local i=$1
+  shift
+  nsenter -t ${PIDS[$i]} -m -n $VXLANCTL "$@"
+}
+
+setup() {
+  cleanup
+  for i in 0 1; do
+    ip netns add ${NS[$i]}
+    ip -n ${NS[$i]} link set lo up
+    ip netns exec ${NS[$i]} sysctl -q -w net.ipv6.conf.default.disable_ipv6=1
+  done
+  ip link add ${VETH[0]} netns ${NS[0]} type veth peer name ${VETH[1]} netns ${NS[1]}
+  for i in 0 1; do
+    ip -n ${NS[$i]} link set ${VETH[$i]} mtu 9000 up
+    ip -n ${NS[$i]} addr add ${ADDR[$i]}/24 dev ${VETH[$i]}
+  done
+}
+
+cleanup() {
+  for i in 0 1; do
+    if [ ${PIDS[$i]} -gt 0 ]; then
+      kill ${PIDS[$i]} 2> /dev/null || true
+      wait ${PIDS[$i]} 2> /dev/null || true
+      PIDS[$i]=0
+    fi
+    ip netns del ${NS[$i]} 2> /dev/null || true
+  done
+}
+
+trap cleanup EXIT
+
+# Adds VNIs with static FDB entries for destination MAC addresses of
+# tapgen, all of which point to the other side.
+add_instances() {
+  local i=$1 n_vnis=$2 n_entries=$3
+  local peer=${ADDR[$(( 1 - i ))]}
+  for vni in $( seq $FIRST_VNI $(( FIRST_VNI + n_vnis - 1 )) ); do
+    vxlanctl $i -a -n $vni -x $(( n_entries + 1024 )) > /dev/null
+    awk -v n=$n_entries -v ip=$peer 'BEGIN {
+      for ( i = 0; i < n; i++ ) {
+        printf( "add 02:bb:00:%02x:%02x:%02x %s\n", int( i / 65536 ) % 256, int( i / 256 ) % 256, i % 256, ip );
+      }
+    }' | vxlanctl $i -u -n $vni > /dev/null
+  done
+  for vni in $( seq $FIRST_VNI $(( FIRST_VNI + n_vnis - 1 )) ); do
+    for n in $( seq 50 ); do
+      if ip -n ${NS[$i]} link show vxlan$vni 2> /dev/null | grep -q "UP"; then
+        break
+      fi
+      sleep 0.1
+    done
+  done
+}
+
+taps() {
+  local n_vnis=$1
+  seq -f "vxlan%g" -s , $FIRST_VNI $(( FIRST_VNI + n_vnis - 1 ))
+}
+
+# Prints "tid name ticks" of each thread of a process.
+thread_ticks() {
+  local pid=$1
+  for task in /proc/$pid/task/*; do
+    local stat
+    stat=$( cat $task/stat 2> /dev/null ) || continue
+    # Fields after the command name which may contain spaces.
+    local fields=( ${stat##*) } )
+    echo "${task##*/} $( cat $task/comm ) $(( fields[11] + fields[12] ))"
+  done
+}
+
+# Prints CPU usage of each thread in percent as a JSON object. Instance
+# threads may be started during a run since idle instances are woken up
+# by traffic.
+cpu_usage() {
+  local before=$1 after=$2 seconds=$3
+  join -a 2 -e 0 -o 0,2.2,1.3,2.3 <( sort $before ) <( sort $after ) | awk -v hz=$( getconf CLK_TCK ) -v s=$seconds '
+    BEGIN { printf( "{" ) }
+    { if ( n++ > 0 ) printf( ", " ); printf( "\"%s/%s\": %.1f", $2, $1, ( $4 - $3 ) * 100 / hz / s ) }
+    END { printf( "}" ) }'
+}
+
+run() {
+  local mode=$1 size=$2 n_vnis=$3 n_entries=$4
+  local tmp=$( mktemp -d )
+
+  setup
+  start_vxland 0
+  start_vxland 1
+  add_instances 0 $n_vnis $n_entries
+  add_instances 1 $n_vnis $n_entries
+
+  local args="-i $( taps $n_vnis ) -s $size -m $n_entries -d $DURATION"
+  for i in 0 1; do
+    thread_ticks ${PIDS[$i]} > $tmp/before.$i
+  done
+  if [ $mode = uni ]; then
+    ip netns exec ${NS[1]} $TAPGEN $args -o 2 -r > $tmp/gen.1 &
+    local receiver=$!
+    ip netns exec ${NS[0]} $TAPGEN $args -o 1 -t > $tmp/gen.0
+  else
+    ip netns exec ${NS[1]} $TAPGEN $args -o 2 -t -r > $tmp/gen.1 &
+    local receiver=$!
+    ip netns exec ${NS[0]} $TAPGEN $args -o 1 -t -r > $tmp/gen.0
+  fi
+  wait $receiver
+  for i in 0 1; do
+    thread_ticks ${PIDS[$i]} > $tmp/after.$i
+  done
+
+  awk -v mode=$mode -v size=$size -v vnis=$n_vnis -v entries=$n_entries -v engine=$ENGINE \
+      -v cpu0="$( cpu_usage $tmp/before.0 $tmp/after.0 $DURATION )" \
+      -v cpu1="$( cpu_usage $tmp/before.1 $tmp/after.1 $DURATION )" '
+    {
+      gsub( /[{},:"]/, " " )
+      for ( i = 1; i < NF; i += 2 ) {
+        v[ $i ] += $( i + 1 )
+        if ( $i == "seconds" && $( i + 1 ) > seconds ) seconds = $( i + 1 )
+      }
+    }
+    END {
+      printf( "    { \"mode\": \"%s\", \"engine\": \"%s\", \"frame_size\": %d, \"vnis\": %d, \"fdb_entries\": %d, ",
+              mode, engine, size, vnis, entries )
+      printf( "\"seconds\": %.3f, \"tx_packets\": %d, \"rx_packets\": %d, ", seconds, v[ "tx_packets" ], v[ "rx_packets" ] )
+      printf( "\"tx_pps\": %.0f, \"rx_pps\": %.0f, \"rx_gbps\": %.3f, \"loss\": %.4f, ",
+              v[ "tx_packets" ] / seconds, v[ "rx_packets" ] / seconds, v[ "rx_bytes" ] * 8 / seconds / 1e9,
+              v[ "tx_packets" ] > 0 ? 1 - v[ "rx_packets" ] / v[ "tx_packets" ] : 0 )
+      printf( "\"cpu\": { \"a\": %s, \"b\": %s } }", cpu0, cpu1 )
+    }' $tmp/gen.0 $tmp/gen.1
+
+  rm -rf $tmp
+  cleanup
+}
+
+report() {
+  echo "{"
+  echo "  \"benchmark\": \"vxland_e2e\","
+  echo "  \"revision\": \"$( git -C $BENCHDIR rev-parse --short HEAD 2> /dev/null || echo unknown )\","
+  echo "  \"date\": \"$( date -u +%Y-%m-%dT%H:%M:%SZ )\","
+  echo "  \"host\": { \"kernel\": \"$( uname -r )\", \"cpus\": $( nproc ) },"
+  echo "  \"duration\": $DURATION,"
+  echo "  \"results\": ["
+  local first=true
+  for mode in $MODES; do
+    for size in $SIZES; do
+      for n_vnis in $VNIS; do
+        for n_entries in $FDB_ENTRIES; do
+          $first || echo ","
+          first=false
+          echo "mode = $mode, size = $size, vnis = $n_vnis, fdb_entries = $n_entries" >&2
+          run $mode $size $n_vnis $n_entries
+        done
+      done
+    done
+  done
+  echo
+  echo "  ]"
+  echo "}"
+}
+
+if [ "$OUTPUT" = "-" ]; then
+  report
+else
+  report > $OUTPUT
+fi
@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Frame generator and counter for benchmarking vxland. Frames are sent
+ * to and counted on tap interfaces with packet sockets, so that frames
+ * go through vxland exactly as frames of virtual machines do.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define MAX_INTERFACES 1024
+#define BATCH_SIZE 64
+#define MIN_FRAME_SIZE 60
+#define MAX_FRAME_SIZE 9000
+#define BENCH_ETHER_TYPE 0x88b5 // Local experimental
+
+
+typedef struct {
+  int n_interfaces;
+  int tx_socks[ MAX_INTERFACES ];
+  int rx_socks[ MAX_INTERFACES ];
+  size_t frame_size;
+  uint32_t n_macs;
+  uint8_t id;
+  bool transmit;
+  bool receive;
+  unsigned int duration;
+} tapgen_options;
+
+typedef struct {
+  uint64_t packets;
+  uint64_t bytes;
+} counters;
+
+
+static tapgen_options options;
+static volatile bool running = true;
+static counters tx_counters;
+static counters rx_counters;
+
+
+static void
+usage( const char *name ) {
+  printf( "Usage: %s -i INTERFACE[,INTERFACE]... [OPTION]...\n"
+          "  -i, --interfaces  Tap interfaces to send frames to and count frames on\n"
+          "  -s, --size        Frame size in octets without FCS ( default 64 )\n"
+          "  -m, --macs        Number of destination MAC addresses to cycle ( default 1 )\n"
+          "  -o, --id          Identifier of this generator put in source MAC addresses\n"
+          "  -d, --duration    Seconds to run ( default 10 )\n"
+          "  -t, --transmit    Send frames\n"
+          "  -r, --receive     Count received frames\n"
+          "  -h, --help        Show this help and exit.\n",
+          name );
+}
+
+
+static int
+open_packet_socket( const char *name, bool receive ) {
+  unsigned int ifindex = if_nametoindex( name );
+  if ( ifindex == 0 ) {
+    fprintf( stderr, "Failed to find an interface ( name = %s ).\n", name );
+    return -1;
+  }
+
+  int sock = socket( AF_PACKET, SOCK_RAW, receive ? htons( ETH_P_ALL ) : 0 );
+  if ( sock < 0 ) {
+    fprintf( stderr, "Failed to create a packet socket ( errno = %s [%d] ).\n", strerror( errno ), errno );
+    return -1;
+  }
+
+  int on = 1;
+  if ( receive ) {
+    // Frames sent by the generator itself must not be counted.
+    setsockopt( sock, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof( on ) );
+    int size = 16 * 1024 * 1024;
+    setsockopt( sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof( size ) );
+  }
+  else {
+    setsockopt( sock, SOL_PACKET, PACKET_QDISC_BYPASS, &on, sizeof( on ) );
+  }
+
+  struct sockaddr_ll sll;
+  memset( &sll, 0, sizeof( sll ) );
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = receive ? htons( ETH_P_ALL ) : 0;
+  sll.sll_ifindex = ( int ) ifindex;
+  if ( bind( sock, ( struct sockaddr * ) &sll, sizeof( sll ) ) < 0 ) {
+    fprintf( stderr, "Failed to bind a packet socket ( name = %s, errno = %s [%d] ).\n",
+             name, strerror( errno ), errno );
+    close( sock );
+    return -1;
+  }
+
+  return sock;
+}
+
+
+static bool
+open_interfaces( char *names ) {
+  char *saveptr = NULL;
+  for ( char *name = strtok_r( names, ",", &saveptr ); name != NULL; name = strtok_r( NULL, ",", &saveptr ) ) {
+    if ( options.n_interfaces >= MAX_INTERFACES ) {
+      fprintf( stderr, "Too many interfaces ( max = %d ).\n", MAX_INTERFACES );
+      return false;
+    }
+    int i = options.n_interfaces++;
+    options.tx_socks[ i ] = options.transmit ? open_packet_socket( name, false ) : -1;
+    options.rx_socks[ i ] = options.receive ? open_packet_socket( name, true ) : -1;
+    if ( ( options.transmit && options.tx_socks[ i ] < 0 ) || ( options.receive && options.rx_socks[ i ] < 0 ) ) {
+      return false;
+    }
+  }
+
+  return options.n_interfaces > 0;
+}
+
+
+// Destination MAC addresses are 02:bb:00:00:00:00 and onwards, which
+// the benchmark script adds to forwarding databases.
+static void
+set_destination( uint8_t *frame, uint32_t index ) {
+  frame[ 0 ] = 0x02;
+  frame[ 1 ] = 0xbb;
+  frame[ 2 ] = 0x00;
+  frame[ 3 ] = ( uint8_t ) ( index >> 16 );
+  frame[ 4 ] = ( uint8_t ) ( index >> 8 );
+  frame[ 5 ] = ( uint8_t ) index;
+}
+
+
+static void *
+transmit_frames( void *args ) {
+  ( void ) args;
+
+  static uint8_t frames[ BATCH_SIZE ][ MAX_FRAME_SIZE ];
+  struct iovec iov[ BATCH_SIZE ];
+  struct mmsghdr msgs[ BATCH_SIZE ];
+  memset( msgs, 0, sizeof( msgs ) );
+  for ( int i = 0; i < BATCH_SIZE; i++ ) {
+    uint8_t *frame = frames[ i ];
+    memset( frame, 0, options.frame_size );
+    uint8_t source[ ETH_ALEN ] = { 0x02, 0xaa, 0x00, 0x00, 0x00, options.id };
+    memcpy( frame + ETH_ALEN, source, ETH_ALEN );
+    frame[ 12 ] = BENCH_ETHER_TYPE >> 8;
+    frame[ 13 ] = BENCH_ETHER_TYPE & 0xff;
+    iov[ i ].iov_base = frame;
+    iov[ i ].iov_len = options.frame_size;
+    msgs[ i ].msg_hdr.msg_iov = &iov[ i ];
+    msgs[ i ].msg_hdr.msg_iovlen = 1;
+  }
+
+  uint32_t mac = 0;
+  int interface = 0;
+  while ( running ) {
+    for ( int i = 0; i < BATCH_SIZE; i++ ) {
+      set_destination( frames[ i ], mac );
+      mac = ( mac + 1 ) % options.n_macs;
+    }
+    int n = sendmmsg( options.tx_socks[ interface ], msgs, BATCH_SIZE, 0 );
+    if ( n > 0 ) {
+      tx_counters.packets += ( uint64_t ) n;
+      tx_counters.bytes += ( uint64_t ) n * options.frame_size;
+    }
+    else if ( n < 0 && errno != ENOBUFS && errno != EAGAIN && errno != EINTR ) {
+      fprintf( stderr, "Failed to send frames ( errno = %s [%d] ).\n", strerror( errno ), errno );
+      break;
+    }
+    interface = ( interface + 1 ) % options.n_interfaces;
+  }
+
+  return NULL;
+}
+
+
+static void *
+receive_frames( void *args ) {
+  ( void ) args;
+
+  static uint8_t buffers[ BATCH_SIZE ][ MAX_FRAME_SIZE ];
+  struct iovec iov[ BATCH_SIZE ];
+  struct mmsghdr msgs[ BATCH_SIZE ];
+  memset( msgs, 0, sizeof( msgs ) );
+  for ( int i = 0; i < BATCH_SIZE; i++ ) {
+    iov[ i ].iov_base = buffers[ i ];
+    iov[ i ].iov_len = sizeof( buffers[ i ] );
+    msgs[ i ].msg_hdr.msg_iov = &iov[ i ];
+    msgs[ i ].msg_hdr.msg_iovlen = 1;
+  }
+
+  struct pollfd *fds = calloc( ( size_t ) options.n_interfaces, sizeof( struct pollfd ) );
+  for ( int i = 0; i < options.n_interfaces; i++ ) {
+    fds[ i ].fd = options.rx_socks[ i ];
+    fds[ i ].events = POLLIN;
+  }
+
+  while ( running ) {
+    int ret = poll( fds, ( nfds_t ) options.n_interfaces, 100 );
+    if ( ret <= 0 ) {
+      continue;
+    }
+    for ( int i = 0; i < options.n_interfaces; i++ ) {
+      if ( ( fds[ i ].revents & POLLIN ) == 0 ) {
+        continue;
+      }
+      int n;
+      while ( ( n = recvmmsg( fds[ i ].fd, msgs, BATCH_SIZE, MSG_DONTWAIT, NULL ) ) > 0 ) {
+        for ( int j = 0; j < n; j++ ) {
+          const uint8_t *frame = buffers[ j ];
+          // Frames other than benchmark ones ( e.g. IPv6 router solicitations ) are ignored.
+          if ( msgs[ j ].msg_len < ETH_HLEN || frame[ 12 ] != ( BENCH_ETHER_TYPE >> 8 ) ||
+               frame[ 13 ] != ( BENCH_ETHER_TYPE & 0xff ) ) {
+            continue;
+          }
+          rx_counters.packets++;
+          rx_counters.bytes += msgs[ j ].msg_len;
+        }
+      }
+    }
+  }
+
+  free( fds );
+
+  return NULL;
+}
+
+
+static double
+now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ( double ) ts.tv_sec + ( double ) ts.tv_nsec / 1e9;
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  static struct option long_options[] = {
+    { "interfaces", required_argument, NULL, 'i' },
+    { "size", required_argument, NULL, 's' },
+    { "macs", required_argument, NULL, 'm' },
+    { "id", required_argument, NULL, 'o' },
+    { "duration", required_argument, NULL, 'd' },
+    { "transmit", no_argument, NULL, 't' },
+    { "receive", no_argument, NULL, 'r' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+
+  memset( &options, 0, sizeof( options ) );
+  options.frame_size = MIN_FRAME_SIZE + 4;
+  options.n_macs = 1;
+  options.id = 1;
+  options.duration = 10;
+  char *interfaces = NULL;
+
+  int c;
+  while ( ( c = getopt_long( argc, argv, "i:s:m:o:d:trh", long_options, NULL ) ) != -1 ) {
+    switch ( c ) {
+      case 'i':
+        interfaces = optarg;
+        break;
+      case 's':
+        options.frame_size = ( size_t ) atoi( optarg );
+        break;
+      case 'm':
+        options.n_macs = ( uint32_t ) atoi( optarg );
+        break;
+      case 'o':
+        options.id = ( uint8_t ) atoi( optarg );
+        break;
+      case 'd':
+        options.duration = ( unsigned int ) atoi( optarg );
+        break;
+      case 't':
+        options.transmit = true;
+        break;
+      case 'r':
+        options.receive = true;
+        break;
+      case 'h':
+      default:
+        usage( argv[ 0 ] );
+        return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if ( interfaces == NULL || ( !options.transmit && !options.receive ) || options.n_macs == 0 ||
+       options.frame_size < MIN_FRAME_SIZE || options.frame_size > MAX_FRAME_SIZE ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  if ( !open_interfaces( interfaces ) ) {
+    return EXIT_FAILURE;
+  }
+
+  pthread_t tx_thread;
+  pthread_t rx_thread;
+  double started_at = now();
+  if ( options.receive ) {
+    pthread_create( &rx_thread, NULL, receive_frames, NULL );
+  }
+  if ( options.transmit ) {
+    pthread_create( &tx_thread, NULL, transmit_frames, NULL );
+  }
+
+  sleep( options.duration );
+  running = false;
+
+  if ( options.transmit ) {
+    pthread_join( tx_thread, NULL );
+  }
+  if ( options.receive ) {
+    pthread_join( rx_thread, NULL );
+  }
+  double elapsed = now() - started_at;
+
+  printf( "{ \"seconds\": %.3f, \"tx_packets\": %" PRIu64 ", \"tx_bytes\": %" PRIu64
+          ", \"rx_packets\": %" PRIu64 ", \"rx_bytes\": %" PRIu64 " }\n",
+          elapsed, tx_counters.packets, tx_counters.bytes, rx_counters.packets, rx_counters.bytes );
+
+  return EXIT_SUCCESS;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+#include "log.h"
+#include "wrapper.h"
+
+
+// Block types and options of pcapng ( draft-ietf-opsawg-pcapng ).
+enum {
+  PCAPNG_INTERFACE_DESCRIPTION_BLOCK = 0x00000001,
+  PCAPNG_ENHANCED_PACKET_BLOCK = 0x00000006,
+  PCAPNG_SECTION_HEADER_BLOCK = 0x0A0D0D0A,
+};
+
+enum {
+  PCAPNG_OPT_ENDOFOPT = 0,
+  PCAPNG_OPT_COMMENT = 1,
+  PCAPNG_SHB_USERAPPL = 4,
+  PCAPNG_IF_NAME = 2,
+  PCAPNG_IF_TSRESOL = 9,
+};
+
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define LINKTYPE_RAW 101
+#define PCAPNG_TSRESOL_NSEC 9
+#define PCAPNG_MAX_OPTIONS_LENGTH 256
+
+
+struct captured_packet {
+  struct timespec captured_at;
+  uint32_t vni;
+  uint32_t length; // Length on the wire
+  uint32_t captured_length;
+  uint8_t data[ 0 ];
+};
+
+/*
+ * Keeps the last n_slots packets received. A single thread captures while
+ * the control thread may dump at any time, so slots are only touched with
+ * the mutex held. Slots are slot_size octets apart.
+ */
+struct capture_ring {
+  pthread_mutex_t mutex;
+  char interface[ IFNAMSIZ ];
+  unsigned int n_slots;
+  unsigned int snap_length;
+  size_t slot_size;
+  uint64_t n_captured;
+  uint8_t *slots;
+};
+
+
+struct capture_ring *
+create_capture_ring( const char *interface, unsigned int n_packets, unsigned int snap_length ) {
+  assert( interface != NULL );
+  assert( n_packets > 0 );
+  assert( snap_length >= CAPTURE_MIN_LENGTH );
+
+  struct capture_ring *ring = malloc( sizeof( struct capture_ring ) );
+  assert( ring != NULL );
+  memset( ring, 0, sizeof( struct capture_ring ) );
+
+  pthread_mutex_init( &ring->mutex, NULL );
+  strncpy( ring->interface, interface, sizeof( ring->interface ) - 1 );
+  ring->n_slots = n_packets;
+  ring->snap_length = snap_length;
+  ring->slot_size = ( offsetof( struct captured_packet, data ) + snap_length + 7 ) & ~( size_t ) 7;
+  ring->slots = malloc( ring->slot_size * n_packets );
+  if ( ring->slots == NULL ) {
+    error( "Failed to allocate a capture ring ( n_packets = %u, snap_length = %u ).", n_packets, snap_length );
+    pthread_mutex_destroy( &ring->mutex );
+    free( ring );
+    return NULL;
+  }
+
+  return ring;
+}
+
+
+void
+destroy_capture_ring( struct capture_ring *ring ) {
+  assert( ring != NULL );
+
+  pthread_mutex_destroy( &ring->mutex );
+  free( ring->slots );
+  free( ring );
+}
+
+
+// Returns the slot for a new packet with the mutex held.
+static struct captured_packet *
+claim_slot( struct capture_ring *ring, uint32_t vni, size_t length ) {
+  pthread_mutex_lock( &ring->mutex );
+
+  size_t index = ( size_t ) ( ring->n_captured % ring->n_slots );
+  ring->n_captured++;
+  struct captured_packet *slot = ( struct captured_packet * ) ( void * ) ( ring->slots + index * ring->slot_size );
+  clock_gettime( CLOCK_REALTIME, &slot->captured_at );
+  slot->vni = vni;
+  slot->length = ( uint32_t ) length;
+  slot->captured_length = ( uint32_t ) ( length < ring->snap_length ? length : ring->snap_length );
+
+  return slot;
+}
+
+
+void
+capture_packet( struct capture_ring *ring, uint32_t vni, const void *packet, size_t length ) {
+  assert( ring != NULL );
+  assert( packet != NULL );
+
+  struct captured_packet *slot = claim_slot( ring, vni, length );
+  memcpy( slot->data, packet, slot->captured_length );
+
+  pthread_mutex_unlock( &ring->mutex );
+}
+
+
+static uint16_t
+ip_checksum( const void *header, size_t length ) {
+  const uint8_t *p = header;
+  uint32_t sum = 0;
+  for ( size_t i = 0; i + 1 < length; i += 2 ) {
+    sum += ( uint32_t ) ( p[ i ] << 8 | p[ i + 1 ] );
+  }
+  while ( sum >> 16 ) {
+    sum = ( sum & 0xffff ) + ( sum >> 16 );
+  }
+
+  return htons( ( uint16_t ) ~sum );
+}
+
+
+/*
+ * Captures the payload of a datagram received on a UDP socket. IPv4 and
+ * UDP headers are made up from the source address and the local port so
+ * that all captures are IPv4 packets. The local address is not known and
+ * left unspecified.
+ */
+void
+capture_udp_payload( struct capture_ring *ring, uint32_t vni, const struct sockaddr_in *source, uint16_t port,
+                     const void *payload, size_t length ) {
+  assert( ring != NULL );
+  assert( source != NULL );
+  assert( payload != NULL );
+
+  size_t headers_length = sizeof( struct iphdr ) + sizeof( struct udphdr );
+  if ( length > UINT16_MAX - headers_length ) {
+    return;
+  }
+
+  struct iphdr ip;
+  memset( &ip, 0, sizeof( ip ) );
+  ip.version = 4;
+  ip.ihl = sizeof( struct iphdr ) / 4;
+  ip.tot_len = htons( ( uint16_t ) ( headers_length + length ) );
+  ip.frag_off = htons( IP_DF );
+  ip.ttl = 64;
+  ip.protocol = IPPROTO_UDP;
+  ip.saddr = source->sin_addr.s_addr;
+  ip.daddr = htonl( INADDR_ANY );
+  ip.check = ip_checksum( &ip, sizeof( ip ) );
+
+  struct udphdr udp;
+  memset( &udp, 0, sizeof( udp ) );
+  udp.source = source->sin_port;
+  udp.dest = htons( port );
+  udp.len = htons( ( uint16_t ) ( sizeof( struct udphdr ) + length ) );
+
+  struct captured_packet *slot = claim_slot( ring, vni, headers_length + length );
+  memcpy( slot->data, &ip, sizeof( ip ) );
+  memcpy( slot->data + sizeof( ip ), &udp, sizeof( udp ) );
+  memcpy( slot->data + headers_length, payload, slot->captured_length - headers_length );
+
+  pthread_mutex_unlock( &ring->mutex );
+}
+
+
+static size_t
+append( uint8_t *block, size_t offset, const void *data, size_t length ) {
+  memcpy( block + offset, data, length );
+
+  return offset + length;
+}
+
+
+static size_t
+append_u16( uint8_t *block, size_t offset, uint16_t value ) {
+  return append( block, offset, &value, sizeof( value ) );
+}
+
+
+static size_t
+append_u32( uint8_t *block, size_t offset, uint32_t value ) {
+  return append( block, offset, &value, sizeof( value ) );
+}
+
+
+static size_t
+append_padding( uint8_t *block, size_t offset ) {
+  while ( offset % 4 != 0 ) {
+    block[ offset++ ] = 0;
+  }
+
+  return offset;
+}
+
+
+static size_t
+append_option( uint8_t *block, size_t offset, uint16_t code, const void *value, size_t length ) {
+  offset = append_u16( block, offset, code );
+  offset = append_u16( block, offset, ( uint16_t ) length );
+  offset = append( block, offset, value, length );
+
+  return append_padding( block, offset );
+}
+
+
+static size_t
+append_end_of_options( uint8_t *block, size_t offset ) {
+  offset = append_u16( block, offset, PCAPNG_OPT_ENDOFOPT );
+
+  return append_u16( block, offset, 0 );
+}
+
+
+// Blocks are built with room for the type and length at the head, which
+// are filled in here together with the trailing length.
+static bool
+write_block( FILE *stream, uint8_t *block, uint32_t type, size_t offset ) {
+  uint32_t length = ( uint32_t ) ( offset + sizeof( uint32_t ) );
+  append_u32( block, 0, type );
+  append_u32( block, sizeof( uint32_t ), length );
+  append_u32( block, offset, length );
+
+  return fwrite( block, length, 1, stream ) == 1;
+}
+
+
+// Writes a section header and an interface description. All values are in
+// host byte order, which readers tell from the byte order magic.
+static bool
+write_headers( FILE *stream, uint8_t *block, const char *interface, const char *application,
+               unsigned int snap_length ) {
+  size_t offset = 2 * sizeof( uint32_t );
+  offset = append_u32( block, offset, PCAPNG_BYTE_ORDER_MAGIC );
+  offset = append_u16( block, offset, 1 );
+  offset = append_u16( block, offset, 0 );
+  int64_t section_length = -1;
+  offset = append( block, offset, &section_length, sizeof( section_length ) );
+  offset = append_option( block, offset, PCAPNG_SHB_USERAPPL, application, strlen( application ) );
+  offset = append_end_of_options( block, offset );
+  if ( !write_block( stream, block, PCAPNG_SECTION_HEADER_BLOCK, offset ) ) {
+    return false;
+  }
+
+  offset = 2 * sizeof( uint32_t );
+  offset = append_u16( block, offset, LINKTYPE_RAW );
+  offset = append_u16( block, offset, 0 );
+  offset = append_u32( block, offset, snap_length );
+  offset = append_option( block, offset, PCAPNG_IF_NAME, interface, strlen( interface ) );
+  uint8_t resolution = PCAPNG_TSRESOL_NSEC;
+  offset = append_option( block, offset, PCAPNG_IF_TSRESOL, &resolution, sizeof( resolution ) );
+  offset = append_end_of_options( block, offset );
+
+  return write_block( stream, block, PCAPNG_INTERFACE_DESCRIPTION_BLOCK, offset );
+}
+
+
+// The VNI goes into a comment since no standard option carries it.
+static bool
+write_packet( FILE *stream, uint8_t *block, const struct captured_packet *packet ) {
+  uint64_t timestamp = ( uint64_t ) packet->captured_at.tv_sec * 1000000000 + ( uint64_t ) packet->captured_at.tv_nsec;
+
+  size_t offset = 2 * sizeof( uint32_t );
+  offset = append_u32( block, offset, 0 );
+  offset = append_u32( block, offset, ( uint32_t ) ( timestamp >> 32 ) );
+  offset = append_u32( block, offset, ( uint32_t ) timestamp );
+  offset = append_u32( block, offset, packet->captured_length );
+  offset = append_u32( block, offset, packet->length );
+  offset = append( block, offset, packet->data, packet->captured_length );
+  offset = append_padding( block, offset );
+  if ( packet->vni != CAPTURE_NO_VNI ) {
+    char comment[ 32 ];
+    snprintf( comment, sizeof( comment ), "vni %u", packet->vni );
+    offset = append_option( block, offset, PCAPNG_OPT_COMMENT, comment, strlen( comment ) );
+    offset = append_end_of_options( block, offset );
+  }
+
+  return write_block( stream, block, PCAPNG_ENHANCED_PACKET_BLOCK, offset );
+}
+
+
+/*
+ * Writes packets in the ring to a pcapng file, oldest first. Slots are
+ * copied out first so that capturing is not held up by file I/O.
+ */
+bool
+dump_capture_ring( struct capture_ring *ring, const char *file, const char *application, uint32_t *n_packets ) {
+  assert( ring != NULL );
+  assert( file != NULL );
+  assert( application != NULL );
+  assert( n_packets != NULL );
+
+  *n_packets = 0;
+
+  pthread_mutex_lock( &ring->mutex );
+  uint64_t n_captured = ring->n_captured;
+  unsigned int n = n_captured < ring->n_slots ? ( unsigned int ) n_captured : ring->n_slots;
+  uint8_t *slots = malloc( ring->slot_size * ( n > 0 ? n : 1 ) );
+  if ( slots == NULL ) {
+    pthread_mutex_unlock( &ring->mutex );
+    error( "Failed to allocate memory for dumping captured packets ( n_packets = %u ).", n );
+    return false;
+  }
+  size_t first = ( size_t ) ( ( n_captured - n ) % ring->n_slots );
+  for ( unsigned int i = 0; i < n; i++ ) {
+    size_t index = ( first + i ) % ring->n_slots;
+    memcpy( slots + i * ring->slot_size, ring->slots + index * ring->slot_size, ring->slot_size );
+  }
+  pthread_mutex_unlock( &ring->mutex );
+
+  // Packets may carry traffic of any tenant.
+  int fd = open( file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR );
+  FILE *stream = fd >= 0 ? fdopen( fd, "w" ) : NULL;
+  if ( stream == NULL ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to open %s ( errno = %s [%d] ).", file, error_string, errno );
+    if ( fd >= 0 ) {
+      close( fd );
+    }
+    free( slots );
+    return false;
+  }
+
+  uint8_t *block = malloc( ring->slot_size + PCAPNG_MAX_OPTIONS_LENGTH + IFNAMSIZ + strlen( application ) );
+  assert( block != NULL );
+  bool ret = write_headers( stream, block, ring->interface, application, ring->snap_length );
+  for ( unsigned int i = 0; ret && i < n; i++ ) {
+    ret = write_packet( stream, block, ( const struct captured_packet * ) ( void * ) ( slots + i * ring->slot_size ) );
+  }
+  if ( fclose( stream ) != 0 ) {
+    ret = false;
+  }
+  if ( !ret ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to write captured packets to %s ( errno = %s [%d] ).", file, error_string, errno );
+  }
+  else {
+    *n_packets = n;
+  }
+
+  free( block );
+  free( slots );
+
+  return ret;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define CAPTURE_FILE_LENGTH 1024
+#define CAPTURE_NO_VNI UINT32_MAX
+// Room for an IPv4 header, a UDP header, a VXLAN header and an Ethernet header.
+#define CAPTURE_MIN_LENGTH 64
+
+
+struct capture_ring;
+
+
+struct capture_ring *create_capture_ring( const char *interface, unsigned int n_packets, unsigned int snap_length );
+void destroy_capture_ring( struct capture_ring *ring );
+void capture_packet( struct capture_ring *ring, uint32_t vni, const void *packet, size_t length );
+void capture_udp_payload( struct capture_ring *ring, uint32_t vni, const struct sockaddr_in *source, uint16_t port,
+                          const void *payload, size_t length );
+bool dump_capture_ring( struct capture_ring *ring, const char *file, const char *application, uint32_t *n_packets );
+
+
+#endif // CAPTURE_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -20,9 +20,14 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <sys/un.h>
@@ -36,6 +41,43 @@
 extern volatile bool running;
 static const int MAX_SEND_RECV_RETRY = 5;
 
+#define MAX_CTRL_CONNECTIONS 64
+#define CTRL_SERVER_BACKLOG 64
+static const int MAX_QUEUED_REPLIES = 4096;
+static const int MAX_REQUESTS_PER_EVENT = 64;
+static const size_t MAX_BATCH_LENGTH = 64 * 1024 * 1024;
+
+
+// A reply waiting for the client to read earlier ones.
+struct ctrl_reply {
+  struct ctrl_reply *next;
+  size_t length;
+  uint8_t data[ 0 ];
+};
+
+// Records of a request that is continued by later ones with the same xid.
+struct ctrl_batch {
+  struct ctrl_batch *next;
+  uint32_t xid;
+  bool failed;
+  uint8_t *data;
+  size_t length;
+};
+
+struct ctrl_connection {
+  int fd;
+  uint32_t events;
+  struct ctrl_reply *head;
+  struct ctrl_reply *tail;
+  int n_replies;
+  struct ctrl_batch *batches;
+  bool eof; // The client sent all requests and waits for queued replies
+  bool closing;
+};
+
+static struct ctrl_connection connections[ MAX_CTRL_CONNECTIONS ];
+static int epoll_fd = -1;
+
 
 ssize_t
 send_command( int fd, void *command, size_t *length ) {
@@ -71,7 +113,7 @@ send_command( int fd, void *command, size_t *length ) {
       continue;
     }
 
-    retval = send( fd, command, *length, MSG_DONTWAIT );
+    retval = send( fd, command, *length, MSG_DONTWAIT | MSG_NOSIGNAL );
     if ( retval < 0 ) {
       if ( errno == EAGAIN || errno == EINTR || errno == EWOULDBLOCK ) {
         n_retries++;
@@ -153,6 +195,198 @@ recv_command( int fd, void *command, size_t *length ) {
 }
 
 
+// Sends fixed-size records packed into as few replies as possible. The
+// first header_length bytes of each reply are copied from header, which
+// starts with a command_reply_header. All replies but the last carry
+// FLAG_MORE and the last one carries last_flags.
+bool
+send_packed_replies( int fd, const void *header, size_t header_length, const void *records, size_t record_size,
+                     int n_records, uint8_t last_flags ) {
+  assert( fd >= 0 );
+  assert( header != NULL );
+  assert( header_length >= sizeof( command_reply_header ) && header_length < COMMAND_MESSAGE_LENGTH );
+  assert( record_size > 0 && record_size <= COMMAND_MESSAGE_LENGTH - header_length );
+  assert( n_records == 0 || records != NULL );
+
+  uint8_t reply[ COMMAND_MESSAGE_LENGTH ];
+  int max_records = ( int ) ( ( COMMAND_MESSAGE_LENGTH - header_length ) / record_size );
+  int offset = 0;
+  do {
+    int n = n_records - offset;
+    if ( n > max_records ) {
+      n = max_records;
+    }
+    size_t length = header_length + record_size * ( size_t ) n;
+    memcpy( reply, header, header_length );
+    if ( n > 0 ) {
+      memcpy( reply + header_length, ( const uint8_t * ) records + record_size * ( size_t ) offset,
+              record_size * ( size_t ) n );
+    }
+    command_reply_header *reply_header = ( command_reply_header * ) reply;
+    reply_header->flags = offset + n < n_records ? FLAG_MORE : last_flags;
+    reply_header->length = ( uint16_t ) length;
+    if ( !send_ctrl_reply( fd, reply, length ) ) {
+      return false;
+    }
+    offset += n;
+  } while ( offset < n_records );
+
+  return true;
+}
+
+
+// Sends a command along with file descriptors ( SCM_RIGHTS ). Unlike
+// send_command(), the command must fit in a single message.
+ssize_t
+send_command_with_fds( int fd, void *command, size_t length, const int *fds, int n_fds ) {
+  assert( fd >= 0 );
+  assert( command != NULL );
+  assert( length > 0 );
+  assert( n_fds >= 0 && n_fds <= MAX_COMMAND_FDS );
+  assert( n_fds == 0 || fds != NULL );
+
+  struct iovec iov = { .iov_base = command, .iov_len = length };
+  union {
+    char buf[ CMSG_SPACE( sizeof( int ) * MAX_COMMAND_FDS ) ];
+    struct cmsghdr align;
+  } control;
+  memset( &control, 0, sizeof( control ) );
+
+  struct msghdr mhdr;
+  memset( &mhdr, 0, sizeof( mhdr ) );
+  mhdr.msg_iov = &iov;
+  mhdr.msg_iovlen = 1;
+  if ( n_fds > 0 ) {
+    size_t fds_length = sizeof( int ) * ( size_t ) n_fds;
+    mhdr.msg_control = control.buf;
+    mhdr.msg_controllen = CMSG_SPACE( fds_length );
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR( &mhdr );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( fds_length );
+    memcpy( CMSG_DATA( cmsg ), fds, fds_length );
+  }
+
+  // The socket may be non-blocking; wait until it drains if it is full.
+  ssize_t ret = -1;
+  int n_retries = 0;
+  while ( true ) {
+    ret = sendmsg( fd, &mhdr, MSG_NOSIGNAL );
+    if ( ret >= 0 || ( errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK ) ) {
+      break;
+    }
+    if ( errno != EINTR ) {
+      if ( n_retries++ >= MAX_SEND_RECV_RETRY ) {
+        break;
+      }
+      fd_set fdset;
+      FD_ZERO( &fdset );
+      FD_SET( fd, &fdset );
+      struct timespec timeout = { 1, 0 };
+      pselect( fd + 1, NULL, &fdset, NULL, &timeout, NULL );
+    }
+  }
+  if ( ret < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to send ( fd = %d, n_fds = %d, errno = %s [%d] ).", fd, n_fds, error_string, errno );
+  }
+
+  return ret;
+}
+
+
+// Receives a command and file descriptors passed with it. Waits for up to
+// timeout seconds. Received descriptors are close-on-exec.
+ssize_t
+recv_command_with_fds( int fd, void *command, size_t *length, int *fds, int *n_fds, time_t timeout ) {
+  assert( fd >= 0 );
+  assert( command != NULL );
+  assert( length != NULL );
+  assert( *length > 0 );
+  assert( fds != NULL );
+  assert( n_fds != NULL );
+
+  *n_fds = 0;
+
+  struct timespec started;
+  clock_gettime( CLOCK_MONOTONIC, &started );
+  while ( true ) {
+    fd_set fdset;
+    FD_ZERO( &fdset );
+    FD_SET( fd, &fdset );
+    struct timespec interval = { 1, 0 };
+    int ret = pselect( fd + 1, &fdset, NULL, NULL, &interval, NULL );
+    if ( ret < 0 && errno != EINTR ) {
+      error( "Failed to select ( fd = %d, errno = %d ).", fd, errno );
+      return -1;
+    }
+    if ( ret > 0 ) {
+      break;
+    }
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    if ( now.tv_sec - started.tv_sec >= timeout ) {
+      error( "Timed out while waiting for a command ( fd = %d, timeout = %d ).", fd, ( int ) timeout );
+      return -1;
+    }
+  }
+
+  struct iovec iov = { .iov_base = command, .iov_len = *length };
+  union {
+    char buf[ CMSG_SPACE( sizeof( int ) * MAX_COMMAND_FDS ) ];
+    struct cmsghdr align;
+  } control;
+  memset( &control, 0, sizeof( control ) );
+
+  struct msghdr mhdr;
+  memset( &mhdr, 0, sizeof( mhdr ) );
+  mhdr.msg_iov = &iov;
+  mhdr.msg_iovlen = 1;
+  mhdr.msg_control = control.buf;
+  mhdr.msg_controllen = sizeof( control.buf );
+
+  ssize_t retval = -1;
+  do {
+    retval = recvmsg( fd, &mhdr, MSG_CMSG_CLOEXEC );
+  } while ( retval < 0 && errno == EINTR );
+  if ( retval < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to recv ( fd = %d, errno = %s [%d] ).", fd, error_string, errno );
+    return -1;
+  }
+
+  for ( struct cmsghdr *cmsg = CMSG_FIRSTHDR( &mhdr ); cmsg != NULL; cmsg = CMSG_NXTHDR( &mhdr, cmsg ) ) {
+    if ( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ) {
+      continue;
+    }
+    int n = ( int ) ( ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int ) );
+    for ( int i = 0; i < n; i++ ) {
+      int passed_fd = -1;
+      memcpy( &passed_fd, CMSG_DATA( cmsg ) + sizeof( int ) * ( size_t ) i, sizeof( int ) );
+      if ( *n_fds < MAX_COMMAND_FDS ) {
+        fds[ ( *n_fds )++ ] = passed_fd;
+      }
+      else {
+        close( passed_fd );
+      }
+    }
+  }
+  if ( ( mhdr.msg_flags & ( MSG_TRUNC | MSG_CTRUNC ) ) != 0 ) {
+    error( "A command is truncated ( fd = %d, flags = %#x ).", fd, mhdr.msg_flags );
+    for ( int i = 0; i < *n_fds; i++ ) {
+      close( fds[ i ] );
+    }
+    *n_fds = 0;
+    return -1;
+  }
+  *length = ( size_t ) retval;
+
+  return retval;
+}
+
+
 bool
 init_ctrl_client( int *fd ) {
   assert( fd != NULL );
@@ -171,6 +405,19 @@ init_ctrl_client( int *fd ) {
 }
 
 
+// Returns true if the peer closed an idle connection. Replies are read in
+// full before the next request, so nothing is expected to be pending.
+bool
+ctrl_connection_closed( int fd ) {
+  assert( fd >= 0 );
+
+  struct pollfd pfd = { .fd = fd, .events = POLLIN | POLLRDHUP, .revents = 0 };
+  int ret = poll( &pfd, 1, 0 );
+
+  return ret > 0 && ( pfd.revents & ( POLLIN | POLLRDHUP | POLLHUP | POLLERR ) ) != 0;
+}
+
+
 bool
 finalize_ctrl_client( int fd ) {
   assert( fd >= 0 );
@@ -181,6 +428,27 @@ finalize_ctrl_client( int fd ) {
 }
 
 
+bool
+connect_ctrl_server( int fd, const char *file ) {
+  assert( fd >= 0 );
+  assert( file != NULL );
+
+  struct sockaddr_un saddr;
+  memset( &saddr, 0, sizeof( saddr ) );
+  saddr.sun_family = AF_UNIX;
+  strncpy( saddr.sun_path, file, sizeof( saddr.sun_path ) - 1 );
+  int ret = connect( fd, ( const struct sockaddr * ) &saddr, ( socklen_t ) sizeof( saddr ) );
+  if ( ret < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to connect ( file = %s, ret = %d, errno = %s [%d] ).", file, ret, error_string, errno );
+    return false;
+  }
+
+  return true;
+}
+
+
 bool
 init_ctrl_server( int *listen_fd, const char *file ) {
   assert( listen_fd != NULL );
@@ -209,7 +477,7 @@ init_ctrl_server( int *listen_fd, const char *file ) {
     return false;
   }
 
-  ret = listen( *listen_fd, 1 );
+  ret = listen( *listen_fd, CTRL_SERVER_BACKLOG );
   if ( ret < 0 ) {
     char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
     error( "Failed to listen ( ret = %d, errno = %s [%d] ).", ret, error_string, errno );
@@ -220,6 +488,434 @@ init_ctrl_server( int *listen_fd, const char *file ) {
 }
 
 
+// Moves a listening socket bound to a temporary path over the path clients
+// connect to. A process taking over binds to a temporary path first so that
+// the running process stays reachable until the takeover completes.
+bool
+publish_ctrl_server( const char *temporary_file, const char *file ) {
+  assert( temporary_file != NULL );
+  assert( file != NULL );
+
+  int ret = rename( temporary_file, file );
+  if ( ret < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    critical( "Failed to rename a control socket ( from = %s, to = %s, ret = %d, errno = %s [%d] ).",
+              temporary_file, file, ret, error_string, errno );
+    return false;
+  }
+
+  return true;
+}
+
+
+static struct ctrl_connection *
+lookup_connection( int fd ) {
+  for ( int i = 0; i < MAX_CTRL_CONNECTIONS; i++ ) {
+    if ( connections[ i ].fd == fd && fd >= 0 ) {
+      return &connections[ i ];
+    }
+  }
+
+  return NULL;
+}
+
+
+// Reads requests while replies can be queued and writes while any are queued.
+static void
+update_events( struct ctrl_connection *connection ) {
+  assert( connection != NULL );
+
+  uint32_t events = 0;
+  if ( connection->n_replies < MAX_QUEUED_REPLIES && !connection->eof ) {
+    events |= EPOLLIN;
+  }
+  if ( connection->head != NULL ) {
+    events |= EPOLLOUT;
+  }
+  if ( events == connection->events ) {
+    return;
+  }
+
+  struct epoll_event event;
+  memset( &event, 0, sizeof( event ) );
+  event.events = events;
+  event.data.ptr = connection;
+  if ( epoll_ctl( epoll_fd, EPOLL_CTL_MOD, connection->fd, &event ) < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to modify events ( fd = %d, errno = %s [%d] ).", connection->fd, error_string, errno );
+    connection->closing = true;
+    return;
+  }
+  connection->events = events;
+}
+
+
+static void
+close_connection( struct ctrl_connection *connection ) {
+  assert( connection != NULL );
+
+  while ( connection->head != NULL ) {
+    struct ctrl_reply *reply = connection->head;
+    connection->head = reply->next;
+    free( reply );
+  }
+  while ( connection->batches != NULL ) {
+    struct ctrl_batch *batch = connection->batches;
+    connection->batches = batch->next;
+    if ( batch->data != NULL ) {
+      free( batch->data );
+    }
+    free( batch );
+  }
+  epoll_ctl( epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL );
+  close( connection->fd );
+  memset( connection, 0, sizeof( struct ctrl_connection ) );
+  connection->fd = -1;
+}
+
+
+static bool
+send_message( struct ctrl_connection *connection, const void *message, size_t length ) {
+  ssize_t ret = send( connection->fd, message, length, MSG_DONTWAIT | MSG_NOSIGNAL );
+  if ( ret < 0 && ( errno == EPIPE || errno == ECONNRESET ) ) {
+    // The client went away without reading all replies.
+    connection->closing = true;
+  }
+  else if ( ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to send ( fd = %d, errno = %s [%d] ).", connection->fd, error_string, errno );
+    connection->closing = true;
+  }
+
+  // Messages on a sequenced-packet socket are sent as a whole or not at all.
+  return ret == ( ssize_t ) length;
+}
+
+
+static void
+flush_replies( struct ctrl_connection *connection ) {
+  assert( connection != NULL );
+
+  while ( connection->head != NULL && !connection->closing ) {
+    struct ctrl_reply *reply = connection->head;
+    if ( !send_message( connection, reply->data, reply->length ) ) {
+      break;
+    }
+    connection->head = reply->next;
+    if ( connection->head == NULL ) {
+      connection->tail = NULL;
+    }
+    connection->n_replies--;
+    free( reply );
+  }
+  if ( connection->eof && connection->head == NULL ) {
+    connection->closing = true;
+    return;
+  }
+  update_events( connection );
+}
+
+
+// Sends a reply without blocking. Replies that the client is not ready to
+// read are queued on the connection and sent in order as it drains.
+bool
+send_ctrl_reply( int fd, const void *reply, size_t length ) {
+  assert( fd >= 0 );
+  assert( reply != NULL );
+  assert( length > 0 );
+
+  struct ctrl_connection *connection = lookup_connection( fd );
+  if ( connection == NULL ) {
+    size_t remaining = length;
+    return send_command( fd, ( void * ) ( uintptr_t ) reply, &remaining ) > 0;
+  }
+  if ( connection->closing ) {
+    return false;
+  }
+  if ( connection->head == NULL && send_message( connection, reply, length ) ) {
+    return true;
+  }
+  if ( connection->closing ) {
+    return false;
+  }
+
+  struct ctrl_reply *queued = malloc( sizeof( struct ctrl_reply ) + length );
+  assert( queued != NULL );
+  queued->next = NULL;
+  queued->length = length;
+  memcpy( queued->data, reply, length );
+  if ( connection->tail != NULL ) {
+    connection->tail->next = queued;
+  }
+  else {
+    connection->head = queued;
+  }
+  connection->tail = queued;
+  connection->n_replies++;
+  update_events( connection );
+
+  return true;
+}
+
+
+// Gathers records of a request that may be continued by later requests with
+// the same xid on the connection. While more is set, records are staged and
+// CTRL_BATCH_STAGED is returned. The last request returns all records of the
+// batch in *batch, which the caller frees. Passing NULL records marks the
+// batch as failed, so that the last request returns CTRL_BATCH_FAILED.
+int
+collect_ctrl_batch( int fd, uint32_t xid, bool more, const void *records, size_t length, void **batch,
+                    size_t *batch_length ) {
+  assert( fd >= 0 );
+  assert( batch != NULL );
+  assert( batch_length != NULL );
+
+  *batch = NULL;
+  *batch_length = 0;
+
+  struct ctrl_connection *connection = lookup_connection( fd );
+  struct ctrl_batch *staged = NULL;
+  struct ctrl_batch **prev = NULL;
+  if ( connection != NULL ) {
+    for ( prev = &connection->batches; *prev != NULL; prev = &( *prev )->next ) {
+      if ( ( *prev )->xid == xid ) {
+        staged = *prev;
+        break;
+      }
+    }
+    if ( staged == NULL && more ) {
+      staged = malloc( sizeof( struct ctrl_batch ) );
+      assert( staged != NULL );
+      memset( staged, 0, sizeof( struct ctrl_batch ) );
+      staged->xid = xid;
+      staged->next = connection->batches;
+      connection->batches = staged;
+      prev = &connection->batches;
+    }
+  }
+  else if ( more ) {
+    return CTRL_BATCH_FAILED;
+  }
+
+  bool failed = staged != NULL ? staged->failed : false;
+  size_t total = staged != NULL ? staged->length : 0;
+  if ( records == NULL || total + length > MAX_BATCH_LENGTH ) {
+    failed = true;
+  }
+  uint8_t *data = NULL;
+  if ( !failed && total + length > 0 ) {
+    data = realloc( staged != NULL ? staged->data : NULL, total + length );
+    assert( data != NULL );
+    memcpy( data + total, records, length );
+    total += length;
+  }
+  else if ( staged != NULL && staged->data != NULL ) {
+    free( staged->data );
+  }
+
+  if ( more ) {
+    staged->data = data;
+    staged->length = failed ? 0 : total;
+    staged->failed = failed;
+    return CTRL_BATCH_STAGED;
+  }
+
+  if ( staged != NULL ) {
+    *prev = staged->next;
+    free( staged );
+  }
+  if ( failed ) {
+    return CTRL_BATCH_FAILED;
+  }
+  *batch = data;
+  *batch_length = total;
+
+  return CTRL_BATCH_COMPLETE;
+}
+
+
+static void
+accept_connections( int listen_fd ) {
+  while ( true ) {
+    int fd = accept4( listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+    if ( fd < 0 ) {
+      if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+        char buf[ 256 ];
+        char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+        error( "Failed to accept ( listen_fd = %d, errno = %s [%d] ).", listen_fd, error_string, errno );
+      }
+      return;
+    }
+
+    struct ctrl_connection *connection = NULL;
+    for ( int i = 0; i < MAX_CTRL_CONNECTIONS && connection == NULL; i++ ) {
+      if ( connections[ i ].fd < 0 ) {
+        connection = &connections[ i ];
+      }
+    }
+    if ( connection == NULL ) {
+      warn( "Too many control connections ( fd = %d, max = %d ).", fd, MAX_CTRL_CONNECTIONS );
+      close( fd );
+      continue;
+    }
+
+    memset( connection, 0, sizeof( struct ctrl_connection ) );
+    connection->fd = fd;
+    connection->events = EPOLLIN;
+    struct epoll_event event;
+    memset( &event, 0, sizeof( event ) );
+    event.events = connection->events;
+    event.data.ptr = connection;
+    if ( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &event ) < 0 ) {
+      char buf[ 256 ];
+      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+      error( "Failed to add a control connection ( fd = %d, errno = %s [%d] ).", fd, error_string, errno );
+      close( fd );
+      connection->fd = -1;
+    }
+  }
+}
+
+
+// Serves requests that are pipelined on the connection. Up to
+// MAX_REQUESTS_PER_EVENT requests are served at a time so that a busy client
+// does not starve others.
+static void
+serve_requests( struct ctrl_connection *connection, ctrl_request_handler handler ) {
+  assert( connection != NULL );
+  assert( handler != NULL );
+
+  uint8_t request[ COMMAND_MESSAGE_LENGTH ];
+  for ( int i = 0; i < MAX_REQUESTS_PER_EVENT && !connection->closing; i++ ) {
+    if ( connection->n_replies >= MAX_QUEUED_REPLIES ) {
+      break;
+    }
+    memset( request, 0, sizeof( command_request_header ) );
+    ssize_t ret = recv( connection->fd, request, sizeof( request ), MSG_DONTWAIT );
+    if ( ret < 0 ) {
+      if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+        char buf[ 256 ];
+        char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+        error( "Failed to recv ( fd = %d, errno = %s [%d] ).", connection->fd, error_string, errno );
+        connection->closing = true;
+      }
+      break;
+    }
+    if ( ret == 0 ) {
+      // connection closed by peer
+      connection->eof = true;
+      if ( connection->head == NULL ) {
+        connection->closing = true;
+      }
+      else {
+        update_events( connection );
+      }
+      break;
+    }
+    if ( ( size_t ) ret < sizeof( command_request_header ) ) {
+      error( "Too short request ( fd = %d, length = %zd ).", connection->fd, ret );
+      connection->closing = true;
+      break;
+    }
+
+    size_t length = ( size_t ) ret;
+    if ( !handler( connection->fd, request, &length ) ) {
+      connection->closing = true;
+    }
+  }
+}
+
+
+// Runs the control server until running is cleared. Connections are kept
+// open and requests on them are served in order, so that a client may send
+// many requests before reading replies that carry the same xid.
+bool
+run_ctrl_server( int listen_fd, ctrl_request_handler handler, ctrl_idle_handler idle ) {
+  assert( listen_fd >= 0 );
+  assert( handler != NULL );
+
+  for ( int i = 0; i < MAX_CTRL_CONNECTIONS; i++ ) {
+    memset( &connections[ i ], 0, sizeof( struct ctrl_connection ) );
+    connections[ i ].fd = -1;
+  }
+
+  char buf[ 256 ];
+  epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+  if ( epoll_fd < 0 ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to create an epoll instance ( errno = %s [%d] ).", error_string, errno );
+    return false;
+  }
+  int flags = fcntl( listen_fd, F_GETFL );
+  if ( flags >= 0 ) {
+    fcntl( listen_fd, F_SETFL, flags | O_NONBLOCK );
+  }
+  struct epoll_event event;
+  memset( &event, 0, sizeof( event ) );
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if ( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, listen_fd, &event ) < 0 ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to add a listening socket ( listen_fd = %d, errno = %s [%d] ).", listen_fd, error_string, errno );
+    close( epoll_fd );
+    epoll_fd = -1;
+    return false;
+  }
+
+  bool ret = true;
+  while ( running ) {
+    if ( idle != NULL ) {
+      idle();
+    }
+
+    struct epoll_event events[ 16 ];
+    int n_events = epoll_wait( epoll_fd, events, 16, 1000 );
+    if ( n_events < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+      error( "Failed to wait for events ( epoll_fd = %d, errno = %s [%d] ).", epoll_fd, error_string, errno );
+      ret = false;
+      break;
+    }
+
+    for ( int i = 0; i < n_events; i++ ) {
+      struct ctrl_connection *connection = events[ i ].data.ptr;
+      if ( connection == NULL ) {
+        accept_connections( listen_fd );
+        continue;
+      }
+      if ( connection->fd < 0 ) {
+        continue;
+      }
+      if ( ( events[ i ].events & EPOLLOUT ) != 0 ) {
+        flush_replies( connection );
+      }
+      if ( ( events[ i ].events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) != 0 && !connection->eof ) {
+        serve_requests( connection, handler );
+      }
+      if ( connection->closing ) {
+        close_connection( connection );
+      }
+    }
+  }
+
+  for ( int i = 0; i < MAX_CTRL_CONNECTIONS; i++ ) {
+    if ( connections[ i ].fd >= 0 ) {
+      close_connection( &connections[ i ] );
+    }
+  }
+  close( epoll_fd );
+  epoll_fd = -1;
+
+  return ret;
+}
+
+
 bool
 finalize_ctrl_server( int listen_fd, const char *file ) {
   assert( listen_fd >= 0 );
@@ -26,9 +26,11 @@
 #include <netinet/in.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 
 #define COMMAND_MESSAGE_LENGTH 4096
+#define MAX_COMMAND_FDS 4
 
 
 enum {
@@ -41,6 +43,7 @@ enum {
 enum {
   FLAG_NONE = 0x00,
   FLAG_MORE = 0x01,
+  FLAG_TRUNCATED = 0x02, // Records were cut at the requested maximum
 };
 
 
@@ -60,14 +63,37 @@ typedef struct {
 } command_reply_header;
 
 
+// Results of collect_ctrl_batch().
+enum {
+  CTRL_BATCH_STAGED,
+  CTRL_BATCH_COMPLETE,
+  CTRL_BATCH_FAILED,
+};
+
+
+typedef bool ( *ctrl_request_handler )( int fd, void *request, size_t *length );
+typedef void ( *ctrl_idle_handler )( void );
+
+
 extern volatile bool running;
 
 
 ssize_t send_command( int fd, void *command, size_t *length );
 ssize_t recv_command( int fd, void *command, size_t *length );
+bool send_packed_replies( int fd, const void *header, size_t header_length, const void *records, size_t record_size,
+                          int n_records, uint8_t last_flags );
+ssize_t send_command_with_fds( int fd, void *command, size_t length, const int *fds, int n_fds );
+ssize_t recv_command_with_fds( int fd, void *command, size_t *length, int *fds, int *n_fds, time_t timeout );
 bool init_ctrl_client( int *fd );
+bool ctrl_connection_closed( int fd );
 bool finalize_ctrl_client( int fd );
+bool connect_ctrl_server( int fd, const char *file );
 bool init_ctrl_server( int *listen_fd, const char *file );
+bool publish_ctrl_server( const char *temporary_file, const char *file );
+bool run_ctrl_server( int listen_fd, ctrl_request_handler handler, ctrl_idle_handler idle );
+bool send_ctrl_reply( int fd, const void *reply, size_t length );
+int collect_ctrl_batch( int fd, uint32_t xid, bool more, const void *records, size_t length, void **batch,
+                        size_t *batch_length );
 bool finalize_ctrl_server( int listen_fd, const char *file );
 
 
@@ -33,24 +33,36 @@
 #include "checks.h"
 #include "ethdev.h"
 #include "reflector_common.h"
-#include "hash.h"
+#include "latency.h"
 #include "linked_list.h"
 #include "log.h"
+#include "probes.h"
 #include "queue.h"
+#include "vni_table.h"
 #include "wrapper.h"
 
 
-static struct hash *tunnel_endpoints = NULL;
+static struct vni_table *tunnel_endpoints = NULL;
+#ifdef LATENCY_STATS
+// Histograms of VNIs that packets were reflected on. Only the distributor
+// thread adds and updates them.
+typedef struct {
+  uint32_t vni;
+  struct latency_histogram histogram;
+} vni_latency;
 
+static struct vni_table *latencies = NULL;
+#endif
 
-static void
+
+void
 create_tunnel_endpoints() {
   assert( tunnel_endpoints == NULL );
 
-  tunnel_endpoints = malloc( sizeof( struct hash ) );
-  assert( tunnel_endpoints != NULL );
-
-  init_hash( tunnel_endpoints, sizeof( uint32_t ) );
+  tunnel_endpoints = create_vni_table();
+#ifdef LATENCY_STATS
+  latencies = create_vni_table();
+#endif
 }
 
 
@@ -58,40 +70,116 @@ static void
 delete_tunnel_endpoints() {
   assert( tunnel_endpoints != NULL );
 
-  list *vnis = create_list();
+  int n = 0;
+  list **lists = ( list ** ) create_list_from_vni_table( tunnel_endpoints, &n );
+  for ( int i = 0; i < n; i++ ) {
+    delete_list_totally( lists[ i ] );
+  }
+  if ( lists != NULL ) {
+    free( lists );
+  }
+
+  destroy_vni_table( tunnel_endpoints );
+  tunnel_endpoints = NULL;
+}
 
-  for ( int n = 0; n < HASH_TABLE_SIZE; n++ ) {
-    struct hashnode *ptr = &tunnel_endpoints->table[ n ];
-    pthread_mutex_lock( &tunnel_endpoints->mutex[ n ] );
-    for ( struct hashnode *p = ptr; p != NULL; p = p->next ) {
-      if ( p->key != NULL ) {
-        append_to_tail( vnis, p->key );
-      }
+
+#ifdef LATENCY_STATS
+static void
+delete_latencies() {
+  assert( latencies != NULL );
+
+  int n = 0;
+  vni_latency **entries = ( vni_latency ** ) create_list_from_vni_table( latencies, &n );
+  for ( int i = 0; i < n; i++ ) {
+    free( entries[ i ] );
+  }
+  if ( entries != NULL ) {
+    free( entries );
+  }
+
+  destroy_vni_table( latencies );
+  latencies = NULL;
+}
+
+
+static void
+record_reflect_latency( uint32_t vni, uint64_t received_at ) {
+  assert( latencies != NULL );
+
+  vni_latency *entry = search_vni_table( latencies, vni );
+  if ( entry == NULL ) {
+    entry = malloc( sizeof( vni_latency ) );
+    assert( entry != NULL );
+    memset( entry, 0, sizeof( vni_latency ) );
+    entry->vni = vni;
+    insert_vni_table( latencies, vni, entry );
+  }
+  record_latency( &entry->histogram, received_at );
+}
+
+
+static int
+compare_vni_stats( const void *x, const void *y ) {
+  const vni_stats *a = x;
+  const vni_stats *b = y;
+
+  return a->vni < b->vni ? -1 : ( a->vni > b->vni ? 1 : 0 );
+}
+
+
+// Returns latency summaries of a VNI, or of all VNIs if vni is UINT32_MAX, in order of VNI.
+vni_stats *
+get_vni_stats( uint32_t vni, int *n_stats ) {
+  assert( latencies != NULL );
+  assert( n_stats != NULL );
+
+  *n_stats = 0;
+  if ( vni != UINT32_MAX ) {
+    vni_latency *entry = search_vni_table( latencies, vni );
+    if ( entry == NULL ) {
+      return NULL;
     }
-    pthread_mutex_unlock( &tunnel_endpoints->mutex[ n ] );
+    vni_stats *stats = malloc( sizeof( vni_stats ) );
+    assert( stats != NULL );
+    stats->vni = vni;
+    summarize_latency( &entry->histogram, &stats->reflect_latency );
+    *n_stats = 1;
+    return stats;
   }
 
-  for ( list_element *e = vnis->head; e != NULL; e = e->next ) {
-    if ( e->data != NULL ) {
-      void *deleted = delete_hash( tunnel_endpoints, e->data );
-      if ( deleted != NULL ) {
-        delete_list_totally( deleted );
-      }
+  int n = 0;
+  vni_latency **entries = ( vni_latency ** ) create_list_from_vni_table( latencies, &n );
+  if ( n == 0 || entries == NULL ) {
+    if ( entries != NULL ) {
+      free( entries );
     }
+    return NULL;
   }
-  delete_list( vnis );
 
-  destroy_hash( tunnel_endpoints );
-  free( tunnel_endpoints );
-  tunnel_endpoints = NULL;
+  vni_stats *stats = malloc( sizeof( vni_stats ) * ( size_t ) n );
+  assert( stats != NULL );
+  for ( int i = 0; i < n; i++ ) {
+    stats[ i ].vni = entries[ i ]->vni;
+    summarize_latency( &entries[ i ]->histogram, &stats[ i ].reflect_latency );
+  }
+  free( entries );
+  qsort( stats, ( size_t ) n, sizeof( vni_stats ), compare_vni_stats );
+  *n_stats = n;
+
+  return stats;
 }
+#endif
 
 
+// Lists are looked up without a lock and may be in use by the distributor at
+// any time, so a list stays in the table once created even if it becomes
+// empty. Lists are freed only when the table is deleted.
 list *
 lookup_tunnel_endpoints( uint32_t vni ) {
   assert( tunnel_endpoints != NULL );
 
-  list *l = ( list * ) search_hash( tunnel_endpoints, &vni );
+  list *l = ( list * ) search_vni_table( tunnel_endpoints, vni );
   if ( l == NULL || ( l != NULL && l->head == NULL ) ) {
     return NULL;
   }
@@ -105,7 +193,7 @@ get_all_tunnel_endpoints() {
   assert( tunnel_endpoints != NULL );
 
   int n = 0;
-  list **lists = ( list ** ) create_list_from_hash( tunnel_endpoints, &n );
+  list **lists = ( list ** ) create_list_from_vni_table( tunnel_endpoints, &n );
   if ( n == 0 || lists == NULL ) {
     if ( lists != NULL ) {
       free( lists );
@@ -128,6 +216,11 @@ get_all_tunnel_endpoints() {
 
   free( lists );
 
+  if ( endpoints->head == NULL ) {
+    delete_list( endpoints );
+    return NULL;
+  }
+
   return endpoints;
 }
 
@@ -147,13 +240,13 @@ add_tunnel_endpoint( uint32_t vni, struct in_addr ip_addr, uint16_t port ) {
   memcpy( &tep->ip_addr, &ip_addr, sizeof( tep->ip_addr ) );
   tep->port = htons( port );
 
-  list *l = ( list * ) search_hash( tunnel_endpoints, &vni );
+  list *l = ( list * ) search_vni_table( tunnel_endpoints, vni );
   if ( l == NULL ) {
     l = create_list();
     assert( l != NULL );
-    int ret = insert_hash( tunnel_endpoints, l, &vni );
-    if ( ret < 0 ) {
-      error( "Failed to insert a hash entry." );
+    if ( !insert_vni_table( tunnel_endpoints, vni, l ) ) {
+      error( "Failed to insert a VNI table entry ( vni = %#x ).", vni );
+      delete_list( l );
       free( tep );
       return false;
     }
@@ -190,7 +283,7 @@ set_tunnel_endpoint_port( uint32_t vni, struct in_addr ip_addr, uint16_t port )
     return false;
   }
 
-  list *l = ( list * ) search_hash( tunnel_endpoints, &vni );
+  list *l = ( list * ) search_vni_table( tunnel_endpoints, vni );
   if ( l == NULL ) {
     return false;
   }
@@ -222,7 +315,7 @@ delete_tunnel_endpoint( uint32_t vni, struct in_addr ip_addr ) {
   }
 
   tunnel_endpoint *delete = NULL;
-  list *l = ( list * ) search_hash( tunnel_endpoints, &vni );
+  list *l = ( list * ) search_vni_table( tunnel_endpoints, vni );
   if ( l == NULL ) {
     return false;
   }
@@ -245,26 +338,187 @@ delete_tunnel_endpoint( uint32_t vni, struct in_addr ip_addr ) {
   delete_element( l, delete );
   free( delete );
 
-  if ( l->head == NULL ) {
-    void *deleted = delete_hash( tunnel_endpoints, &vni );
-    if ( deleted != NULL ) {
-      delete_list( deleted );
-    }
+  return true;
+}
+
+
+enum {
+  TEP_KEPT,
+  TEP_ADDED,
+  TEP_DELETED,
+};
+
+typedef struct {
+  tep_update update;
+  int index;
+} ordered_tep_update;
+
+
+static int
+compare_tep_addresses( const void *x, const void *y ) {
+  uint32_t a = ntohl( ( *( tunnel_endpoint * const * ) x )->ip_addr.s_addr );
+  uint32_t b = ntohl( ( *( tunnel_endpoint * const * ) y )->ip_addr.s_addr );
+
+  return a < b ? -1 : ( a > b ? 1 : 0 );
+}
+
+
+static int
+compare_tep_updates( const void *x, const void *y ) {
+  const ordered_tep_update *a = x;
+  const ordered_tep_update *b = y;
+
+  uint32_t a_addr = ntohl( a->update.ip_addr.s_addr );
+  uint32_t b_addr = ntohl( b->update.ip_addr.s_addr );
+  if ( a_addr != b_addr ) {
+    return a_addr < b_addr ? -1 : 1;
   }
 
-  return true;
+  return a->index < b->index ? -1 : ( a->index > b->index ? 1 : 0 );
 }
 
 
-static uint32_t
-get_vni_value( struct vxlanhdr *vxlan ) {
-  uint32_t vni = 0;
+// Applies a batch of updates to the tunnel endpoints of a VNI. The list is
+// held throughout so that the distributor sees either the old or the new
+// set. With replace, tunnel endpoints that the batch does not add are
+// removed. Returns the number of updates that could not be applied.
+int
+update_tunnel_endpoints( uint32_t vni, const tep_update *updates, int n_updates, bool replace ) {
+  assert( tunnel_endpoints != NULL );
+  assert( updates != NULL || n_updates == 0 );
+
+  if ( !valid_vni( vni ) ) {
+    return n_updates;
+  }
+
+  list *l = ( list * ) search_vni_table( tunnel_endpoints, vni );
+  if ( l == NULL ) {
+    l = create_list();
+    assert( l != NULL );
+    if ( !insert_vni_table( tunnel_endpoints, vni, l ) ) {
+      error( "Failed to insert a VNI table entry ( vni = %#x ).", vni );
+      delete_list( l );
+      return n_updates;
+    }
+  }
+
+  // Updates are applied in order of address so that updates of an address
+  // are adjacent. Updates of the same address keep their order.
+  ordered_tep_update *ordered = malloc( sizeof( ordered_tep_update ) * ( size_t ) ( n_updates > 0 ? n_updates : 1 ) );
+  assert( ordered != NULL );
+  for ( int i = 0; i < n_updates; i++ ) {
+    ordered[ i ].update = updates[ i ];
+    ordered[ i ].index = i;
+  }
+  qsort( ordered, ( size_t ) n_updates, sizeof( ordered_tep_update ), compare_tep_updates );
+
+  pthread_mutex_lock( &l->mutex );
+
+  int n_teps = 0;
+  for ( list_element *e = l->head; e != NULL; e = e->next ) {
+    n_teps++;
+  }
+  int size = n_teps + n_updates > 0 ? n_teps + n_updates : 1;
+  tunnel_endpoint **teps = malloc( sizeof( tunnel_endpoint * ) * ( size_t ) size );
+  uint8_t *states = calloc( ( size_t ) size, sizeof( uint8_t ) );
+  assert( teps != NULL && states != NULL );
+  n_teps = 0;
+  for ( list_element *e = l->head; e != NULL; e = e->next ) {
+    if ( e->data != NULL ) {
+      teps[ n_teps++ ] = e->data;
+    }
+  }
+  qsort( teps, ( size_t ) n_teps, sizeof( tunnel_endpoint * ), compare_tep_addresses );
+  int n_sorted = n_teps;
+
+  int n_failed = 0;
+  for ( int i = 0; i < n_updates; i++ ) {
+    const tep_update *update = &ordered[ i ].update;
+    tunnel_endpoint key;
+    key.ip_addr = update->ip_addr;
+    tunnel_endpoint *k = &key;
+    tunnel_endpoint **found = bsearch( &k, teps, ( size_t ) n_sorted, sizeof( tunnel_endpoint * ),
+                                       compare_tep_addresses );
+    if ( found == NULL && n_teps > n_sorted && teps[ n_teps - 1 ]->ip_addr.s_addr == update->ip_addr.s_addr ) {
+      found = &teps[ n_teps - 1 ];
+    }
+
+    switch ( update->op ) {
+      case TEP_UPDATE_ADD:
+        if ( found == NULL ) {
+          tunnel_endpoint *tep = malloc( sizeof( tunnel_endpoint ) );
+          assert( tep != NULL );
+          memset( tep, 0, sizeof( tunnel_endpoint ) );
+          tep->vni = vni;
+          tep->ip_addr = update->ip_addr;
+          found = &teps[ n_teps++ ];
+          *found = tep;
+        }
+        ( *found )->port = htons( update->port );
+        states[ found - teps ] = TEP_ADDED;
+        break;
+
+      case TEP_UPDATE_DELETE:
+        // Deleting an absent entry is not an error so that updates can be replayed.
+        if ( found != NULL ) {
+          states[ found - teps ] = TEP_DELETED;
+        }
+        break;
 
-  vni |= ( uint32_t ) ( vxlan->vni[ 0 ] << 16 );
-  vni |= ( uint32_t ) ( vxlan->vni[ 1 ] << 8 );
-  vni |= ( uint32_t ) vxlan->vni[ 2 ];
+      default:
+        n_failed++;
+        break;
+    }
+  }
+  if ( replace ) {
+    for ( int i = 0; i < n_sorted; i++ ) {
+      if ( states[ i ] == TEP_KEPT ) {
+        states[ i ] = TEP_DELETED;
+      }
+    }
+  }
 
-  return vni;
+  // The list is rebuilt in a single pass rather than by an append or delete
+  // per update, each of which would walk the list.
+  list_element **next = &l->head;
+  while ( *next != NULL ) {
+    list_element *e = *next;
+    tunnel_endpoint **tep = NULL;
+    if ( e->data != NULL ) {
+      tep = bsearch( &e->data, teps, ( size_t ) n_sorted, sizeof( tunnel_endpoint * ), compare_tep_addresses );
+    }
+    if ( tep != NULL && states[ tep - teps ] == TEP_DELETED ) {
+      *next = e->next;
+      free( e );
+    }
+    else {
+      next = &e->next;
+    }
+  }
+  for ( int i = n_sorted; i < n_teps; i++ ) {
+    if ( states[ i ] == TEP_ADDED ) {
+      list_element *e = malloc( sizeof( list_element ) );
+      assert( e != NULL );
+      e->data = teps[ i ];
+      e->next = NULL;
+      *next = e;
+      next = &e->next;
+    }
+  }
+
+  for ( int i = 0; i < n_teps; i++ ) {
+    if ( states[ i ] == TEP_DELETED ) {
+      free( teps[ i ] );
+    }
+  }
+
+  pthread_mutex_unlock( &l->mutex );
+
+  free( states );
+  free( teps );
+  free( ordered );
+
+  return n_failed;
 }
 
 
@@ -280,10 +534,11 @@ distribute_packet( ethdev *dev, packet_buffer *packet ) {
   struct iphdr *ip = packet->ip;
   struct udphdr *udp = packet->udp;
   struct vxlanhdr *vxlan = packet->vxlan;
-  uint32_t vni = get_vni_value( vxlan );
+  uint32_t vni = get_vni_value( vxlan->vni );
 
   list *destination_list = lookup_tunnel_endpoints( vni );
   if ( destination_list == NULL ) {
+    PROBE3( reflectord, packet_dropped, vni, PROBE_DROP_UNKNOWN_VNI, packet->length );
     return true;
   }
 
@@ -294,6 +549,9 @@ distribute_packet( ethdev *dev, packet_buffer *packet ) {
   dst.sin_family = AF_INET;
   dst.sin_port = IPPROTO_UDP;
 
+#ifdef LATENCY_STATS
+  int n_sent = 0;
+#endif
   pthread_mutex_lock( &destination_list->mutex );
   for ( list_element *e = destination_list->head; e != NULL; e = e->next ) {
     tunnel_endpoint *tep = e->data;
@@ -337,6 +595,7 @@ distribute_packet( ethdev *dev, packet_buffer *packet ) {
                  dev->name, packet->data, packet->length );
           goto error;
         }
+        PROBE3( reflectord, packet_dropped, vni, PROBE_DROP_SEND_FAILED, packet->length );
       }
       break;
     }
@@ -345,9 +604,19 @@ distribute_packet( ethdev *dev, packet_buffer *packet ) {
     }
     tep->counters.packet++;
     tep->counters.octet += packet->length;
+    PROBE4( reflectord, packet_reflected, vni, packet->data, packet->length, tep->ip_addr.s_addr );
+#ifdef LATENCY_STATS
+    n_sent++;
+#endif
   }
   pthread_mutex_unlock( &destination_list->mutex );
 
+#ifdef LATENCY_STATS
+  if ( n_sent > 0 ) {
+    record_reflect_latency( vni, packet->received_at );
+  }
+#endif
+
   return true;
 
 error:
@@ -381,8 +650,6 @@ distributor_main( void *args ) {
   info( "Distributer thread is started ( pid = %u, tid = %u ).",
         getpid(), distributor_thread );
 
-  create_tunnel_endpoints();
-
   bool err = false;
   while ( running ) {
     wait_for_new_packets();
@@ -411,6 +678,9 @@ distributor_main( void *args ) {
   running = false;
 
   delete_tunnel_endpoints();
+#ifdef LATENCY_STATS
+  delete_latencies();
+#endif
 
   if ( !err ) {
     info( "Distributer thread is terminated ( pid = %u, tid = %u ).",
@@ -25,14 +25,20 @@
 #include <netinet/in.h>
 #include <stdint.h>
 #include "linked_list.h"
+#include "reflector_common.h"
 
 
 void *distributor_main( void *args );
+void create_tunnel_endpoints();
 bool add_tunnel_endpoint( uint32_t vni, struct in_addr ip_addr, uint16_t port );
 bool set_tunnel_endpoint_port( uint32_t vni, struct in_addr ip_addr, uint16_t port );
 list *lookup_tunnel_endpoints( uint32_t vni );
 list *get_all_tunnel_endpoints();
 bool delete_tunnel_endpoint( uint32_t vni, struct in_addr ip_addr );
+int update_tunnel_endpoints( uint32_t vni, const tep_update *updates, int n_updates, bool replace );
+#ifdef LATENCY_STATS
+vni_stats *get_vni_stats( uint32_t vni, int *n_stats );
+#endif
 
 
 #endif // DISTRIBUTOR_H
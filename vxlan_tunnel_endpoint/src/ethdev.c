@@ -21,6 +21,7 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/if_ether.h>
 #include <net/if.h>
 #include <netpacket/packet.h>
@@ -52,6 +53,7 @@ init_ethdev( const char *name, uint16_t port, ethdev **dev ) {
 
   memset( ( *dev )->name, '\0', sizeof( ( *dev )->name ) );
   strncpy( ( *dev )->name, name, sizeof( ( *dev )->name ) - 1 );
+  ( *dev )->discard = false;
 
   int fd = -1;
   int dummy_fd = -1;
@@ -184,6 +186,74 @@ error:
 }
 
 
+// Wraps sockets handed over from a previous process. The interface has
+// already been configured by the process that opened them.
+bool
+adopt_ethdev( const char *name, int fd, int dummy_fd, ethdev **dev ) {
+  assert( name != NULL );
+  assert( fd >= 0 );
+  assert( dummy_fd >= 0 );
+  assert( dev != NULL );
+
+  unsigned int ifindex = if_nametoindex( name );
+  if ( ifindex == 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to retrieve interface index ( name = %s, errno = %s [%d] ).", name, error_string, errno );
+    return false;
+  }
+
+  *dev = malloc( sizeof( ethdev ) );
+  assert( *dev != NULL );
+
+  memset( ( *dev )->name, '\0', sizeof( ( *dev )->name ) );
+  strncpy( ( *dev )->name, name, sizeof( ( *dev )->name ) - 1 );
+  ( *dev )->ifindex = ( int ) ifindex;
+  ( *dev )->fd = fd;
+  ( *dev )->dummy_fd = dummy_fd;
+  ( *dev )->discard = false;
+
+  return true;
+}
+
+
+// A device that is always writable and sends nothing. Used while packets
+// are replayed from a file so that nothing leaves the host.
+bool
+init_discard_ethdev( const char *name, ethdev **dev ) {
+  assert( name != NULL );
+  assert( dev != NULL );
+
+  int fd = open( "/dev/null", O_WRONLY );
+  if ( fd < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to open /dev/null ( fd = %d, errno = %s [%d] ).", fd, error_string, errno );
+    return false;
+  }
+  int dummy_fd = dup( fd );
+  if ( dummy_fd < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to duplicate a file descriptor ( fd = %d, errno = %s [%d] ).", fd, error_string, errno );
+    close( fd );
+    return false;
+  }
+
+  *dev = malloc( sizeof( ethdev ) );
+  assert( *dev != NULL );
+
+  memset( ( *dev )->name, '\0', sizeof( ( *dev )->name ) );
+  strncpy( ( *dev )->name, name, sizeof( ( *dev )->name ) - 1 );
+  ( *dev )->ifindex = 0;
+  ( *dev )->fd = fd;
+  ( *dev )->dummy_fd = dummy_fd;
+  ( *dev )->discard = true;
+
+  return true;
+}
+
+
 bool
 close_ethdev( ethdev *dev ) {
   assert( dev != NULL );
@@ -254,6 +324,10 @@ send_to_ethdev( ethdev *dev, const char *data, size_t length, struct sockaddr_in
   assert( length > 0 );
   assert( dst != NULL );
 
+  if ( dev->discard ) {
+    return ( ssize_t ) length;
+  }
+
   ssize_t ret = sendto( dev->fd, data, length, 0, ( struct sockaddr * ) dst, sizeof( struct sockaddr_in ) );
   if ( ret < 0 ) {
     if ( err != NULL ) {
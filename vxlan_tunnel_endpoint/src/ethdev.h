@@ -33,10 +33,13 @@ typedef struct {
   int ifindex;
   char name[ IFNAMSIZ ];
   int dummy_fd;
+  bool discard; // Packets are dropped instead of being sent
 } ethdev;
 
 
 bool init_ethdev( const char *name, uint16_t port, ethdev **dev );
+bool adopt_ethdev( const char *name, int fd, int dummy_fd, ethdev **dev );
+bool init_discard_ethdev( const char *name, ethdev **dev );
 bool close_ethdev( ethdev *dev );
 ssize_t recv_from_ethdev( ethdev *dev, char *data, size_t length, int *err );
 ssize_t send_to_ethdev( ethdev *dev, const char *data, size_t length, struct sockaddr_in *addr, int *err );
@@ -17,160 +17,421 @@
  */
 
 
+
+/*
+ * Forwarding database entries are carved out of a per-FDB slab and
+ * returned to it after a QSBR grace period. The number of entries is
+ * bounded, and the least recently seen dynamic entry among a small
+ * sample is evicted when the FDB is full.
+ */
+
+
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <unistd.h>
+#include "checks.h"
 #include "fdb.h"
 #include "log.h"
+#include "probes.h"
+#include "qsbr.h"
+#include "timer_wheel.h"
 #include "vxlan_common.h"
 #include "wrapper.h"
 
 
-#define SUB_TIMESPEC( _a, _b, _return )                       \
-  do {                                                        \
-    ( _return )->tv_sec = ( _a )->tv_sec - ( _b )->tv_sec;    \
-    ( _return )->tv_nsec = ( _a )->tv_nsec - ( _b )->tv_nsec; \
-    if ( ( _return )->tv_nsec < 0 ) {                         \
-      ( _return )->tv_sec--;                                  \
-      ( _return )->tv_nsec += 1000000000;                     \
-    }                                                         \
-  }                                                           \
-  while ( 0 )
+uint32_t fdb_clock = 0;
+
+// Protects the aging wheel and the slab chunks, and serializes insertions and
+// deletions on every FDB so that an entry is scheduled on the wheel if and only
+// if it is in its FDB.
+static pthread_mutex_t aging_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct timer_wheel aging_wheel;
+static pthread_t aging_thread;
+static bool aging_thread_started = false;
+
+
+static uint32_t
+coarse_now() {
+  struct timespec ts = { 0, 0 };
+  clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+
+  return ( uint32_t ) ts.tv_sec;
+}
+
+
+static void
+retire_memory( void *ptr ) {
+  qsbr_retire( ptr, free );
+}
+
+
+static void
+free_fdb( struct fdb *fdb ) {
+  assert( fdb != NULL );
+
+  for ( uint32_t i = 0; i < fdb->n_chunks; i++ ) {
+    free( fdb->chunks[ i ] );
+  }
+  if ( fdb->chunks != NULL ) {
+    free( fdb->chunks );
+  }
+  pthread_mutex_destroy( &fdb->slab_mutex );
+  free( fdb );
+}
+
+
+static void
+release_entry( void *ptr ) {
+  struct fdb_entry *entry = ptr;
+  struct fdb *fdb = entry->fdb;
+  assert( fdb != NULL );
+
+  PROBE2( vxland, fdb_release, fdb, entry->mac );
+
+  pthread_mutex_lock( &fdb->slab_mutex );
+  entry->next_free = fdb->free_entries;
+  fdb->free_entries = entry;
+  fdb->n_retiring--;
+  bool release = ( fdb->destroyed && fdb->n_retiring == 0 ) ? true : false;
+  pthread_mutex_unlock( &fdb->slab_mutex );
+
+  if ( release ) {
+    free_fdb( fdb );
+  }
+}
+
+
+static void
+retire_entry( struct fdb_entry *entry ) {
+  assert( entry != NULL );
+  assert( entry->fdb != NULL );
+
+  pthread_mutex_lock( &entry->fdb->slab_mutex );
+  entry->fdb->n_retiring++;
+  pthread_mutex_unlock( &entry->fdb->slab_mutex );
+
+  qsbr_retire( entry, release_entry );
+}
+
+
+static void
+retire_entries( list *entries ) {
+  assert( entries != NULL );
+
+  for ( list_element *e = entries->head; e != NULL; e = e->next ) {
+    retire_entry( e->data );
+  }
+  delete_list( entries );
+}
+
+
+static void
+unlink_entry( struct fdb_entry *entry ) {
+  assert( entry != NULL );
+
+  delete_timer_wheel_entry( &entry->timer );
+  entry->flags &= ( uint8_t ) ~FDB_ENTRY_FLAG_LINKED;
+}
 
 
 static bool
-now( struct timespec *ts ) {
-  assert( ts != NULL );
+evict_entry( struct fdb *fdb ) {
+  assert( fdb != NULL );
 
-  char buf[ 256 ];
+  uint32_t capacity = fdb->n_chunks * FDB_SLAB_CHUNK_ENTRIES;
+  struct fdb_entry *victim = NULL;
+  int n_samples = 0;
+  for ( uint32_t i = 0; i < capacity && n_samples < FDB_EVICTION_SAMPLES; i++ ) {
+    uint32_t index = fdb->eviction_hand;
+    fdb->eviction_hand = ( fdb->eviction_hand + 1 ) % capacity;
+    struct fdb_entry *entry = &fdb->chunks[ index / FDB_SLAB_CHUNK_ENTRIES ][ index % FDB_SLAB_CHUNK_ENTRIES ];
+    if ( ( entry->flags & FDB_ENTRY_FLAG_LINKED ) == 0 || entry->type != FDB_ENTRY_TYPE_DYNAMIC ) {
+      continue;
+    }
+    n_samples++;
+    uint32_t last_seen = __atomic_load_n( &entry->last_seen, __ATOMIC_RELAXED );
+    if ( victim == NULL || ( int32_t ) ( last_seen - victim->last_seen ) < 0 ) {
+      victim = entry;
+    }
+  }
 
-  int ret = clock_gettime( CLOCK_MONOTONIC, ts );
-  if ( ret < 0 ) {
-    const char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-    error( "Failed to add a forwarding database entry ( %s [%d] ).", error_string, errno );
+  if ( victim == NULL ) {
     return false;
   }
 
+  void *deleted = delete_hash( &fdb->fdb, victim->mac );
+  assert( deleted == victim );
+  PROBE3( vxland, fdb_evict, fdb, victim->mac, victim->vtep_addr.s_addr );
+  unlink_entry( victim );
+  fdb->n_evictions++;
+  retire_entry( victim );
+
   return true;
 }
 
 
+static bool
+add_slab_chunk( struct fdb *fdb ) {
+  assert( fdb != NULL );
+
+  struct fdb_entry *chunk = malloc( sizeof( struct fdb_entry ) * FDB_SLAB_CHUNK_ENTRIES );
+  struct fdb_entry **chunks = realloc( fdb->chunks, sizeof( struct fdb_entry * ) * ( fdb->n_chunks + 1 ) );
+  if ( chunk == NULL || chunks == NULL ) {
+    error( "Failed to allocate a forwarding database chunk ( n_chunks = %u ).", fdb->n_chunks );
+    if ( chunk != NULL ) {
+      free( chunk );
+    }
+    if ( chunks != NULL ) {
+      fdb->chunks = chunks;
+    }
+    return false;
+  }
+  memset( chunk, 0, sizeof( struct fdb_entry ) * FDB_SLAB_CHUNK_ENTRIES );
+  fdb->chunks = chunks;
+  fdb->chunks[ fdb->n_chunks++ ] = chunk;
+
+  pthread_mutex_lock( &fdb->slab_mutex );
+  for ( int i = FDB_SLAB_CHUNK_ENTRIES - 1; i >= 0; i-- ) {
+    chunk[ i ].next_free = fdb->free_entries;
+    fdb->free_entries = &chunk[ i ];
+  }
+  pthread_mutex_unlock( &fdb->slab_mutex );
+
+  return true;
+}
+
+
+static struct fdb_entry *
+allocate_entry( struct fdb *fdb ) {
+  assert( fdb != NULL );
+
+  if ( ( uint32_t ) fdb->fdb.count >= fdb->max_entries && !evict_entry( fdb ) ) {
+    return NULL;
+  }
+
+  pthread_mutex_lock( &fdb->slab_mutex );
+  struct fdb_entry *entry = fdb->free_entries;
+  if ( entry != NULL ) {
+    fdb->free_entries = entry->next_free;
+  }
+  pthread_mutex_unlock( &fdb->slab_mutex );
+
+  if ( entry == NULL ) {
+    if ( !add_slab_chunk( fdb ) ) {
+      return NULL;
+    }
+    pthread_mutex_lock( &fdb->slab_mutex );
+    entry = fdb->free_entries;
+    fdb->free_entries = entry->next_free;
+    pthread_mutex_unlock( &fdb->slab_mutex );
+  }
+
+  memset( entry, 0, sizeof( struct fdb_entry ) );
+  entry->fdb = fdb;
+  entry->last_seen = __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED );
+  entry->created_at = entry->last_seen;
+
+  return entry;
+}
+
+
 static void
-append_to_garbage_list( struct fdb *fdb, struct fdb_entry *entry ) {
+free_entry( struct fdb_entry *entry ) {
+  assert( entry != NULL );
+  assert( entry->fdb != NULL );
+
+  // Never published, so it can go back to the slab immediately.
+  pthread_mutex_lock( &entry->fdb->slab_mutex );
+  entry->next_free = entry->fdb->free_entries;
+  entry->fdb->free_entries = entry;
+  pthread_mutex_unlock( &entry->fdb->slab_mutex );
+}
+
+
+static time_t
+get_aging_time( struct fdb_entry *entry ) {
+  assert( entry != NULL );
+  assert( entry->fdb != NULL );
+
+  if ( entry->type == FDB_ENTRY_TYPE_DYNAMIC ) {
+    return entry->fdb->aging_time;
+  }
+
+  return ( time_t ) entry->aging_time;
+}
+
+
+static void
+schedule_entry( struct fdb_entry *entry ) {
+  assert( entry != NULL );
+
+  time_t aging_time = get_aging_time( entry );
+  if ( aging_time > 0 ) {
+    time_t last_seen = ( time_t ) __atomic_load_n( &entry->last_seen, __ATOMIC_RELAXED );
+    add_timer_wheel_entry( &aging_wheel, &entry->timer, last_seen + aging_time );
+  }
+  else {
+    delete_timer_wheel_entry( &entry->timer );
+  }
+}
+
+
+static bool
+link_entry( struct fdb *fdb, struct fdb_entry *entry ) {
   assert( fdb != NULL );
-  assert( fdb->garbage != NULL );
   assert( entry != NULL );
 
-  now( &entry->deleted_at );
-  append_to_tail( fdb->garbage, entry );
+  int ret = insert_hash( &fdb->fdb, entry, entry->mac );
+  if ( ret != 1 ) {
+    return false;
+  }
+  entry->flags |= FDB_ENTRY_FLAG_LINKED;
+  schedule_entry( entry );
+  PROBE4( vxland, fdb_insert, fdb, entry->mac, entry->vtep_addr.s_addr, entry->type );
+
+  return true;
 }
 
 
-void *
-fdb_decrease_ttl_thread( void *param ) {
-  assert( param != NULL );
+static void
+expire_entry( struct timer_wheel_entry *timer, void *user_data ) {
+  assert( timer != NULL );
+  assert( user_data != NULL );
+
+  struct fdb_entry *entry = ( struct fdb_entry * ) ( ( char * ) timer - offsetof( struct fdb_entry, timer ) );
+  list *expired = user_data;
+
+  time_t aging_time = get_aging_time( entry );
+  if ( aging_time <= 0 ) {
+    return;
+  }
+
+  // Refreshed entries are rescheduled rather than touched on every packet.
+  time_t expires = ( time_t ) __atomic_load_n( &entry->last_seen, __ATOMIC_RELAXED ) + aging_time;
+  if ( expires > ( time_t ) fdb_clock ) {
+    add_timer_wheel_entry( &aging_wheel, &entry->timer, expires );
+    return;
+  }
+
+  void *deleted = delete_hash( &entry->fdb->fdb, entry->mac );
+  assert( deleted == entry );
+  entry->flags &= ( uint8_t ) ~FDB_ENTRY_FLAG_LINKED;
+  PROBE3( vxland, fdb_expire, entry->fdb, entry->mac, entry->vtep_addr.s_addr );
+  append_to_tail( expired, deleted );
+}
+
 
-  struct fdb *fdb = ( struct fdb * ) param;
-  struct hash *hash = &fdb->fdb;
+static void *
+age_entries( void *param ) {
+  UNUSED( param );
 
   while ( running ) {
-    for ( int n = 0; n < HASH_TABLE_SIZE; n++ ) {
-      pthread_mutex_lock( &hash->mutex[ n ] );
-      struct hashnode *prev = &hash->table[ n ];
-      for ( struct hashnode *ptr = hash->table[ n ].next; ptr != NULL; ptr = ptr->next ) {
-        struct fdb_entry *entry = ( struct fdb_entry * ) ptr->data;
-        if ( entry->ttl >= 0 ) {
-          entry->ttl -= fdb->sleep_seconds;
-          if ( entry->ttl <= 0 ) {
-            prev->next = ptr->next;
-            free( ptr->key );
-            free( ptr );
-            append_to_garbage_list( fdb, entry );
-            ptr = prev;
-            fdb->fdb.count--;
-          }
-          else {
-            prev = ptr;
-          }
-        }
-        else {
-          prev = ptr;
-        }
-      }
-      pthread_mutex_unlock( &hash->mutex[ n ] );
-    }
-    // FIXME: use timerfd instead of sleep
-    sleep( ( unsigned int ) fdb->sleep_seconds );
+    struct timespec req = { 1, 0 };
+    nanosleep( &req, NULL );
+
+    int state = PTHREAD_CANCEL_ENABLE;
+    pthread_setcancelstate( PTHREAD_CANCEL_DISABLE, &state );
+
+    list *expired = create_list();
+    pthread_mutex_lock( &aging_mutex );
+    __atomic_store_n( &fdb_clock, coarse_now(), __ATOMIC_RELAXED );
+    advance_timer_wheel( &aging_wheel, ( time_t ) fdb_clock, expire_entry, expired );
+    // Entries are unreachable from the table by now. They are retired before
+    // the lock is released so that destroy_fdb() cannot free the FDB while
+    // expired entries are not counted as retiring yet.
+    retire_entries( expired );
+    pthread_mutex_unlock( &aging_mutex );
+
+    pthread_setcancelstate( state, NULL );
   }
 
   return NULL;
 }
 
 
-static void
-fdb_decrease_ttl_thread_init( struct fdb *fdb ) {
-  assert( fdb != NULL );
+bool
+init_fdb_aging() {
+  fdb_clock = coarse_now();
+  init_timer_wheel( &aging_wheel, ( time_t ) fdb_clock );
 
   pthread_attr_t attr;
-
   pthread_attr_init( &attr );
   int ret = pthread_attr_setstacksize( &attr, 128 * 1024 );
   if ( ret != 0 ) {
-    critical( "Failed to set stack size for a FDB management thread." );
+    error( "Failed to set stack size for a FDB aging thread." );
+    return false;
   }
-  ret = pthread_create( &fdb->decrease_ttl_t, &attr, fdb_decrease_ttl_thread, fdb );
+  ret = pthread_create( &aging_thread, &attr, age_entries, NULL );
   if ( ret != 0 ) {
-    critical( "Failed to create a FDB management thread." );
+    error( "Failed to create a FDB aging thread." );
+    return false;
   }
+  pthread_setname_np( aging_thread, "fdb_aging" );
+  aging_thread_started = true;
+
+  return true;
 }
 
 
-static void
-set_sleep_seconds( struct fdb *fdb ) {
-  assert( fdb != NULL );
-
-  fdb->sleep_seconds = fdb->aging_time / 10;
-  if ( fdb->sleep_seconds <= 0 ) {
-    fdb->sleep_seconds = 1;
+bool
+finalize_fdb_aging() {
+  if ( !aging_thread_started ) {
+    return true;
   }
-  else if ( fdb->sleep_seconds > 10 ) {
-    fdb->sleep_seconds = 10;
+
+  void *retval = NULL;
+  if ( pthread_tryjoin_np( aging_thread, &retval ) == EBUSY ) {
+    pthread_cancel( aging_thread );
+    while ( pthread_tryjoin_np( aging_thread, &retval ) == EBUSY ) {
+      struct timespec req = { 0, 50000000 };
+      nanosleep( &req, NULL );
+    }
   }
+  aging_thread_started = false;
+
+  return true;
 }
 
 
 struct fdb *
-init_fdb( time_t aging_time ) {
+init_fdb( time_t aging_time, uint32_t max_entries ) {
   struct fdb *fdb = ( struct fdb * ) malloc( sizeof( struct fdb ) );
-  init_hash( &fdb->fdb, 6 );
-  fdb->garbage = create_list();
-  fdb->aging_time = aging_time;
-  if ( aging_time > 0 ) {
-    set_sleep_seconds( fdb );
-    fdb_decrease_ttl_thread_init( fdb );
-  }
+  memset( fdb, 0, sizeof( struct fdb ) );
+  init_hash( &fdb->fdb, ETH_ALEN );
+  set_hash_table_release_function( &fdb->fdb, retire_memory );
+  fdb->aging_time = aging_time > 0 ? aging_time : 0;
+  fdb->max_entries = max_entries;
+  pthread_mutex_init( &fdb->slab_mutex, NULL );
 
   return fdb;
 }
 
 
-static void
-terminate_decrease_ttl_thread( struct fdb *fdb ) {
-  assert( fdb != NULL );
+struct fdb_type_filter {
+  list *deleted;
+  uint8_t type;
+};
 
-  void *retval = NULL;
-  if ( pthread_tryjoin_np( fdb->decrease_ttl_t, &retval ) == EBUSY ) {
-    pthread_cancel( fdb->decrease_ttl_t );
-    while ( pthread_tryjoin_np( fdb->decrease_ttl_t, &retval ) == EBUSY ) {
-      struct timespec req = { 0, 50000000 };
-      nanosleep( &req, NULL );
-    }
+
+static bool
+delete_entry_by_type( void *data, void *user_data ) {
+  struct fdb_entry *entry = data;
+  struct fdb_type_filter *filter = user_data;
+
+  if ( ( entry->type & filter->type ) == 0 ) {
+    return false;
   }
+
+  unlink_entry( entry );
+  append_to_tail( filter->deleted, entry );
+
+  return true;
 }
 
 
@@ -178,38 +439,45 @@ void
 destroy_fdb( struct fdb *fdb ) {
   assert( fdb != NULL );
 
-  if ( fdb->aging_time > 0 ) {
-    terminate_decrease_ttl_thread( fdb );
-  }
-
+  fdb_delete_all_entries( fdb, FDB_ENTRY_TYPE_ALL );
   destroy_hash( &fdb->fdb );
-  delete_list_totally( fdb->garbage );
+
+  // Retired entries still point to the FDB, so the last one frees it.
+  pthread_mutex_lock( &fdb->slab_mutex );
+  fdb->destroyed = true;
+  bool release = ( fdb->n_retiring == 0 ) ? true : false;
+  pthread_mutex_unlock( &fdb->slab_mutex );
+
+  if ( release ) {
+    free_fdb( fdb );
+  }
 }
 
 
 bool
-fdb_add_entry( struct fdb *fdb, uint8_t *mac, struct sockaddr_in vtep_addr ) {
+fdb_add_entry( struct fdb *fdb, uint8_t *mac, struct in_addr vtep_addr ) {
   assert( fdb != NULL );
   assert( mac != NULL );
 
-  struct fdb_entry *entry = malloc( sizeof( struct fdb_entry ) );
-  memset( entry, 0, sizeof( struct fdb_entry ) );
+  pthread_mutex_lock( &aging_mutex );
 
-  entry->vtep_addr = vtep_addr;
-  if ( fdb->aging_time > 0 ) {
-    entry->ttl = fdb->aging_time;
-  }
-  else {
-    entry->ttl = -1;
+  struct fdb_entry *entry = allocate_entry( fdb );
+  if ( entry == NULL ) {
+    pthread_mutex_unlock( &aging_mutex );
+    return false;
   }
   memcpy( entry->mac, mac, ETH_ALEN );
+  entry->vtep_addr = vtep_addr;
+  entry->type = FDB_ENTRY_TYPE_DYNAMIC;
 
-  now( &entry->created_at );
+  bool ret = link_entry( fdb, entry );
+  if ( !ret ) {
+    free_entry( entry );
+  }
 
-  entry->type = FDB_ENTRY_TYPE_DYNAMIC;
+  pthread_mutex_unlock( &aging_mutex );
 
-  int ret = insert_hash( &fdb->fdb, entry, mac );
-  return ( ret == 1 ) ? true : false;
+  return ret;
 }
 
 
@@ -217,31 +485,32 @@ bool
 fdb_add_static_entry( struct fdb *fdb, struct ether_addr eth_addr, struct in_addr ip_addr, time_t aging_time ) {
   assert( fdb != NULL );
 
-  fdb_delete_entry( fdb, eth_addr );
+  pthread_mutex_lock( &aging_mutex );
 
-  struct fdb_entry *entry = malloc( sizeof( struct fdb_entry ) );
-  memset( entry, 0, sizeof( struct fdb_entry ) );
-
-  entry->vtep_addr.sin_addr = ip_addr;
-  if ( aging_time > 0 ) {
-    entry->ttl = aging_time;
+  struct fdb_entry *deleted = delete_hash( &fdb->fdb, eth_addr.ether_addr_octet );
+  if ( deleted != NULL ) {
+    unlink_entry( deleted );
+    retire_entry( deleted );
   }
-  else {
-    entry->ttl = -1;
+
+  struct fdb_entry *entry = allocate_entry( fdb );
+  if ( entry == NULL ) {
+    pthread_mutex_unlock( &aging_mutex );
+    return false;
   }
   memcpy( entry->mac, eth_addr.ether_addr_octet, ETH_ALEN );
-
-  now( &entry->created_at );
-
+  entry->vtep_addr = ip_addr;
+  entry->aging_time = aging_time > 0 ? ( uint32_t ) aging_time : 0;
   entry->type = FDB_ENTRY_TYPE_STATIC;
 
-  int ret = insert_hash( &fdb->fdb, entry, eth_addr.ether_addr_octet );
-  if ( ret != 1 ) {
-    free( entry );
-    return false;
+  bool ret = link_entry( fdb, entry );
+  if ( !ret ) {
+    free_entry( entry );
   }
 
-  return true;
+  pthread_mutex_unlock( &aging_mutex );
+
+  return ret;
 }
 
 
@@ -249,9 +518,15 @@ bool
 fdb_delete_entry( struct fdb *fdb, struct ether_addr eth_addr ) {
   assert( fdb != NULL );
 
+  pthread_mutex_lock( &aging_mutex );
   struct fdb_entry *deleted = delete_hash( &fdb->fdb, eth_addr.ether_addr_octet );
   if ( deleted != NULL ) {
-    append_to_garbage_list( fdb, deleted );
+    unlink_entry( deleted );
+  }
+  pthread_mutex_unlock( &aging_mutex );
+
+  if ( deleted != NULL ) {
+    retire_entry( deleted );
   }
 
   return ( deleted != NULL ) ? true : false;
@@ -262,26 +537,11 @@ bool
 fdb_delete_all_entries( struct fdb *fdb, uint8_t type ) {
   assert( fdb != NULL );
 
-  struct hash *hash = &fdb->fdb;
-  for ( int n = 0; n < HASH_TABLE_SIZE; n++ ) {
-    pthread_mutex_lock( &hash->mutex[ n ] );
-    struct hashnode *prev = &hash->table[ n ];
-    for ( struct hashnode *ptr = hash->table[ n ].next; ptr != NULL; ptr = ptr->next ) {
-      struct fdb_entry *entry = ( struct fdb_entry * ) ptr->data;
-      if ( entry->type & type ) {
-        prev->next = ptr->next;
-        free( ptr->key );
-        free( ptr );
-        append_to_garbage_list( fdb, entry );
-        ptr = prev;
-        fdb->fdb.count--;
-      }
-      else {
-        prev = ptr;
-      }
-    }
-    pthread_mutex_unlock( &hash->mutex[ n ] );
-  }
+  struct fdb_type_filter filter = { create_list(), type };
+  pthread_mutex_lock( &aging_mutex );
+  delete_hash_if( &fdb->fdb, delete_entry_by_type, &filter );
+  pthread_mutex_unlock( &aging_mutex );
+  retire_entries( filter.deleted );
 
   return true;
 }
@@ -292,7 +552,18 @@ fdb_search_entry( struct fdb *fdb, uint8_t *mac ) {
   assert( fdb != NULL );
   assert( mac != NULL );
 
-  return search_hash( &fdb->fdb, mac );
+  return search_hash_lockless( &fdb->fdb, mac );
+}
+
+
+static void
+reschedule_dynamic_entry( void *data, void *user_data ) {
+  struct fdb_entry *entry = data;
+  UNUSED( user_data );
+
+  if ( entry->type == FDB_ENTRY_TYPE_DYNAMIC ) {
+    schedule_entry( entry );
+  }
 }
 
 
@@ -300,120 +571,110 @@ bool
 set_aging_time( struct fdb *fdb, time_t aging_time ) {
   assert( fdb != NULL );
 
-  if ( fdb->aging_time <= 0 && aging_time > 0 ) {
-    fdb->aging_time = aging_time;
-    set_sleep_seconds( fdb );
-    fdb_decrease_ttl_thread_init( fdb );
-  }
-  else if ( fdb->aging_time > 0 && aging_time > 0 ) {
-    time_t old_aging_time = fdb->aging_time;
-    if ( old_aging_time > aging_time ) {
-      time_t diff = old_aging_time - aging_time;
-      struct hash *hash = &fdb->fdb;
-      for ( int n = 0; n < HASH_TABLE_SIZE; n++ ) {
-        pthread_mutex_lock( &hash->mutex[ n ] );
-        struct hashnode *prev = &hash->table[ n ];
-        for ( struct hashnode *ptr = hash->table[ n ].next; ptr != NULL; ptr = ptr->next ) {
-          struct fdb_entry *entry = ( struct fdb_entry * ) ptr->data;
-          entry->ttl -= diff;
-          if ( entry->ttl <= 0 ) {
-            prev->next = ptr->next;
-            free( ptr->key );
-            free( ptr );
-            append_to_garbage_list( fdb, entry );
-            ptr = prev;
-            fdb->fdb.count--;
-          }
-          else {
-            prev = ptr;
-          }
-        }
-        pthread_mutex_unlock( &hash->mutex[ n ] );
-      }
-    }
-    else if ( old_aging_time < aging_time ) {
-      time_t diff = aging_time - old_aging_time;
-      struct hash *hash = &fdb->fdb;
-      for ( int n = 0; n < HASH_TABLE_SIZE; n++ ) {
-        pthread_mutex_lock( &hash->mutex[ n ] );
-        for ( struct hashnode *ptr = hash->table[ n ].next; ptr != NULL; ptr = ptr->next ) {
-          struct fdb_entry *entry = ( struct fdb_entry * ) ptr->data;
-          entry->ttl += diff;
-        }
-        pthread_mutex_unlock( &hash->mutex[ n ] );
-      }
-    }
-    fdb->aging_time = aging_time;
-    set_sleep_seconds( fdb );
-  }
-  else if ( fdb->aging_time > 0 && aging_time <= 0 ) {
-    fdb->aging_time = 0;
-    terminate_decrease_ttl_thread( fdb );
+  if ( aging_time < 0 ) {
+    aging_time = 0;
   }
-  else {
+
+  pthread_mutex_lock( &aging_mutex );
+
+  time_t old_aging_time = fdb->aging_time;
+  if ( old_aging_time <= 0 && aging_time <= 0 ) {
+    pthread_mutex_unlock( &aging_mutex );
     return false;
   }
 
+  fdb->aging_time = aging_time;
+  // Timers that fire too early are simply rescheduled, so dynamic entries only
+  // need to be revisited when the aging time gets shorter or aging is toggled.
+  if ( old_aging_time <= 0 || aging_time <= 0 || aging_time < old_aging_time ) {
+    foreach_hash( &fdb->fdb, reschedule_dynamic_entry, NULL );
+  }
+
+  pthread_mutex_unlock( &aging_mutex );
+
   return true;
 }
 
 
-list *
-get_fdb_entries( struct fdb *fdb ) {
+bool
+set_max_fdb_entries( struct fdb *fdb, uint32_t max_entries ) {
   assert( fdb != NULL );
 
-  list *entries = create_list();
-  assert( entries != NULL );
-  int n_entries = 0;
-  struct hash *hash = &fdb->fdb;
-  for ( int n = 0; n < HASH_TABLE_SIZE; n++ ) {
-    pthread_mutex_lock( &hash->mutex[ n ] );
-    for ( struct hashnode *ptr = hash->table[ n ].next; ptr != NULL; ptr = ptr->next ) {
-      struct fdb_entry *entry = malloc( sizeof( struct fdb_entry ) );
-      assert( entry != NULL );
-      memcpy( entry, ptr->data, sizeof( struct fdb_entry ) );
-      append_to_tail( entries, entry );
-      n_entries++;
+  pthread_mutex_lock( &aging_mutex );
+  fdb->max_entries = max_entries;
+  while ( ( uint32_t ) fdb->fdb.count > fdb->max_entries ) {
+    if ( !evict_entry( fdb ) ) {
+      break;
     }
-    pthread_mutex_unlock( &hash->mutex[ n ] );
   }
+  pthread_mutex_unlock( &aging_mutex );
 
-  if ( n_entries == 0 ) {
-    delete_list( entries );
-    return NULL;
-  }
-
-  return entries;
+  return true;
 }
 
 
 void
-fdb_collect_garbage( struct fdb *fdb ) {
+get_fdb_stats( struct fdb *fdb, struct fdb_stats *stats ) {
   assert( fdb != NULL );
-  assert( fdb->garbage != NULL );
+  assert( stats != NULL );
+
+  pthread_mutex_lock( &aging_mutex );
+  stats->n_entries = ( uint32_t ) fdb->fdb.count;
+  stats->max_entries = fdb->max_entries;
+  stats->n_evictions = fdb->n_evictions;
+  stats->memory_usage = sizeof( struct fdb );
+  stats->memory_usage += ( uint64_t ) fdb->n_chunks * ( sizeof( struct fdb_entry * ) +
+                                                        sizeof( struct fdb_entry ) * FDB_SLAB_CHUNK_ENTRIES );
+  stats->memory_usage += get_hash_memory_usage( &fdb->fdb );
+  pthread_mutex_unlock( &aging_mutex );
+}
 
-  if ( fdb->garbage->head == NULL ) {
-    return;
+
+struct entry_array {
+  struct fdb_entry *entries;
+  int n_entries;
+  int size;
+};
+
+
+static void
+copy_entry( void *data, void *user_data ) {
+  struct entry_array *array = user_data;
+
+  if ( array->n_entries == array->size ) {
+    array->size = array->size > 0 ? array->size * 2 : 64;
+    array->entries = realloc( array->entries, sizeof( struct fdb_entry ) * ( size_t ) array->size );
+    assert( array->entries != NULL );
   }
+  struct fdb_entry *entry = &array->entries[ array->n_entries++ ];
+  memcpy( entry, data, sizeof( struct fdb_entry ) );
+  entry->aging_time = ( uint32_t ) get_aging_time( data );
+  entry->fdb = NULL;
+  memset( &entry->timer, 0, sizeof( entry->timer ) );
+}
 
-  pthread_mutex_lock( &fdb->garbage->mutex );
 
-  struct timespec diff = { 0, 0 };
-  now( &diff );
+// Copies all entries into a single array so that the table is held only
+// while copying. Returns NULL if there is no entry.
+struct fdb_entry *
+get_fdb_entries( struct fdb *fdb, int *n_entries ) {
+  assert( fdb != NULL );
+  assert( n_entries != NULL );
 
-  for ( int i = 0; i < 256 && fdb->garbage->head != NULL; i++ ) {
-    struct fdb_entry *entry = fdb->garbage->head->data;
-    SUB_TIMESPEC( &diff, &entry->deleted_at, &diff );
-    if ( diff.tv_sec < 2 ) {
-      break;
-    }
-    list_element *delete_me = fdb->garbage->head;
-    fdb->garbage->head = delete_me->next;
-    free( delete_me->data );
-    free( delete_me );
+  struct entry_array array = { NULL, 0, ( int ) fdb->fdb.count };
+  if ( array.size > 0 ) {
+    array.entries = malloc( sizeof( struct fdb_entry ) * ( size_t ) array.size );
+    assert( array.entries != NULL );
+  }
+  foreach_hash( &fdb->fdb, copy_entry, &array );
+
+  *n_entries = array.n_entries;
+  if ( array.n_entries == 0 && array.entries != NULL ) {
+    free( array.entries );
+    return NULL;
   }
 
-  pthread_mutex_unlock( &fdb->garbage->mutex );
+  return array.entries;
 }
 
 
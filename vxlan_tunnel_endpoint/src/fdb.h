@@ -27,6 +27,7 @@
 #include <net/ethernet.h>
 #include "hash.h"
 #include "linked_list.h"
+#include "timer_wheel.h"
 
 
 enum {
@@ -35,35 +36,80 @@ enum {
   FDB_ENTRY_TYPE_ALL = 0x03,
 };
 
+enum {
+  FDB_ENTRY_FLAG_LINKED = 0x01,
+};
+
+
+#define FDB_SLAB_CHUNK_ENTRIES 256
+#define FDB_EVICTION_SAMPLES 16
+
+
+struct fdb;
 
 struct fdb_entry {
   uint8_t mac[ ETH_ALEN ];
-  struct sockaddr_in vtep_addr;
-  time_t ttl;
-  struct timespec created_at;
-  struct timespec deleted_at;
   uint8_t type;
+  uint8_t flags;
+  struct in_addr vtep_addr;
+  uint32_t last_seen;
+  uint32_t created_at;
+  uint32_t aging_time;
+  struct fdb *fdb;
+  union {
+    struct timer_wheel_entry timer;
+    struct fdb_entry *next_free;
+  };
 };
 
 struct fdb {
   struct hash fdb;
   time_t aging_time;
-  time_t sleep_seconds;
-  list *garbage;
-  pthread_t decrease_ttl_t;
+  uint32_t max_entries;
+  uint64_t n_evictions;
+  struct fdb_entry **chunks;
+  uint32_t n_chunks;
+  uint32_t eviction_hand;
+  struct fdb_entry *free_entries;
+  uint32_t n_retiring;
+  bool destroyed;
+  pthread_mutex_t slab_mutex;
 };
 
+struct fdb_stats {
+  uint32_t n_entries;
+  uint32_t max_entries;
+  uint64_t n_evictions;
+  uint64_t memory_usage;
+};
+
+
+// Seconds on CLOCK_MONOTONIC_COARSE, advanced by the aging thread.
+extern uint32_t fdb_clock;
+
+
+static inline void
+refresh_fdb_entry( struct fdb_entry *entry ) {
+  uint32_t now = __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED );
+  if ( __atomic_load_n( &entry->last_seen, __ATOMIC_RELAXED ) != now ) {
+    __atomic_store_n( &entry->last_seen, now, __ATOMIC_RELAXED );
+  }
+}
+
 
-struct fdb *init_fdb( time_t aging_time );
+bool init_fdb_aging();
+bool finalize_fdb_aging();
+struct fdb *init_fdb( time_t aging_time, uint32_t max_entries );
 void destroy_fdb( struct fdb *fdb );
-bool fdb_add_entry( struct fdb *fdb, uint8_t *mac, struct sockaddr_in vtep_addr );
+bool fdb_add_entry( struct fdb *fdb, uint8_t *mac, struct in_addr vtep_addr );
 bool fdb_add_static_entry( struct fdb *fdb, struct ether_addr eth_addr, struct in_addr ip_addr, time_t aging_time );
 bool fdb_delete_entry( struct fdb *fdb, struct ether_addr eth_addr );
 bool fdb_delete_all_entries( struct fdb *fdb, uint8_t type );
 struct fdb_entry *fdb_search_entry( struct fdb *fdb, uint8_t *mac );
 bool set_aging_time( struct fdb *fdb, time_t aging_time );
-list *get_fdb_entries( struct fdb *fdb );
-void fdb_collect_garbage( struct fdb *fdb );
+bool set_max_fdb_entries( struct fdb *fdb, uint32_t max_entries );
+void get_fdb_stats( struct fdb *fdb, struct fdb_stats *stats );
+struct fdb_entry *get_fdb_entries( struct fdb *fdb, int *n_entries );
 
 
 #endif // FDB_H
@@ -17,72 +17,285 @@
  */
 
 
+/*
+ * Open addressing hash table with linear probing. Keys up to
+ * HASH_MAX_KEY_LENGTH bytes are stored inline in slots together with
+ * their hash values, so a lookup usually touches a single cache line.
+ * Deleted slots are marked as tombstones and cleaned up on resize.
+ *
+ * A table grows (or shrinks) incrementally. A new table is allocated
+ * and the old one is migrated a few slots at a time by every following
+ * insertion or deletion, while lookups search both tables.
+ */
+
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+#include "checks.h"
 #include "hash.h"
 
 
-void
-init_hash( struct hash *hash, int keylen ) {
-  assert( hash != NULL );
+#define HASH_INITIAL_SIZE 64
+#define HASH_MIGRATION_STEP 64
+#define HASH_SLOT_EMPTY 0
+#define HASH_SLOT_DELETED 1
+#define HASH_SLOT_IN_USE 0x8000000000000000ULL
 
-  memset( hash, 0, sizeof( struct hash ) );
-  for ( int n = 0; n < HASH_TABLE_SIZE; n++ ) {
-    hash->table[ n ].data = NULL;
-    hash->table[ n ].next = NULL;
-    pthread_mutex_init( &hash->mutex[ n ], NULL );
+
+static uint64_t
+mix( uint64_t value ) {
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53ULL;
+  value ^= value >> 33;
+
+  return value;
+}
+
+
+static uint64_t
+generate_seed() {
+  uint64_t seed = 0;
+  if ( getrandom( &seed, sizeof( seed ), GRND_NONBLOCK ) != sizeof( seed ) ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    seed = ( uint64_t ) ts.tv_nsec ^ ( ( uint64_t ) ts.tv_sec << 32 ) ^ ( uint64_t ) getpid();
   }
 
-  hash->keylen = keylen;
-  hash->count = 0;
+  return mix( seed );
 }
 
 
-int
-calculate_hash( void *key, int keylen ) {
-  assert( key != NULL );
-  assert( keylen > 0 );
+static void
+load_key( const struct hash *hash, const void *key, uint64_t *words ) {
+  const uint8_t *bytes = key;
 
-  if ( key == NULL ) {
-    return -1;
+  words[ 0 ] = 0;
+  words[ 1 ] = 0;
+
+  switch ( hash->keylen ) {
+    case 3:
+    {
+      words[ 0 ] = ( uint64_t ) bytes[ 0 ] | ( uint64_t ) bytes[ 1 ] << 8 | ( uint64_t ) bytes[ 2 ] << 16;
+    }
+    break;
+
+    case 4:
+    {
+      uint32_t value;
+      memcpy( &value, bytes, sizeof( value ) );
+      words[ 0 ] = value;
+    }
+    break;
+
+    case 6:
+    {
+      uint32_t low;
+      uint16_t high;
+      memcpy( &low, bytes, sizeof( low ) );
+      memcpy( &high, bytes + sizeof( low ), sizeof( high ) );
+      words[ 0 ] = ( uint64_t ) low | ( uint64_t ) high << 32;
+    }
+    break;
+
+    default:
+    {
+      memcpy( words, bytes, ( size_t ) hash->keylen );
+    }
+    break;
   }
+}
+
 
-  uint32_t sum = 0;
-  uint8_t *buf = ( uint8_t * ) key;
-  for ( int len = keylen; len > 0; len-- ) {
-    sum += *buf;
-    buf++;
+static uint64_t
+calculate_hash( const struct hash *hash, const uint64_t *words ) {
+  uint64_t value = mix( hash->seed ^ words[ 0 ] );
+  if ( hash->keylen > ( int ) sizeof( uint64_t ) ) {
+    value = mix( value ^ words[ 1 ] );
   }
 
-  return sum % HASH_TABLE_SIZE;
+  return value | HASH_SLOT_IN_USE;
 }
 
 
-int
-compare_key( void *key1, void *key2, int keylen ) {
-  assert( key1 != NULL );
-  assert( key2 != NULL );
-  assert( keylen > 0 );
+static struct hash_slot *
+find_slot( struct hash_table *table, uint64_t hash_value, const uint64_t *words ) {
+  if ( table == NULL ) {
+    return NULL;
+  }
 
-  uint8_t *kb1 = ( uint8_t * ) key1;
-  uint8_t *kb2 = ( uint8_t * ) key2;
+  uint32_t mask = table->size - 1;
+  uint32_t i = ( uint32_t ) hash_value & mask;
+  // Bounded so that a lockless reader racing with a writer always terminates.
+  for ( uint32_t n = 0; n < table->size; n++, i = ( i + 1 ) & mask ) {
+    struct hash_slot *slot = &table->slots[ i ];
+    uint64_t slot_hash = __atomic_load_n( &slot->hash, __ATOMIC_RELAXED );
+    if ( slot_hash == HASH_SLOT_EMPTY ) {
+      return NULL;
+    }
+    if ( slot_hash == hash_value && slot->key[ 0 ] == words[ 0 ] && slot->key[ 1 ] == words[ 1 ] ) {
+      return slot;
+    }
+  }
 
-  if ( ( key1 == NULL ) || ( key2 == NULL ) ) {
-    return -1;
+  return NULL;
+}
+
+
+static void
+put_slot( struct hash_table *table, uint64_t hash_value, const uint64_t *words, void *data ) {
+  assert( table != NULL );
+  assert( table->used < table->size - 1 );
+
+  uint32_t mask = table->size - 1;
+  uint32_t i = ( uint32_t ) hash_value & mask;
+  while ( table->slots[ i ].hash & HASH_SLOT_IN_USE ) {
+    i = ( i + 1 ) & mask;
   }
 
-  for ( int i = 0; i < keylen; i++ ) {
-    if ( *kb1 != *kb2 ) {
-      return -1;
+  struct hash_slot *slot = &table->slots[ i ];
+  if ( slot->hash == HASH_SLOT_EMPTY ) {
+    table->used++;
+  }
+  slot->key[ 0 ] = words[ 0 ];
+  slot->key[ 1 ] = words[ 1 ];
+  slot->data = data;
+  __atomic_store_n( &slot->hash, hash_value, __ATOMIC_RELEASE );
+  table->count++;
+}
+
+
+static void
+clear_slot( struct hash_table *table, struct hash_slot *slot ) {
+  uint32_t next = ( uint32_t ) ( ( slot - table->slots ) + 1 ) & ( table->size - 1 );
+  if ( table->slots[ next ].hash == HASH_SLOT_EMPTY ) {
+    // Nothing probes past this slot, so it can be emptied instead of being marked.
+    __atomic_store_n( &slot->hash, HASH_SLOT_EMPTY, __ATOMIC_RELEASE );
+    table->used--;
+  }
+  else {
+    __atomic_store_n( &slot->hash, HASH_SLOT_DELETED, __ATOMIC_RELEASE );
+  }
+  slot->data = NULL;
+  table->count--;
+}
+
+
+/*
+ * Writers bump the sequence number to an odd value before modifying
+ * slots or tables and back to an even value afterwards. Lockless
+ * readers retry if the sequence number changed under them.
+ */
+static void
+begin_update( struct hash *hash ) {
+  __atomic_store_n( &hash->sequence, hash->sequence + 1, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+
+static void
+end_update( struct hash *hash ) {
+  __atomic_store_n( &hash->sequence, hash->sequence + 1, __ATOMIC_RELEASE );
+}
+
+
+static void
+release_table( struct hash *hash, struct hash_table *table ) {
+  if ( table == NULL ) {
+    return;
+  }
+
+  if ( hash->table_release_function != NULL ) {
+    hash->table_release_function( table );
+  }
+  else {
+    free( table );
+  }
+}
+
+
+static struct hash_table *
+allocate_table( uint32_t size ) {
+  size_t length = sizeof( struct hash_table ) + sizeof( struct hash_slot ) * size;
+  struct hash_table *table = malloc( length );
+  assert( table != NULL );
+  memset( table, 0, length );
+  table->size = size;
+
+  return table;
+}
+
+
+static void
+migrate( struct hash *hash, uint32_t n_slots ) {
+  struct hash_table *old = hash->old;
+  if ( old == NULL ) {
+    return;
+  }
+
+  for ( ; n_slots > 0 && hash->migrated < old->size; n_slots--, hash->migrated++ ) {
+    struct hash_slot *slot = &old->slots[ hash->migrated ];
+    if ( slot->hash & HASH_SLOT_IN_USE ) {
+      put_slot( hash->current, slot->hash, slot->key, slot->data );
+      __atomic_store_n( &slot->hash, HASH_SLOT_DELETED, __ATOMIC_RELEASE );
+      slot->data = NULL;
+      old->count--;
     }
-    kb1++;
-    kb2++;
   }
 
-  return 0;
+  if ( hash->migrated >= old->size ) {
+    __atomic_store_n( &hash->old, NULL, __ATOMIC_RELEASE );
+    hash->migrated = 0;
+    release_table( hash, old );
+  }
+}
+
+
+static void
+start_resize( struct hash *hash ) {
+  if ( hash->old != NULL ) {
+    migrate( hash, hash->old->size );
+  }
+
+  uint32_t size = HASH_INITIAL_SIZE;
+  while ( size < ( uint32_t ) hash->count * 2 + 2 ) {
+    size *= 2;
+  }
+
+  struct hash_table *table = allocate_table( size );
+  hash->migrated = 0;
+  __atomic_store_n( &hash->old, hash->current, __ATOMIC_RELEASE );
+  __atomic_store_n( &hash->current, table, __ATOMIC_RELEASE );
+}
+
+
+void
+init_hash( struct hash *hash, int keylen ) {
+  assert( hash != NULL );
+  assert( keylen > 0 && keylen <= HASH_MAX_KEY_LENGTH );
+
+  memset( hash, 0, sizeof( struct hash ) );
+  pthread_rwlock_init( &hash->lock, NULL );
+  hash->keylen = keylen;
+  hash->seed = generate_seed();
+  hash->count = 0;
+  hash->table_release_function = NULL;
+
+  hash->current = allocate_table( HASH_INITIAL_SIZE );
+}
+
+
+void
+set_hash_table_release_function( struct hash *hash, void ( *function )( void *ptr ) ) {
+  assert( hash != NULL );
+
+  hash->table_release_function = function;
 }
 
 
@@ -92,33 +305,36 @@ insert_hash( struct hash *hash, void *data, void *key ) {
   assert( data != NULL );
   assert( key != NULL );
 
-  int hash_value = -1;
-  if ( ( hash_value = calculate_hash( key, hash->keylen ) ) < 0 ) {
+  uint64_t words[ 2 ];
+  load_key( hash, key, words );
+  uint64_t hash_value = calculate_hash( hash, words );
+
+  pthread_rwlock_wrlock( &hash->lock );
+
+  if ( find_slot( hash->current, hash_value, words ) != NULL ||
+       find_slot( hash->old, hash_value, words ) != NULL ) {
+    pthread_rwlock_unlock( &hash->lock );
     return -1;
   }
 
-  struct hashnode *prev = &hash->table[ hash_value ];
-  pthread_mutex_lock( &hash->mutex[ hash_value ] );
+  begin_update( hash );
 
-  for ( struct hashnode *ptr = prev->next; ptr != NULL; ptr = ptr->next ) {
-    if ( compare_key( key, ptr->key, hash->keylen ) == 0 ) {
-      pthread_mutex_unlock( &hash->mutex[ hash_value ] );
-      return -1;
-    }
-    prev = ptr;
+  if ( hash->current == NULL ) {
+    start_resize( hash );
+  }
+  migrate( hash, HASH_MIGRATION_STEP );
+  uint32_t pending = ( hash->old != NULL ) ? hash->old->count : 0;
+  if ( ( hash->current->used + pending + 1 ) * 4 > hash->current->size * 3 ) {
+    start_resize( hash );
+    migrate( hash, HASH_MIGRATION_STEP );
   }
 
-  struct hashnode *node = ( struct hashnode * ) malloc( sizeof( struct hashnode ) );
-  memset( node, 0, sizeof( struct hashnode ) );
-  node->next = NULL;
-  node->data = data;
-  node->key = ( uint8_t * ) malloc( ( size_t ) hash->keylen );
-  memcpy( node->key, key, ( size_t ) hash->keylen );
-  prev->next = node;
-
+  put_slot( hash->current, hash_value, words, data );
   hash->count++;
 
-  pthread_mutex_unlock( &hash->mutex[ hash_value ] );
+  end_update( hash );
+
+  pthread_rwlock_unlock( &hash->lock );
 
   return 1;
 }
@@ -129,36 +345,38 @@ delete_hash( struct hash *hash, void *key ) {
   assert( hash != NULL );
   assert( key != NULL );
 
-  int hash_value = -1;
-  if ( ( hash_value = calculate_hash( key, hash->keylen ) ) < 0 ) {
-    return NULL;
-  }
-
-  struct hashnode *prev = &hash->table[ hash_value ];
+  uint64_t words[ 2 ];
+  load_key( hash, key, words );
+  uint64_t hash_value = calculate_hash( hash, words );
 
-  pthread_mutex_lock( &hash->mutex[ hash_value ] );
+  pthread_rwlock_wrlock( &hash->lock );
 
-  struct hashnode *ptr = NULL;
-  for ( ptr = prev->next; ptr != NULL; ptr = ptr->next ) {
-    if ( compare_key( key, ptr->key, hash->keylen ) == 0 ) {
-      break;
-    }
-    prev = ptr;
+  struct hash_table *table = hash->current;
+  struct hash_slot *slot = find_slot( table, hash_value, words );
+  if ( slot == NULL ) {
+    table = hash->old;
+    slot = find_slot( table, hash_value, words );
   }
-
-  if ( ptr == NULL ) {
-    pthread_mutex_unlock( &hash->mutex[ hash_value ] );
+  if ( slot == NULL ) {
+    pthread_rwlock_unlock( &hash->lock );
     return NULL;
   }
 
-  prev->next = ptr->next;
-  void *data = ptr->data;
-  free( ptr->key );
-  free( ptr );
+  begin_update( hash );
 
+  void *data = slot->data;
+  clear_slot( table, slot );
   hash->count--;
 
-  pthread_mutex_unlock( &hash->mutex[ hash_value ] );
+  migrate( hash, HASH_MIGRATION_STEP );
+  if ( hash->old == NULL && hash->current->size > HASH_INITIAL_SIZE &&
+       ( uint32_t ) hash->count * 8 < hash->current->size ) {
+    start_resize( hash );
+  }
+
+  end_update( hash );
+
+  pthread_rwlock_unlock( &hash->lock );
 
   return data;
 }
@@ -169,25 +387,67 @@ search_hash( struct hash *hash, void *key ) {
   assert( hash != NULL );
   assert( key != NULL );
 
-  int hash_value;
-  if ( ( hash_value = calculate_hash( key, hash->keylen ) ) < 0 ) {
-    return NULL;
+  uint64_t words[ 2 ];
+  load_key( hash, key, words );
+  uint64_t hash_value = calculate_hash( hash, words );
+
+  pthread_rwlock_rdlock( &hash->lock );
+
+  struct hash_slot *slot = find_slot( hash->current, hash_value, words );
+  if ( slot == NULL ) {
+    slot = find_slot( hash->old, hash_value, words );
   }
+  void *data = ( slot != NULL ) ? slot->data : NULL;
+
+  pthread_rwlock_unlock( &hash->lock );
+
+  return data;
+}
 
-  struct hashnode *ptr = &hash->table[ hash_value ];
 
-  pthread_mutex_lock( &hash->mutex[ hash_value ] );
+/*
+ * Searches without taking the lock. Tables replaced by writers are handed
+ * to the function set by set_hash_table_release_function(). Data deleted by
+ * writers is not, so callers must defer freeing it until concurrent readers
+ * are done with it (fdb.c and neighbor.c do so through QSBR).
+ */
+void *
+search_hash_lockless( struct hash *hash, void *key ) {
+  assert( hash != NULL );
+  assert( key != NULL );
 
-  for ( ptr = ptr->next; ptr != NULL; ptr = ptr->next ) {
-    if ( compare_key( key, ptr->key, hash->keylen ) == 0 ) {
-      pthread_mutex_unlock( &hash->mutex[ hash_value ] );
-      return ptr->data;
+  uint64_t words[ 2 ];
+  load_key( hash, key, words );
+  uint64_t hash_value = calculate_hash( hash, words );
+
+  while ( true ) {
+    uint32_t sequence = __atomic_load_n( &hash->sequence, __ATOMIC_ACQUIRE );
+    if ( sequence & 1 ) {
+      continue;
+    }
+
+    void *data = NULL;
+    struct hash_slot *slot = find_slot( __atomic_load_n( &hash->current, __ATOMIC_ACQUIRE ), hash_value, words );
+    if ( slot == NULL ) {
+      slot = find_slot( __atomic_load_n( &hash->old, __ATOMIC_ACQUIRE ), hash_value, words );
+    }
+    if ( slot != NULL ) {
+      data = __atomic_load_n( &slot->data, __ATOMIC_RELAXED );
+    }
+
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    if ( __atomic_load_n( &hash->sequence, __ATOMIC_RELAXED ) == sequence ) {
+      return data;
     }
   }
+}
 
-  pthread_mutex_unlock( &hash->mutex[ hash_value ] );
 
-  return NULL;
+static void
+free_data( void *data, void *user_data ) {
+  UNUSED( user_data );
+
+  free( data );
 }
 
 
@@ -195,20 +455,39 @@ void
 destroy_hash( struct hash *hash ) {
   assert( hash != NULL );
 
-  for ( int n = 0; n < HASH_TABLE_SIZE; n++ ) {
-    struct hashnode *ptr = &hash->table[ n ];
-    pthread_mutex_lock( &hash->mutex[ n ] );
-    if ( ptr->next != NULL ) {
-      for ( struct hashnode *pptr = ptr->next; pptr != NULL; ) {
-        struct hashnode *prev = pptr;
-        pptr = pptr->next;
-        free( prev->key );
-        free( prev->data );
-        free( prev );
-      }
+  foreach_hash( hash, free_data, NULL );
+
+  pthread_rwlock_wrlock( &hash->lock );
+  begin_update( hash );
+  struct hash_table *old = hash->old;
+  struct hash_table *current = hash->current;
+  __atomic_store_n( &hash->old, NULL, __ATOMIC_RELEASE );
+  __atomic_store_n( &hash->current, NULL, __ATOMIC_RELEASE );
+  hash->migrated = 0;
+  hash->count = 0;
+  end_update( hash );
+  pthread_rwlock_unlock( &hash->lock );
+
+  release_table( hash, old );
+  release_table( hash, current );
+}
+
+
+size_t
+get_hash_memory_usage( struct hash *hash ) {
+  assert( hash != NULL );
+
+  size_t usage = 0;
+  pthread_rwlock_rdlock( &hash->lock );
+  struct hash_table *tables[] = { hash->current, hash->old };
+  for ( int i = 0; i < 2; i++ ) {
+    if ( tables[ i ] != NULL ) {
+      usage += sizeof( struct hash_table ) + sizeof( struct hash_slot ) * tables[ i ]->size;
     }
-    pthread_mutex_unlock( &hash->mutex[ n ] );
   }
+  pthread_rwlock_unlock( &hash->lock );
+
+  return usage;
 }
 
 
@@ -217,27 +496,78 @@ create_list_from_hash( struct hash *hash, int *num ) {
   assert( hash != NULL );
   assert( num != NULL );
 
+  pthread_rwlock_rdlock( &hash->lock );
+
   void **datalist = ( void ** ) malloc( sizeof( void * ) * ( size_t ) hash->count );
   memset( datalist, 0, sizeof( void * ) * ( size_t ) hash->count );
 
-  for ( int c = 0, n = 0; n < HASH_TABLE_SIZE; n++ ) {
-    struct hashnode *ptr = &hash->table[ n ];
-    pthread_mutex_lock( &hash->mutex[ n ] );
-    if ( ptr->next != NULL ) {
-      for ( struct hashnode *pptr = ptr->next; pptr != NULL; pptr = pptr->next ) {
-        // datalist[ c ] = ( void * ) malloc( sizeof( void * ) );
-        datalist[ c++ ] = pptr->data;
+  int c = 0;
+  struct hash_table *tables[] = { hash->old, hash->current };
+  for ( int t = 0; t < 2; t++ ) {
+    for ( uint32_t i = 0; tables[ t ] != NULL && i < tables[ t ]->size; i++ ) {
+      if ( tables[ t ]->slots[ i ].hash & HASH_SLOT_IN_USE ) {
+        datalist[ c++ ] = tables[ t ]->slots[ i ].data;
       }
     }
-    pthread_mutex_unlock( &hash->mutex[ n ] );
   }
+  *num = c;
 
-  *num = hash->count;
+  pthread_rwlock_unlock( &hash->lock );
 
   return datalist;
 }
 
 
+void
+foreach_hash( struct hash *hash, void ( *function )( void *data, void *user_data ), void *user_data ) {
+  assert( hash != NULL );
+  assert( function != NULL );
+
+  pthread_rwlock_rdlock( &hash->lock );
+
+  struct hash_table *tables[] = { hash->old, hash->current };
+  for ( int t = 0; t < 2; t++ ) {
+    for ( uint32_t i = 0; tables[ t ] != NULL && i < tables[ t ]->size; i++ ) {
+      if ( tables[ t ]->slots[ i ].hash & HASH_SLOT_IN_USE ) {
+        function( tables[ t ]->slots[ i ].data, user_data );
+      }
+    }
+  }
+
+  pthread_rwlock_unlock( &hash->lock );
+}
+
+
+int
+delete_hash_if( struct hash *hash, bool ( *function )( void *data, void *user_data ), void *user_data ) {
+  assert( hash != NULL );
+  assert( function != NULL );
+
+  pthread_rwlock_wrlock( &hash->lock );
+
+  int n_deleted = 0;
+  struct hash_table *tables[] = { hash->old, hash->current };
+  for ( int t = 0; t < 2; t++ ) {
+    for ( uint32_t i = 0; tables[ t ] != NULL && i < tables[ t ]->size; i++ ) {
+      struct hash_slot *slot = &tables[ t ]->slots[ i ];
+      if ( ( slot->hash & HASH_SLOT_IN_USE ) && function( slot->data, user_data ) ) {
+        // Leave a tombstone so that the slots not yet visited stay reachable.
+        begin_update( hash );
+        __atomic_store_n( &slot->hash, HASH_SLOT_DELETED, __ATOMIC_RELEASE );
+        slot->data = NULL;
+        tables[ t ]->count--;
+        hash->count--;
+        end_update( hash );
+        n_deleted++;
+      }
+    }
+  }
+
+  pthread_rwlock_unlock( &hash->lock );
+
+  return n_deleted;
+}
+
 
 /*
  * Local variables:
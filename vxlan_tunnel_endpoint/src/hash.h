@@ -22,23 +22,37 @@
 
 
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 
 
-#define HASH_TABLE_SIZE 256
+#define HASH_MAX_KEY_LENGTH 16
 
 
-struct hashnode {
-  uint8_t *key;
+struct hash_slot {
+  uint64_t hash;
+  uint64_t key[ HASH_MAX_KEY_LENGTH / sizeof( uint64_t ) ];
   void *data;
-  struct hashnode *next;
+};
+
+
+struct hash_table {
+  uint32_t size;
+  uint32_t used;
+  uint32_t count;
+  struct hash_slot slots[ 0 ];
 };
 
 
 struct hash {
-  struct hashnode table[ HASH_TABLE_SIZE ];
-  pthread_mutex_t mutex[ HASH_TABLE_SIZE ];
+  struct hash_table *current;
+  struct hash_table *old;
+  uint32_t migrated;
+  uint32_t sequence;
+  uint64_t seed;
+  pthread_rwlock_t lock;
+  void ( *table_release_function )( void *ptr );
   int keylen;
   int count;
 };
@@ -48,8 +62,13 @@ void init_hash( struct hash *hash, int keylen );
 int insert_hash( struct hash *hash, void *data, void *key );
 void *delete_hash( struct hash *hash, void *key );
 void *search_hash( struct hash *hash, void *key );
+void *search_hash_lockless( struct hash *hash, void *key );
+void set_hash_table_release_function( struct hash *hash, void ( *function )( void *ptr ) );
 void destroy_hash( struct hash *hash );
+size_t get_hash_memory_usage( struct hash *hash );
 void **create_list_from_hash( struct hash *hash, int *num );
+void foreach_hash( struct hash *hash, void ( *function )( void *data, void *user_data ), void *user_data );
+int delete_hash_if( struct hash *hash, bool ( *function )( void *data, void *user_data ), void *user_data );
 
 
 #endif // HASH_H
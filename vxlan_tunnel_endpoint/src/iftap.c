@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include "iftap.h"
 #include "log.h"
+#include "netlink.h"
 #include "wrapper.h"
 
 
@@ -63,67 +64,11 @@ tap_alloc( const char *dev ) {
 }
 
 
-static bool
-get_interface_flags( int fd, struct ifreq *ifr ) {
-  assert( fd >= 0 );
-  assert( ifr != NULL );
-
-  ifr->ifr_flags = 0;
-  int ret = ioctl( fd, SIOCGIFFLAGS, ( void * ) ifr );
-  if ( ret < 0 ) {
-    char buf[ 256 ];
-    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-    error( "Failed to retrieve interface flags ( errno = %s [%d] ).", error_string, errno );
-    return false;
-  }
-
-  return true;
-}
-
-
 bool
 tap_up( const char *dev ) {
   assert( dev != NULL );
 
-  char buf[ 256 ];
-
-  int fd = socket( AF_INET, SOCK_DGRAM, 0 );
-  if ( fd < 0 ) {
-    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-    error( "Failed to create a control channel of the tap interface ( ret = %d, errno = %s [%d] ).",
-           fd, error_string, errno );
-    return false;
-  }
-
-  struct ifreq ifr;
-  memset( &ifr, 0, sizeof( ifr ) );
-  strncpy( ifr.ifr_name, dev, IFNAMSIZ );
-
-  int retval = ioctl( fd, SIOCGIFINDEX, ( void * ) &ifr );
-  if ( retval != 0 ) {
-    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-    error( "Failed to retrieve interface index ( errno = %s [%d] ).", error_string, errno );
-    return false;
-  }
-
-  bool ret = get_interface_flags( fd, &ifr );
-  if ( !ret ) {
-    return false;
-  }
-
-  ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
-  retval = ioctl( fd, SIOCSIFFLAGS, ( void * ) &ifr );
-  if ( retval < 0 ) {
-    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-    error( "Failed to make a tap interface ( %s ) up ( ret = %d, errno = %s [%d] ).",
-           dev, retval, error_string, errno );
-    close( fd );
-    return false;
-  }
-
-  close( fd );
-
-  return true;
+  return set_link_flags( dev, IFF_UP, IFF_UP );
 }
 
 
@@ -131,38 +76,7 @@ bool
 tap_down( const char *dev ) {
   assert( dev != NULL );
 
-  char buf[ 256 ];
-
-  int fd = socket( AF_INET, SOCK_DGRAM, 0 );
-  if ( fd < 0 ) {
-    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-    error( "Failed to create a control channel of the tap interface ( ret = %d, errno = %s [%d] ).",
-           fd, error_string, errno );
-    return false;
-  }
-
-  struct ifreq ifr;
-  memset( &ifr, 0, sizeof( ifr ) );
-  strncpy( ifr.ifr_name, dev, IFNAMSIZ );
-
-  bool ret = get_interface_flags( fd, &ifr );
-  if ( !ret ) {
-    return false;
-  }
-
-  ifr.ifr_flags &= ~IFF_UP;
-  int retval = ioctl( fd, SIOCSIFFLAGS, ( void * ) &ifr );
-  if ( retval < 0 ) {
-    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-    error( "Failed to make a tap interface ( %s ) down ( ret = %d, errno = %s [%d] ).",
-           dev, retval, error_string, errno );
-    close( fd );
-    return false;
-  }
-
-  close( fd );
-
-  return true;
+  return set_link_flags( dev, 0, IFF_UP );
 }
 
 
@@ -0,0 +1,1260 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * An alternative to the select() based loops in vxland.c and
+ * process_vxlan_instance(). A single thread drives an io_uring which
+ * keeps a multishot receive posted on the UDP socket and a read posted
+ * on every tap interface. All receives pick their buffers from a
+ * provided buffer ring registered with the kernel. Completions are
+ * reaped in batches and new requests are submitted with the next wait.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "checks.h"
+#include "fdb.h"
+#include "io_uring_engine.h"
+#include "latency.h"
+#include "log.h"
+#include "net.h"
+#include "netlink.h"
+#include "probes.h"
+#include "qsbr.h"
+#include "trunk.h"
+#include "wrapper.h"
+
+
+#define URING_SQ_ENTRIES 1024
+#define URING_CQ_ENTRIES 8192
+#define URING_BUFFER_GROUP 0
+#define URING_N_BUFFERS 512
+// Buffers that tap writes never take so that vxlan messages keep being received
+// while some taps are not drained.
+#define URING_RECV_RESERVE ( URING_N_BUFFERS / 4 )
+#define URING_MAX_WRITES ( URING_N_BUFFERS - URING_RECV_RESERVE )
+#define URING_MAX_TAP_WRITES 128
+#define URING_BUFFER_SIZE ( sizeof( struct io_uring_recvmsg_out ) + sizeof( struct sockaddr_in ) + VXLAN_PACKET_BUF_LEN )
+#define URING_MAINTENANCE_INTERVAL 1
+
+#define USER_DATA( _op, _slot, _bid ) \
+  ( ( uint64_t ) ( _op ) | ( ( uint64_t ) ( _slot ) << 8 ) | ( ( uint64_t ) ( _bid ) << 40 ) )
+#define USER_DATA_OP( _data ) ( ( uint8_t ) ( ( _data ) & 0xff ) )
+#define USER_DATA_SLOT( _data ) ( ( uint32_t ) ( ( ( _data ) >> 8 ) & 0xffffffff ) )
+
+
+enum {
+  OP_UDP_RECV,
+  OP_TAP_READ,
+  OP_TAP_WRITE,
+  OP_UDP_SEND,
+  OP_TIMER,
+  OP_EVENT,
+  OP_LINK_EVENT,
+  OP_CANCEL,
+};
+
+enum {
+  COMMAND_ADD,
+  COMMAND_DELETE,
+};
+
+
+struct uring_tap {
+  struct vxlan_instance *instance;
+  int fd;
+  unsigned int inflight;
+  unsigned int writing;
+  bool in_use;
+  bool reading;
+  bool starved;
+  bool removing;
+  bool cancelling;
+  bool trunk;
+  struct uring_command *delete_command;
+};
+
+struct uring_buffer_context {
+  struct udphdr udp;
+  struct vxlanhdr vhdr;
+  struct sockaddr_in dst;
+  struct iovec iov[ VXLAN_MESSAGE_IOVLEN ];
+  struct msghdr mhdr;
+#ifdef LATENCY_STATS
+  uint32_t vni; // The instance is looked up again when the frame is completed
+  uint64_t received_at;
+#endif
+};
+
+struct uring_command {
+  int type;
+  struct vxlan_instance *instance;
+  bool done;
+  struct uring_command *next;
+};
+
+struct io_uring_engine {
+  int ring_fd;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int sq_mask;
+  unsigned int sq_entries;
+  unsigned int sqe_tail;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe *cqes;
+
+  struct io_uring_buf_ring *buf_ring;
+  size_t buf_ring_size;
+  uint16_t buf_tail;
+  unsigned int n_held_buffers;
+  unsigned int n_writing;
+  char *buffers;
+  struct uring_buffer_context *contexts;
+
+  struct uring_tap *taps;
+  uint32_t n_taps;
+  int trunk_slot;
+  unsigned int n_starved;
+
+  struct msghdr recv_mhdr;
+  bool udp_recv_posted;
+  int timer_fd;
+  uint64_t timer_count;
+  int event_fd;
+  uint64_t event_count;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  struct uring_command *commands;
+  bool stopped;
+};
+
+
+static struct vxlan *vxlan = NULL;
+static struct io_uring_engine *engine = NULL;
+
+
+static int
+io_uring_setup( unsigned int entries, struct io_uring_params *params ) {
+  return ( int ) syscall( __NR_io_uring_setup, entries, params );
+}
+
+
+static int
+io_uring_enter( int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags,
+                void *arg, size_t argsz ) {
+  return ( int ) syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz );
+}
+
+
+static int
+io_uring_register( int fd, unsigned int opcode, void *arg, unsigned int nr_args ) {
+  return ( int ) syscall( __NR_io_uring_register, fd, opcode, arg, nr_args );
+}
+
+
+static bool
+map_rings( struct io_uring_params *params ) {
+  assert( engine != NULL );
+  assert( params != NULL );
+
+  engine->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof( unsigned int );
+  engine->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof( struct io_uring_cqe );
+  if ( params->features & IORING_FEAT_SINGLE_MMAP ) {
+    if ( engine->cq_ring_size > engine->sq_ring_size ) {
+      engine->sq_ring_size = engine->cq_ring_size;
+    }
+    engine->cq_ring_size = engine->sq_ring_size;
+  }
+
+  engine->sq_ring = mmap( NULL, engine->sq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_SQ_RING );
+  if ( engine->sq_ring == MAP_FAILED ) {
+    engine->sq_ring = NULL;
+    return false;
+  }
+
+  if ( params->features & IORING_FEAT_SINGLE_MMAP ) {
+    engine->cq_ring = engine->sq_ring;
+  }
+  else {
+    engine->cq_ring = mmap( NULL, engine->cq_ring_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_CQ_RING );
+    if ( engine->cq_ring == MAP_FAILED ) {
+      engine->cq_ring = NULL;
+      return false;
+    }
+  }
+
+  engine->sqes_size = params->sq_entries * sizeof( struct io_uring_sqe );
+  engine->sqes = mmap( NULL, engine->sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_SQES );
+  if ( engine->sqes == MAP_FAILED ) {
+    engine->sqes = NULL;
+    return false;
+  }
+
+  char *sq = engine->sq_ring;
+  engine->sq_head = ( unsigned int * ) ( void * ) ( sq + params->sq_off.head );
+  engine->sq_tail = ( unsigned int * ) ( void * ) ( sq + params->sq_off.tail );
+  engine->sq_mask = *( unsigned int * ) ( void * ) ( sq + params->sq_off.ring_mask );
+  engine->sq_entries = params->sq_entries;
+  unsigned int *array = ( unsigned int * ) ( void * ) ( sq + params->sq_off.array );
+  for ( unsigned int i = 0; i < params->sq_entries; i++ ) {
+    array[ i ] = i;
+  }
+  engine->sqe_tail = *engine->sq_tail;
+
+  char *cq = engine->cq_ring;
+  engine->cq_head = ( unsigned int * ) ( void * ) ( cq + params->cq_off.head );
+  engine->cq_tail = ( unsigned int * ) ( void * ) ( cq + params->cq_off.tail );
+  engine->cq_mask = *( unsigned int * ) ( void * ) ( cq + params->cq_off.ring_mask );
+  engine->cqes = ( struct io_uring_cqe * ) ( void * ) ( cq + params->cq_off.cqes );
+
+  return true;
+}
+
+
+static void
+recycle_buffer( uint16_t bid ) {
+  assert( engine != NULL );
+  assert( bid < URING_N_BUFFERS );
+
+  struct io_uring_buf *buf = &engine->buf_ring->bufs[ engine->buf_tail & ( URING_N_BUFFERS - 1 ) ];
+  buf->addr = ( uint64_t ) ( uintptr_t ) ( engine->buffers + ( size_t ) bid * URING_BUFFER_SIZE );
+  buf->len = ( uint32_t ) URING_BUFFER_SIZE;
+  buf->bid = bid;
+  engine->buf_tail++;
+  engine->n_held_buffers--;
+  __atomic_store_n( &engine->buf_ring->tail, engine->buf_tail, __ATOMIC_RELEASE );
+}
+
+
+static bool
+setup_buffer_ring() {
+  assert( engine != NULL );
+
+  engine->buf_ring_size = URING_N_BUFFERS * sizeof( struct io_uring_buf );
+  void *ring = mmap( NULL, engine->buf_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0 );
+  if ( ring == MAP_FAILED ) {
+    return false;
+  }
+  engine->buf_ring = ring;
+  engine->buf_ring->tail = 0;
+  engine->buf_tail = 0;
+  engine->n_held_buffers = URING_N_BUFFERS;
+
+  struct io_uring_buf_reg reg;
+  memset( &reg, 0, sizeof( reg ) );
+  reg.ring_addr = ( uint64_t ) ( uintptr_t ) ring;
+  reg.ring_entries = URING_N_BUFFERS;
+  reg.bgid = URING_BUFFER_GROUP;
+  int ret = io_uring_register( engine->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1 );
+  if ( ret < 0 ) {
+    return false;
+  }
+
+  engine->buffers = malloc( URING_N_BUFFERS * URING_BUFFER_SIZE );
+  engine->contexts = malloc( URING_N_BUFFERS * sizeof( struct uring_buffer_context ) );
+  if ( engine->buffers == NULL || engine->contexts == NULL ) {
+    return false;
+  }
+  memset( engine->contexts, 0, URING_N_BUFFERS * sizeof( struct uring_buffer_context ) );
+  for ( uint16_t bid = 0; bid < URING_N_BUFFERS; bid++ ) {
+    recycle_buffer( bid );
+  }
+
+  return true;
+}
+
+
+static void
+flush_submission_queue() {
+  assert( engine != NULL );
+
+  __atomic_store_n( engine->sq_tail, engine->sqe_tail, __ATOMIC_RELEASE );
+}
+
+
+static unsigned int
+n_unsubmitted() {
+  assert( engine != NULL );
+
+  return engine->sqe_tail - __atomic_load_n( engine->sq_head, __ATOMIC_ACQUIRE );
+}
+
+
+static int
+submit_and_wait( unsigned int min_complete, long timeout_nsec ) {
+  assert( engine != NULL );
+
+  flush_submission_queue();
+
+  struct __kernel_timespec ts = { timeout_nsec / 1000000000, timeout_nsec % 1000000000 };
+  struct io_uring_getevents_arg arg;
+  memset( &arg, 0, sizeof( arg ) );
+  arg.ts = ( uint64_t ) ( uintptr_t ) &ts;
+
+  unsigned int flags = IORING_ENTER_EXT_ARG;
+  if ( min_complete > 0 ) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+
+  int ret = io_uring_enter( engine->ring_fd, n_unsubmitted(), min_complete, flags, &arg, sizeof( arg ) );
+  if ( ret < 0 && errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to enter io_uring ( ret = %d, errno = %s [%d] ).", ret, error_string, errno );
+    return -1;
+  }
+
+  return ret;
+}
+
+
+static bool
+reserve_sqes( unsigned int n ) {
+  assert( engine != NULL );
+
+  if ( n_unsubmitted() + n <= engine->sq_entries ) {
+    return true;
+  }
+  submit_and_wait( 0, 0 );
+
+  return ( n_unsubmitted() + n <= engine->sq_entries );
+}
+
+
+static struct io_uring_sqe *
+get_sqe() {
+  assert( engine != NULL );
+
+  if ( !reserve_sqes( 1 ) ) {
+    return NULL;
+  }
+
+  struct io_uring_sqe *sqe = &engine->sqes[ engine->sqe_tail & engine->sq_mask ];
+  engine->sqe_tail++;
+  memset( sqe, 0, sizeof( struct io_uring_sqe ) );
+
+  return sqe;
+}
+
+
+static bool
+post_udp_recv() {
+  assert( engine != NULL );
+
+  struct io_uring_sqe *sqe = get_sqe();
+  if ( sqe == NULL ) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = vxlan->udp_sock;
+  sqe->addr = ( uint64_t ) ( uintptr_t ) &engine->recv_mhdr;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  sqe->user_data = USER_DATA( OP_UDP_RECV, 0, 0 );
+  engine->udp_recv_posted = true;
+
+  return true;
+}
+
+
+static bool
+post_fd_read( int fd, uint64_t *value, uint8_t op ) {
+  assert( engine != NULL );
+
+  struct io_uring_sqe *sqe = get_sqe();
+  if ( sqe == NULL ) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = ( uint64_t ) ( uintptr_t ) value;
+  sqe->len = sizeof( uint64_t );
+  sqe->off = ( uint64_t ) -1;
+  sqe->user_data = USER_DATA( op, 0, 0 );
+
+  return true;
+}
+
+
+static bool
+post_fd_poll( int fd, uint8_t op ) {
+  assert( engine != NULL );
+
+  struct io_uring_sqe *sqe = get_sqe();
+  if ( sqe == NULL ) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = USER_DATA( op, 0, 0 );
+
+  return true;
+}
+
+
+static bool
+post_tap_read( uint32_t slot ) {
+  assert( engine != NULL );
+  assert( slot < engine->n_taps );
+
+  struct uring_tap *tap = &engine->taps[ slot ];
+  struct io_uring_sqe *sqe = get_sqe();
+  if ( sqe == NULL ) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = tap->fd;
+  sqe->len = VXLAN_PACKET_BUF_LEN;
+  sqe->off = ( uint64_t ) -1;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  sqe->user_data = USER_DATA( OP_TAP_READ, slot, 0 );
+  tap->inflight++;
+  tap->reading = true;
+
+  return true;
+}
+
+
+static bool
+post_tap_write( uint32_t slot, uint16_t bid, struct vxlan_instance *instance, void *data, size_t length ) {
+  assert( engine != NULL );
+  assert( slot < engine->n_taps );
+  assert( instance != NULL );
+
+  struct uring_tap *tap = &engine->taps[ slot ];
+  // A tap may not hold more write buffers than are left to all the others, so
+  // n taps which are not drained pin at most n / ( n + 1 ) of URING_MAX_WRITES.
+  unsigned int free_writes = URING_MAX_WRITES - engine->n_writing;
+  if ( tap->writing >= URING_MAX_TAP_WRITES || tap->writing >= free_writes ) {
+    instance->stats.egress_dropped++;
+    return false;
+  }
+  struct io_uring_sqe *sqe = get_sqe();
+  if ( sqe == NULL ) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = tap->fd;
+  sqe->addr = ( uint64_t ) ( uintptr_t ) data;
+  sqe->len = ( uint32_t ) length;
+  sqe->off = ( uint64_t ) -1;
+  sqe->user_data = USER_DATA( OP_TAP_WRITE, slot, bid );
+  tap->inflight++;
+  tap->writing++;
+  engine->n_writing++;
+
+  return true;
+}
+
+
+static bool
+post_udp_send_and_tap_read( uint32_t slot, uint16_t bid, int sock ) {
+  assert( engine != NULL );
+  assert( slot < engine->n_taps );
+  assert( sock >= 0 );
+
+  if ( !reserve_sqes( 2 ) ) {
+    return false;
+  }
+
+  struct uring_tap *tap = &engine->taps[ slot ];
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = sock;
+  sqe->addr = ( uint64_t ) ( uintptr_t ) &engine->contexts[ bid ].mhdr;
+  // The next read on this tap is only started once the frame is on its way.
+  sqe->flags = IOSQE_IO_HARDLINK;
+  sqe->user_data = USER_DATA( OP_UDP_SEND, slot, bid );
+  tap->inflight++;
+
+  return post_tap_read( slot );
+}
+
+
+static void
+post_cancel( uint32_t slot ) {
+  assert( engine != NULL );
+  assert( slot < engine->n_taps );
+
+  struct uring_tap *tap = &engine->taps[ slot ];
+  struct io_uring_sqe *sqe = get_sqe();
+  if ( sqe == NULL ) {
+    return;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = tap->fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = USER_DATA( OP_CANCEL, slot, 0 );
+  tap->cancelling = true;
+}
+
+
+static void
+rearm_starved_taps() {
+  assert( engine != NULL );
+
+  if ( engine->n_starved == 0 ) {
+    return;
+  }
+
+  for ( uint32_t slot = 0; slot < engine->n_taps && engine->n_starved > 0; slot++ ) {
+    struct uring_tap *tap = &engine->taps[ slot ];
+    if ( !tap->in_use || !tap->starved ) {
+      continue;
+    }
+    tap->starved = false;
+    engine->n_starved--;
+    if ( !tap->removing && !tap->reading ) {
+      post_tap_read( slot );
+    }
+  }
+}
+
+
+static uint32_t
+allocate_tap_slot() {
+  assert( engine != NULL );
+
+  for ( uint32_t slot = 0; slot < engine->n_taps; slot++ ) {
+    if ( !engine->taps[ slot ].in_use ) {
+      return slot;
+    }
+  }
+
+  uint32_t n_taps = engine->n_taps > 0 ? engine->n_taps * 2 : 64;
+  struct uring_tap *taps = realloc( engine->taps, n_taps * sizeof( struct uring_tap ) );
+  assert( taps != NULL );
+  memset( &taps[ engine->n_taps ], 0, ( n_taps - engine->n_taps ) * sizeof( struct uring_tap ) );
+  uint32_t slot = engine->n_taps;
+  engine->taps = taps;
+  engine->n_taps = n_taps;
+
+  return slot;
+}
+
+
+static void
+complete_command( struct uring_command *command ) {
+  assert( command != NULL );
+
+  pthread_mutex_lock( &engine->mutex );
+  command->done = true;
+  pthread_cond_broadcast( &engine->cond );
+  pthread_mutex_unlock( &engine->mutex );
+}
+
+
+static void
+release_tap_slot( uint32_t slot ) {
+  assert( engine != NULL );
+  assert( slot < engine->n_taps );
+
+  struct uring_tap *tap = &engine->taps[ slot ];
+  if ( tap->starved ) {
+    engine->n_starved--;
+  }
+  if ( tap->instance != NULL ) {
+    tap->instance->io_slot = -1;
+  }
+  struct uring_command *command = tap->delete_command;
+  memset( tap, 0, sizeof( struct uring_tap ) );
+  if ( command != NULL ) {
+    complete_command( command );
+  }
+}
+
+
+static void
+handle_commands() {
+  assert( engine != NULL );
+
+  pthread_mutex_lock( &engine->mutex );
+  struct uring_command *commands = engine->commands;
+  engine->commands = NULL;
+  pthread_mutex_unlock( &engine->mutex );
+
+  // Commands are queued in reverse order.
+  struct uring_command *ordered = NULL;
+  while ( commands != NULL ) {
+    struct uring_command *next = commands->next;
+    commands->next = ordered;
+    ordered = commands;
+    commands = next;
+  }
+
+  while ( ordered != NULL ) {
+    struct uring_command *command = ordered;
+    ordered = ordered->next;
+
+    if ( command->type == COMMAND_ADD ) {
+      uint32_t slot = allocate_tap_slot();
+      struct uring_tap *tap = &engine->taps[ slot ];
+      memset( tap, 0, sizeof( struct uring_tap ) );
+      tap->in_use = true;
+      tap->instance = command->instance;
+      tap->fd = command->instance->tap_sock;
+      command->instance->io_slot = ( int ) slot;
+      post_tap_read( slot );
+      free( command );
+      continue;
+    }
+
+    int slot = command->instance->io_slot;
+    if ( slot < 0 || ( uint32_t ) slot >= engine->n_taps || !engine->taps[ slot ].in_use ) {
+      complete_command( command );
+      continue;
+    }
+    struct uring_tap *tap = &engine->taps[ slot ];
+    tap->removing = true;
+    tap->delete_command = command;
+    if ( tap->inflight == 0 ) {
+      release_tap_slot( ( uint32_t ) slot );
+    }
+    else {
+      post_cancel( ( uint32_t ) slot );
+    }
+  }
+}
+
+
+static void
+handle_vxlan_datagram( uint16_t bid, int res ) {
+  assert( engine != NULL );
+
+  uint64_t received_at = LATENCY_TIMESTAMP();
+  char *buffer = engine->buffers + ( size_t ) bid * URING_BUFFER_SIZE;
+  struct io_uring_recvmsg_out *out = ( struct io_uring_recvmsg_out * ) ( void * ) buffer;
+  size_t header_length = sizeof( struct io_uring_recvmsg_out ) + engine->recv_mhdr.msg_namelen +
+                         engine->recv_mhdr.msg_controllen;
+  if ( ( size_t ) res < header_length || ( out->flags & MSG_TRUNC ) != 0 ) {
+    recycle_buffer( bid );
+    return;
+  }
+
+  struct sockaddr_in *addr = ( struct sockaddr_in * ) ( void * ) ( out + 1 );
+  char *payload = buffer + header_length;
+  size_t length = out->payloadlen;
+  if ( vxlan->capture != NULL ) {
+    uint32_t vni = length >= sizeof( struct vxlanhdr ) ?
+                   get_vni_value( ( ( struct vxlanhdr * ) ( void * ) payload )->vni ) : CAPTURE_NO_VNI;
+    capture_udp_payload( vxlan->capture, vni, addr, vxlan->port, payload, length );
+  }
+  if ( !vxlan->active || length < sizeof( struct vxlanhdr ) + sizeof( struct ether_header ) ) {
+    PROBE3( vxland, frame_dropped, PROBE_NO_VNI, vxlan->active ? PROBE_DROP_MALFORMED : PROBE_DROP_INACTIVE, length );
+    recycle_buffer( bid );
+    return;
+  }
+
+  struct vxlanhdr *vhdr = ( struct vxlanhdr * ) ( void * ) payload;
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vhdr->vni ) );
+  if ( instance == NULL || !instance->activated ) {
+    PROBE3( vxland, frame_dropped, PROBE_VNI( vhdr->vni ),
+            instance == NULL ? PROBE_DROP_UNKNOWN_VNI : PROBE_DROP_INACTIVE, length );
+    recycle_buffer( bid );
+    return;
+  }
+  int slot = instance->vlan != 0 ? engine->trunk_slot : instance->io_slot;
+  if ( slot < 0 ) {
+    recycle_buffer( bid );
+    return;
+  }
+
+  struct ether_header *ether = ( struct ether_header * ) ( void * ) ( payload + sizeof( struct vxlanhdr ) );
+  size_t frame_length = length - sizeof( struct vxlanhdr );
+  process_fdb_etherframe_from_vxlan( instance, ether, frame_length, addr );
+  if ( instance->vlan != 0 ) {
+    // Tags are pushed in place over the vxlan header which is no longer needed.
+    ether = push_vlan_tags( instance, ether, &frame_length );
+  }
+#ifdef LATENCY_STATS
+  engine->contexts[ bid ].vni = get_vni_value( vhdr->vni );
+  engine->contexts[ bid ].received_at = received_at;
+#else
+  UNUSED( received_at );
+#endif
+  if ( !post_tap_write( ( uint32_t ) slot, bid, instance, ether, frame_length ) ) {
+    PROBE3( vxland, frame_dropped, PROBE_VNI( vhdr->vni ), PROBE_DROP_EGRESS_FULL, frame_length );
+    recycle_buffer( bid );
+    return;
+  }
+  PROBE3( vxland, frame_decapsulated, PROBE_VNI( vhdr->vni ), ether, frame_length );
+}
+
+
+static void
+handle_tap_frame( uint32_t slot, uint16_t bid, int res ) {
+  assert( engine != NULL );
+  assert( slot < engine->n_taps );
+
+  uint64_t received_at = LATENCY_TIMESTAMP();
+  struct uring_tap *tap = &engine->taps[ slot ];
+  struct vxlan_instance *instance = tap->instance;
+  if ( tap->removing || ( instance != NULL && !instance->activated ) || !vxlan->active || res <= 0 ) {
+    recycle_buffer( bid );
+    if ( !tap->removing ) {
+      post_tap_read( slot );
+    }
+    return;
+  }
+
+  struct ether_header *ether = ( struct ether_header * ) ( void * ) ( engine->buffers + ( size_t ) bid * URING_BUFFER_SIZE );
+  size_t length = ( size_t ) res;
+  if ( tap->trunk ) {
+    instance = pop_vlan_tags( &ether, &length );
+    if ( instance == NULL || !instance->activated ) {
+      recycle_buffer( bid );
+      post_tap_read( slot );
+      return;
+    }
+  }
+  PROBE3( vxland, frame_from_tap, PROBE_VNI( instance->vni ), ether, length );
+  if ( answer_neighbor_solicitation( instance, ether, length ) ) {
+    recycle_buffer( bid );
+    post_tap_read( slot );
+    return;
+  }
+
+  struct uring_buffer_context *context = &engine->contexts[ bid ];
+  int destination = lookup_vxlan_destination( instance, ether, &context->dst );
+  if ( destination == VXLAN_DESTINATION_NONE ) {
+    PROBE3( vxland, frame_dropped, PROBE_VNI( instance->vni ), PROBE_DROP_NO_DESTINATION, length );
+    recycle_buffer( bid );
+    post_tap_read( slot );
+    return;
+  }
+
+  build_vxlan_message( instance, &context->udp, &context->vhdr, ether, length, context->iov );
+
+  // Head-end replication is done synchronously since a frame cannot be tied to a single send.
+  if ( destination == VXLAN_DESTINATION_FLOOD && replicate_etherframe_to_remotes( instance, context->iov ) ) {
+    RECORD_LATENCY( &instance->latency->encap, received_at );
+    PROBE4( vxland, frame_encapsulated, PROBE_VNI( instance->vni ), ether, length, destination );
+    recycle_buffer( bid );
+    post_tap_read( slot );
+    return;
+  }
+
+  memset( &context->mhdr, 0, sizeof( context->mhdr ) );
+  int sock = set_vxlan_message_destination( instance, &context->mhdr, context->iov, &context->dst );
+#ifdef LATENCY_STATS
+  context->vni = get_vni_value( instance->vni );
+  context->received_at = received_at;
+#endif
+
+  if ( !post_udp_send_and_tap_read( slot, bid, sock ) ) {
+    PROBE3( vxland, frame_dropped, PROBE_VNI( instance->vni ), PROBE_DROP_SEND_FAILED, length );
+    recycle_buffer( bid );
+    post_tap_read( slot );
+    return;
+  }
+  PROBE4( vxland, frame_encapsulated, PROBE_VNI( instance->vni ), ether, length, destination );
+}
+
+
+static void
+handle_timer() {
+  assert( engine != NULL );
+
+  for ( uint32_t slot = 0; slot < engine->n_taps; slot++ ) {
+    struct uring_tap *tap = &engine->taps[ slot ];
+    if ( !tap->in_use ) {
+      continue;
+    }
+    if ( tap->removing ) {
+      if ( !tap->cancelling ) {
+        post_cancel( slot );
+      }
+      continue;
+    }
+    if ( tap->trunk ) {
+      maintain_trunk();
+      continue;
+    }
+    maintain_vxlan_instance( tap->instance );
+  }
+
+  qsbr_reclaim();
+}
+
+
+#ifdef LATENCY_STATS
+static void
+record_completion_latency( uint16_t bid, uint8_t op ) {
+  assert( engine != NULL );
+  assert( bid < URING_N_BUFFERS );
+
+  struct uring_buffer_context *context = &engine->contexts[ bid ];
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, context->vni );
+  if ( instance == NULL ) {
+    return;
+  }
+  record_latency( op == OP_TAP_WRITE ? &instance->latency->decap : &instance->latency->encap, context->received_at );
+}
+#endif
+
+
+static void
+handle_completion( struct io_uring_cqe *cqe ) {
+  assert( engine != NULL );
+  assert( cqe != NULL );
+
+  uint8_t op = USER_DATA_OP( cqe->user_data );
+  uint32_t slot = USER_DATA_SLOT( cqe->user_data );
+  bool has_buffer = ( cqe->flags & IORING_CQE_F_BUFFER ) != 0;
+  uint16_t bid = ( uint16_t ) ( cqe->flags >> IORING_CQE_BUFFER_SHIFT );
+  char buf[ 256 ];
+
+  if ( has_buffer ) {
+    engine->n_held_buffers++;
+  }
+
+  switch ( op ) {
+    case OP_UDP_RECV:
+    {
+      if ( ( cqe->flags & IORING_CQE_F_MORE ) == 0 ) {
+        engine->udp_recv_posted = false;
+      }
+      if ( cqe->res < 0 && cqe->res != -ENOBUFS ) {
+        char *error_string = safe_strerror_r( -cqe->res, buf, sizeof( buf ) );
+        warn( "Failed to receive a vxlan message ( errno = %s [%d] ).", error_string, -cqe->res );
+      }
+      if ( has_buffer ) {
+        handle_vxlan_datagram( bid, cqe->res );
+      }
+    }
+    break;
+
+    case OP_TAP_READ:
+    {
+      struct uring_tap *tap = &engine->taps[ slot ];
+      tap->inflight--;
+      tap->reading = false;
+      if ( has_buffer ) {
+        handle_tap_frame( slot, bid, cqe->res );
+      }
+      else if ( cqe->res == -ENOBUFS && !tap->removing ) {
+        if ( !tap->starved ) {
+          tap->starved = true;
+          engine->n_starved++;
+        }
+      }
+      else if ( !tap->removing ) {
+        if ( cqe->res < 0 && cqe->res != -ECANCELED ) {
+          char *error_string = safe_strerror_r( -cqe->res, buf, sizeof( buf ) );
+          warn( "Failed to read data from a tap device ( fd = %d, errno = %s [%d] ).",
+                tap->fd, error_string, -cqe->res );
+        }
+        post_tap_read( slot );
+      }
+    }
+    break;
+
+    case OP_TAP_WRITE:
+    {
+      engine->taps[ slot ].inflight--;
+      engine->taps[ slot ].writing--;
+      engine->n_writing--;
+      recycle_buffer( ( uint16_t ) ( cqe->user_data >> 40 ) );
+      if ( cqe->res < 0 ) {
+        char *error_string = safe_strerror_r( -cqe->res, buf, sizeof( buf ) );
+        warn( "Failed to write an Ethernet frame to a tap interface ( socket = %d, errno = %s [%d] ).",
+              engine->taps[ slot ].fd, error_string, -cqe->res );
+      }
+#ifdef LATENCY_STATS
+      else {
+        record_completion_latency( ( uint16_t ) ( cqe->user_data >> 40 ), OP_TAP_WRITE );
+      }
+#endif
+    }
+    break;
+
+    case OP_UDP_SEND:
+    {
+      engine->taps[ slot ].inflight--;
+      recycle_buffer( ( uint16_t ) ( cqe->user_data >> 40 ) );
+      if ( cqe->res < 0 ) {
+        char *error_string = safe_strerror_r( -cqe->res, buf, sizeof( buf ) );
+        warn( "Failed to send a vxlan message ( errno = %s [%d] ).", error_string, -cqe->res );
+      }
+#ifdef LATENCY_STATS
+      else {
+        record_completion_latency( ( uint16_t ) ( cqe->user_data >> 40 ), OP_UDP_SEND );
+      }
+#endif
+    }
+    break;
+
+    case OP_TIMER:
+    {
+      post_fd_read( engine->timer_fd, &engine->timer_count, OP_TIMER );
+      handle_timer();
+    }
+    break;
+
+    case OP_EVENT:
+    {
+      post_fd_read( engine->event_fd, &engine->event_count, OP_EVENT );
+      handle_commands();
+    }
+    break;
+
+    case OP_LINK_EVENT:
+    {
+      post_fd_poll( get_link_monitor_fd(), OP_LINK_EVENT );
+      handle_interface_events();
+    }
+    break;
+
+    case OP_CANCEL:
+    {
+      engine->taps[ slot ].cancelling = false;
+    }
+    break;
+
+    default:
+      break;
+  }
+
+  if ( op == OP_TAP_READ || op == OP_TAP_WRITE || op == OP_UDP_SEND ) {
+    struct uring_tap *tap = &engine->taps[ slot ];
+    if ( tap->in_use && tap->removing ) {
+      if ( tap->inflight == 0 ) {
+        release_tap_slot( slot );
+      }
+      else if ( !tap->cancelling ) {
+        post_cancel( slot );
+      }
+    }
+  }
+}
+
+
+static unsigned int
+reap_completions() {
+  assert( engine != NULL );
+
+  unsigned int n = 0;
+  unsigned int head = *engine->cq_head;
+  unsigned int tail = __atomic_load_n( engine->cq_tail, __ATOMIC_ACQUIRE );
+  while ( head != tail ) {
+    struct io_uring_cqe cqe = engine->cqes[ head & engine->cq_mask ];
+    head++;
+    // Release the slot before handling so that large batches do not stall the kernel.
+    __atomic_store_n( engine->cq_head, head, __ATOMIC_RELEASE );
+    handle_completion( &cqe );
+    n++;
+    if ( head == tail ) {
+      tail = __atomic_load_n( engine->cq_tail, __ATOMIC_ACQUIRE );
+    }
+  }
+
+  return n;
+}
+
+
+void
+run_io_uring_engine() {
+  assert( vxlan != NULL );
+  assert( engine != NULL );
+
+  info( "io_uring engine is started ( sq = %u, buffers = %u ).", engine->sq_entries, URING_N_BUFFERS );
+
+  post_fd_read( engine->timer_fd, &engine->timer_count, OP_TIMER );
+  post_fd_read( engine->event_fd, &engine->event_count, OP_EVENT );
+  if ( get_link_monitor_fd() >= 0 ) {
+    post_fd_poll( get_link_monitor_fd(), OP_LINK_EVENT );
+  }
+  if ( vxlan->trunk_sock >= 0 ) {
+    uint32_t slot = allocate_tap_slot();
+    struct uring_tap *tap = &engine->taps[ slot ];
+    memset( tap, 0, sizeof( struct uring_tap ) );
+    tap->in_use = true;
+    tap->trunk = true;
+    tap->fd = vxlan->trunk_sock;
+    engine->trunk_slot = ( int ) slot;
+    post_tap_read( slot );
+  }
+  handle_commands();
+
+  qsbr_register_thread();
+
+  while ( running ) {
+    qsbr_quiescent_state();
+
+    // Reads ended with ENOBUFS are rearmed once a buffer is given back. Until
+    // then the loop waits for writes and sends to complete.
+    if ( engine->n_held_buffers < URING_N_BUFFERS ) {
+      if ( !engine->udp_recv_posted ) {
+        post_udp_recv();
+      }
+      rearm_starved_taps();
+    }
+
+    qsbr_thread_offline();
+    int ret = submit_and_wait( 1, 1000000000 );
+    qsbr_thread_online();
+    if ( ret < 0 ) {
+      break;
+    }
+    reap_completions();
+  }
+
+  pthread_mutex_lock( &engine->mutex );
+  engine->stopped = true;
+  for ( struct uring_command *c = engine->commands; c != NULL; ) {
+    struct uring_command *next = c->next;
+    if ( c->type == COMMAND_ADD ) {
+      free( c );
+    }
+    else {
+      c->done = true;
+    }
+    c = next;
+  }
+  engine->commands = NULL;
+  for ( uint32_t slot = 0; slot < engine->n_taps; slot++ ) {
+    struct uring_tap *tap = &engine->taps[ slot ];
+    if ( tap->in_use && tap->delete_command != NULL ) {
+      tap->delete_command->done = true;
+    }
+  }
+  pthread_cond_broadcast( &engine->cond );
+  pthread_mutex_unlock( &engine->mutex );
+
+  qsbr_unregister_thread();
+
+  info( "io_uring engine is terminated." );
+}
+
+
+static bool
+enqueue_command( int type, struct vxlan_instance *instance ) {
+  assert( engine != NULL );
+  assert( instance != NULL );
+
+  struct uring_command *command = malloc( sizeof( struct uring_command ) );
+  assert( command != NULL );
+  memset( command, 0, sizeof( struct uring_command ) );
+  command->type = type;
+  command->instance = instance;
+
+  pthread_mutex_lock( &engine->mutex );
+  if ( engine->stopped ) {
+    pthread_mutex_unlock( &engine->mutex );
+    instance->io_slot = -1;
+    free( command );
+    return false;
+  }
+  command->next = engine->commands;
+  engine->commands = command;
+  uint64_t one = 1;
+  ssize_t ret = write( engine->event_fd, &one, sizeof( one ) );
+  UNUSED( ret );
+  if ( type == COMMAND_DELETE ) {
+    while ( !command->done ) {
+      pthread_cond_wait( &engine->cond, &engine->mutex );
+    }
+    free( command );
+  }
+  pthread_mutex_unlock( &engine->mutex );
+
+  return true;
+}
+
+
+bool
+add_instance_to_io_uring_engine( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  return enqueue_command( COMMAND_ADD, instance );
+}
+
+
+bool
+delete_instance_from_io_uring_engine( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  if ( engine == NULL || instance->io_slot < 0 ) {
+    instance->io_slot = -1;
+    return true;
+  }
+
+  enqueue_command( COMMAND_DELETE, instance );
+
+  return true;
+}
+
+
+static void
+release_engine() {
+  assert( engine != NULL );
+
+  if ( engine->sqes != NULL ) {
+    munmap( engine->sqes, engine->sqes_size );
+  }
+  if ( engine->cq_ring != NULL && engine->cq_ring != engine->sq_ring ) {
+    munmap( engine->cq_ring, engine->cq_ring_size );
+  }
+  if ( engine->sq_ring != NULL ) {
+    munmap( engine->sq_ring, engine->sq_ring_size );
+  }
+  if ( engine->ring_fd >= 0 ) {
+    close( engine->ring_fd );
+  }
+  if ( engine->buf_ring != NULL ) {
+    munmap( engine->buf_ring, engine->buf_ring_size );
+  }
+  if ( engine->timer_fd >= 0 ) {
+    close( engine->timer_fd );
+  }
+  if ( engine->event_fd >= 0 ) {
+    close( engine->event_fd );
+  }
+  if ( engine->buffers != NULL ) {
+    free( engine->buffers );
+  }
+  if ( engine->contexts != NULL ) {
+    free( engine->contexts );
+  }
+  if ( engine->taps != NULL ) {
+    free( engine->taps );
+  }
+  pthread_mutex_destroy( &engine->mutex );
+  pthread_cond_destroy( &engine->cond );
+  free( engine );
+  engine = NULL;
+}
+
+
+bool
+init_io_uring_engine( struct vxlan *_vxlan ) {
+  assert( _vxlan != NULL );
+  assert( engine == NULL );
+
+  vxlan = _vxlan;
+
+  engine = malloc( sizeof( struct io_uring_engine ) );
+  assert( engine != NULL );
+  memset( engine, 0, sizeof( struct io_uring_engine ) );
+  engine->ring_fd = -1;
+  engine->timer_fd = -1;
+  engine->event_fd = -1;
+  engine->trunk_slot = -1;
+  pthread_mutex_init( &engine->mutex, NULL );
+  pthread_cond_init( &engine->cond, NULL );
+
+  char buf[ 256 ];
+
+  struct io_uring_params params;
+  memset( &params, 0, sizeof( params ) );
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = URING_CQ_ENTRIES;
+  engine->ring_fd = io_uring_setup( URING_SQ_ENTRIES, &params );
+  if ( engine->ring_fd < 0 ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    warn( "Failed to set up io_uring ( errno = %s [%d] ).", error_string, errno );
+    goto error;
+  }
+  if ( ( params.features & IORING_FEAT_EXT_ARG ) == 0 ) {
+    warn( "io_uring does not support extended arguments." );
+    goto error;
+  }
+
+  if ( !map_rings( &params ) ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    warn( "Failed to map io_uring rings ( errno = %s [%d] ).", error_string, errno );
+    goto error;
+  }
+
+  if ( !setup_buffer_ring() ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    warn( "Failed to register io_uring buffers ( errno = %s [%d] ).", error_string, errno );
+    goto error;
+  }
+
+  engine->recv_mhdr.msg_namelen = sizeof( struct sockaddr_in );
+  engine->recv_mhdr.msg_controllen = 0;
+
+  engine->timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+  engine->event_fd = eventfd( 0, EFD_NONBLOCK );
+  if ( engine->timer_fd < 0 || engine->event_fd < 0 ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    warn( "Failed to create file descriptors for io_uring ( errno = %s [%d] ).", error_string, errno );
+    goto error;
+  }
+  struct itimerspec timer;
+  memset( &timer, 0, sizeof( struct itimerspec ) );
+  timer.it_value.tv_sec = URING_MAINTENANCE_INTERVAL;
+  timer.it_interval.tv_sec = URING_MAINTENANCE_INTERVAL;
+  timerfd_settime( engine->timer_fd, 0, &timer, 0 );
+
+  return true;
+
+error:
+  release_engine();
+
+  return false;
+}
+
+
+bool
+finalize_io_uring_engine() {
+  if ( engine == NULL ) {
+    return true;
+  }
+
+  release_engine();
+
+  return true;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <assert.h>
+#include <string.h>
+#include "latency.h"
+
+
+static unsigned int
+bucket_of( uint64_t value ) {
+  if ( value < 2 * LATENCY_SUB_BUCKETS ) {
+    return ( unsigned int ) value;
+  }
+
+  unsigned int exponent = ( unsigned int ) ( 63 - __builtin_clzll( value ) );
+  unsigned int shift = exponent - LATENCY_SUB_BUCKET_BITS;
+  unsigned int bucket = shift * LATENCY_SUB_BUCKETS + ( unsigned int ) ( value >> shift );
+  if ( bucket >= LATENCY_N_BUCKETS ) {
+    bucket = LATENCY_N_BUCKETS - 1;
+  }
+
+  return bucket;
+}
+
+
+static uint64_t
+bucket_upper_bound( unsigned int bucket ) {
+  if ( bucket < 2 * LATENCY_SUB_BUCKETS ) {
+    return bucket;
+  }
+
+  unsigned int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+  uint64_t lower = ( uint64_t ) ( bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS ) << shift;
+
+  return lower + ( ( uint64_t ) 1 << shift ) - 1;
+}
+
+
+void
+record_latency( struct latency_histogram *histogram, uint64_t since ) {
+  assert( histogram != NULL );
+
+  uint64_t now = latency_clock();
+  uint64_t latency = now > since ? now - since : 0;
+
+  histogram->count++;
+  histogram->sum += latency;
+  if ( latency > histogram->max ) {
+    histogram->max = latency;
+  }
+  histogram->buckets[ bucket_of( latency ) ]++;
+}
+
+
+void
+merge_latency_histogram( struct latency_histogram *to, const struct latency_histogram *from ) {
+  assert( to != NULL );
+  assert( from != NULL );
+
+  to->count += from->count;
+  to->sum += from->sum;
+  if ( from->max > to->max ) {
+    to->max = from->max;
+  }
+  for ( unsigned int i = 0; i < LATENCY_N_BUCKETS; i++ ) {
+    to->buckets[ i ] += from->buckets[ i ];
+  }
+}
+
+
+// Percentiles are the upper bounds of the buckets they fall into.
+static uint64_t
+percentile( const struct latency_histogram *histogram, uint64_t count, unsigned int percent ) {
+  uint64_t rank = ( count * percent + 99 ) / 100;
+  uint64_t seen = 0;
+  for ( unsigned int i = 0; i < LATENCY_N_BUCKETS; i++ ) {
+    seen += histogram->buckets[ i ];
+    if ( seen >= rank ) {
+      uint64_t bound = bucket_upper_bound( i );
+      return bound < histogram->max ? bound : histogram->max;
+    }
+  }
+
+  return histogram->max;
+}
+
+
+void
+summarize_latency( const struct latency_histogram *histogram, struct latency_summary *summary ) {
+  assert( histogram != NULL );
+  assert( summary != NULL );
+
+  // The histogram may be updated while it is copied, so the count is
+  // taken from the buckets.
+  struct latency_histogram copy;
+  memcpy( &copy, histogram, sizeof( copy ) );
+  uint64_t count = 0;
+  for ( unsigned int i = 0; i < LATENCY_N_BUCKETS; i++ ) {
+    count += copy.buckets[ i ];
+  }
+
+  memset( summary, 0, sizeof( struct latency_summary ) );
+  if ( count == 0 ) {
+    return;
+  }
+  summary->count = count;
+  summary->mean = copy.sum / count;
+  summary->p50 = percentile( &copy, count, 50 );
+  summary->p90 = percentile( &copy, count, 90 );
+  summary->p99 = percentile( &copy, count, 99 );
+  summary->max = copy.max;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
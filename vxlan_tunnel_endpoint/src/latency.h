@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+
+#include <stdint.h>
+#include <time.h>
+#include "checks.h"
+
+
+// Time frames spend inside the daemon in nanoseconds, summarized from a
+// histogram when statistics are requested.
+struct latency_summary {
+  uint64_t count;
+  uint64_t mean;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t max;
+};
+
+
+#ifdef LATENCY_STATS
+
+// Log-linear buckets: values below 2 * LATENCY_SUB_BUCKETS have a bucket
+// each, and every power of two above is split into LATENCY_SUB_BUCKETS.
+// The last bucket takes everything from about 17 seconds.
+#define LATENCY_SUB_BUCKET_BITS 3
+#define LATENCY_SUB_BUCKETS ( 1 << LATENCY_SUB_BUCKET_BITS )
+#define LATENCY_N_BUCKETS ( 32 * LATENCY_SUB_BUCKETS )
+
+// Updated without locking by the single thread that completes frames on
+// a path, and copied as is when read.
+struct latency_histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[ LATENCY_N_BUCKETS ];
+};
+
+
+static inline uint64_t
+latency_clock() {
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+
+  return ( uint64_t ) now.tv_sec * 1000000000 + ( uint64_t ) now.tv_nsec;
+}
+
+
+void record_latency( struct latency_histogram *histogram, uint64_t since );
+void merge_latency_histogram( struct latency_histogram *to, const struct latency_histogram *from );
+void summarize_latency( const struct latency_histogram *histogram, struct latency_summary *summary );
+
+#define LATENCY_TIMESTAMP() latency_clock()
+#define RECORD_LATENCY( _histogram, _since ) record_latency( _histogram, _since )
+
+#else // LATENCY_STATS
+
+#define LATENCY_TIMESTAMP() 0
+#define RECORD_LATENCY( _histogram, _since ) UNUSED( _since )
+
+#endif // LATENCY_STATS
+
+
+#endif // LATENCY_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libreflectorctl.h"
+#include "reflector_ctrl_client.h"
+
+
+volatile bool running = true;
+
+static pthread_mutex_t request_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool opened = false;
+
+
+typedef struct {
+  reflectorctl_tep_handler handler;
+  void *user_data;
+  unsigned int n_records;
+} request_context;
+
+
+static void
+handle_record( uint8_t type, const void *record, void *user_data ) {
+  assert( record != NULL );
+  assert( user_data != NULL );
+
+  if ( type != LIST_TEP_REPLY ) {
+    return;
+  }
+
+  request_context *context = user_data;
+  const tunnel_endpoint *src = record;
+  reflectorctl_tunnel_endpoint tep;
+  memset( &tep, 0, sizeof( tep ) );
+  tep.vni = src->vni;
+  inet_ntop( AF_INET, &src->ip_addr, tep.ip_addr, sizeof( tep.ip_addr ) );
+  tep.port = ntohs( src->port );
+  tep.packet_count = src->counters.packet;
+  tep.octet_count = src->counters.octet;
+  context->handler( &tep, context->user_data );
+  context->n_records++;
+}
+
+
+// Takes the lock and opens the connection if not yet. Records in replies
+// are passed to the context until end_request() is called.
+static bool
+begin_request( request_context *context ) {
+  pthread_mutex_lock( &request_mutex );
+
+  if ( !opened ) {
+    opened = init_reflector_ctrl_client();
+  }
+  if ( context != NULL ) {
+    set_reflector_ctrl_record_handler( handle_record, context );
+  }
+
+  return opened;
+}
+
+
+// Releases the lock and converts the result into a status code. The
+// connection is dropped on failures that may have left it out of sync;
+// the next request opens a new one.
+static int
+end_request( bool ret, uint8_t reason ) {
+  set_reflector_ctrl_record_handler( NULL, NULL );
+  if ( !ret && ( reason == SUCCEEDED || reason == OTHER_ERROR ) ) {
+    if ( opened ) {
+      finalize_reflector_ctrl_client();
+      opened = false;
+    }
+    reason = OTHER_ERROR;
+  }
+
+  pthread_mutex_unlock( &request_mutex );
+
+  return ret ? REFLECTORCTL_SUCCEEDED : reason;
+}
+
+
+static bool
+valid_tep_vni( uint32_t vni ) {
+  return vni <= 0x00ffffff;
+}
+
+
+static bool
+parse_ip_addr( const char *string, struct in_addr *addr ) {
+  assert( addr != NULL );
+
+  return string != NULL && inet_pton( AF_INET, string, addr ) == 1;
+}
+
+
+int
+reflectorctl_api_version( void ) {
+  return REFLECTORCTL_API_VERSION;
+}
+
+
+int
+reflectorctl_open( void ) {
+  bool ret = begin_request( NULL );
+
+  return end_request( ret, OTHER_ERROR );
+}
+
+
+void
+reflectorctl_close( void ) {
+  pthread_mutex_lock( &request_mutex );
+
+  if ( opened ) {
+    finalize_reflector_ctrl_client();
+    opened = false;
+  }
+
+  pthread_mutex_unlock( &request_mutex );
+}
+
+
+int
+reflectorctl_add_tep( uint32_t vni, const char *ip_addr, uint16_t port ) {
+  struct in_addr addr;
+  if ( !valid_tep_vni( vni ) || !parse_ip_addr( ip_addr, &addr ) ) {
+    return REFLECTORCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && add_tep( vni, addr, port, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+reflectorctl_set_tep( uint32_t vni, const char *ip_addr, uint16_t port ) {
+  struct in_addr addr;
+  if ( !valid_tep_vni( vni ) || !parse_ip_addr( ip_addr, &addr ) ) {
+    return REFLECTORCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) &&
+             set_tep( vni, addr, SET_TEP_VNI | SET_TEP_IP_ADDR | SET_TEP_PORT, port, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+reflectorctl_delete_tep( uint32_t vni, const char *ip_addr ) {
+  struct in_addr addr;
+  if ( !valid_tep_vni( vni ) || !parse_ip_addr( ip_addr, &addr ) ) {
+    return REFLECTORCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && delete_tep( vni, addr, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+reflectorctl_list_teps( uint32_t vni, reflectorctl_tep_handler handler, void *user_data ) {
+  if ( !( valid_tep_vni( vni ) || vni == REFLECTORCTL_ALL_VNIS ) || handler == NULL ) {
+    return REFLECTORCTL_INVALID_ARGUMENT;
+  }
+
+  request_context context;
+  memset( &context, 0, sizeof( context ) );
+  context.handler = handler;
+  context.user_data = user_data;
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( &context ) && list_tep( vni, NULL, NULL, 0, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+reflectorctl_update_teps( uint32_t vni, const reflectorctl_tep_update *updates, unsigned int n_updates,
+                          bool replace ) {
+  if ( !valid_tep_vni( vni ) || ( updates == NULL && n_updates > 0 ) ) {
+    return REFLECTORCTL_INVALID_ARGUMENT;
+  }
+
+  tep_update *converted = NULL;
+  if ( n_updates > 0 ) {
+    converted = malloc( sizeof( tep_update ) * n_updates );
+    assert( converted != NULL );
+  }
+  for ( unsigned int i = 0; i < n_updates; i++ ) {
+    memset( &converted[ i ], 0, sizeof( tep_update ) );
+    if ( updates[ i ].op == REFLECTORCTL_UPDATE_ADD ) {
+      converted[ i ].op = TEP_UPDATE_ADD;
+      converted[ i ].port = updates[ i ].port;
+    }
+    else if ( updates[ i ].op == REFLECTORCTL_UPDATE_DELETE ) {
+      converted[ i ].op = TEP_UPDATE_DELETE;
+    }
+    else {
+      free( converted );
+      return REFLECTORCTL_INVALID_ARGUMENT;
+    }
+    if ( !parse_ip_addr( updates[ i ].ip_addr, &converted[ i ].ip_addr ) ) {
+      free( converted );
+      return REFLECTORCTL_INVALID_ARGUMENT;
+    }
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && update_teps( vni, converted, n_updates, replace, &reason );
+  free( converted );
+
+  return end_request( ret, reason );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
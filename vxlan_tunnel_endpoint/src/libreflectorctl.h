@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef LIBREFLECTORCTL_H
+#define LIBREFLECTORCTL_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * Client library for the reflectord control interface. Results are
+ * returned in the structures below instead of tables printed by
+ * reflectorctl. Requests are sent over a single connection that is opened
+ * on the first request and kept until reflectorctl_close() is called.
+ * Functions may be called from any thread but requests are serialized.
+ *
+ * All functions except reflectorctl_close() return one of the status
+ * codes below, which are the same as the exit status of reflectorctl.
+ */
+
+
+#define REFLECTORCTL_API_VERSION 1
+
+// Lists tunnel endpoints of all VNIs.
+#define REFLECTORCTL_ALL_VNIS UINT32_MAX
+
+
+enum {
+  REFLECTORCTL_SUCCEEDED = 0,
+  REFLECTORCTL_INVALID_ARGUMENT = 1,
+  REFLECTORCTL_ALREADY_RUNNING = 2,
+  REFLECTORCTL_PORT_ALREADY_IN_USE = 3,
+  REFLECTORCTL_DUPLICATED_TEP_ENTRY = 4,
+  REFLECTORCTL_TEP_ENTRY_NOT_FOUND = 5,
+  REFLECTORCTL_OTHER_ERROR = 255,
+};
+
+enum {
+  REFLECTORCTL_UPDATE_ADD = 1,
+  REFLECTORCTL_UPDATE_DELETE = 2,
+};
+
+
+// Addresses are in text form and NUL-terminated.
+typedef struct {
+  uint32_t vni;
+  char ip_addr[ 16 ];
+  uint16_t port; // Zero if packets are sent to the port they came from
+  uint64_t packet_count;
+  uint64_t octet_count;
+} reflectorctl_tunnel_endpoint;
+
+typedef struct {
+  uint8_t op;
+  char ip_addr[ 16 ];
+  uint16_t port; // Ignored on delete
+} reflectorctl_tep_update;
+
+
+// Called once per tunnel endpoint in order of VNI and IP address. It must
+// not call functions of the library.
+typedef void ( *reflectorctl_tep_handler )( const reflectorctl_tunnel_endpoint *tep, void *user_data );
+
+
+int reflectorctl_api_version( void );
+int reflectorctl_open( void );
+void reflectorctl_close( void );
+int reflectorctl_add_tep( uint32_t vni, const char *ip_addr, uint16_t port );
+int reflectorctl_set_tep( uint32_t vni, const char *ip_addr, uint16_t port );
+int reflectorctl_delete_tep( uint32_t vni, const char *ip_addr );
+int reflectorctl_list_teps( uint32_t vni, reflectorctl_tep_handler handler, void *user_data );
+int reflectorctl_update_teps( uint32_t vni, const reflectorctl_tep_update *updates, unsigned int n_updates,
+                              bool replace );
+
+
+#endif // LIBREFLECTORCTL_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,625 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/ether.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libvxlanctl.h"
+#include "vxlan_ctrl_client.h"
+
+
+#define VNI_MAX 0x00ffffff
+
+
+volatile bool running = true;
+
+static pthread_mutex_t request_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool opened = false;
+
+
+// Where records in replies go. Either a handler is called for each record
+// or a single record is copied out.
+typedef struct {
+  vxlanctl_instance_handler instance_handler;
+  vxlanctl_fdb_entry_handler fdb_entry_handler;
+  vxlanctl_remote_handler remote_handler;
+  void *user_data;
+  vxlanctl_global *global;
+  vxlanctl_instance *instance;
+  unsigned int n_records;
+} request_context;
+
+
+static void
+convert_global( const struct vxlan *vxlan, vxlanctl_global *global ) {
+  assert( vxlan != NULL );
+  assert( global != NULL );
+
+  memset( global, 0, sizeof( vxlanctl_global ) );
+  strncpy( global->ifname, vxlan->ifname, sizeof( global->ifname ) - 1 );
+  global->port = vxlan->port;
+  global->source_port_min = vxlan->source_port_min;
+  global->source_port_max = vxlan->source_port_max;
+  inet_ntop( AF_INET, &vxlan->flooding_addr, global->flooding_addr, sizeof( global->flooding_addr ) );
+  global->flooding_port = vxlan->flooding_port;
+  global->aging_time = ( uint32_t ) vxlan->aging_time;
+  global->max_fdb_entries = vxlan->max_fdb_entries;
+  global->idle_timeout = ( uint32_t ) vxlan->idle_timeout;
+}
+
+
+static void
+convert_instance( const struct vxlan_instance *record, vxlanctl_instance *instance ) {
+  assert( record != NULL );
+  assert( instance != NULL );
+
+  memset( instance, 0, sizeof( vxlanctl_instance ) );
+  instance->vni = ( uint32_t ) ( record->vni[ 0 ] << 16 | record->vni[ 1 ] << 8 | record->vni[ 2 ] );
+  instance->state = VXLANCTL_STATE_INACTIVE;
+  if ( record->activated ) {
+    instance->state = record->fdb == NULL && !record->worker_started ? VXLANCTL_STATE_DORMANT : VXLANCTL_STATE_ACTIVE;
+  }
+  inet_ntop( AF_INET, &record->addr.sin_addr, instance->flooding_addr, sizeof( instance->flooding_addr ) );
+  instance->port = record->port;
+  instance->vlan = record->vlan;
+  instance->inner_vlan = record->inner_vlan;
+  instance->aging_time = ( uint32_t ) record->aging_time;
+  instance->max_fdb_entries = record->fdb_stats.max_entries;
+  instance->n_fdb_entries = record->fdb_stats.n_entries;
+  instance->fdb_memory_usage = record->fdb_stats.memory_usage;
+  instance->learning = record->learning;
+  instance->flood_rate = record->flood_rate;
+  instance->neighbor_suppression = record->neighbor_suppression;
+  instance->unknown_unicast_flooded = record->stats.unknown_unicast_flooded;
+  instance->unknown_unicast_dropped = record->stats.unknown_unicast_dropped;
+  instance->neighbor_suppression_hits = record->stats.neighbor_suppression_hits;
+  instance->neighbor_suppression_misses = record->stats.neighbor_suppression_misses;
+  instance->egress_dropped = record->stats.egress_dropped;
+}
+
+
+static void
+convert_fdb_entry( const fdb_entry_record *record, vxlanctl_fdb_entry *entry ) {
+  assert( record != NULL );
+  assert( entry != NULL );
+
+  memset( entry, 0, sizeof( vxlanctl_fdb_entry ) );
+  const uint8_t *mac = record->eth_addr.ether_addr_octet;
+  snprintf( entry->eth_addr, sizeof( entry->eth_addr ), "%02x:%02x:%02x:%02x:%02x:%02x",
+            mac[ 0 ], mac[ 1 ], mac[ 2 ], mac[ 3 ], mac[ 4 ], mac[ 5 ] );
+  inet_ntop( AF_INET, &record->ip_addr, entry->ip_addr, sizeof( entry->ip_addr ) );
+  entry->type = record->type == FDB_ENTRY_TYPE_DYNAMIC ? VXLANCTL_FDB_ENTRY_DYNAMIC : VXLANCTL_FDB_ENTRY_STATIC;
+
+  // Timestamps in FDB entries are seconds on the coarse monotonic clock.
+  struct timespec now = { 0, 0 };
+  clock_gettime( CLOCK_MONOTONIC_COARSE, &now );
+  if ( now.tv_sec > ( time_t ) record->created_at ) {
+    entry->age = ( uint32_t ) ( now.tv_sec - ( time_t ) record->created_at );
+  }
+  if ( record->aging_time > 0 ) {
+    time_t expire_in = ( time_t ) record->last_seen + ( time_t ) record->aging_time - now.tv_sec;
+    entry->expire_in = expire_in > 0 ? ( uint32_t ) expire_in : 0;
+  }
+}
+
+
+static void
+handle_record( uint8_t type, const void *record, void *user_data ) {
+  assert( record != NULL );
+  assert( user_data != NULL );
+
+  request_context *context = user_data;
+  switch ( type ) {
+    case SHOW_GLOBAL_REPLY:
+    {
+      if ( context->global != NULL ) {
+        convert_global( record, context->global );
+      }
+    }
+    break;
+
+    case LIST_INSTANCES_REPLY:
+    {
+      vxlanctl_instance instance;
+      convert_instance( record, &instance );
+      if ( context->instance != NULL ) {
+        *context->instance = instance;
+      }
+      else if ( context->instance_handler != NULL ) {
+        context->instance_handler( &instance, context->user_data );
+      }
+    }
+    break;
+
+    case SHOW_FDB_REPLY:
+    {
+      vxlanctl_fdb_entry entry;
+      convert_fdb_entry( record, &entry );
+      if ( context->fdb_entry_handler != NULL ) {
+        context->fdb_entry_handler( &entry, context->user_data );
+      }
+    }
+    break;
+
+    case SHOW_REMOTES_REPLY:
+    {
+      char addr[ INET_ADDRSTRLEN ];
+      memset( addr, '\0', sizeof( addr ) );
+      inet_ntop( AF_INET, record, addr, sizeof( addr ) );
+      if ( context->remote_handler != NULL ) {
+        context->remote_handler( addr, context->user_data );
+      }
+    }
+    break;
+
+    default:
+      return;
+  }
+
+  context->n_records++;
+}
+
+
+// Takes the lock and opens the connection if not yet. Records in replies
+// are passed to the context until end_request() is called.
+static bool
+begin_request( request_context *context ) {
+  pthread_mutex_lock( &request_mutex );
+
+  if ( !opened ) {
+    opened = init_vxlan_ctrl_client();
+  }
+  if ( context != NULL ) {
+    set_vxlan_ctrl_record_handler( handle_record, context );
+  }
+
+  return opened;
+}
+
+
+// Releases the lock and converts the result into a status code. The
+// connection is dropped on failures that may have left it out of sync,
+// e.g. when the daemon restarted; the next request opens a new one.
+static int
+end_request( bool ret, uint8_t reason ) {
+  set_vxlan_ctrl_record_handler( NULL, NULL );
+  if ( !ret && ( reason == SUCCEEDED || reason == OTHER_ERROR ) ) {
+    if ( opened ) {
+      finalize_vxlan_ctrl_client();
+      opened = false;
+    }
+    reason = OTHER_ERROR;
+  }
+
+  pthread_mutex_unlock( &request_mutex );
+
+  return ret ? VXLANCTL_SUCCEEDED : reason;
+}
+
+
+static bool
+parse_ip_addr( const char *string, struct in_addr *addr ) {
+  assert( addr != NULL );
+
+  if ( string == NULL || string[ 0 ] == '\0' ) {
+    addr->s_addr = htonl( INADDR_ANY );
+    return true;
+  }
+
+  return inet_pton( AF_INET, string, addr ) == 1;
+}
+
+
+static bool
+parse_eth_addr( const char *string, struct ether_addr *addr ) {
+  assert( addr != NULL );
+
+  return string != NULL && ether_aton_r( string, addr ) != NULL;
+}
+
+
+static bool
+convert_fdb_updates( const vxlanctl_fdb_update *updates, unsigned int n_updates, fdb_update *converted ) {
+  assert( updates != NULL || n_updates == 0 );
+  assert( converted != NULL || n_updates == 0 );
+
+  for ( unsigned int i = 0; i < n_updates; i++ ) {
+    memset( &converted[ i ], 0, sizeof( fdb_update ) );
+    if ( updates[ i ].op == VXLANCTL_UPDATE_ADD ) {
+      converted[ i ].op = FDB_UPDATE_ADD;
+      if ( inet_pton( AF_INET, updates[ i ].ip_addr, &converted[ i ].ip_addr ) != 1 ) {
+        return false;
+      }
+    }
+    else if ( updates[ i ].op == VXLANCTL_UPDATE_DELETE ) {
+      converted[ i ].op = FDB_UPDATE_DELETE;
+    }
+    else {
+      return false;
+    }
+    if ( !parse_eth_addr( updates[ i ].eth_addr, &converted[ i ].eth_addr ) ) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+static bool
+convert_neighbor_updates( const vxlanctl_neighbor_update *updates, unsigned int n_updates,
+                          neighbor_update *converted ) {
+  assert( updates != NULL || n_updates == 0 );
+  assert( converted != NULL || n_updates == 0 );
+
+  for ( unsigned int i = 0; i < n_updates; i++ ) {
+    memset( &converted[ i ], 0, sizeof( neighbor_update ) );
+    if ( updates[ i ].op == VXLANCTL_UPDATE_ADD ) {
+      converted[ i ].op = FDB_UPDATE_ADD;
+      if ( !parse_eth_addr( updates[ i ].eth_addr, &converted[ i ].eth_addr ) ) {
+        return false;
+      }
+    }
+    else if ( updates[ i ].op == VXLANCTL_UPDATE_DELETE ) {
+      converted[ i ].op = FDB_UPDATE_DELETE;
+    }
+    else {
+      return false;
+    }
+    if ( inet_pton( AF_INET, updates[ i ].ip_addr, converted[ i ].addr ) == 1 ) {
+      converted[ i ].family = AF_INET;
+    }
+    else if ( inet_pton( AF_INET6, updates[ i ].ip_addr, converted[ i ].addr ) == 1 ) {
+      converted[ i ].family = AF_INET6;
+    }
+    else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+int
+vxlanctl_api_version( void ) {
+  return VXLANCTL_API_VERSION;
+}
+
+
+int
+vxlanctl_open( void ) {
+  bool ret = begin_request( NULL );
+
+  return end_request( ret, OTHER_ERROR );
+}
+
+
+void
+vxlanctl_close( void ) {
+  pthread_mutex_lock( &request_mutex );
+
+  if ( opened ) {
+    finalize_vxlan_ctrl_client();
+    opened = false;
+  }
+
+  pthread_mutex_unlock( &request_mutex );
+}
+
+
+int
+vxlanctl_add_instance( uint32_t vni, const char *flooding_addr, uint16_t port, int aging_time,
+                       int max_fdb_entries, bool learning, int flood_rate, bool neighbor_suppression,
+                       uint16_t vlan, uint16_t inner_vlan ) {
+  struct in_addr addr;
+  if ( vni > VNI_MAX || !parse_ip_addr( flooding_addr, &addr ) ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) &&
+             add_instance( vni, addr, port, ( time_t ) aging_time, max_fdb_entries, learning, flood_rate,
+                           neighbor_suppression, vlan, inner_vlan, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_set_instance( uint32_t vni, unsigned int set, const char *flooding_addr, uint16_t port, int aging_time,
+                       int max_fdb_entries, bool learning, int flood_rate, bool neighbor_suppression ) {
+  struct in_addr addr;
+  if ( vni > VNI_MAX || !parse_ip_addr( flooding_addr, &addr ) ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint16_t set_bitmap = SET_VNI;
+  set_bitmap |= ( set & VXLANCTL_SET_FLOODING_ADDR ) != 0 ? SET_IP_ADDR : 0;
+  set_bitmap |= ( set & VXLANCTL_SET_PORT ) != 0 ? SET_UDP_PORT : 0;
+  set_bitmap |= ( set & VXLANCTL_SET_AGING_TIME ) != 0 ? SET_AGING_TIME : 0;
+  set_bitmap |= ( set & VXLANCTL_SET_MAX_FDB_ENTRIES ) != 0 ? SET_MAX_FDB_ENTRIES : 0;
+  set_bitmap |= ( set & VXLANCTL_SET_LEARNING ) != 0 ? SET_LEARNING : 0;
+  set_bitmap |= ( set & VXLANCTL_SET_FLOOD_RATE ) != 0 ? SET_FLOOD_RATE : 0;
+  set_bitmap |= ( set & VXLANCTL_SET_NEIGHBOR_SUPPRESSION ) != 0 ? SET_NEIGHBOR_SUPPRESSION : 0;
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) &&
+             set_instance( vni, set_bitmap, addr, port, ( time_t ) aging_time, max_fdb_entries, learning,
+                           flood_rate, neighbor_suppression, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_activate_instance( uint32_t vni ) {
+  if ( vni > VNI_MAX ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && activate_instance( vni, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_inactivate_instance( uint32_t vni ) {
+  if ( vni > VNI_MAX ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && inactivate_instance( vni, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_delete_instance( uint32_t vni ) {
+  if ( vni > VNI_MAX ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && delete_instance( vni, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_show_global( vxlanctl_global *global ) {
+  if ( global == NULL ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  request_context context;
+  memset( &context, 0, sizeof( context ) );
+  context.global = global;
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( &context ) && show_global( 0, &reason );
+  if ( ret && context.n_records == 0 ) {
+    ret = false;
+    reason = OTHER_ERROR;
+  }
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_list_instances( vxlanctl_instance_handler handler, void *user_data ) {
+  if ( handler == NULL ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  request_context context;
+  memset( &context, 0, sizeof( context ) );
+  context.instance_handler = handler;
+  context.user_data = user_data;
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( &context ) && list_instances( 0xffffffff, 0, NULL, 0, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_show_instance( uint32_t vni, vxlanctl_instance *instance ) {
+  if ( vni > VNI_MAX || instance == NULL ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  request_context context;
+  memset( &context, 0, sizeof( context ) );
+  context.instance = instance;
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( &context ) && list_instances( vni, 0, NULL, 0, &reason );
+  if ( ret && context.n_records == 0 ) {
+    ret = false;
+    reason = INSTANCE_NOT_FOUND;
+  }
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_show_fdb( uint32_t vni, vxlanctl_fdb_entry_handler handler, void *user_data ) {
+  if ( vni > VNI_MAX || handler == NULL ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  request_context context;
+  memset( &context, 0, sizeof( context ) );
+  context.fdb_entry_handler = handler;
+  context.user_data = user_data;
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( &context ) && show_fdb( vni, NULL, NULL, 0, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_add_fdb_entry( uint32_t vni, const char *eth_addr, const char *ip_addr, int aging_time ) {
+  struct ether_addr mac;
+  struct in_addr addr;
+  if ( vni > VNI_MAX || !parse_eth_addr( eth_addr, &mac ) || ip_addr == NULL ||
+       inet_pton( AF_INET, ip_addr, &addr ) != 1 ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && add_fdb_entry( vni, mac, addr, ( time_t ) aging_time, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_delete_fdb_entry( uint32_t vni, const char *eth_addr ) {
+  struct ether_addr mac;
+  if ( vni > VNI_MAX || !parse_eth_addr( eth_addr, &mac ) ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && delete_fdb_entry( vni, mac, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_update_fdb( uint32_t vni, const vxlanctl_fdb_update *updates, unsigned int n_updates, bool replace ) {
+  if ( vni > VNI_MAX || ( updates == NULL && n_updates > 0 ) ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  fdb_update *converted = NULL;
+  if ( n_updates > 0 ) {
+    converted = malloc( sizeof( fdb_update ) * n_updates );
+    assert( converted != NULL );
+  }
+  if ( !convert_fdb_updates( updates, n_updates, converted ) ) {
+    free( converted );
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && update_fdb( vni, converted, n_updates, replace, &reason );
+  free( converted );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_update_neighbors( uint32_t vni, const vxlanctl_neighbor_update *updates, unsigned int n_updates ) {
+  if ( vni > VNI_MAX || ( updates == NULL && n_updates > 0 ) ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  neighbor_update *converted = NULL;
+  if ( n_updates > 0 ) {
+    converted = malloc( sizeof( neighbor_update ) * n_updates );
+    assert( converted != NULL );
+  }
+  if ( !convert_neighbor_updates( updates, n_updates, converted ) ) {
+    free( converted );
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && update_neighbors( vni, converted, n_updates, &reason );
+  free( converted );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_add_remote( uint32_t vni, const char *ip_addr ) {
+  struct in_addr addr;
+  if ( vni > VNI_MAX || ip_addr == NULL || inet_pton( AF_INET, ip_addr, &addr ) != 1 ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && add_remote( vni, addr, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+// Deletes all remotes of the instance if no address is given.
+int
+vxlanctl_delete_remote( uint32_t vni, const char *ip_addr ) {
+  struct in_addr addr;
+  if ( vni > VNI_MAX || !parse_ip_addr( ip_addr, &addr ) ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( NULL ) && delete_remote( vni, addr, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+int
+vxlanctl_show_remotes( uint32_t vni, vxlanctl_remote_handler handler, void *user_data ) {
+  if ( vni > VNI_MAX || handler == NULL ) {
+    return VXLANCTL_INVALID_ARGUMENT;
+  }
+
+  request_context context;
+  memset( &context, 0, sizeof( context ) );
+  context.remote_handler = handler;
+  context.user_data = user_data;
+
+  uint8_t reason = OTHER_ERROR;
+  bool ret = begin_request( &context ) && show_remotes( vni, &reason );
+
+  return end_request( ret, reason );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef LIBVXLANCTL_H
+#define LIBVXLANCTL_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * Client library for the vxland control interface. Unlike vxlanctl, which
+ * prints tables, results are returned in the structures below. Requests
+ * are sent over a single connection that is opened on the first request
+ * and kept until vxlanctl_close() is called. Functions may be called from
+ * any thread but requests are serialized.
+ *
+ * All functions except vxlanctl_close() return one of the status codes
+ * below, which are the same as the exit status of vxlanctl.
+ */
+
+
+#define VXLANCTL_API_VERSION 1
+
+// Leaves aging time, maximum number of FDB entries or flood rate to the
+// daemon's default.
+#define VXLANCTL_DEFAULT ( -1 )
+
+
+enum {
+  VXLANCTL_SUCCEEDED = 0,
+  VXLANCTL_INVALID_ARGUMENT = 1,
+  VXLANCTL_ALREADY_RUNNING = 2,
+  VXLANCTL_PORT_ALREADY_IN_USE = 3,
+  VXLANCTL_SOURCE_PORTS_NOT_ALLOCATED = 4,
+  VXLANCTL_DUPLICATED_INSTANCE = 5,
+  VXLANCTL_INSTANCE_NOT_FOUND = 6,
+  VXLANCTL_OTHER_ERROR = 255,
+};
+
+enum {
+  VXLANCTL_STATE_INACTIVE = 0,
+  VXLANCTL_STATE_ACTIVE = 1,
+  VXLANCTL_STATE_DORMANT = 2, // Active but without tables or thread until it sees traffic
+};
+
+enum {
+  VXLANCTL_FDB_ENTRY_DYNAMIC = 0,
+  VXLANCTL_FDB_ENTRY_STATIC = 1,
+};
+
+enum {
+  VXLANCTL_UPDATE_ADD = 1,
+  VXLANCTL_UPDATE_DELETE = 2,
+};
+
+// Attributes changed by vxlanctl_set_instance().
+enum {
+  VXLANCTL_SET_FLOODING_ADDR = 0x0001,
+  VXLANCTL_SET_PORT = 0x0002,
+  VXLANCTL_SET_AGING_TIME = 0x0004,
+  VXLANCTL_SET_MAX_FDB_ENTRIES = 0x0008,
+  VXLANCTL_SET_LEARNING = 0x0010,
+  VXLANCTL_SET_FLOOD_RATE = 0x0020,
+  VXLANCTL_SET_NEIGHBOR_SUPPRESSION = 0x0040,
+};
+
+
+// Addresses are in text form and NUL-terminated.
+typedef struct {
+  char ifname[ 16 ];
+  uint16_t port;
+  uint16_t source_port_min; // Zero if the UDP port is used as source port
+  uint16_t source_port_max;
+  char flooding_addr[ 16 ];
+  uint16_t flooding_port;
+  uint32_t aging_time;
+  uint32_t max_fdb_entries;
+  uint32_t idle_timeout;
+} vxlanctl_global;
+
+typedef struct {
+  uint32_t vni;
+  uint8_t state;
+  char flooding_addr[ 16 ];
+  uint16_t port;
+  uint16_t vlan; // Zero unless attached to the trunk
+  uint16_t inner_vlan;
+  uint32_t aging_time;
+  uint32_t max_fdb_entries;
+  uint32_t n_fdb_entries;
+  uint64_t fdb_memory_usage; // In bytes
+  bool learning;
+  int32_t flood_rate;
+  bool neighbor_suppression;
+  uint64_t unknown_unicast_flooded;
+  uint64_t unknown_unicast_dropped;
+  uint64_t neighbor_suppression_hits;
+  uint64_t neighbor_suppression_misses;
+  uint64_t egress_dropped;
+} vxlanctl_instance;
+
+typedef struct {
+  char eth_addr[ 18 ];
+  char ip_addr[ 16 ];
+  uint8_t type;
+  uint32_t age; // Seconds since the entry was created
+  uint32_t expire_in; // Zero if the entry does not age
+} vxlanctl_fdb_entry;
+
+typedef struct {
+  uint8_t op;
+  char eth_addr[ 18 ];
+  char ip_addr[ 16 ]; // Ignored on delete
+} vxlanctl_fdb_update;
+
+typedef struct {
+  uint8_t op;
+  char ip_addr[ 46 ]; // IPv4 or IPv6
+  char eth_addr[ 18 ]; // Ignored on delete
+} vxlanctl_neighbor_update;
+
+
+// Handlers are called once per record in order of VNI, MAC or IP address.
+// They must not call functions of the library.
+typedef void ( *vxlanctl_instance_handler )( const vxlanctl_instance *instance, void *user_data );
+typedef void ( *vxlanctl_fdb_entry_handler )( const vxlanctl_fdb_entry *entry, void *user_data );
+typedef void ( *vxlanctl_remote_handler )( const char *ip_addr, void *user_data );
+
+
+int vxlanctl_api_version( void );
+int vxlanctl_open( void );
+void vxlanctl_close( void );
+int vxlanctl_add_instance( uint32_t vni, const char *flooding_addr, uint16_t port, int aging_time,
+                           int max_fdb_entries, bool learning, int flood_rate, bool neighbor_suppression,
+                           uint16_t vlan, uint16_t inner_vlan );
+int vxlanctl_set_instance( uint32_t vni, unsigned int set, const char *flooding_addr, uint16_t port, int aging_time,
+                           int max_fdb_entries, bool learning, int flood_rate, bool neighbor_suppression );
+int vxlanctl_activate_instance( uint32_t vni );
+int vxlanctl_inactivate_instance( uint32_t vni );
+int vxlanctl_delete_instance( uint32_t vni );
+int vxlanctl_show_global( vxlanctl_global *global );
+int vxlanctl_list_instances( vxlanctl_instance_handler handler, void *user_data );
+int vxlanctl_show_instance( uint32_t vni, vxlanctl_instance *instance );
+int vxlanctl_show_fdb( uint32_t vni, vxlanctl_fdb_entry_handler handler, void *user_data );
+int vxlanctl_add_fdb_entry( uint32_t vni, const char *eth_addr, const char *ip_addr, int aging_time );
+int vxlanctl_delete_fdb_entry( uint32_t vni, const char *eth_addr );
+int vxlanctl_update_fdb( uint32_t vni, const vxlanctl_fdb_update *updates, unsigned int n_updates, bool replace );
+int vxlanctl_update_neighbors( uint32_t vni, const vxlanctl_neighbor_update *updates, unsigned int n_updates );
+int vxlanctl_add_remote( uint32_t vni, const char *ip_addr );
+int vxlanctl_delete_remote( uint32_t vni, const char *ip_addr );
+int vxlanctl_show_remotes( uint32_t vni, vxlanctl_remote_handler handler, void *user_data );
+
+
+#endif // LIBVXLANCTL_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -22,13 +22,40 @@
 #include <linux/limits.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 #include "checks.h"
 #include "log.h"
 
 
+#define LOG_MESSAGE_LENGTH 256
+#define LOG_RING_SIZE 64 // Must be a power of two
+#define LOG_FLUSH_INTERVAL 10000000 // nanoseconds
+
+
+// A message formatted by the thread that logged it and waiting to be
+// written by the flusher.
+typedef struct {
+  int priority;
+  char message[ LOG_MESSAGE_LENGTH ];
+} log_record;
+
+// Each thread that logs owns a ring with a single producer (the thread)
+// and a single consumer (the flusher). Rings of exited threads are kept
+// and handed to new threads once drained.
+typedef struct log_ring {
+  log_record records[ LOG_RING_SIZE ];
+  uint32_t head; // Next record to write out; advanced by the flusher
+  uint32_t tail; // Next record to fill; advanced by the owner
+  uint32_t n_dropped;
+  bool released;
+  struct log_ring *next;
+} log_ring;
+
+
 static const char *log_levels[] = { "critical", "error", "warning", "notice", "info", "debug" };
 
 static pthread_mutex_t mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
@@ -36,6 +63,15 @@ static uint8_t output_to = 0;
 static char ident_string[ PATH_MAX ];
 static int log_level = LOG_INFO;
 
+static log_ring *rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread log_ring *thread_ring = NULL;
+static bool async = false;
+static volatile bool flusher_running = false;
+static pthread_t flusher_tid;
+
 
 void
 set_log_level( int priority ) {
@@ -47,12 +83,176 @@ set_log_level( int priority ) {
 
 
 static void
-log_stdout( const char *format, va_list ap ) {
-  size_t length = strlen( format ) + 2;
-  char format_newline[ length ];
-  snprintf( format_newline, length, "%s\n", format );
-  vprintf( format_newline, ap );
-  fflush( stdout );
+write_message( int priority, const char *message ) {
+  if ( output_to & LOG_OUTPUT_STDOUT ) {
+    fputs( message, stdout );
+    fputc( '\n', stdout );
+  }
+  if ( output_to & LOG_OUTPUT_SYSLOG ) {
+    syslog( priority, "%s", message );
+  }
+}
+
+
+static void
+release_ring( void *ring ) {
+  __atomic_store_n( &( ( log_ring * ) ring )->released, true, __ATOMIC_RELEASE );
+}
+
+
+static void
+create_ring_key() {
+  pthread_key_create( &ring_key, release_ring );
+}
+
+
+// Finds a drained ring released by an exited thread or allocates one.
+static log_ring *
+get_thread_ring() {
+  if ( thread_ring != NULL ) {
+    return thread_ring;
+  }
+
+  pthread_once( &ring_key_once, create_ring_key );
+
+  pthread_mutex_lock( &rings_mutex );
+  log_ring *ring = NULL;
+  for ( log_ring *r = rings; r != NULL; r = r->next ) {
+    if ( __atomic_load_n( &r->released, __ATOMIC_ACQUIRE ) &&
+         __atomic_load_n( &r->head, __ATOMIC_ACQUIRE ) == r->tail ) {
+      ring = r;
+      ring->released = false;
+      break;
+    }
+  }
+  if ( ring == NULL ) {
+    ring = malloc( sizeof( log_ring ) );
+    if ( ring != NULL ) {
+      memset( ring, 0, sizeof( log_ring ) );
+      ring->next = rings;
+      __atomic_store_n( &rings, ring, __ATOMIC_RELEASE );
+    }
+  }
+  pthread_mutex_unlock( &rings_mutex );
+
+  if ( ring != NULL ) {
+    pthread_setspecific( ring_key, ring );
+  }
+  thread_ring = ring;
+
+  return ring;
+}
+
+
+// Returns a record to fill in the ring of the calling thread, or NULL
+// if the ring is full. The record is handed to the flusher with
+// commit_record().
+static log_record *
+reserve_record() {
+  log_ring *ring = get_thread_ring();
+  if ( ring == NULL ) {
+    return NULL;
+  }
+
+  uint32_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+  if ( ring->tail - head >= LOG_RING_SIZE ) {
+    __atomic_add_fetch( &ring->n_dropped, 1, __ATOMIC_RELAXED );
+    return NULL;
+  }
+
+  return &ring->records[ ring->tail & ( LOG_RING_SIZE - 1 ) ];
+}
+
+
+static void
+commit_record() {
+  __atomic_store_n( &thread_ring->tail, thread_ring->tail + 1, __ATOMIC_RELEASE );
+}
+
+
+// Writes out records of all threads. Returns the number of records written.
+static unsigned int
+flush_rings() {
+  unsigned int n_records = 0;
+
+  pthread_mutex_lock( &mutex );
+  for ( log_ring *ring = __atomic_load_n( &rings, __ATOMIC_ACQUIRE ); ring != NULL; ring = ring->next ) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+    for ( ; head != tail; head++ ) {
+      log_record *record = &ring->records[ head & ( LOG_RING_SIZE - 1 ) ];
+      write_message( record->priority, record->message );
+      n_records++;
+    }
+    __atomic_store_n( &ring->head, head, __ATOMIC_RELEASE );
+
+    uint32_t n_dropped = __atomic_exchange_n( &ring->n_dropped, 0, __ATOMIC_RELAXED );
+    if ( n_dropped > 0 ) {
+      char message[ LOG_MESSAGE_LENGTH ];
+      snprintf( message, sizeof( message ), "%u log messages are dropped.", n_dropped );
+      write_message( LOG_WARNING, message );
+    }
+  }
+  if ( n_records > 0 && ( output_to & LOG_OUTPUT_STDOUT ) ) {
+    fflush( stdout );
+  }
+  pthread_mutex_unlock( &mutex );
+
+  return n_records;
+}
+
+
+static void *
+flush_log( void *arg ) {
+  UNUSED( arg );
+
+  while ( __atomic_load_n( &flusher_running, __ATOMIC_ACQUIRE ) ) {
+    if ( flush_rings() == 0 ) {
+      struct timespec interval = { 0, LOG_FLUSH_INTERVAL };
+      nanosleep( &interval, NULL );
+    }
+  }
+  flush_rings();
+
+  return NULL;
+}
+
+
+static void
+log_message( int priority, uint32_t n_suppressed, const char *format, va_list args ) {
+  // Critical messages are often the last ones before exiting.
+  bool deferred = __atomic_load_n( &async, __ATOMIC_ACQUIRE ) && priority > LOG_CRIT;
+  log_record *record = NULL;
+  char buf[ LOG_MESSAGE_LENGTH * 4 ];
+  char *message = buf;
+  size_t size = sizeof( buf );
+  if ( deferred ) {
+    record = reserve_record();
+    if ( record == NULL ) {
+      return;
+    }
+    record->priority = priority;
+    message = record->message;
+    size = sizeof( record->message );
+  }
+
+  int length = vsnprintf( message, size, format, args );
+  if ( n_suppressed > 0 && length >= 0 && ( size_t ) length < size ) {
+    snprintf( message + length, size - ( size_t ) length,
+              " ( %u similar messages are suppressed )", n_suppressed );
+  }
+
+  if ( deferred ) {
+    commit_record();
+    return;
+  }
+
+  pthread_mutex_lock( &mutex );
+  write_message( priority, message );
+  if ( output_to & LOG_OUTPUT_STDOUT ) {
+    fflush( stdout );
+  }
+  pthread_mutex_unlock( &mutex );
 }
 
 
@@ -62,25 +262,49 @@ do_log( int priority, const char *format, ... ) {
   assert( priority <= LOG_DEBUG );
   assert( format != NULL );
 
-  if ( priority > log_level ) {
+  if ( priority > log_level || output_to == 0 ) {
     return;
   }
 
-  pthread_mutex_lock( &mutex );
-
   va_list args;
-  if ( output_to & LOG_OUTPUT_STDOUT ) {
-    va_start( args, format );
-    log_stdout( format, args );
-    va_end( args );
+  va_start( args, format );
+  log_message( priority, 0, format, args );
+  va_end( args );
+}
+
+
+// Logs a message unless the call site logged LOG_RATE_LIMIT messages in
+// the current second. Counters are updated without locking, so the limit
+// is approximate when several threads log from the same site.
+void
+do_log_at_site( log_site *site, int priority, const char *format, ... ) {
+  assert( site != NULL );
+  assert( priority >= LOG_CRIT );
+  assert( priority <= LOG_DEBUG );
+  assert( format != NULL );
+
+  if ( priority > log_level || output_to == 0 ) {
+    return;
   }
-  if ( output_to & LOG_OUTPUT_SYSLOG ) {
-    va_start( args, format );
-    vsyslog( priority, format, args );
-    va_end( args );
+
+  struct timespec now = { 0, 0 };
+  clock_gettime( CLOCK_MONOTONIC_COARSE, &now );
+  uint32_t second = ( uint32_t ) now.tv_sec;
+  uint32_t n_suppressed = 0;
+  if ( __atomic_load_n( &site->second, __ATOMIC_RELAXED ) != second ) {
+    __atomic_store_n( &site->second, second, __ATOMIC_RELAXED );
+    __atomic_store_n( &site->n_logged, 0, __ATOMIC_RELAXED );
+    n_suppressed = __atomic_exchange_n( &site->n_suppressed, 0, __ATOMIC_RELAXED );
+  }
+  if ( __atomic_add_fetch( &site->n_logged, 1, __ATOMIC_RELAXED ) > LOG_RATE_LIMIT ) {
+    __atomic_add_fetch( &site->n_suppressed, 1, __ATOMIC_RELAXED );
+    return;
   }
 
-  pthread_mutex_unlock( &mutex );
+  va_list args;
+  va_start( args, format );
+  log_message( priority, n_suppressed, format, args );
+  va_end( args );
 }
 
 
@@ -99,24 +323,46 @@ set_log_level_from_environment_variable() {
 }
 
 
+// With LOG_OUTPUT_ASYNC, messages are formatted into a ring of the
+// calling thread and written out by a background thread, so that threads
+// never wait for stdout or syslog. The thread must be started after
+// daemonizing; call finalize_log() before forking.
 void
 init_log( const char *ident, uint8_t output ) {
   assert( ident != NULL );
 
   set_log_level_from_environment_variable();
 
-  output_to = output;
+  output_to = output & ( LOG_OUTPUT_STDOUT | LOG_OUTPUT_SYSLOG );
 
   if ( output_to & LOG_OUTPUT_SYSLOG ) {
     memset( ident_string, '\0', sizeof( ident_string ) );
     strncpy( ident_string, ident, sizeof( ident_string ) - 1 );
     openlog( ident_string, LOG_NDELAY, LOG_USER );
   }
+
+  if ( ( output & LOG_OUTPUT_ASYNC ) != 0 && output_to != 0 ) {
+    flusher_running = true;
+    if ( pthread_create( &flusher_tid, NULL, flush_log, NULL ) == 0 ) {
+      pthread_setname_np( flusher_tid, "log_flusher" );
+      __atomic_store_n( &async, true, __ATOMIC_RELEASE );
+    }
+    else {
+      flusher_running = false;
+    }
+  }
 }
 
 
 void
 finalize_log() {
+  if ( __atomic_load_n( &async, __ATOMIC_ACQUIRE ) ) {
+    __atomic_store_n( &async, false, __ATOMIC_RELEASE );
+    __atomic_store_n( &flusher_running, false, __ATOMIC_RELEASE );
+    pthread_join( flusher_tid, NULL );
+    flush_rings();
+  }
+
   if ( output_to & LOG_OUTPUT_SYSLOG ) {
     closelog();
     memset( ident_string, '\0', sizeof( ident_string ) );
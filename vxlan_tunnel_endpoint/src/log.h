@@ -29,17 +29,37 @@
 
 #define LOG_OUTPUT_STDOUT 0x01
 #define LOG_OUTPUT_SYSLOG 0x02
+#define LOG_OUTPUT_ASYNC 0x04 // Written by a background thread
+
+// Messages per second logged from a single call site. The rest are
+// counted and reported with the next message logged from there.
+#define LOG_RATE_LIMIT 10
+
+
+typedef struct {
+  uint32_t second;
+  uint32_t n_logged;
+  uint32_t n_suppressed;
+} log_site;
+
+
+#define LOG_AT_SITE( priority, ... )                     \
+  do {                                                   \
+    static log_site log_site_;                           \
+    do_log_at_site( &log_site_, priority, __VA_ARGS__ ); \
+  } while ( 0 )
 
 #define critical( ... ) do_log( LOG_CRIT, __VA_ARGS__ );
-#define error( ... ) do_log( LOG_ERR, __VA_ARGS__ );
-#define warn( ... ) do_log( LOG_WARNING, __VA_ARGS__ );
-#define notice( ... ) do_log( LOG_NOTICE, __VA_ARGS__ );
-#define info( ... ) do_log( LOG_INFO, __VA_ARGS__ );
-#define debug( ... ) do_log( LOG_DEBUG, __VA_ARGS__ );
+#define error( ... ) LOG_AT_SITE( LOG_ERR, __VA_ARGS__ );
+#define warn( ... ) LOG_AT_SITE( LOG_WARNING, __VA_ARGS__ );
+#define notice( ... ) LOG_AT_SITE( LOG_NOTICE, __VA_ARGS__ );
+#define info( ... ) LOG_AT_SITE( LOG_INFO, __VA_ARGS__ );
+#define debug( ... ) LOG_AT_SITE( LOG_DEBUG, __VA_ARGS__ );
 
 
 void set_log_level( int priority );
 void do_log( int priority, const char *format, ... );
+void do_log_at_site( log_site *site, int priority, const char *format, ... );
 void init_log( const char *ident, uint8_t output );
 void finalize_log();
 
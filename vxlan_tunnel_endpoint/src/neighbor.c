@@ -0,0 +1,516 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Per-instance IP to MAC address table for answering ARP requests and
+ * IPv6 neighbor solicitations locally instead of flooding them to every
+ * tunnel end point. The data path looks entries up without locks, and
+ * replaced or deleted entries are reclaimed with QSBR.
+ */
+
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/icmp6.h>
+#include <netinet/if_ether.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "checks.h"
+#include "fdb.h"
+#include "neighbor.h"
+#include "qsbr.h"
+#include "wrapper.h"
+
+
+struct nd_packet {
+  struct ip6_hdr ip6;
+  union {
+    struct nd_neighbor_solicit solicit;
+    struct nd_neighbor_advert advert;
+  };
+  struct nd_opt_hdr option;
+  uint8_t lladdr[ ETH_ALEN ];
+};
+
+
+static void
+retire_memory( void *ptr ) {
+  qsbr_retire( ptr, free );
+}
+
+
+static void
+make_key( int family, const void *addr, uint8_t *key ) {
+  assert( addr != NULL );
+  assert( key != NULL );
+
+  if ( family == AF_INET ) {
+    memset( key, 0, NEIGHBOR_ADDR_LENGTH );
+    key[ 10 ] = 0xff;
+    key[ 11 ] = 0xff;
+    memcpy( key + 12, addr, sizeof( struct in_addr ) );
+  }
+  else {
+    memcpy( key, addr, NEIGHBOR_ADDR_LENGTH );
+  }
+}
+
+
+static bool
+expired( struct neighbor_table *table, struct neighbor_entry *entry ) {
+  if ( entry->type != NEIGHBOR_ENTRY_TYPE_DYNAMIC ) {
+    return false;
+  }
+
+  uint32_t aging_time = __atomic_load_n( &table->aging_time, __ATOMIC_RELAXED );
+  if ( aging_time == 0 ) {
+    return false;
+  }
+  uint32_t now = __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED );
+
+  return ( now - __atomic_load_n( &entry->last_seen, __ATOMIC_RELAXED ) ) > aging_time ? true : false;
+}
+
+
+static bool
+delete_expired_entry( void *data, void *user_data ) {
+  struct neighbor_entry *entry = data;
+  struct neighbor_table *table = user_data;
+
+  if ( !expired( table, entry ) ) {
+    return false;
+  }
+  qsbr_retire( entry, free );
+
+  return true;
+}
+
+
+// Must be called with table->mutex held.
+static bool
+update_entry( struct neighbor_table *table, const uint8_t *key, const uint8_t *mac, uint8_t type ) {
+  struct neighbor_entry *entry = search_hash( &table->neighbors, ( void * ) ( uintptr_t ) key );
+  if ( entry != NULL ) {
+    if ( type == NEIGHBOR_ENTRY_TYPE_DYNAMIC && entry->type == NEIGHBOR_ENTRY_TYPE_STATIC ) {
+      return true;
+    }
+    if ( entry->type == type && memcmp( entry->mac, mac, ETH_ALEN ) == 0 ) {
+      __atomic_store_n( &entry->last_seen, __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED ), __ATOMIC_RELAXED );
+      return true;
+    }
+    // Readers may hold the entry, so it is replaced rather than modified in place.
+    delete_hash( &table->neighbors, ( void * ) ( uintptr_t ) key );
+    qsbr_retire( entry, free );
+  }
+  else if ( ( uint32_t ) table->neighbors.count >= table->max_entries ) {
+    delete_hash_if( &table->neighbors, delete_expired_entry, table );
+    if ( ( uint32_t ) table->neighbors.count >= table->max_entries ) {
+      return false;
+    }
+  }
+
+  entry = malloc( sizeof( struct neighbor_entry ) );
+  assert( entry != NULL );
+  memset( entry, 0, sizeof( struct neighbor_entry ) );
+  memcpy( entry->addr, key, NEIGHBOR_ADDR_LENGTH );
+  memcpy( entry->mac, mac, ETH_ALEN );
+  entry->type = type;
+  entry->last_seen = __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED );
+  insert_hash( &table->neighbors, entry, entry->addr );
+
+  return true;
+}
+
+
+struct neighbor_table *
+create_neighbor_table( uint32_t max_entries, time_t aging_time ) {
+  struct neighbor_table *table = malloc( sizeof( struct neighbor_table ) );
+  assert( table != NULL );
+  memset( table, 0, sizeof( struct neighbor_table ) );
+  init_hash( &table->neighbors, NEIGHBOR_ADDR_LENGTH );
+  set_hash_table_release_function( &table->neighbors, retire_memory );
+  table->max_entries = max_entries;
+  table->aging_time = aging_time > 0 ? ( uint32_t ) aging_time : 0;
+  pthread_mutex_init( &table->mutex, NULL );
+
+  return table;
+}
+
+
+void
+destroy_neighbor_table( struct neighbor_table *table ) {
+  assert( table != NULL );
+
+  destroy_hash( &table->neighbors );
+  pthread_mutex_destroy( &table->mutex );
+  free( table );
+}
+
+
+bool
+add_neighbor( struct neighbor_table *table, int family, const void *addr, struct ether_addr eth_addr ) {
+  assert( table != NULL );
+  assert( addr != NULL );
+
+  uint8_t key[ NEIGHBOR_ADDR_LENGTH ];
+  make_key( family, addr, key );
+
+  pthread_mutex_lock( &table->mutex );
+  bool ret = update_entry( table, key, eth_addr.ether_addr_octet, NEIGHBOR_ENTRY_TYPE_STATIC );
+  pthread_mutex_unlock( &table->mutex );
+
+  return ret;
+}
+
+
+bool
+delete_neighbor( struct neighbor_table *table, int family, const void *addr ) {
+  assert( table != NULL );
+  assert( addr != NULL );
+
+  uint8_t key[ NEIGHBOR_ADDR_LENGTH ];
+  make_key( family, addr, key );
+
+  pthread_mutex_lock( &table->mutex );
+  struct neighbor_entry *deleted = delete_hash( &table->neighbors, key );
+  pthread_mutex_unlock( &table->mutex );
+
+  if ( deleted == NULL ) {
+    return false;
+  }
+  qsbr_retire( deleted, free );
+
+  return true;
+}
+
+
+static bool
+delete_entry_by_type( void *data, void *user_data ) {
+  struct neighbor_entry *entry = data;
+  uint8_t *type = user_data;
+
+  if ( ( entry->type & *type ) == 0 ) {
+    return false;
+  }
+  qsbr_retire( entry, free );
+
+  return true;
+}
+
+
+bool
+delete_all_neighbors( struct neighbor_table *table, uint8_t type ) {
+  assert( table != NULL );
+
+  pthread_mutex_lock( &table->mutex );
+  delete_hash_if( &table->neighbors, delete_entry_by_type, &type );
+  pthread_mutex_unlock( &table->mutex );
+
+  return true;
+}
+
+
+// Restores an entry with its type, e.g. one handed over from another process.
+bool
+add_neighbor_entry( struct neighbor_table *table, const struct neighbor_entry *entry ) {
+  assert( table != NULL );
+  assert( entry != NULL );
+
+  pthread_mutex_lock( &table->mutex );
+  bool ret = update_entry( table, entry->addr, entry->mac, entry->type );
+  pthread_mutex_unlock( &table->mutex );
+
+  return ret;
+}
+
+
+static void
+copy_entry( void *data, void *user_data ) {
+  list *entries = user_data;
+
+  struct neighbor_entry *entry = malloc( sizeof( struct neighbor_entry ) );
+  assert( entry != NULL );
+  memcpy( entry, data, sizeof( struct neighbor_entry ) );
+  append_to_tail( entries, entry );
+}
+
+
+list *
+get_neighbor_entries( struct neighbor_table *table ) {
+  assert( table != NULL );
+
+  list *entries = create_list();
+  assert( entries != NULL );
+  pthread_mutex_lock( &table->mutex );
+  foreach_hash( &table->neighbors, copy_entry, entries );
+  pthread_mutex_unlock( &table->mutex );
+
+  if ( entries->head == NULL ) {
+    delete_list( entries );
+    return NULL;
+  }
+
+  return entries;
+}
+
+
+void
+set_neighbor_aging_time( struct neighbor_table *table, time_t aging_time ) {
+  assert( table != NULL );
+
+  __atomic_store_n( &table->aging_time, aging_time > 0 ? ( uint32_t ) aging_time : 0, __ATOMIC_RELAXED );
+}
+
+
+void
+set_max_neighbors( struct neighbor_table *table, uint32_t max_entries ) {
+  assert( table != NULL );
+
+  pthread_mutex_lock( &table->mutex );
+  table->max_entries = max_entries;
+  pthread_mutex_unlock( &table->mutex );
+}
+
+
+static const struct ether_arp *
+get_arp( const struct ether_header *ether, size_t length ) {
+  if ( length < sizeof( struct ether_header ) + sizeof( struct ether_arp ) ||
+       ether->ether_type != htons( ETHERTYPE_ARP ) ) {
+    return NULL;
+  }
+
+  const struct ether_arp *arp = ( const void * ) ( ether + 1 );
+  if ( arp->ea_hdr.ar_hrd != htons( ARPHRD_ETHER ) || arp->ea_hdr.ar_pro != htons( ETHERTYPE_IP ) ||
+       arp->ea_hdr.ar_hln != ETH_ALEN || arp->ea_hdr.ar_pln != sizeof( struct in_addr ) ) {
+    return NULL;
+  }
+
+  return arp;
+}
+
+
+static const struct nd_packet *
+get_nd_packet( const struct ether_header *ether, size_t length, uint8_t type ) {
+  size_t offset = sizeof( struct ether_header ) + sizeof( struct ip6_hdr );
+  size_t min_length = offset + ( type == ND_NEIGHBOR_SOLICIT ? sizeof( struct nd_neighbor_solicit )
+                                                             : sizeof( struct nd_neighbor_advert ) );
+  if ( length < min_length || ether->ether_type != htons( ETHERTYPE_IPV6 ) ) {
+    return NULL;
+  }
+
+  const struct nd_packet *nd = ( const void * ) ( ether + 1 );
+  if ( nd->ip6.ip6_nxt != IPPROTO_ICMPV6 || nd->ip6.ip6_hlim != 255 ||
+       nd->solicit.nd_ns_type != type || nd->solicit.nd_ns_code != 0 ) {
+    return NULL;
+  }
+
+  return nd;
+}
+
+
+static const uint8_t *
+find_lladdr_option( const struct nd_packet *nd, size_t length, uint8_t option_type ) {
+  size_t offset = sizeof( struct ether_header ) + offsetof( struct nd_packet, option );
+  if ( length >= offset + sizeof( struct nd_opt_hdr ) + ETH_ALEN &&
+       nd->option.nd_opt_type == option_type && nd->option.nd_opt_len == 1 ) {
+    return nd->lladdr;
+  }
+
+  return NULL;
+}
+
+
+void
+learn_neighbor( struct neighbor_table *table, const struct ether_header *ether, size_t length ) {
+  assert( table != NULL );
+  assert( ether != NULL );
+
+  uint8_t key[ NEIGHBOR_ADDR_LENGTH ];
+  const uint8_t *mac = NULL;
+
+  const struct ether_arp *arp = get_arp( ether, length );
+  const struct nd_packet *nd = NULL;
+  if ( arp != NULL ) {
+    struct in_addr spa;
+    memcpy( &spa, arp->arp_spa, sizeof( spa ) );
+    if ( spa.s_addr == htonl( INADDR_ANY ) ) {
+      return;
+    }
+    make_key( AF_INET, &spa, key );
+    mac = arp->arp_sha;
+  }
+  else if ( ( nd = get_nd_packet( ether, length, ND_NEIGHBOR_ADVERT ) ) != NULL ) {
+    if ( IN6_IS_ADDR_MULTICAST( &nd->advert.nd_na_target ) ) {
+      return;
+    }
+    make_key( AF_INET6, &nd->advert.nd_na_target, key );
+    mac = find_lladdr_option( nd, length, ND_OPT_TARGET_LINKADDR );
+    if ( mac == NULL ) {
+      mac = ether->ether_shost;
+    }
+  }
+  else {
+    return;
+  }
+
+  // Avoid taking the lock for refreshing an entry that is already known.
+  struct neighbor_entry *entry = search_hash_lockless( &table->neighbors, key );
+  if ( entry != NULL && memcmp( entry->mac, mac, ETH_ALEN ) == 0 ) {
+    uint32_t now = __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED );
+    if ( __atomic_load_n( &entry->last_seen, __ATOMIC_RELAXED ) != now ) {
+      __atomic_store_n( &entry->last_seen, now, __ATOMIC_RELAXED );
+    }
+    return;
+  }
+
+  pthread_mutex_lock( &table->mutex );
+  update_entry( table, key, mac, NEIGHBOR_ENTRY_TYPE_DYNAMIC );
+  pthread_mutex_unlock( &table->mutex );
+}
+
+
+static uint16_t
+icmp6_checksum( const struct ip6_hdr *ip6, const void *data, size_t length ) {
+  uint32_t sum = 0;
+  const uint16_t *p = ( const uint16_t * ) ( const void * ) &ip6->ip6_src;
+  for ( size_t i = 0; i < sizeof( struct in6_addr ); i++ ) { // Source and destination addresses
+    sum += p[ i ];
+  }
+  sum += htons( ( uint16_t ) length );
+  sum += htons( IPPROTO_ICMPV6 );
+
+  p = data;
+  for ( size_t i = 0; i < length / 2; i++ ) {
+    sum += p[ i ];
+  }
+  while ( sum >> 16 ) {
+    sum = ( sum & 0xffff ) + ( sum >> 16 );
+  }
+
+  return ( uint16_t ) ~sum;
+}
+
+
+static size_t
+build_arp_reply( const struct ether_header *ether, const struct ether_arp *arp, const struct neighbor_entry *entry,
+                 uint8_t *reply ) {
+  struct ether_header *reply_ether = ( void * ) reply;
+  memcpy( reply_ether->ether_dhost, arp->arp_sha, ETH_ALEN );
+  memcpy( reply_ether->ether_shost, entry->mac, ETH_ALEN );
+  reply_ether->ether_type = ether->ether_type;
+
+  struct ether_arp *reply_arp = ( void * ) ( reply_ether + 1 );
+  reply_arp->ea_hdr = arp->ea_hdr;
+  reply_arp->ea_hdr.ar_op = htons( ARPOP_REPLY );
+  memcpy( reply_arp->arp_sha, entry->mac, ETH_ALEN );
+  memcpy( reply_arp->arp_spa, arp->arp_tpa, sizeof( reply_arp->arp_spa ) );
+  memcpy( reply_arp->arp_tha, arp->arp_sha, ETH_ALEN );
+  memcpy( reply_arp->arp_tpa, arp->arp_spa, sizeof( reply_arp->arp_tpa ) );
+
+  return sizeof( struct ether_header ) + sizeof( struct ether_arp );
+}
+
+
+static size_t
+build_neighbor_advert( const struct ether_header *ether, const struct nd_packet *nd,
+                       const struct neighbor_entry *entry, uint8_t *reply ) {
+  struct ether_header *reply_ether = ( void * ) reply;
+  memcpy( reply_ether->ether_dhost, ether->ether_shost, ETH_ALEN );
+  memcpy( reply_ether->ether_shost, entry->mac, ETH_ALEN );
+  reply_ether->ether_type = ether->ether_type;
+
+  struct nd_packet *advert = ( void * ) ( reply_ether + 1 );
+  size_t payload_length = sizeof( struct nd_packet ) - sizeof( struct ip6_hdr );
+  memset( advert, 0, sizeof( struct nd_packet ) );
+  advert->ip6.ip6_flow = htonl( 6 << 28 );
+  advert->ip6.ip6_plen = htons( ( uint16_t ) payload_length );
+  advert->ip6.ip6_nxt = IPPROTO_ICMPV6;
+  advert->ip6.ip6_hlim = 255;
+  advert->ip6.ip6_src = nd->solicit.nd_ns_target;
+  advert->ip6.ip6_dst = nd->ip6.ip6_src;
+  advert->advert.nd_na_type = ND_NEIGHBOR_ADVERT;
+  advert->advert.nd_na_code = 0;
+  advert->advert.nd_na_flags_reserved = ND_NA_FLAG_SOLICITED | ND_NA_FLAG_OVERRIDE;
+  advert->advert.nd_na_target = nd->solicit.nd_ns_target;
+  advert->option.nd_opt_type = ND_OPT_TARGET_LINKADDR;
+  advert->option.nd_opt_len = 1;
+  memcpy( advert->lladdr, entry->mac, ETH_ALEN );
+  advert->advert.nd_na_cksum = icmp6_checksum( &advert->ip6, &advert->advert, payload_length );
+
+  return sizeof( struct ether_header ) + sizeof( struct nd_packet );
+}
+
+
+int
+suppress_neighbor_solicitation( struct neighbor_table *table, const struct ether_header *ether, size_t length,
+                                uint8_t *reply, size_t *reply_length ) {
+  assert( table != NULL );
+  assert( ether != NULL );
+  assert( reply != NULL );
+  assert( reply_length != NULL );
+
+  uint8_t key[ NEIGHBOR_ADDR_LENGTH ];
+  const struct ether_arp *arp = get_arp( ether, length );
+  const struct nd_packet *nd = NULL;
+  if ( arp != NULL ) {
+    // Gratuitous ARP and ARP probes are left to the hosts.
+    if ( arp->ea_hdr.ar_op != htons( ARPOP_REQUEST ) ||
+         memcmp( arp->arp_spa, arp->arp_tpa, sizeof( arp->arp_spa ) ) == 0 ) {
+      return NEIGHBOR_NOT_SOLICITATION;
+    }
+    make_key( AF_INET, arp->arp_tpa, key );
+  }
+  else if ( ( nd = get_nd_packet( ether, length, ND_NEIGHBOR_SOLICIT ) ) != NULL ) {
+    // Solicitations for duplicate address detection are sent from the unspecified address.
+    if ( IN6_IS_ADDR_UNSPECIFIED( &nd->ip6.ip6_src ) || IN6_IS_ADDR_MULTICAST( &nd->solicit.nd_ns_target ) ) {
+      return NEIGHBOR_NOT_SOLICITATION;
+    }
+    make_key( AF_INET6, &nd->solicit.nd_ns_target, key );
+  }
+  else {
+    return NEIGHBOR_NOT_SOLICITATION;
+  }
+
+  struct neighbor_entry *entry = search_hash_lockless( &table->neighbors, key );
+  if ( entry == NULL || expired( table, entry ) ||
+       memcmp( entry->mac, ether->ether_shost, ETH_ALEN ) == 0 ) {
+    return NEIGHBOR_NOT_FOUND;
+  }
+
+  if ( arp != NULL ) {
+    *reply_length = build_arp_reply( ether, arp, entry, reply );
+  }
+  else {
+    *reply_length = build_neighbor_advert( ether, nd, entry, reply );
+  }
+  assert( *reply_length <= NEIGHBOR_REPLY_MAX_LENGTH );
+
+  return NEIGHBOR_SUPPRESSED;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
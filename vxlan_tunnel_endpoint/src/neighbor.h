@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef NEIGHBOR_H
+#define NEIGHBOR_H
+
+
+#include <net/ethernet.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "hash.h"
+#include "linked_list.h"
+
+
+#define NEIGHBOR_ADDR_LENGTH 16
+#define NEIGHBOR_REPLY_MAX_LENGTH 128
+
+
+enum {
+  NEIGHBOR_ENTRY_TYPE_DYNAMIC = 0x01,
+  NEIGHBOR_ENTRY_TYPE_STATIC = 0x02,
+  NEIGHBOR_ENTRY_TYPE_ALL = 0x03,
+};
+
+enum {
+  NEIGHBOR_NOT_SOLICITATION = 0,
+  NEIGHBOR_SUPPRESSED = 1,
+  NEIGHBOR_NOT_FOUND = 2,
+};
+
+
+struct neighbor_entry {
+  uint8_t addr[ NEIGHBOR_ADDR_LENGTH ]; // IPv4 addresses are stored as IPv4-mapped IPv6 addresses
+  uint8_t mac[ ETH_ALEN ];
+  uint8_t type;
+  uint32_t last_seen;
+};
+
+struct neighbor_table {
+  struct hash neighbors;
+  uint32_t max_entries;
+  uint32_t aging_time;
+  pthread_mutex_t mutex;
+};
+
+
+struct neighbor_table *create_neighbor_table( uint32_t max_entries, time_t aging_time );
+void destroy_neighbor_table( struct neighbor_table *table );
+bool add_neighbor( struct neighbor_table *table, int family, const void *addr, struct ether_addr eth_addr );
+bool delete_neighbor( struct neighbor_table *table, int family, const void *addr );
+bool delete_all_neighbors( struct neighbor_table *table, uint8_t type );
+bool add_neighbor_entry( struct neighbor_table *table, const struct neighbor_entry *entry );
+list *get_neighbor_entries( struct neighbor_table *table );
+void set_neighbor_aging_time( struct neighbor_table *table, time_t aging_time );
+void set_max_neighbors( struct neighbor_table *table, uint32_t max_entries );
+void learn_neighbor( struct neighbor_table *table, const struct ether_header *ether, size_t length );
+int suppress_neighbor_solicitation( struct neighbor_table *table, const struct ether_header *ether, size_t length,
+                                    uint8_t *reply, size_t *reply_length );
+
+
+#endif // NEIGHBOR_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
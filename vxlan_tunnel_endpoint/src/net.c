@@ -19,6 +19,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -27,17 +28,30 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
+#include <linux/filter.h>
 #include <linux/if_ether.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <ifaddrs.h>
 #include <netdb.h>
 #include <pthread.h>
+#include "checks.h"
 #include "hash.h"
+#include "latency.h"
 #include "log.h"
 #include "net.h"
 #include "fdb.h"
+#include "neighbor.h"
+#include "netlink.h"
+#include "probes.h"
+#include "trunk.h"
 #include "wrapper.h"
 
 
+#define VXLAN_REPLICATION_BATCH 64
+#define VXLAN_FLOW_HASH_MULTIPLIER 0x9e3779b97f4a7c15ULL
+
+
 struct multicast_group_table {
   struct hash groups;
   pthread_mutex_t mutex;
@@ -156,19 +170,50 @@ delete_user_from_multicast_group( struct in_addr maddr, unsigned int *n_users )
 }
 
 
-void
-send_etherframe_from_vxlan_to_local( struct vxlan_instance *instance,
-                                     struct ether_header *ether, size_t len ) {
-  assert( vxlan != NULL );
-  assert( instance != NULL );
-  assert( ether != NULL );
-  assert( len > 0 );
+// Nothing leaves the host while datagrams are replayed from a file.
+static ssize_t
+write_to_tap( int fd, const void *data, size_t len ) {
+  if ( vxlan->replay != NULL ) {
+    return ( ssize_t ) len;
+  }
 
-  if ( !instance->activated || !vxlan->active ) {
-    return;
+  return write( fd, data, len );
+}
+
+
+static int
+send_vxlan_messages( int sock, struct mmsghdr *msgs, unsigned int n ) {
+  if ( vxlan->replay != NULL ) {
+    return ( int ) n;
   }
 
-  ssize_t ret = write( instance->tap_sock, ether, len );
+  return sendmmsg( sock, msgs, n, 0 );
+}
+
+
+static ssize_t
+send_vxlan_message( int sock, const struct msghdr *mhdr ) {
+  if ( vxlan->replay != NULL ) {
+    ssize_t len = 0;
+    for ( size_t i = 0; i < mhdr->msg_iovlen; i++ ) {
+      len += ( ssize_t ) mhdr->msg_iov[ i ].iov_len;
+    }
+    return len;
+  }
+
+  return sendmsg( sock, mhdr, 0 );
+}
+
+
+static void
+write_etherframe_to_local( struct vxlan_instance *instance, struct ether_header *ether, size_t len ) {
+  char tagged[ VXLAN_PACKET_BUF_LEN + VLAN_MAX_TAGS_LENGTH ];
+  if ( instance->vlan != 0 ) {
+    len = copy_etherframe_with_vlan_tags( instance, tagged, ether, len );
+    ether = ( struct ether_header * ) ( void * ) tagged;
+  }
+
+  ssize_t ret = write_to_tap( instance->tap_sock, ether, len );
   if ( ret != ( ssize_t ) len ) {
     char buf[ 256 ];
     char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
@@ -179,56 +224,421 @@ send_etherframe_from_vxlan_to_local( struct vxlan_instance *instance,
 }
 
 
+// Writes queued frames to a tap interface. Returns false if the tap cannot take more for now.
+bool
+drain_egress_queue( queue *egress, int fd ) {
+  assert( egress != NULL );
+  assert( fd >= 0 );
+
+  struct egress_frame *frame = NULL;
+  while ( ( frame = peek( egress ) ) != NULL ) {
+    ssize_t ret = write_to_tap( fd, frame->data, frame->length );
+    if ( ret < 0 && ( errno == EAGAIN || errno == EINTR ) ) {
+      return false;
+    }
+    if ( ret != ( ssize_t ) frame->length ) {
+      char buf[ 256 ];
+      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+      warn( "Failed to write an Ethernet frame to a tap interface ( socket = %d, "
+            "len = %u, ret = %d, errno = %s [%d] ).",
+            fd, frame->length, ret, error_string, errno );
+    }
+#ifdef LATENCY_STATS
+    else {
+      struct vxlan_instance *instance = search_vni_table( vxlan->instances, frame->vni );
+      if ( instance != NULL ) {
+        record_latency( &instance->latency->decap, frame->received_at );
+      }
+    }
+#endif
+    dequeue( egress );
+    free( frame );
+  }
+
+  return true;
+}
+
+
 void
-send_etherframe_from_local_to_vxlan( struct vxlan_instance *instance,
-                                     struct ether_header *ether, size_t len ) {
+send_etherframe_from_vxlan_to_local( struct vxlan_instance *instance,
+                                     struct ether_header *ether, size_t len, uint64_t received_at ) {
   assert( vxlan != NULL );
   assert( instance != NULL );
   assert( ether != NULL );
   assert( len > 0 );
 
   if ( !instance->activated || !vxlan->active ) {
+    PROBE3( vxland, frame_dropped, PROBE_VNI( instance->vni ), PROBE_DROP_INACTIVE, len );
     return;
   }
 
-  struct vxlanhdr vhdr;
-  memset( &vhdr, 0, sizeof( vhdr ) );
-  vhdr.flags = VXLAN_VALIDFLAG;
-  memcpy( vhdr.vni, instance->vni, VXLAN_VNISIZE );
+  // Frames are written directly while the instance thread is not running.
+  queue *egress = __atomic_load_n( &instance->egress, __ATOMIC_ACQUIRE );
+  if ( egress == NULL ) {
+    write_etherframe_to_local( instance, ether, len );
+    RECORD_LATENCY( &instance->latency->decap, received_at );
+    PROBE3( vxland, frame_decapsulated, PROBE_VNI( instance->vni ), ether, len );
+    return;
+  }
 
-  struct iovec iov[ 2 ];
-  memset( iov, 0, sizeof( iov ) );
-  iov[ 0 ].iov_base = &vhdr;
-  iov[ 0 ].iov_len  = sizeof( vhdr );
-  iov[ 1 ].iov_base = ether;
-  iov[ 1 ].iov_len  = len;
+  // Hand the frame over to the instance thread so that a tap which is not drained
+  // cannot block decapsulation for other instances.
+  if ( egress->length >= VXLAN_EGRESS_QUEUE_LENGTH ) {
+    instance->stats.egress_dropped++;
+    PROBE3( vxland, frame_dropped, PROBE_VNI( instance->vni ), PROBE_DROP_EGRESS_FULL, len );
+    return;
+  }
 
-  struct msghdr mhdr;
-  memset( &mhdr, 0, sizeof( mhdr ) );
-  mhdr.msg_iov = iov;
-  mhdr.msg_iovlen = 2;
-  mhdr.msg_controllen = 0;
+  struct egress_frame *frame = malloc( offsetof( struct egress_frame, data ) + len + VLAN_MAX_TAGS_LENGTH );
+  assert( frame != NULL );
+  if ( instance->vlan != 0 ) {
+    frame->length = copy_etherframe_with_vlan_tags( instance, frame->data, ether, len );
+  }
+  else {
+    frame->length = len;
+    memcpy( frame->data, ether, len );
+  }
+#ifdef LATENCY_STATS
+  frame->vni = get_vni_value( instance->vni );
+  frame->received_at = received_at;
+#else
+  UNUSED( received_at );
+#endif
+  enqueue( egress, frame );
+  PROBE3( vxland, frame_decapsulated, PROBE_VNI( instance->vni ), ether, len );
+
+  // The instance thread drains the queue until it is empty before waiting again.
+  if ( egress->length <= 1 ) {
+    uint64_t count = 1;
+    ssize_t ret = write( instance->egress_event, &count, sizeof( count ) );
+    UNUSED( ret );
+  }
+}
 
-  char buf[ 256 ];
 
-  struct fdb_entry *entry = fdb_search_entry( instance->fdb, ether->ether_dhost );
+static bool
+flood_unknown_unicast( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  if ( instance->learning ) {
+    instance->stats.unknown_unicast_flooded++;
+    return true;
+  }
+
+  // Only the thread that encapsulates frames for the instance touches the window.
+  uint32_t now = __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED );
+  if ( instance->flood_window != now ) {
+    instance->flood_window = now;
+    instance->n_flooded_in_window = 0;
+  }
+  if ( instance->n_flooded_in_window >= ( uint32_t ) instance->flood_rate ) {
+    instance->stats.unknown_unicast_dropped++;
+    return false;
+  }
+  instance->n_flooded_in_window++;
+  instance->stats.unknown_unicast_flooded++;
+
+  return true;
+}
+
+
+static uint64_t
+add_to_flow_hash( uint64_t hash, uint64_t value ) {
+  hash = ( hash ^ value ) * VXLAN_FLOW_HASH_MULTIPLIER;
+
+  return hash ^ ( hash >> 29 );
+}
+
+
+static uint64_t
+hash_transport_ports( uint64_t hash, uint8_t protocol, const uint8_t *l4, size_t len ) {
+  if ( ( protocol != IPPROTO_TCP && protocol != IPPROTO_UDP && protocol != IPPROTO_SCTP ) || len < 4 ) {
+    return hash;
+  }
+
+  uint32_t ports = 0;
+  memcpy( &ports, l4, sizeof( ports ) );
+
+  return add_to_flow_hash( hash, ports );
+}
+
+
+// Hashes inner L2/L3/L4 headers so that all frames of a flow share one outer source port ( RFC 7348 ).
+static uint64_t
+hash_inner_flow( struct ether_header *ether, size_t len ) {
+  const uint8_t *p = ( const uint8_t * ) ether;
+  if ( len < sizeof( struct ether_header ) ) {
+    return 0;
+  }
+
+  uint64_t macs[ 2 ] = { 0, 0 };
+  memcpy( macs, p, ETH_ALEN * 2 );
+  uint64_t hash = add_to_flow_hash( 0, macs[ 0 ] );
+  hash = add_to_flow_hash( hash, macs[ 1 ] );
+
+  size_t offset = ETH_ALEN * 2;
+  uint16_t type = ntohs( ether->ether_type );
+  if ( type == ETHERTYPE_VLAN && len >= offset + 8 ) {
+    uint16_t tci = 0;
+    memcpy( &tci, p + offset + 2, sizeof( tci ) );
+    hash = add_to_flow_hash( hash, tci );
+    memcpy( &type, p + offset + 4, sizeof( type ) );
+    type = ntohs( type );
+    offset += 4;
+  }
+  hash = add_to_flow_hash( hash, type );
+  offset += 2;
+
+  if ( type == ETHERTYPE_IP && len >= offset + sizeof( struct iphdr ) ) {
+    struct iphdr ip;
+    memcpy( &ip, p + offset, sizeof( ip ) );
+    hash = add_to_flow_hash( hash, ( uint64_t ) ip.saddr << 32 | ip.daddr );
+    hash = add_to_flow_hash( hash, ip.protocol );
+    size_t ip_len = ( size_t ) ip.ihl * 4;
+    // Fragments other than the first one carry no transport header.
+    if ( ( ntohs( ip.frag_off ) & ( IP_MF | IP_OFFMASK ) ) == 0 && ip_len >= sizeof( struct iphdr ) &&
+         len >= offset + ip_len ) {
+      hash = hash_transport_ports( hash, ip.protocol, p + offset + ip_len, len - offset - ip_len );
+    }
+  }
+  else if ( type == ETHERTYPE_IPV6 && len >= offset + sizeof( struct ip6_hdr ) ) {
+    struct ip6_hdr ip6;
+    memcpy( &ip6, p + offset, sizeof( ip6 ) );
+    uint64_t words[ 4 ];
+    memcpy( words, &ip6.ip6_src, sizeof( words ) );
+    for ( int i = 0; i < 4; i++ ) {
+      hash = add_to_flow_hash( hash, words[ i ] );
+    }
+    hash = add_to_flow_hash( hash, ntohl( ip6.ip6_flow ) & 0x000fffff );
+    hash = add_to_flow_hash( hash, ip6.ip6_nxt );
+    hash = hash_transport_ports( hash, ip6.ip6_nxt, p + offset + sizeof( struct ip6_hdr ),
+                                 len - offset - sizeof( struct ip6_hdr ) );
+  }
+
+  return hash;
+}
+
+
+void
+build_vxlan_message( struct vxlan_instance *instance, struct udphdr *udp, struct vxlanhdr *vhdr,
+                     struct ether_header *ether, size_t len, struct iovec *iov ) {
+  assert( vxlan != NULL );
+  assert( instance != NULL );
+  assert( udp != NULL );
+  assert( vhdr != NULL );
+  assert( ether != NULL );
+  assert( iov != NULL );
+
+  memset( vhdr, 0, sizeof( struct vxlanhdr ) );
+  vhdr->flags = VXLAN_VALIDFLAG;
+  memcpy( vhdr->vni, instance->vni, VXLAN_VNISIZE );
+
+  memset( udp, 0, sizeof( struct udphdr ) );
+  if ( vxlan->raw_sock >= 0 ) {
+    uint32_t n_ports = ( uint32_t ) ( vxlan->source_port_max - vxlan->source_port_min ) + 1;
+    uint64_t hash = hash_inner_flow( ether, len );
+    uint32_t port = vxlan->source_port_min + ( uint32_t ) ( ( hash ^ ( hash >> 32 ) ) % n_ports );
+    udp->source = htons( ( uint16_t ) port );
+    udp->dest = htons( instance->port );
+    udp->len = htons( ( uint16_t ) ( sizeof( struct udphdr ) + sizeof( struct vxlanhdr ) + len ) );
+    // A zero checksum is allowed for VXLAN over IPv4.
+    udp->check = 0;
+  }
+
+  iov[ 0 ].iov_base = udp;
+  iov[ 0 ].iov_len = sizeof( struct udphdr );
+  iov[ 1 ].iov_base = vhdr;
+  iov[ 1 ].iov_len = sizeof( struct vxlanhdr );
+  iov[ 2 ].iov_base = ether;
+  iov[ 2 ].iov_len = len;
+}
+
+
+int
+set_vxlan_message_destination( struct vxlan_instance *instance, struct msghdr *mhdr, struct iovec *iov,
+                               struct sockaddr_in *dst ) {
+  assert( vxlan != NULL );
+  assert( instance != NULL );
+  assert( mhdr != NULL );
+  assert( iov != NULL );
+  assert( dst != NULL );
+
+  mhdr->msg_name = dst;
+  mhdr->msg_namelen = sizeof( struct sockaddr_in );
+
+  // Multicast delivery trees do not take source ports into account, so flooding keeps the bound socket.
+  if ( vxlan->raw_sock >= 0 && !IN_MULTICAST( ntohl( dst->sin_addr.s_addr ) ) ) {
+    mhdr->msg_iov = iov;
+    mhdr->msg_iovlen = VXLAN_MESSAGE_IOVLEN;
+    return vxlan->raw_sock;
+  }
+
+  mhdr->msg_iov = iov + 1;
+  mhdr->msg_iovlen = VXLAN_MESSAGE_IOVLEN - 1;
+  return instance->udp_sock;
+}
+
+
+int
+lookup_vxlan_destination( struct vxlan_instance *instance,
+                          struct ether_header *ether, struct sockaddr_in *dst ) {
+  assert( instance != NULL );
+  assert( ether != NULL );
+  assert( dst != NULL );
+
+  touch_vxlan_instance( instance );
+
+  // Nothing is known about destinations until the tables are allocated.
+  struct fdb *fdb = __atomic_load_n( &instance->fdb, __ATOMIC_ACQUIRE );
+  struct fdb_entry *entry = fdb != NULL ? fdb_search_entry( fdb, ether->ether_dhost ) : NULL;
   if ( entry == NULL ) {
-    mhdr.msg_name = &instance->addr;
-    mhdr.msg_namelen = sizeof( instance->addr );
-    if ( sendmsg( instance->udp_sock, &mhdr, 0 ) < 0 ) {
-      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-      warn( "Failed to send a vxlan message ( errno = %s [%d] ).", error_string, errno );
+    if ( ( ether->ether_dhost[ 0 ] & 0x01 ) == 0 && !flood_unknown_unicast( instance ) ) {
+      return VXLAN_DESTINATION_NONE;
     }
+    *dst = instance->addr;
+    return VXLAN_DESTINATION_FLOOD;
   }
-  else {
-    entry->vtep_addr.sin_port = htons( instance->port );
-    mhdr.msg_name = &entry->vtep_addr;
-    mhdr.msg_namelen = sizeof( entry->vtep_addr );
-    if ( sendmsg( instance->udp_sock, &mhdr, 0 ) < 0 ) {
-      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-      warn( "Failed to send a vxlan message ( errno = %s [%d] ).", error_string, errno );
+
+  memset( dst, 0, sizeof( struct sockaddr_in ) );
+  dst->sin_family = AF_INET;
+  dst->sin_addr.s_addr = __atomic_load_n( &entry->vtep_addr.s_addr, __ATOMIC_RELAXED );
+  dst->sin_port = htons( instance->port );
+
+  return VXLAN_DESTINATION_UNICAST;
+}
+
+
+bool
+replicate_etherframe_to_remotes( struct vxlan_instance *instance, struct iovec *iov ) {
+  assert( instance != NULL );
+  assert( iov != NULL );
+
+  struct vxlan_remote_list *list = __atomic_load_n( &instance->remotes, __ATOMIC_ACQUIRE );
+  if ( list == NULL || list->n_remotes == 0 ) {
+    return false;
+  }
+
+  struct sockaddr_in dsts[ VXLAN_REPLICATION_BATCH ];
+  struct mmsghdr msgs[ VXLAN_REPLICATION_BATCH ];
+  memset( msgs, 0, sizeof( msgs ) );
+  int sock = -1;
+  for ( int offset = 0; offset < list->n_remotes; offset += VXLAN_REPLICATION_BATCH ) {
+    unsigned int n = ( unsigned int ) ( list->n_remotes - offset );
+    if ( n > VXLAN_REPLICATION_BATCH ) {
+      n = VXLAN_REPLICATION_BATCH;
+    }
+    for ( unsigned int i = 0; i < n; i++ ) {
+      memset( &dsts[ i ], 0, sizeof( struct sockaddr_in ) );
+      dsts[ i ].sin_family = AF_INET;
+      dsts[ i ].sin_addr = list->remotes[ offset + ( int ) i ];
+      dsts[ i ].sin_port = htons( instance->port );
+      // All remotes are unicast addresses, so every message goes out from the same socket.
+      sock = set_vxlan_message_destination( instance, &msgs[ i ].msg_hdr, iov, &dsts[ i ] );
+    }
+
+    unsigned int sent = 0;
+    while ( sent < n ) {
+      int ret = send_vxlan_messages( sock, msgs + sent, n - sent );
+      if ( ret < 0 ) {
+        if ( errno == EINTR ) {
+          continue;
+        }
+        char buf[ 256 ];
+        char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+        warn( "Failed to replicate a vxlan message ( errno = %s [%d] ).", error_string, errno );
+        // Skip the remote that failed and carry on with the rest.
+        sent++;
+        continue;
+      }
+      sent += ( unsigned int ) ret;
     }
   }
+
+  return true;
+}
+
+
+bool
+answer_neighbor_solicitation( struct vxlan_instance *instance, struct ether_header *ether, size_t len ) {
+  assert( instance != NULL );
+  assert( ether != NULL );
+
+  if ( !instance->neighbor_suppression ) {
+    return false;
+  }
+
+  struct neighbor_table *neighbors = __atomic_load_n( &instance->neighbors, __ATOMIC_ACQUIRE );
+  if ( neighbors == NULL ) {
+    return false;
+  }
+
+  uint8_t reply[ NEIGHBOR_REPLY_MAX_LENGTH ];
+  size_t reply_len = 0;
+  int ret = suppress_neighbor_solicitation( neighbors, ether, len, reply, &reply_len );
+  if ( ret == NEIGHBOR_NOT_FOUND ) {
+    instance->stats.neighbor_suppression_misses++;
+    return false;
+  }
+  if ( ret != NEIGHBOR_SUPPRESSED ) {
+    return false;
+  }
+
+  instance->stats.neighbor_suppression_hits++;
+  // Written by the thread reading the tap rather than queued with decapsulated frames.
+  write_etherframe_to_local( instance, ( struct ether_header * ) ( void * ) reply, reply_len );
+
+  return true;
+}
+
+
+void
+send_etherframe_from_local_to_vxlan( struct vxlan_instance *instance,
+                                     struct ether_header *ether, size_t len, uint64_t received_at ) {
+  assert( vxlan != NULL );
+  assert( instance != NULL );
+  assert( ether != NULL );
+  assert( len > 0 );
+
+  PROBE3( vxland, frame_from_tap, PROBE_VNI( instance->vni ), ether, len );
+
+  if ( !instance->activated || !vxlan->active ) {
+    PROBE3( vxland, frame_dropped, PROBE_VNI( instance->vni ), PROBE_DROP_INACTIVE, len );
+    return;
+  }
+
+  if ( answer_neighbor_solicitation( instance, ether, len ) ) {
+    return;
+  }
+
+  struct sockaddr_in dst;
+  int destination = lookup_vxlan_destination( instance, ether, &dst );
+  if ( destination == VXLAN_DESTINATION_NONE ) {
+    PROBE3( vxland, frame_dropped, PROBE_VNI( instance->vni ), PROBE_DROP_NO_DESTINATION, len );
+    return;
+  }
+
+  struct udphdr udp;
+  struct vxlanhdr vhdr;
+  struct iovec iov[ VXLAN_MESSAGE_IOVLEN ];
+  build_vxlan_message( instance, &udp, &vhdr, ether, len, iov );
+  if ( destination == VXLAN_DESTINATION_FLOOD && replicate_etherframe_to_remotes( instance, iov ) ) {
+    RECORD_LATENCY( &instance->latency->encap, received_at );
+    PROBE4( vxland, frame_encapsulated, PROBE_VNI( instance->vni ), ether, len, destination );
+    return;
+  }
+
+  struct msghdr mhdr;
+  memset( &mhdr, 0, sizeof( mhdr ) );
+  int sock = set_vxlan_message_destination( instance, &mhdr, iov, &dst );
+  if ( send_vxlan_message( sock, &mhdr ) < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    warn( "Failed to send a vxlan message ( errno = %s [%d] ).", error_string, errno );
+    PROBE3( vxland, frame_dropped, PROBE_VNI( instance->vni ), PROBE_DROP_SEND_FAILED, len );
+    return;
+  }
+  RECORD_LATENCY( &instance->latency->encap, received_at );
+  PROBE4( vxland, frame_encapsulated, PROBE_VNI( instance->vni ), ether, len, destination );
 }
 
 
@@ -286,6 +696,10 @@ set_ipv4_multicast_join_and_iface( int socket, struct in_addr maddr, char *ifnam
 
   int ret = setsockopt( socket, IPPROTO_IP, IP_ADD_MEMBERSHIP,
                         ( char * ) &mreq, sizeof( mreq ) );
+  if ( ret < 0 && errno == EADDRINUSE ) {
+    // The socket was handed over from a previous process which had joined.
+    ret = 0;
+  }
   if ( ret < 0 ) {
     char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
     error( "Failed to send a membership report ( socket = %d, ret = %d, errno = %s [%d] ).",
@@ -411,7 +825,6 @@ ipv4_multicast_join( struct in_addr addr ) {
     return false;
   }
 
-  update_interface_state();
   if ( !vxlan->active ) {
     return false;
   }
@@ -428,7 +841,6 @@ ipv4_multicast_leave( struct in_addr addr ) {
     return false;
   }
 
-  update_interface_state();
   if ( !vxlan->active ) {
     return false;
   }
@@ -453,30 +865,90 @@ update_interface_state() {
 }
 
 
+// Called when the link monitor socket becomes readable. The interface state is
+// only re-read when a notification concerns the interface we are bound to.
+void
+handle_interface_events() {
+  assert( vxlan != NULL );
+
+  if ( receive_link_events() ) {
+    update_interface_state();
+  }
+}
+
+
+static int
+create_raw_socket() {
+  char buf[ 256 ];
+
+  int sock = socket( AF_INET, SOCK_RAW, IPPROTO_UDP );
+  if ( sock < 0 ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to create a raw socket for IPv4 ( ret = %d, errno = %s [%d] ).",
+           sock, error_string, errno );
+    return -1;
+  }
+
+  // The socket is only for sending. Drop copies of all UDP datagrams the host receives.
+  struct sock_filter code[] = { BPF_STMT( BPF_RET | BPF_K, 0 ) };
+  struct sock_fprog filter = { .len = 1, .filter = code };
+  int ret = setsockopt( sock, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof( filter ) );
+  if ( ret < 0 ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to attach a socket filter ( socket = %d, ret = %d, errno = %s [%d] ).",
+           sock, ret, error_string, errno );
+    close( sock );
+    return -1;
+  }
+
+  return sock;
+}
+
+
 bool
 init_net( struct vxlan *_vxlan ) {
   assert( _vxlan != NULL );
 
   vxlan = _vxlan;
 
-  vxlan->udp_sock = socket( AF_INET, SOCK_DGRAM, 0 );
+  // Sockets handed over from a previous process are already set up.
+  bool ret = true;
   if ( vxlan->udp_sock < 0 ) {
-    char buf[ 256 ];
-    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-    error( "Failed to create a socket for IPv4 ( ret = %d, errno = %s [%d] ).",
-           vxlan->udp_sock, error_string, errno );
-    goto error;
+    vxlan->udp_sock = socket( AF_INET, SOCK_DGRAM, 0 );
+    if ( vxlan->udp_sock < 0 ) {
+      char buf[ 256 ];
+      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+      error( "Failed to create a socket for IPv4 ( ret = %d, errno = %s [%d] ).",
+             vxlan->udp_sock, error_string, errno );
+      goto error;
+    }
+
+    ret = bind_ipv4_inaddrany( vxlan->udp_sock, vxlan->port );
+    if ( !ret ) {
+      goto error;
+    }
+    ret = set_ipv4_multicast_loop( vxlan->udp_sock, 0 );
+    if ( !ret ) {
+      goto error;
+    }
+    ret = set_ipv4_multicast_ttl( vxlan->udp_sock, VXLAN_MCAST_TTL );
+    if ( !ret ) {
+      goto error;
+    }
   }
 
-  bool ret = bind_ipv4_inaddrany( vxlan->udp_sock, vxlan->port );
-  if ( !ret ) {
-    goto error;
+  if ( vxlan->source_port_min == 0 && vxlan->raw_sock >= 0 ) {
+    close( vxlan->raw_sock );
+    vxlan->raw_sock = -1;
   }
-  ret = set_ipv4_multicast_loop( vxlan->udp_sock, 0 );
-  if ( !ret ) {
-    goto error;
+  else if ( vxlan->source_port_min > 0 && vxlan->raw_sock < 0 ) {
+    vxlan->raw_sock = create_raw_socket();
+    if ( vxlan->raw_sock < 0 ) {
+      goto error;
+    }
   }
-  ret = set_ipv4_multicast_ttl( vxlan->udp_sock, VXLAN_MCAST_TTL );
+
+  ret = init_netlink( vxlan->ifname );
   if ( !ret ) {
     goto error;
   }
@@ -497,6 +969,11 @@ error:
   if ( vxlan->udp_sock >= 0 ) {
     close( vxlan->udp_sock );
   }
+  if ( vxlan->raw_sock >= 0 ) {
+    close( vxlan->raw_sock );
+    vxlan->raw_sock = -1;
+  }
+  finalize_netlink();
 
   return false;
 }
@@ -509,6 +986,10 @@ finalize_net() {
   if ( vxlan->udp_sock >= 0 ) {
     close( vxlan->udp_sock );
   }
+  if ( vxlan->raw_sock >= 0 ) {
+    close( vxlan->raw_sock );
+  }
+  finalize_netlink();
 
   return finalize_multicast_group_table();
 }
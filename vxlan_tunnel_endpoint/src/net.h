@@ -24,16 +24,41 @@
 #include <net/ethernet.h>
 #include <netinet/if_ether.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "queue.h"
+#include "vxlan.h"
 #include "vxlan_common.h"
 #include "vxlan_instance.h"
 
 
+enum {
+  VXLAN_DESTINATION_NONE = 0,
+  VXLAN_DESTINATION_UNICAST = 1,
+  VXLAN_DESTINATION_FLOOD = 2,
+};
+
+// A VXLAN message is an outer UDP header, a VXLAN header and an Ethernet frame.
+#define VXLAN_MESSAGE_IOVLEN 3
+
+
+int lookup_vxlan_destination( struct vxlan_instance *instance,
+                              struct ether_header *ether, struct sockaddr_in *dst );
+void build_vxlan_message( struct vxlan_instance *instance, struct udphdr *udp, struct vxlanhdr *vhdr,
+                          struct ether_header *ether, size_t len, struct iovec *iov );
+int set_vxlan_message_destination( struct vxlan_instance *instance, struct msghdr *mhdr, struct iovec *iov,
+                                   struct sockaddr_in *dst );
+bool replicate_etherframe_to_remotes( struct vxlan_instance *instance, struct iovec *iov );
+bool drain_egress_queue( queue *egress, int fd );
 void send_etherframe_from_vxlan_to_local( struct vxlan_instance *instance,
-                                          struct ether_header *ether, size_t len );
+                                          struct ether_header *ether, size_t len, uint64_t received_at );
+bool answer_neighbor_solicitation( struct vxlan_instance *instance, struct ether_header *ether, size_t len );
 void send_etherframe_from_local_to_vxlan( struct vxlan_instance *instance,
-                                          struct ether_header *ether, size_t len );
+                                          struct ether_header *ether, size_t len, uint64_t received_at );
 bool update_interface_state();
+void handle_interface_events();
 bool ipv4_multicast_join( struct in_addr addr );
 bool ipv4_multicast_leave( struct in_addr addr );
 bool init_net( struct vxlan *vxlan );
@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "log.h"
+#include "netlink.h"
+#include "wrapper.h"
+
+
+#define LINK_BATCH_MAX 128
+#define NETLINK_RECV_BUF_LEN 8192
+
+
+struct link_request {
+  struct nlmsghdr hdr;
+  struct ifinfomsg ifi;
+  char attrs[ RTA_SPACE( IFNAMSIZ ) ];
+};
+
+#define LINK_REQUEST_LEN NLMSG_ALIGN( sizeof( struct link_request ) )
+
+
+static int request_fd = -1;
+static int monitor_fd = -1;
+static uint32_t sequence = 0;
+static pthread_mutex_t request_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Requests queued between begin_link_batch() and commit_link_batch(). Only the
+// thread holding request_mutex touches these.
+static char batch[ LINK_BATCH_MAX * LINK_REQUEST_LEN ] __attribute__( ( aligned( NLMSG_ALIGNTO ) ) );
+static char batch_ifnames[ LINK_BATCH_MAX ][ IFNAMSIZ ];
+static unsigned int n_batched = 0;
+static uint32_t batch_sequence = 0;
+static __thread bool batching = false;
+
+static char monitored_ifname[ IFNAMSIZ ];
+static int monitored_index = 0;
+
+
+static int
+open_netlink_socket( unsigned int groups ) {
+  char buf[ 256 ];
+
+  int fd = socket( AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE );
+  if ( fd < 0 ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to create a netlink socket ( ret = %d, errno = %s [%d] ).", fd, error_string, errno );
+    return -1;
+  }
+
+  struct sockaddr_nl addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = groups;
+  int ret = bind( fd, ( struct sockaddr * ) &addr, sizeof( addr ) );
+  if ( ret < 0 ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to bind a netlink socket ( fd = %d, groups = %#x, errno = %s [%d] ).",
+           fd, groups, error_string, errno );
+    close( fd );
+    return -1;
+  }
+
+  return fd;
+}
+
+
+static void
+build_link_request( struct link_request *request, uint32_t seq, const char *ifname,
+                    unsigned int flags, unsigned int change ) {
+  assert( request != NULL );
+  assert( ifname != NULL );
+
+  memset( request, 0, sizeof( *request ) );
+  request->hdr.nlmsg_len = ( uint32_t ) sizeof( *request );
+  request->hdr.nlmsg_type = RTM_NEWLINK;
+  request->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  request->hdr.nlmsg_seq = seq;
+  request->ifi.ifi_family = AF_UNSPEC;
+  request->ifi.ifi_index = 0; // looked up by IFLA_IFNAME
+  request->ifi.ifi_flags = flags;
+  request->ifi.ifi_change = change;
+
+  struct rtattr *rta = ( struct rtattr * ) request->attrs;
+  rta->rta_type = IFLA_IFNAME;
+  rta->rta_len = ( unsigned short ) RTA_LENGTH( IFNAMSIZ );
+  strncpy( RTA_DATA( rta ), ifname, IFNAMSIZ - 1 );
+}
+
+
+// Sends n requests in a single datagram and waits for all of their
+// acknowledgements. Must be called with request_mutex held.
+static bool
+transact( const void *requests, size_t len, uint32_t first_seq, unsigned int n,
+          char ifnames[][ IFNAMSIZ ] ) {
+  assert( request_fd >= 0 );
+  assert( requests != NULL );
+  assert( n > 0 );
+
+  char buf[ 256 ];
+
+  ssize_t sent = send( request_fd, requests, len, 0 );
+  if ( sent < 0 ) {
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to send netlink requests ( fd = %d, n = %u, errno = %s [%d] ).",
+           request_fd, n, error_string, errno );
+    return false;
+  }
+
+  bool ret = true;
+  unsigned int n_acked = 0;
+  char reply[ NETLINK_RECV_BUF_LEN ] __attribute__( ( aligned( NLMSG_ALIGNTO ) ) );
+  while ( n_acked < n ) {
+    ssize_t received = recv( request_fd, reply, sizeof( reply ), 0 );
+    if ( received < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+      error( "Failed to receive netlink acknowledgements ( fd = %d, errno = %s [%d] ).",
+             request_fd, error_string, errno );
+      return false;
+    }
+
+    size_t remaining = ( size_t ) received;
+    const struct nlmsghdr *hdr = ( const struct nlmsghdr * ) reply;
+    while ( remaining >= sizeof( struct nlmsghdr ) && hdr->nlmsg_len >= sizeof( struct nlmsghdr ) &&
+            hdr->nlmsg_len <= remaining ) {
+      uint32_t offset = hdr->nlmsg_seq - first_seq;
+      if ( hdr->nlmsg_type == NLMSG_ERROR && offset < n ) {
+        const struct nlmsgerr *err = NLMSG_DATA( hdr );
+        if ( err->error != 0 ) {
+          char *error_string = safe_strerror_r( -err->error, buf, sizeof( buf ) );
+          error( "Failed to change link flags ( ifname = %s, errno = %s [%d] ).",
+                 ifnames[ offset ], error_string, -err->error );
+          ret = false;
+        }
+        n_acked++;
+      }
+      remaining -= NLMSG_ALIGN( hdr->nlmsg_len ) < remaining ? NLMSG_ALIGN( hdr->nlmsg_len ) : remaining;
+      hdr = ( const struct nlmsghdr * ) ( ( const char * ) hdr + NLMSG_ALIGN( hdr->nlmsg_len ) );
+    }
+  }
+
+  return ret;
+}
+
+
+static bool
+flush_link_batch() {
+  if ( n_batched == 0 ) {
+    return true;
+  }
+
+  bool ret = transact( batch, n_batched * LINK_REQUEST_LEN, batch_sequence, n_batched, batch_ifnames );
+  n_batched = 0;
+
+  return ret;
+}
+
+
+bool
+set_link_flags( const char *ifname, unsigned int flags, unsigned int change ) {
+  assert( ifname != NULL );
+
+  if ( batching ) {
+    if ( n_batched == LINK_BATCH_MAX && !flush_link_batch() ) {
+      return false;
+    }
+    uint32_t seq = ++sequence;
+    if ( n_batched == 0 ) {
+      batch_sequence = seq;
+    }
+    build_link_request( ( struct link_request * ) ( batch + n_batched * LINK_REQUEST_LEN ), seq,
+                        ifname, flags, change );
+    memset( batch_ifnames[ n_batched ], '\0', IFNAMSIZ );
+    strncpy( batch_ifnames[ n_batched ], ifname, IFNAMSIZ - 1 );
+    n_batched++;
+    return true;
+  }
+
+  pthread_mutex_lock( &request_mutex );
+
+  struct link_request request;
+  char ifnames[ 1 ][ IFNAMSIZ ];
+  memset( ifnames, '\0', sizeof( ifnames ) );
+  strncpy( ifnames[ 0 ], ifname, IFNAMSIZ - 1 );
+  uint32_t seq = ++sequence;
+  build_link_request( &request, seq, ifname, flags, change );
+  bool ret = transact( &request, sizeof( request ), seq, 1, ifnames );
+
+  pthread_mutex_unlock( &request_mutex );
+
+  return ret;
+}
+
+
+// Queues link changes made by the calling thread until commit_link_batch()
+// so that they reach the kernel in as few sendmsg() calls as possible.
+void
+begin_link_batch() {
+  assert( !batching );
+
+  pthread_mutex_lock( &request_mutex );
+  batching = true;
+  n_batched = 0;
+}
+
+
+bool
+commit_link_batch() {
+  assert( batching );
+
+  bool ret = flush_link_batch();
+  batching = false;
+  pthread_mutex_unlock( &request_mutex );
+
+  return ret;
+}
+
+
+int
+get_link_monitor_fd() {
+  return monitor_fd;
+}
+
+
+static bool
+handle_link_event( const struct nlmsghdr *hdr ) {
+  assert( hdr != NULL );
+
+  switch ( hdr->nlmsg_type ) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+    {
+      if ( hdr->nlmsg_len < NLMSG_LENGTH( sizeof( struct ifinfomsg ) ) ) {
+        return false;
+      }
+      const struct ifinfomsg *ifi = NLMSG_DATA( hdr );
+      const char *ifname = NULL;
+      size_t remaining = hdr->nlmsg_len - NLMSG_LENGTH( sizeof( struct ifinfomsg ) );
+      const struct rtattr *rta = IFLA_RTA( ifi );
+      while ( remaining >= sizeof( struct rtattr ) && rta->rta_len >= sizeof( struct rtattr ) &&
+              rta->rta_len <= remaining ) {
+        if ( rta->rta_type == IFLA_IFNAME ) {
+          ifname = RTA_DATA( rta );
+          break;
+        }
+        remaining -= RTA_ALIGN( rta->rta_len ) < remaining ? RTA_ALIGN( rta->rta_len ) : remaining;
+        rta = ( const struct rtattr * ) ( ( const char * ) rta + RTA_ALIGN( rta->rta_len ) );
+      }
+      if ( ifname != NULL && strncmp( ifname, monitored_ifname, IFNAMSIZ ) == 0 ) {
+        monitored_index = hdr->nlmsg_type == RTM_NEWLINK ? ifi->ifi_index : 0;
+        return true;
+      }
+      if ( monitored_index != 0 && ifi->ifi_index == monitored_index ) {
+        // Renamed or removed.
+        monitored_index = 0;
+        return true;
+      }
+    }
+    break;
+
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+    {
+      if ( hdr->nlmsg_len < NLMSG_LENGTH( sizeof( struct ifaddrmsg ) ) ) {
+        return false;
+      }
+      const struct ifaddrmsg *ifa = NLMSG_DATA( hdr );
+      if ( ifa->ifa_family == AF_INET && monitored_index != 0 && ifa->ifa_index == ( uint32_t ) monitored_index ) {
+        return true;
+      }
+    }
+    break;
+
+    default:
+      break;
+  }
+
+  return false;
+}
+
+
+// Drains pending link and IPv4 address notifications. Returns true if any of
+// them may have changed the state of the monitored interface, in which case
+// the caller should re-read it.
+bool
+receive_link_events() {
+  if ( monitor_fd < 0 ) {
+    return false;
+  }
+
+  bool changed = false;
+  char buf[ NETLINK_RECV_BUF_LEN ] __attribute__( ( aligned( NLMSG_ALIGNTO ) ) );
+  while ( true ) {
+    ssize_t received = recv( monitor_fd, buf, sizeof( buf ), MSG_DONTWAIT );
+    if ( received < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      if ( errno == ENOBUFS ) {
+        // Notifications were dropped. Let the caller resynchronize.
+        changed = true;
+        continue;
+      }
+      break;
+    }
+
+    size_t remaining = ( size_t ) received;
+    const struct nlmsghdr *hdr = ( const struct nlmsghdr * ) buf;
+    while ( remaining >= sizeof( struct nlmsghdr ) && hdr->nlmsg_len >= sizeof( struct nlmsghdr ) &&
+            hdr->nlmsg_len <= remaining ) {
+      if ( handle_link_event( hdr ) ) {
+        changed = true;
+      }
+      remaining -= NLMSG_ALIGN( hdr->nlmsg_len ) < remaining ? NLMSG_ALIGN( hdr->nlmsg_len ) : remaining;
+      hdr = ( const struct nlmsghdr * ) ( ( const char * ) hdr + NLMSG_ALIGN( hdr->nlmsg_len ) );
+    }
+  }
+
+  return changed;
+}
+
+
+bool
+init_netlink( const char *_monitored_ifname ) {
+  assert( _monitored_ifname != NULL );
+
+  request_fd = open_netlink_socket( 0 );
+  if ( request_fd < 0 ) {
+    return false;
+  }
+  int one = 1;
+  setsockopt( request_fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof( one ) );
+
+  monitor_fd = open_netlink_socket( RTMGRP_LINK | RTMGRP_IPV4_IFADDR );
+  if ( monitor_fd < 0 ) {
+    close( request_fd );
+    request_fd = -1;
+    return false;
+  }
+
+  memset( monitored_ifname, '\0', sizeof( monitored_ifname ) );
+  strncpy( monitored_ifname, _monitored_ifname, sizeof( monitored_ifname ) - 1 );
+  monitored_index = ( int ) if_nametoindex( monitored_ifname );
+
+  return true;
+}
+
+
+bool
+finalize_netlink() {
+  if ( monitor_fd >= 0 ) {
+    close( monitor_fd );
+    monitor_fd = -1;
+  }
+  if ( request_fd >= 0 ) {
+    close( request_fd );
+    request_fd = -1;
+  }
+
+  return true;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
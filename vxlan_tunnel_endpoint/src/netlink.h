@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef NETLINK_H
+#define NETLINK_H
+
+
+#include <stdbool.h>
+
+
+bool set_link_flags( const char *ifname, unsigned int flags, unsigned int change );
+void begin_link_batch();
+bool commit_link_batch();
+int get_link_monitor_fd();
+bool receive_link_events();
+bool init_netlink( const char *monitored_ifname );
+bool finalize_netlink();
+
+
+#endif // NETLINK_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef PROBES_H
+#define PROBES_H
+
+
+#include <stdint.h>
+
+
+/*
+ * Static tracepoints ( USDT ) for bpftrace and perf. A probe is a nop and
+ * a note in the ELF file until a tracer attaches to it. Probes are
+ * compiled out if <sys/sdt.h> is not available or NO_PROBES is defined.
+ * Arguments of each probe are listed in doc/probes.md and the scripts in
+ * probes/ depend on them, so arguments are only ever appended.
+ */
+
+#if !defined( NO_PROBES ) && defined( __has_include )
+#if __has_include( <sys/sdt.h> )
+#include <sys/sdt.h>
+#define PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef PROBES_ENABLED
+#define PROBE1( _provider, _name, _a1 ) DTRACE_PROBE1( _provider, _name, _a1 )
+#define PROBE2( _provider, _name, _a1, _a2 ) DTRACE_PROBE2( _provider, _name, _a1, _a2 )
+#define PROBE3( _provider, _name, _a1, _a2, _a3 ) DTRACE_PROBE3( _provider, _name, _a1, _a2, _a3 )
+#define PROBE4( _provider, _name, _a1, _a2, _a3, _a4 ) DTRACE_PROBE4( _provider, _name, _a1, _a2, _a3, _a4 )
+#else
+#define PROBE1( _provider, _name, _a1 )
+#define PROBE2( _provider, _name, _a1, _a2 )
+#define PROBE3( _provider, _name, _a1, _a2, _a3 )
+#define PROBE4( _provider, _name, _a1, _a2, _a3, _a4 )
+#endif
+
+// VNI of a vxlan header or an instance as an integer.
+#define PROBE_VNI( _vni ) \
+  ( ( uint32_t ) ( _vni )[ 0 ] << 16 | ( uint32_t ) ( _vni )[ 1 ] << 8 | ( uint32_t ) ( _vni )[ 2 ] )
+
+// Passed as the VNI of a packet dropped before its vxlan header is parsed.
+#define PROBE_NO_VNI UINT32_MAX
+
+// Reasons passed to frame_dropped and packet_dropped.
+enum {
+  PROBE_DROP_NO_BUFFER = 1,
+  PROBE_DROP_MALFORMED = 2,
+  PROBE_DROP_UNKNOWN_VNI = 3,
+  PROBE_DROP_INACTIVE = 4,
+  PROBE_DROP_NO_DESTINATION = 5,
+  PROBE_DROP_EGRESS_FULL = 6,
+  PROBE_DROP_SEND_FAILED = 7,
+};
+
+
+#endif // PROBES_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Quiescent-state-based reclamation. Data-plane threads read shared
+ * structures without locks and announce a quiescent state between
+ * packets, when they hold no references to such structures. Writers
+ * unlink an object and retire it, and the object is freed once every
+ * online thread has passed a quiescent state since it was retired.
+ *
+ * Threads must go offline before blocking so that idle threads never
+ * hold back reclamation.
+ */
+
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "qsbr.h"
+
+
+#define QSBR_RECLAIM_THRESHOLD 256
+
+
+struct qsbr_thread {
+  uint64_t seen;
+  struct qsbr_thread *next;
+};
+
+struct qsbr_retired {
+  void *ptr;
+  void ( *free_function )( void *ptr );
+  uint64_t epoch;
+  struct qsbr_retired *next;
+};
+
+
+static uint64_t epoch = 1;
+static struct qsbr_thread *threads = NULL;
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct qsbr_retired *retired = NULL;
+static unsigned int n_retired = 0;
+static pthread_mutex_t retired_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct qsbr_thread *self = NULL;
+
+
+void
+qsbr_register_thread() {
+  if ( self != NULL ) {
+    return;
+  }
+
+  struct qsbr_thread *thread = malloc( sizeof( struct qsbr_thread ) );
+  assert( thread != NULL );
+  memset( thread, 0, sizeof( struct qsbr_thread ) );
+
+  pthread_mutex_lock( &threads_mutex );
+  thread->next = threads;
+  threads = thread;
+  pthread_mutex_unlock( &threads_mutex );
+
+  self = thread;
+  qsbr_thread_online();
+}
+
+
+void
+qsbr_unregister_thread() {
+  if ( self == NULL ) {
+    return;
+  }
+
+  pthread_mutex_lock( &threads_mutex );
+  for ( struct qsbr_thread **p = &threads; *p != NULL; p = &( *p )->next ) {
+    if ( *p == self ) {
+      *p = self->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock( &threads_mutex );
+
+  free( self );
+  self = NULL;
+}
+
+
+void
+qsbr_quiescent_state() {
+  if ( self == NULL ) {
+    return;
+  }
+
+  __atomic_store_n( &self->seen, __atomic_load_n( &epoch, __ATOMIC_ACQUIRE ), __ATOMIC_RELEASE );
+}
+
+
+void
+qsbr_thread_offline() {
+  if ( self == NULL ) {
+    return;
+  }
+
+  __atomic_store_n( &self->seen, 0, __ATOMIC_RELEASE );
+}
+
+
+void
+qsbr_thread_online() {
+  if ( self == NULL ) {
+    return;
+  }
+
+  __atomic_store_n( &self->seen, __atomic_load_n( &epoch, __ATOMIC_ACQUIRE ), __ATOMIC_SEQ_CST );
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+}
+
+
+static uint64_t
+oldest_epoch() {
+  uint64_t oldest = UINT64_MAX;
+
+  pthread_mutex_lock( &threads_mutex );
+  for ( struct qsbr_thread *thread = threads; thread != NULL; thread = thread->next ) {
+    uint64_t seen = __atomic_load_n( &thread->seen, __ATOMIC_ACQUIRE );
+    if ( seen != 0 && seen < oldest ) {
+      oldest = seen;
+    }
+  }
+  pthread_mutex_unlock( &threads_mutex );
+
+  return oldest;
+}
+
+
+void
+qsbr_reclaim() {
+  uint64_t oldest = oldest_epoch();
+
+  pthread_mutex_lock( &retired_mutex );
+  struct qsbr_retired *reclaimable = NULL;
+  for ( struct qsbr_retired **p = &retired; *p != NULL; ) {
+    struct qsbr_retired *r = *p;
+    if ( r->epoch < oldest ) {
+      *p = r->next;
+      r->next = reclaimable;
+      reclaimable = r;
+      n_retired--;
+    }
+    else {
+      p = &r->next;
+    }
+  }
+  pthread_mutex_unlock( &retired_mutex );
+
+  while ( reclaimable != NULL ) {
+    struct qsbr_retired *r = reclaimable;
+    reclaimable = r->next;
+    r->free_function( r->ptr );
+    free( r );
+  }
+}
+
+
+void
+qsbr_retire( void *ptr, void ( *free_function )( void *ptr ) ) {
+  assert( ptr != NULL );
+  assert( free_function != NULL );
+
+  struct qsbr_retired *r = malloc( sizeof( struct qsbr_retired ) );
+  assert( r != NULL );
+  r->ptr = ptr;
+  r->free_function = free_function;
+  r->epoch = __atomic_fetch_add( &epoch, 1, __ATOMIC_SEQ_CST );
+
+  pthread_mutex_lock( &retired_mutex );
+  r->next = retired;
+  retired = r;
+  n_retired++;
+  bool reclaim = n_retired >= QSBR_RECLAIM_THRESHOLD;
+  pthread_mutex_unlock( &retired_mutex );
+
+  if ( reclaim ) {
+    qsbr_reclaim();
+  }
+}
+
+
+void
+qsbr_synchronize() {
+  uint64_t target = __atomic_fetch_add( &epoch, 1, __ATOMIC_SEQ_CST );
+  qsbr_quiescent_state();
+
+  while ( oldest_epoch() <= target ) {
+    struct timespec req = { 0, 1000000 };
+    nanosleep( &req, NULL );
+  }
+}
+
+
+bool
+init_qsbr() {
+  return true;
+}
+
+
+bool
+finalize_qsbr() {
+  pthread_mutex_lock( &retired_mutex );
+  struct qsbr_retired *r = retired;
+  retired = NULL;
+  n_retired = 0;
+  pthread_mutex_unlock( &retired_mutex );
+
+  while ( r != NULL ) {
+    struct qsbr_retired *next = r->next;
+    r->free_function( r->ptr );
+    free( r );
+    r = next;
+  }
+
+  return true;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef QSBR_H
+#define QSBR_H
+
+
+#include <stdbool.h>
+
+
+void qsbr_register_thread();
+void qsbr_unregister_thread();
+void qsbr_quiescent_state();
+void qsbr_thread_offline();
+void qsbr_thread_online();
+void qsbr_retire( void *ptr, void ( *free_function )( void *ptr ) );
+void qsbr_reclaim();
+void qsbr_synchronize();
+bool init_qsbr();
+bool finalize_qsbr();
+
+
+#endif // QSBR_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
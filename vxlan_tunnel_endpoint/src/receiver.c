@@ -31,18 +31,27 @@
 #include <string.h>
 #include <sys/select.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include "checks.h"
 #include "ethdev.h"
 #include "hash.h"
+#include "latency.h"
 #include "linked_list.h"
 #include "log.h"
+#include "probes.h"
 #include "receiver.h"
 #include "reflector_common.h"
 #include "queue.h"
 #include "wrapper.h"
 
 
+// Packets replayed at most before the distributor is notified
+#define REPLAY_BATCH_SIZE 64
+// How long to wait for the distributor to free packet buffers
+#define REPLAY_BUFFER_WAIT 100000
+
+
 static void
 notify_distributor() {
   pthread_mutex_lock( &mutex );
@@ -55,6 +64,84 @@ notify_distributor() {
 }
 
 
+// Sets up headers of a packet. Returns false if it is not for us.
+static bool
+accept_packet( packet_buffer *packet, ssize_t length, uint16_t port ) {
+  if ( length < ( sizeof( struct iphdr ) + sizeof( struct udphdr ) + sizeof( struct vxlanhdr ) ) ||
+       length > PACKET_SIZE ) {
+    PROBE3( reflectord, packet_dropped, PROBE_NO_VNI, PROBE_DROP_MALFORMED, length );
+    return false;
+  }
+
+  packet->ip = ( struct iphdr * ) packet->data;
+  if ( packet->ip->protocol != IPPROTO_UDP ) {
+    return false;
+  }
+  packet->udp = ( struct udphdr * ) ( ( char * ) packet->ip + ( packet->ip->ihl * 4 ) );
+
+  if ( ntohs( packet->udp->dest ) != port ) {
+    return false;
+  }
+  packet->vxlan = ( struct vxlanhdr * ) ( ( char * ) packet->udp + sizeof( struct udphdr ) );
+  packet->length = ( size_t ) length;
+
+  if ( capture != NULL ) {
+    capture_packet( capture, get_vni_value( packet->vxlan->vni ), packet->data, packet->length );
+  }
+
+  return true;
+}
+
+
+static void
+receive_packet( packet_buffer *packet ) {
+  dequeue( free_packet_buffers );
+  enqueue( received_packets, packet );
+  PROBE3( reflectord, packet_received, PROBE_VNI( packet->vxlan->vni ), packet->data, packet->length );
+}
+
+
+/*
+ * Feeds due packets of the replay to the distributor. Unlike packets from
+ * the network, replayed ones wait for free buffers instead of being dropped.
+ */
+static void
+replay_packets( uint16_t port ) {
+  uint64_t wait = 0;
+  for ( int i = 0; i < REPLAY_BATCH_SIZE; i++ ) {
+    packet_buffer *packet = peek( free_packet_buffers );
+    if ( packet == NULL ) {
+      wait = REPLAY_BUFFER_WAIT;
+      break;
+    }
+    size_t length = 0;
+    if ( !next_replayed_packet( replay, packet->data, PACKET_SIZE, &length, &wait ) ) {
+      if ( wait == 0 ) {
+        continue;
+      }
+      break;
+    }
+    wait = 0;
+#ifdef LATENCY_STATS
+    packet->received_at = latency_clock();
+#endif
+
+    if ( accept_packet( packet, ( ssize_t ) length, port ) ) {
+      receive_packet( packet );
+    }
+  }
+
+  if ( wait > 0 ) {
+    // Same as the timeout on receiving packets from the network
+    struct timespec timeout = { 0, 1000000 };
+    if ( wait < 1000000 ) {
+      timeout.tv_nsec = ( long ) wait;
+    }
+    nanosleep( &timeout, NULL );
+  }
+}
+
+
 void *
 receiver_main( void *args ) {
   assert( args != NULL );
@@ -70,6 +157,11 @@ receiver_main( void *args ) {
   while ( running ) {
     notify_distributor();
 
+    if ( replay != NULL ) {
+      replay_packets( options->port );
+      continue;
+    }
+
     fd_set fds;
     FD_ZERO( &fds );
     FD_SET( dev->fd, &fds );
@@ -100,28 +192,18 @@ receiver_main( void *args ) {
     int err = 0;
     ssize_t length = recv_from_ethdev( dev, packet->data, sizeof( packet->data ), &err );
     if ( packet == &trash ) {
+      PROBE3( reflectord, packet_dropped, PROBE_NO_VNI, PROBE_DROP_NO_BUFFER, length );
       continue;
     }
+#ifdef LATENCY_STATS
+    packet->received_at = latency_clock();
+#endif
 
-    if ( length < ( sizeof( struct iphdr ) + sizeof( struct udphdr ) + sizeof( struct vxlanhdr ) ) ||
-         length > PACKET_SIZE ) {
-      continue;
-    }
-
-    packet->ip = ( struct iphdr * ) packet->data;
-    if ( packet->ip->protocol != IPPROTO_UDP ) {
-      continue;
-    }
-    packet->udp = ( struct udphdr * ) ( ( char * ) packet->ip + ( packet->ip->ihl * 4 ) );
-
-    if ( ntohs( packet->udp->dest ) != options->port ) {
+    if ( !accept_packet( packet, length, options->port ) ) {
       continue;
     }
-    packet->vxlan = ( struct vxlanhdr * ) ( ( char * ) packet->udp + sizeof( struct udphdr ) );
-    packet->length = ( size_t ) length;
 
-    dequeue( free_packet_buffers );
-    enqueue( received_packets, packet );
+    receive_packet( packet );
   }
 
   running = false;
@@ -28,6 +28,8 @@ queue *free_packet_buffers = NULL;
 volatile bool running = true;
 pthread_t receiver_thread = 0;
 pthread_t distributor_thread = 0;
+struct capture_ring *capture = NULL; // Received packets are kept for dumping if set
+struct replay *replay = NULL; // Packets are read from a file instead of the network if set
 
 
 /*
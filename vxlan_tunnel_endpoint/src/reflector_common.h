@@ -30,7 +30,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/select.h>
+#include "capture.h"
+#include "latency.h"
 #include "queue.h"
+#include "replay.h"
 #include "vxlan.h"
 #include "wrapper.h"
 
@@ -45,6 +48,8 @@ enum {
   PORT_ALREADY_IN_USE = 3,
   DUPLICATED_TEP_ENTRY = 4,
   TEP_ENTRY_NOT_FOUND = 5,
+  CAPTURE_DISABLED = 6,
+  REPLAY_UNAVAILABLE = 7,
   OTHER_ERROR = 255,
 };
 
@@ -60,12 +65,31 @@ typedef struct {
   } counters;
 } tunnel_endpoint;
 
+typedef struct {
+  uint32_t vni;
+  struct latency_summary reflect_latency; // Until a packet is sent to all tunnel endpoints
+} vni_stats;
+
+enum {
+  TEP_UPDATE_ADD = 0x01,
+  TEP_UPDATE_DELETE = 0x02,
+};
+
+typedef struct {
+  uint8_t op;
+  struct in_addr ip_addr;
+  uint16_t port; // Host byte order
+} tep_update;
+
 typedef struct {
   char data[ PACKET_SIZE + 1 ];
   size_t length;
   struct iphdr *ip;
   struct udphdr *udp;
   struct vxlanhdr *vxlan;
+#ifdef LATENCY_STATS
+  uint64_t received_at;
+#endif
 } packet_buffer;
 
 
@@ -76,6 +100,8 @@ extern pthread_cond_t cond;
 extern queue *received_packets;
 extern queue *free_packet_buffers;
 extern volatile bool running;
+extern struct capture_ring *capture;
+extern struct replay *replay;
 
 
 #endif // REFLECTOR_COMMON_H
@@ -43,6 +43,11 @@
 
 
 static int fd = -1;
+static bool connected = false; // Requests on a connection are served in order
+static char last_record[ 32 ]; // VNI and IP address of the last tunnel endpoint shown
+static reflector_ctrl_record_handler record_handler = NULL; // Records are printed unless set
+static void *record_handler_data = NULL;
+static bool truncated = false;
 
 
 static ssize_t
@@ -52,17 +57,30 @@ send_request( void *reply, size_t *length ) {
   assert( length != NULL );
   assert( *length > 0 );
 
-  struct sockaddr_un saddr;
-  memset( &saddr, 0, sizeof( saddr ) );
-  saddr.sun_family = AF_UNIX;
-  memset( saddr.sun_path, '\0', sizeof( saddr.sun_path ) );
-  strncpy( saddr.sun_path, CTRL_SERVER_SOCK_FILE, sizeof( saddr.sun_path ) - 1 );
-  int ret = connect( fd, ( const struct sockaddr * ) &saddr, ( socklen_t ) sizeof( saddr ) );
-  if ( ret < 0 ) {
-    char buf[ 256 ];
-    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-    error( "Failed to connect ( ret = %d, errno = %s [%d] ).", ret, error_string, errno );
-    return -1;
+  // Reconnect if the daemon went away since the last request, e.g. when
+  // it was restarted while a client kept the connection open.
+  if ( connected && ctrl_connection_closed( fd ) ) {
+    finalize_ctrl_client( fd );
+    connected = false;
+    if ( !init_ctrl_client( &fd ) ) {
+      return -1;
+    }
+  }
+
+  if ( !connected ) {
+    struct sockaddr_un saddr;
+    memset( &saddr, 0, sizeof( saddr ) );
+    saddr.sun_family = AF_UNIX;
+    memset( saddr.sun_path, '\0', sizeof( saddr.sun_path ) );
+    strncpy( saddr.sun_path, CTRL_SERVER_SOCK_FILE, sizeof( saddr.sun_path ) - 1 );
+    int ret = connect( fd, ( const struct sockaddr * ) &saddr, ( socklen_t ) sizeof( saddr ) );
+    if ( ret < 0 ) {
+      char buf[ 256 ];
+      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+      error( "Failed to connect ( ret = %d, errno = %s [%d] ).", ret, error_string, errno );
+      return -1;
+    }
+    connected = true;
   }
 
   return send_command( fd, reply, length );
@@ -95,6 +113,26 @@ dump_tunnel_endpoint( tunnel_endpoint *tep ) {
 }
 
 
+#ifdef LATENCY_STATS
+static void
+print_dump_vni_stats_header() {
+  printf( "   VNI    |   Packets    | Reflect mean (us) | p50 (us) | p90 (us) | p99 (us) | max (us)\n" );
+  printf( "----------+--------------+-------------------+----------+----------+----------+----------\n" );
+}
+
+
+static void
+dump_vni_stats( vni_stats *stats ) {
+  assert( stats != NULL );
+
+  struct latency_summary *latency = &stats->reflect_latency;
+  printf( " %#8x | %12" PRIu64 " | %17.1f | %8.1f | %8.1f | %8.1f | %8.1f\n",
+          stats->vni, latency->count, ( double ) latency->mean / 1000, ( double ) latency->p50 / 1000,
+          ( double ) latency->p90 / 1000, ( double ) latency->p99 / 1000, ( double ) latency->max / 1000 );
+}
+#endif
+
+
 static bool
 handle_reply( void *reply, size_t length, uint8_t *reason ) {
   assert( reply != NULL );
@@ -132,12 +170,50 @@ handle_reply( void *reply, size_t length, uint8_t *reason ) {
       unsigned int count = ( unsigned int ) ( header->length - offsetof( list_tep_reply, tep ) ) / sizeof( tunnel_endpoint );
       tunnel_endpoint *tep = ( ( list_tep_reply * ) reply )->tep;
       for ( unsigned int i = 0; i < count; i++ ) {
-        dump_tunnel_endpoint( tep );
+        if ( record_handler != NULL ) {
+          record_handler( type, tep, record_handler_data );
+        }
+        else {
+          dump_tunnel_endpoint( tep );
+        }
+        char addr[ INET_ADDRSTRLEN ];
+        memset( addr, '\0', sizeof( addr ) );
+        inet_ntop( AF_INET, &tep->ip_addr, addr, sizeof( addr ) );
+        snprintf( last_record, sizeof( last_record ), "%#x/%s", tep->vni, addr );
         tep++;
       }
     }
     break;
 
+    case DUMP_CAPTURE_REPLY:
+    {
+      uint32_t *n_packets = &( ( dump_capture_reply * ) reply )->n_packets;
+      if ( record_handler != NULL ) {
+        record_handler( type, n_packets, record_handler_data );
+        break;
+      }
+      printf( "%u packets are written.\n", *n_packets );
+    }
+    break;
+
+#ifdef LATENCY_STATS
+    case SHOW_STATS_REPLY:
+    {
+      unsigned int count = ( unsigned int ) ( header->length - offsetof( show_stats_reply, stats ) ) / sizeof( vni_stats );
+      vni_stats *stats = ( ( show_stats_reply * ) reply )->stats;
+      for ( unsigned int i = 0; i < count; i++ ) {
+        if ( record_handler != NULL ) {
+          record_handler( type, stats, record_handler_data );
+        }
+        else {
+          dump_vni_stats( stats );
+        }
+        stats++;
+      }
+    }
+    break;
+#endif
+
     default:
       break;
   }
@@ -153,6 +229,8 @@ recv_reply( uint32_t xid, uint8_t *reason ) {
   bool ret = true;
   uint8_t flags = FLAG_MORE;
   int n_replies = 0;
+  memset( last_record, '\0', sizeof( last_record ) );
+  truncated = false;
 
   while ( flags & FLAG_MORE ) {
     char reply[ COMMAND_MESSAGE_LENGTH ];
@@ -174,11 +252,19 @@ recv_reply( uint32_t xid, uint8_t *reason ) {
 
     switch ( header->type ) {
       case LIST_TEP_REPLY:
-        if ( n_replies == 0 && header->status == STATUS_OK ) {
+        if ( n_replies == 0 && header->status == STATUS_OK && record_handler == NULL ) {
           print_dump_tunnel_endpoint_header();
         }
         break;
 
+#ifdef LATENCY_STATS
+      case SHOW_STATS_REPLY:
+        if ( n_replies == 0 && header->status == STATUS_OK && record_handler == NULL ) {
+          print_dump_vni_stats_header();
+        }
+        break;
+#endif
+
       default:
         break;
     }
@@ -188,6 +274,11 @@ recv_reply( uint32_t xid, uint8_t *reason ) {
     n_replies++;
   }
 
+  truncated = ret && ( flags & FLAG_TRUNCATED ) != 0;
+  if ( truncated && strlen( last_record ) > 0 && record_handler == NULL ) {
+    printf( "More entries follow. Continue with --cursor %s.\n", last_record );
+  }
+
   return ret;
 }
 
@@ -268,7 +359,8 @@ delete_tep( uint32_t vni, struct in_addr ip_addr, uint8_t *reason ) {
 
 
 bool
-list_tep( uint32_t vni, uint8_t *reason ) {
+list_tep( uint32_t vni, const uint32_t *cursor_vni, const struct in_addr *cursor_ip_addr, uint32_t max_entries,
+          uint8_t *reason ) {
   assert( fd >= 0 );
   assert( reason != NULL );
 
@@ -278,6 +370,12 @@ list_tep( uint32_t vni, uint8_t *reason ) {
   request.header.type = LIST_TEP_REQUEST;
   request.header.length = ( uint32_t ) sizeof( list_tep_request );
   request.vni = vni;
+  if ( cursor_vni != NULL && cursor_ip_addr != NULL ) {
+    request.filter |= DUMP_CURSOR;
+    request.cursor_vni = *cursor_vni;
+    request.cursor_ip_addr = *cursor_ip_addr;
+  }
+  request.max_entries = max_entries;
   size_t length = sizeof( list_tep_request );
 
   ssize_t ret = send_request( ( void * ) &request, &length );
@@ -290,6 +388,150 @@ list_tep( uint32_t vni, uint8_t *reason ) {
 }
 
 
+#ifdef LATENCY_STATS
+bool
+show_stats( uint32_t vni, uint8_t *reason ) {
+  assert( fd >= 0 );
+  assert( reason != NULL );
+
+  show_stats_request request;
+  memset( &request, 0, sizeof( show_stats_request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = SHOW_STATS_REQUEST;
+  request.header.length = ( uint32_t ) sizeof( show_stats_request );
+  request.vni = vni;
+  size_t length = sizeof( show_stats_request );
+
+  ssize_t ret = send_request( ( void * ) &request, &length );
+  if ( ret < 0 ) {
+    *reason = OTHER_ERROR;
+    return false;
+  }
+
+  return recv_reply( request.header.xid, reason );
+}
+#endif
+
+
+// Dumps recently received packets to a pcapng file. The file is written by
+// the daemon, so the path is absolute on its host.
+bool
+dump_capture( const char *file, uint8_t *reason ) {
+  assert( fd >= 0 );
+  assert( file != NULL );
+  assert( reason != NULL );
+
+  if ( strlen( file ) >= CAPTURE_FILE_LENGTH ) {
+    *reason = INVALID_ARGUMENT;
+    return false;
+  }
+
+  dump_capture_request request;
+  memset( &request, 0, sizeof( dump_capture_request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = DUMP_CAPTURE_REQUEST;
+  request.header.length = ( uint32_t ) sizeof( dump_capture_request );
+  strncpy( request.file, file, sizeof( request.file ) - 1 );
+  size_t length = sizeof( dump_capture_request );
+
+  ssize_t ret = send_request( ( void * ) &request, &length );
+  if ( ret < 0 ) {
+    *reason = OTHER_ERROR;
+    return false;
+  }
+
+  return recv_reply( request.header.xid, reason );
+}
+
+
+bool
+start_replaying( uint8_t *reason ) {
+  assert( fd >= 0 );
+  assert( reason != NULL );
+
+  start_replay_request request;
+  memset( &request, 0, sizeof( start_replay_request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = START_REPLAY_REQUEST;
+  request.header.length = ( uint32_t ) sizeof( start_replay_request );
+  size_t length = sizeof( start_replay_request );
+
+  ssize_t ret = send_request( ( void * ) &request, &length );
+  if ( ret < 0 ) {
+    *reason = OTHER_ERROR;
+    return false;
+  }
+
+  return recv_reply( request.header.xid, reason );
+}
+
+
+// Sends updates in as many requests as needed on a single connection. The
+// daemon applies the batch when the last request arrives and replies once.
+bool
+update_teps( uint32_t vni, const tep_update *updates, unsigned int n_updates, bool replace, uint8_t *reason ) {
+  assert( fd >= 0 );
+  assert( updates != NULL || n_updates == 0 );
+  assert( reason != NULL );
+
+  size_t header_length = offsetof( update_teps_request, updates );
+  unsigned int max_updates = ( unsigned int ) ( ( COMMAND_MESSAGE_LENGTH - header_length ) / sizeof( tep_update ) );
+  update_teps_request *request = malloc( COMMAND_MESSAGE_LENGTH );
+  assert( request != NULL );
+  uint32_t xid = ( uint32_t ) rand();
+  unsigned int offset = 0;
+  do {
+    unsigned int n = n_updates - offset;
+    if ( n > max_updates ) {
+      n = max_updates;
+    }
+
+    size_t length = header_length + sizeof( tep_update ) * n;
+    memset( request, 0, length );
+    request->header.xid = xid;
+    request->header.type = UPDATE_TEPS_REQUEST;
+    request->header.length = ( uint16_t ) length;
+    request->vni = vni;
+    request->flags = replace ? UPDATE_REPLACE : 0;
+    if ( offset + n < n_updates ) {
+      request->flags |= UPDATE_MORE;
+    }
+    request->n_updates = ( uint16_t ) n;
+    if ( n > 0 ) {
+      memcpy( request->updates, updates + offset, sizeof( tep_update ) * n );
+    }
+
+    ssize_t ret = send_request( ( void * ) request, &length );
+    if ( ret <= 0 ) {
+      free( request );
+      *reason = OTHER_ERROR;
+      return false;
+    }
+    offset += n;
+  } while ( offset < n_updates );
+  free( request );
+
+  return recv_reply( xid, reason );
+}
+
+
+// Passes records in replies to a handler instead of printing them. Used
+// by the client library, which converts them into its own structures.
+void
+set_reflector_ctrl_record_handler( reflector_ctrl_record_handler handler, void *user_data ) {
+  record_handler = handler;
+  record_handler_data = user_data;
+}
+
+
+// Returns true if the records of the last reply were cut at the requested
+// maximum.
+bool
+reflector_ctrl_reply_truncated() {
+  return truncated;
+}
+
+
 bool
 init_reflector_ctrl_client() {
   assert( fd < 0 );
@@ -302,7 +544,11 @@ bool
 finalize_reflector_ctrl_client() {
   assert( fd >= 0 );
 
-  return finalize_ctrl_client( fd );
+  bool ret = finalize_ctrl_client( fd );
+  fd = -1;
+  connected = false;
+
+  return ret;
 }
 
 
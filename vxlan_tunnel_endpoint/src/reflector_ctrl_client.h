@@ -27,10 +27,22 @@
 #include "reflector_ctrl_common.h"
 
 
+typedef void ( *reflector_ctrl_record_handler )( uint8_t type, const void *record, void *user_data );
+
+
 bool add_tep( uint32_t vni, struct in_addr ip_addr, uint16_t port, uint8_t *reason );
 bool set_tep( uint32_t vni, struct in_addr ip_addr, uint16_t set_bitmap, uint16_t port, uint8_t *reason );
 bool delete_tep( uint32_t vni, struct in_addr ip_addr, uint8_t *reason );
-bool list_tep( uint32_t vni, uint8_t *reason );
+bool list_tep( uint32_t vni, const uint32_t *cursor_vni, const struct in_addr *cursor_ip_addr, uint32_t max_entries,
+               uint8_t *reason );
+bool update_teps( uint32_t vni, const tep_update *updates, unsigned int n_updates, bool replace, uint8_t *reason );
+bool dump_capture( const char *file, uint8_t *reason );
+bool start_replaying( uint8_t *reason );
+#ifdef LATENCY_STATS
+bool show_stats( uint32_t vni, uint8_t *reason );
+#endif
+void set_reflector_ctrl_record_handler( reflector_ctrl_record_handler handler, void *user_data );
+bool reflector_ctrl_reply_truncated();
 bool init_reflector_ctrl_client();
 bool finalize_reflector_ctrl_client();
 
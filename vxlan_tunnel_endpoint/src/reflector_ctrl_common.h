@@ -22,6 +22,7 @@
 #define REFLECTOR_CTRL_COMMON_H
 
 
+#include <net/if.h>
 #include "ctrl_if.h"
 #include "reflector_common.h"
 
@@ -40,6 +41,18 @@ enum {
   DEL_TEP_REPLY,
   LIST_TEP_REQUEST,
   LIST_TEP_REPLY,
+  HANDOVER_REQUEST,
+  HANDOVER_REPLY,
+  HANDOVER_COMPLETE_REQUEST,
+  HANDOVER_COMPLETE_REPLY,
+  UPDATE_TEPS_REQUEST,
+  UPDATE_TEPS_REPLY,
+  SHOW_STATS_REQUEST,
+  SHOW_STATS_REPLY,
+  DUMP_CAPTURE_REQUEST,
+  DUMP_CAPTURE_REPLY,
+  START_REPLAY_REQUEST,
+  START_REPLAY_REPLY,
   MESSAGE_TYPE_MAX,
 };
 
@@ -49,6 +62,44 @@ enum {
   SET_TEP_PORT = 0x0004,
 };
 
+// Filters on list_tep. Tunnel endpoints are returned in order of VNI and IP
+// address so that a cursor can resume a truncated dump.
+enum {
+  DUMP_CURSOR = 0x01,
+};
+
+// Flags on update_teps. A batch may span several requests on a single
+// connection; all but the last carry UPDATE_MORE and the batch is applied
+// when the last one arrives. With UPDATE_REPLACE, tunnel endpoints of the
+// VNI that are not added by the batch are removed.
+enum {
+  UPDATE_REPLACE = 0x01,
+  UPDATE_MORE = 0x02,
+};
+
+// Records in a handover reply. The raw and dummy sockets ride on the message
+// that carries HANDOVER_SOCKETS.
+enum {
+  HANDOVER_SOCKETS,
+  HANDOVER_TEPS,
+  HANDOVER_END,
+};
+
+#define HANDOVER_VERSION 1
+#define HANDOVER_TIMEOUT 30
+
+
+typedef struct {
+  uint16_t port;
+  char interface[ IFNAMSIZ ];
+} handover_sockets;
+
+typedef struct {
+  uint32_t vni;
+  struct in_addr ip_addr;
+  uint16_t port;
+} handover_tep;
+
 
 typedef struct {
   command_request_header header;
@@ -74,8 +125,43 @@ typedef struct {
 typedef struct {
   command_request_header header;
   uint32_t vni;
+  uint8_t filter;
+  uint32_t cursor_vni; // Tunnel endpoints after this one are returned
+  struct in_addr cursor_ip_addr;
+  uint32_t max_entries; // 0 means no limit
 } list_tep_request;
 
+typedef struct {
+  command_request_header header;
+  uint32_t vni;
+  uint8_t flags;
+  uint16_t n_updates;
+  tep_update updates[ 0 ];
+} update_teps_request;
+
+typedef struct {
+  command_request_header header;
+  uint32_t vni;
+} show_stats_request;
+
+typedef struct {
+  command_request_header header;
+  char file[ CAPTURE_FILE_LENGTH ]; // Absolute path on the host of the daemon
+} dump_capture_request;
+
+typedef struct {
+  command_request_header header;
+} start_replay_request;
+
+typedef struct {
+  command_request_header header;
+  uint32_t version;
+} handover_request;
+
+typedef struct {
+  command_request_header header;
+} handover_complete_request;
+
 typedef struct {
   command_reply_header header;
 } add_tep_reply;
@@ -93,6 +179,32 @@ typedef struct {
   tunnel_endpoint tep[ 0 ];
 } list_tep_reply;
 
+typedef struct {
+  command_reply_header header;
+  uint8_t record;
+  uint16_t n_entries;
+  uint8_t entries[ 0 ];
+} handover_reply;
+
+typedef del_tep_reply handover_complete_reply;
+
+typedef struct {
+  command_reply_header header;
+  uint32_t n_failed;
+} update_teps_reply;
+
+typedef struct {
+  command_reply_header header;
+  vni_stats stats[ 0 ];
+} show_stats_reply;
+
+typedef struct {
+  command_reply_header header;
+  uint32_t n_packets;
+} dump_capture_reply;
+
+typedef del_tep_reply start_replay_reply;
+
 
 #endif // REFLECTOR_CTRL_COMMON_H
 
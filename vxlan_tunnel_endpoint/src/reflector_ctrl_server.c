@@ -26,6 +26,7 @@
 #include <net/if_arp.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -39,22 +40,19 @@
 #include "distributor.h"
 #include "ethdev.h"
 #include "log.h"
+#include "probes.h"
+#include "reflector_handover.h"
 #include "wrapper.h"
 
 
 static int listen_fd = -1;
+static char sock_file[ sizeof( ( ( struct sockaddr_un * ) NULL )->sun_path ) ];
 static ethdev *dev = NULL;
 
 
 static ssize_t
 send_reply( int fd, void *reply, size_t *length ) {
-  return send_command( fd, reply, length );
-}
-
-
-static ssize_t
-recv_request( int fd, void *request, size_t *length ) {
-  return recv_command( fd, request, length );
+  return send_ctrl_reply( fd, reply, *length ) ? ( ssize_t ) *length : -1;
 }
 
 
@@ -164,85 +162,282 @@ delete_tep( int fd, del_tep_request *request ) {
 }
 
 
+// Gathers the updates of a batch that may span several requests on the
+// connection. All but the last request carry UPDATE_MORE and are staged
+// until the last one arrives. Returns CTRL_BATCH_COMPLETE with all updates
+// of the batch, which the caller frees.
+static int
+collect_tep_updates( int fd, update_teps_request *request, size_t length, tep_update **updates, int *n_updates ) {
+  assert( fd >= 0 );
+  assert( request != NULL );
+  assert( updates != NULL );
+  assert( n_updates != NULL );
+
+  size_t header_length = offsetof( update_teps_request, updates );
+  const void *records = NULL;
+  if ( length >= header_length && request->n_updates <= ( length - header_length ) / sizeof( tep_update ) ) {
+    records = request->updates;
+  }
+  void *batch = NULL;
+  size_t batch_length = 0;
+  int ret = collect_ctrl_batch( fd, request->header.xid, ( request->flags & UPDATE_MORE ) != 0, records,
+                                records != NULL ? sizeof( tep_update ) * request->n_updates : 0, &batch, &batch_length );
+  *updates = batch;
+  *n_updates = ( int ) ( batch_length / sizeof( tep_update ) );
+
+  return ret;
+}
+
+
 static void
-list_tep( int fd, list_tep_request *request ) {
+update_teps( int fd, update_teps_request *request, size_t length ) {
   assert( fd >= 0 );
   assert( request != NULL );
 
-  uint8_t reason = 0;
-  list *l = NULL;
-  bool ret = true;
-  if ( !( valid_vni( request->vni ) || request->vni == VNI_ANY ) ) {
-    reason = INVALID_ARGUMENT;
+  update_teps_reply reply;
+  size_t reply_length = sizeof( update_teps_reply );
+  memset( &reply, 0, reply_length );
+  reply.header.xid = request->header.xid;
+  reply.header.type = UPDATE_TEPS_REPLY;
+  reply.header.reason = SUCCEEDED;
+
+  uint32_t vni = request->vni;
+  tep_update *updates = NULL;
+  int n_updates = 0;
+  uint8_t flags = request->flags;
+  int collected = collect_tep_updates( fd, request, length, &updates, &n_updates );
+  if ( collected == CTRL_BATCH_STAGED ) {
+    return;
+  }
+  bool ret = collected == CTRL_BATCH_COMPLETE;
+  if ( !ret || !valid_vni( vni ) ) {
+    reply.header.reason = INVALID_ARGUMENT;
     ret = false;
   }
   else {
-    if ( request->vni == VNI_ANY ) {
-      l = get_all_tunnel_endpoints();
-    }
-    else {
-      l = lookup_tunnel_endpoints( request->vni );
-      if ( l == NULL || ( l != NULL && l->head == NULL ) ) {
-        reason = TEP_ENTRY_NOT_FOUND;
-        ret = false;
-      }
+    reply.n_failed = ( uint32_t ) update_tunnel_endpoints( vni, updates, n_updates, ( flags & UPDATE_REPLACE ) != 0 );
+    debug( "%d tunnel endpoint updates are applied ( vni = %#x, replace = %s, failed = %u ).",
+           n_updates, vni, ( flags & UPDATE_REPLACE ) != 0 ? "true" : "false", reply.n_failed );
+    if ( reply.n_failed > 0 ) {
+      reply.header.reason = OTHER_ERROR;
+      ret = false;
     }
   }
+  if ( updates != NULL ) {
+    free( updates );
+  }
 
-  if ( l == NULL || ( l != NULL && l->head == NULL ) ) {
-    size_t length = offsetof( list_tep_reply, tep );
-    list_tep_reply *reply = malloc( length );
-    memset( reply, 0, length );
-    reply->header.xid = request->header.xid;
-    reply->header.type = LIST_TEP_REPLY;
-    if ( ret ) {
-      reply->header.status = STATUS_OK;
-    }
-    else {
-      reply->header.status = STATUS_NG;
-    }
-    reply->header.reason = reason;
-    reply->header.flags = FLAG_NONE;
-    reply->header.length = ( uint16_t ) length;
-    send_reply( fd, ( void * ) reply, &length );
-    free( reply );
-    return;
+  if ( ret ) {
+    reply.header.status = STATUS_OK;
+  }
+  else {
+    reply.header.status = STATUS_NG;
+  }
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) reply_length;
+  send_reply( fd, ( void * ) &reply, &reply_length );
+}
+
+
+static int
+compare_teps( const void *x, const void *y ) {
+  const tunnel_endpoint *a = x;
+  const tunnel_endpoint *b = y;
+
+  if ( a->vni != b->vni ) {
+    return a->vni < b->vni ? -1 : 1;
+  }
+  uint32_t a_addr = ntohl( a->ip_addr.s_addr );
+  uint32_t b_addr = ntohl( b->ip_addr.s_addr );
+
+  return a_addr < b_addr ? -1 : ( a_addr > b_addr ? 1 : 0 );
+}
+
+
+static tunnel_endpoint *
+copy_teps( list *l, int *n_teps ) {
+  assert( n_teps != NULL );
+
+  *n_teps = 0;
+  if ( l == NULL ) {
+    return NULL;
   }
 
   pthread_mutex_lock( &l->mutex );
+  int size = 0;
   for ( list_element *e = l->head; e != NULL; e = e->next ) {
-    if ( e->data == NULL ) {
-      continue;
+    size++;
+  }
+  tunnel_endpoint *teps = NULL;
+  if ( size > 0 ) {
+    teps = malloc( sizeof( tunnel_endpoint ) * ( size_t ) size );
+    assert( teps != NULL );
+  }
+  for ( list_element *e = l->head; e != NULL; e = e->next ) {
+    if ( e->data != NULL ) {
+      memcpy( &teps[ ( *n_teps )++ ], e->data, sizeof( tunnel_endpoint ) );
     }
-    size_t length = offsetof( list_tep_reply, tep ) + sizeof( tunnel_endpoint );
-    list_tep_reply *reply = malloc( length );
-    memset( reply, 0, length );
-    reply->header.xid = request->header.xid;
-    reply->header.type = LIST_TEP_REPLY;
-    reply->header.status = STATUS_OK;
-    reply->header.flags = ( ( e->next != NULL && e->next->data != NULL ) ? FLAG_MORE : FLAG_NONE );
-    reply->header.length = ( uint16_t ) length;
-    memcpy( reply->tep, e->data, sizeof( tunnel_endpoint ) );
-    send_reply( fd, ( void * ) reply, &length );
-    free( reply );
-  }
-
-  if ( request->vni == VNI_ANY ) {
-    for ( list_element *e = l->head; e != NULL; e = e->next ) {
-      if ( e->data != NULL ) {
-        free( e->data );
-      }
+  }
+  pthread_mutex_unlock( &l->mutex );
+
+  return teps;
+}
+
+
+static void
+list_tep( int fd, list_tep_request *request ) {
+  assert( fd >= 0 );
+  assert( request != NULL );
+
+  list_tep_reply reply;
+  memset( &reply, 0, sizeof( reply ) );
+  reply.header.xid = request->header.xid;
+  reply.header.type = LIST_TEP_REPLY;
+  reply.header.status = STATUS_OK;
+  reply.header.reason = SUCCEEDED;
+
+  int n_teps = 0;
+  tunnel_endpoint *teps = NULL;
+  if ( !( valid_vni( request->vni ) || request->vni == VNI_ANY ) ) {
+    reply.header.status = STATUS_NG;
+    reply.header.reason = INVALID_ARGUMENT;
+  }
+  else if ( request->vni == VNI_ANY ) {
+    list *l = get_all_tunnel_endpoints();
+    teps = copy_teps( l, &n_teps );
+    if ( l != NULL ) {
+      delete_list_totally( l );
     }
   }
+  else {
+    teps = copy_teps( lookup_tunnel_endpoints( request->vni ), &n_teps );
+    if ( n_teps == 0 ) {
+      reply.header.status = STATUS_NG;
+      reply.header.reason = TEP_ENTRY_NOT_FOUND;
+    }
+  }
+  if ( n_teps > 1 ) {
+    qsort( teps, ( size_t ) n_teps, sizeof( tunnel_endpoint ), compare_teps );
+  }
 
-  pthread_mutex_unlock( &l->mutex );
+  tunnel_endpoint cursor;
+  memset( &cursor, 0, sizeof( cursor ) );
+  cursor.vni = request->cursor_vni;
+  cursor.ip_addr = request->cursor_ip_addr;
+  int offset = 0;
+  while ( ( request->filter & DUMP_CURSOR ) != 0 && offset < n_teps &&
+          compare_teps( &teps[ offset ], &cursor ) <= 0 ) {
+    offset++;
+  }
+  int n = n_teps - offset;
+  bool truncated = false;
+  if ( request->max_entries > 0 && n > ( int ) request->max_entries ) {
+    n = ( int ) request->max_entries;
+    truncated = true;
+  }
+
+  send_packed_replies( fd, &reply, offsetof( list_tep_reply, tep ), n > 0 ? teps + offset : NULL,
+                       sizeof( tunnel_endpoint ), n, truncated ? FLAG_TRUNCATED : FLAG_NONE );
 
-  if ( request->vni == VNI_ANY ) {
-    delete_list( l );
+  if ( teps != NULL ) {
+    free( teps );
   }
 }
 
 
+#ifdef LATENCY_STATS
+static void
+show_stats( int fd, show_stats_request *request ) {
+  assert( fd >= 0 );
+  assert( request != NULL );
+
+  show_stats_reply reply;
+  memset( &reply, 0, sizeof( reply ) );
+  reply.header.xid = request->header.xid;
+  reply.header.type = SHOW_STATS_REPLY;
+  reply.header.status = STATUS_OK;
+  reply.header.reason = SUCCEEDED;
+
+  int n_stats = 0;
+  vni_stats *stats = NULL;
+  if ( !( valid_vni( request->vni ) || request->vni == VNI_ANY ) ) {
+    reply.header.status = STATUS_NG;
+    reply.header.reason = INVALID_ARGUMENT;
+  }
+  else {
+    stats = get_vni_stats( request->vni, &n_stats );
+  }
+
+  send_packed_replies( fd, &reply, offsetof( show_stats_reply, stats ), stats, sizeof( vni_stats ), n_stats,
+                       FLAG_NONE );
+
+  if ( stats != NULL ) {
+    free( stats );
+  }
+}
+#endif
+
+
+static void
+dump_capture( int fd, dump_capture_request *request ) {
+  assert( fd >= 0 );
+  assert( request != NULL );
+
+  dump_capture_reply reply;
+  size_t length = sizeof( dump_capture_reply );
+  memset( &reply, 0, length );
+  reply.header.xid = request->header.xid;
+  reply.header.type = DUMP_CAPTURE_REPLY;
+  reply.header.status = STATUS_NG;
+  reply.header.reason = SUCCEEDED;
+
+  request->file[ CAPTURE_FILE_LENGTH - 1 ] = '\0';
+  if ( capture == NULL ) {
+    reply.header.reason = CAPTURE_DISABLED;
+  }
+  else if ( request->file[ 0 ] != '/' ) {
+    reply.header.reason = INVALID_ARGUMENT;
+  }
+  else if ( !dump_capture_ring( capture, request->file, "reflectord", &reply.n_packets ) ) {
+    reply.header.reason = OTHER_ERROR;
+  }
+  else {
+    reply.header.status = STATUS_OK;
+    info( "%u packets are written to %s.", reply.n_packets, request->file );
+  }
+
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) length;
+  send_reply( fd, ( void * ) &reply, &length );
+}
+
+
+static void
+start_replaying( int fd, start_replay_request *request ) {
+  assert( fd >= 0 );
+  assert( request != NULL );
+
+  start_replay_reply reply;
+  size_t length = sizeof( start_replay_reply );
+  memset( &reply, 0, length );
+  reply.header.xid = request->header.xid;
+  reply.header.type = START_REPLAY_REPLY;
+  if ( replay != NULL && start_replay( replay ) ) {
+    reply.header.status = STATUS_OK;
+    reply.header.reason = SUCCEEDED;
+  }
+  else {
+    // Not in replay mode or a replay is in progress
+    reply.header.status = STATUS_NG;
+    reply.header.reason = REPLAY_UNAVAILABLE;
+  }
+
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) length;
+  send_reply( fd, ( void * ) &reply, &length );
+}
+
+
 static bool
 handle_request( int fd, void *request, size_t *length ) {
   assert( fd >= 0 );
@@ -252,6 +447,7 @@ handle_request( int fd, void *request, size_t *length ) {
 
   command_request_header *header = request;
   uint8_t type = header->type;
+  PROBE3( reflectord, ctrl_request, type, header->xid, *length );
   switch ( type ) {
     case ADD_TEP_REQUEST:
       add_tep( fd, request );
@@ -269,11 +465,36 @@ handle_request( int fd, void *request, size_t *length ) {
       list_tep( fd, request );
       break;
 
+    case UPDATE_TEPS_REQUEST:
+      update_teps( fd, request, *length );
+      break;
+
+#ifdef LATENCY_STATS
+    case SHOW_STATS_REQUEST:
+      show_stats( fd, request );
+      break;
+#endif
+
+    case HANDOVER_REQUEST:
+      hand_over_reflector( fd, request, dev );
+      break;
+
+    case DUMP_CAPTURE_REQUEST:
+      dump_capture( fd, request );
+      break;
+
+    case START_REPLAY_REQUEST:
+      start_replaying( fd, request );
+      break;
+
     default:
       error( "Unhandled message type ( %#x ).", type );
+      PROBE2( reflectord, ctrl_request_done, type, header->xid );
       return false;
   }
 
+  PROBE2( reflectord, ctrl_request_done, type, header->xid );
+
   return true;
 }
 
@@ -282,63 +503,44 @@ bool
 run_reflector_ctrl_server() {
   assert( listen_fd >= 0 );
 
-  uint8_t request[ COMMAND_MESSAGE_LENGTH ];
-  size_t length = COMMAND_MESSAGE_LENGTH;
+  run_ctrl_server( listen_fd, handle_request, NULL );
 
-  char buf[ 256 ];
+  return false;
+}
 
-  while ( running ) {
-    fd_set fds;
-    FD_ZERO( &fds );
-    FD_SET( listen_fd, &fds );
-    struct timespec timeout = { 1, 0 };
-    int ret = pselect( listen_fd + 1, &fds, NULL, NULL, &timeout, NULL );
-    if ( ret < 0 ) {
-      if ( errno == EINTR ) {
-        continue;
-      }
-      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-      error( "Failed to select ( listen_fd = %d, errno = %s [%d] ).", listen_fd, error_string, errno );
-      break;
-    }
-    else if ( ret == 0 ) {
-      continue;
-    }
 
-    if ( !FD_ISSET( listen_fd, &fds ) ) {
-      continue;
-    }
+bool
+init_reflector_ctrl_server( ethdev *_dev, bool takeover ) {
+  assert( listen_fd < 0 );
+  assert( _dev != NULL );
 
-    int fd = accept( listen_fd, NULL, NULL );
-    if ( fd < 0 ) {
-      if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) {
-        continue;
-      }
-      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-      error( "Failed to accept ( listen_fd = %d, errno = %s [%d] ).", listen_fd, error_string, errno );
-      break;
-    }
-    memset( &request, 0, ( size_t ) sizeof( request ) );
-    length = COMMAND_MESSAGE_LENGTH;
-    ssize_t retval = recv_request( fd, request, &length );
-    if ( retval > 0 ) {
-      handle_request( fd, ( void * ) request, &length );
-    }
-    close( fd );
+  dev = _dev;
+
+  // The running process keeps CTRL_SERVER_SOCK_FILE until the takeover completes.
+  if ( takeover ) {
+    snprintf( sock_file, sizeof( sock_file ), "%s.%u", CTRL_SERVER_SOCK_FILE, getpid() );
+  }
+  else {
+    snprintf( sock_file, sizeof( sock_file ), "%s", CTRL_SERVER_SOCK_FILE );
   }
 
-  return false;
+  return init_ctrl_server( &listen_fd, sock_file );
 }
 
 
 bool
-init_reflector_ctrl_server( ethdev *_dev ) {
-  assert( listen_fd < 0 );
-  assert( _dev != NULL );
+publish_reflector_ctrl_server() {
+  assert( listen_fd >= 0 );
 
-  dev = _dev;
+  if ( strcmp( sock_file, CTRL_SERVER_SOCK_FILE ) == 0 ) {
+    return true;
+  }
+  if ( !publish_ctrl_server( sock_file, CTRL_SERVER_SOCK_FILE ) ) {
+    return false;
+  }
+  snprintf( sock_file, sizeof( sock_file ), "%s", CTRL_SERVER_SOCK_FILE );
 
-  return init_ctrl_server( &listen_fd, CTRL_SERVER_SOCK_FILE );
+  return true;
 }
 
 
@@ -349,7 +551,7 @@ finalize_reflector_ctrl_server() {
 
   dev = NULL;
 
-  return finalize_ctrl_server( listen_fd, CTRL_SERVER_SOCK_FILE );
+  return finalize_ctrl_server( listen_fd, sock_file );
 }
 
 
@@ -23,11 +23,13 @@
 
 
 #include <stdbool.h>
+#include "ethdev.h"
 #include "reflector_ctrl_common.h"
 
 
 bool run_reflector_ctrl_server();
-bool init_reflector_ctrl_server();
+bool init_reflector_ctrl_server( ethdev *dev, bool takeover );
+bool publish_reflector_ctrl_server();
 bool finalize_reflector_ctrl_server();
 
 
@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "distributor.h"
+#include "linked_list.h"
+#include "log.h"
+#include "reflector_handover.h"
+#include "wrapper.h"
+
+
+static bool handed_over = false;
+static int handover_fd = -1;
+static list *teps = NULL;
+
+
+static bool
+send_records( int fd, uint32_t xid, uint8_t record, const void *entries, size_t entry_size, int n_entries,
+              const int *fds, int n_fds ) {
+  assert( entry_size > 0 );
+
+  int max_entries = ( int ) ( ( COMMAND_MESSAGE_LENGTH - offsetof( handover_reply, entries ) ) / entry_size );
+  int offset = 0;
+  do {
+    int n = n_entries - offset;
+    if ( n > max_entries ) {
+      n = max_entries;
+    }
+    size_t length = offsetof( handover_reply, entries ) + entry_size * ( size_t ) n;
+    handover_reply *reply = malloc( length );
+    memset( reply, 0, length );
+    reply->header.xid = xid;
+    reply->header.type = HANDOVER_REPLY;
+    reply->header.status = STATUS_OK;
+    reply->header.reason = SUCCEEDED;
+    reply->header.flags = record != HANDOVER_END ? FLAG_MORE : FLAG_NONE;
+    reply->header.length = ( uint16_t ) length;
+    reply->record = record;
+    reply->n_entries = ( uint16_t ) n;
+    if ( n > 0 ) {
+      memcpy( reply->entries, ( const uint8_t * ) entries + entry_size * ( size_t ) offset, entry_size * ( size_t ) n );
+    }
+    ssize_t ret = send_command_with_fds( fd, reply, length, fds, offset == 0 ? n_fds : 0 );
+    free( reply );
+    if ( ret < 0 ) {
+      return false;
+    }
+    offset += n;
+  } while ( offset < n_entries );
+
+  return true;
+}
+
+
+static bool
+send_tunnel_endpoints( int fd, uint32_t xid ) {
+  list *l = get_all_tunnel_endpoints();
+  if ( l == NULL ) {
+    return true;
+  }
+
+  int n_entries = 0;
+  for ( list_element *e = l->head; e != NULL; e = e->next ) {
+    n_entries++;
+  }
+  handover_tep *entries = malloc( sizeof( handover_tep ) * ( size_t ) n_entries );
+  memset( entries, 0, sizeof( handover_tep ) * ( size_t ) n_entries );
+  int n = 0;
+  for ( list_element *e = l->head; e != NULL; e = e->next ) {
+    tunnel_endpoint *tep = e->data;
+    entries[ n ].vni = tep->vni;
+    entries[ n ].ip_addr = tep->ip_addr;
+    entries[ n ].port = ntohs( tep->port );
+    n++;
+  }
+  bool ret = send_records( fd, xid, HANDOVER_TEPS, entries, sizeof( handover_tep ), n, NULL, 0 );
+  free( entries );
+  delete_list_totally( l );
+
+  return ret;
+}
+
+
+static void
+send_handover_error( int fd, uint32_t xid, uint8_t reason ) {
+  handover_reply reply;
+  memset( &reply, 0, sizeof( reply ) );
+  reply.header.xid = xid;
+  reply.header.type = HANDOVER_REPLY;
+  reply.header.status = STATUS_NG;
+  reply.header.reason = reason;
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) sizeof( reply );
+  reply.record = HANDOVER_END;
+  send_command_with_fds( fd, &reply, sizeof( reply ), NULL, 0 );
+}
+
+
+// Sends the raw and dummy sockets and the tunnel endpoint table to a new
+// process. Reflection goes on until the new process completes the takeover.
+void
+hand_over_reflector( int fd, handover_request *request, ethdev *dev ) {
+  assert( fd >= 0 );
+  assert( request != NULL );
+  assert( dev != NULL );
+
+  uint32_t xid = request->header.xid;
+  if ( request->version != HANDOVER_VERSION ) {
+    error( "Unsupported handover version ( version = %u, expected = %u ).", request->version, HANDOVER_VERSION );
+    send_handover_error( fd, xid, INVALID_ARGUMENT );
+    return;
+  }
+
+  struct sockaddr_in sin;
+  socklen_t sin_length = sizeof( sin );
+  memset( &sin, 0, sizeof( sin ) );
+  if ( getsockname( dev->dummy_fd, ( struct sockaddr * ) &sin, &sin_length ) < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to retrieve a local address ( dummy_fd = %d, errno = %s [%d] ).",
+           dev->dummy_fd, error_string, errno );
+    send_handover_error( fd, xid, OTHER_ERROR );
+    return;
+  }
+
+  info( "Handing over to a new process." );
+
+  handover_sockets sockets;
+  memset( &sockets, 0, sizeof( sockets ) );
+  sockets.port = ntohs( sin.sin_port );
+  strncpy( sockets.interface, dev->name, sizeof( sockets.interface ) - 1 );
+  int fds[ MAX_COMMAND_FDS ] = { dev->fd, dev->dummy_fd };
+  bool ret = send_records( fd, xid, HANDOVER_SOCKETS, &sockets, sizeof( sockets ), 1, fds, 2 );
+  if ( ret ) {
+    ret = send_tunnel_endpoints( fd, xid );
+  }
+  if ( ret ) {
+    ret = send_records( fd, xid, HANDOVER_END, NULL, 1, 0, NULL, 0 );
+  }
+  if ( !ret ) {
+    warn( "Failed to hand over. Continuing to reflect." );
+    return;
+  }
+
+  uint8_t buf[ COMMAND_MESSAGE_LENGTH ];
+  size_t length = sizeof( buf );
+  int n_fds = 0;
+  ssize_t retval = recv_command_with_fds( fd, buf, &length, fds, &n_fds, HANDOVER_TIMEOUT );
+  for ( int i = 0; i < n_fds; i++ ) {
+    close( fds[ i ] );
+  }
+  command_request_header *header = ( void * ) buf;
+  if ( retval <= 0 || length < sizeof( command_request_header ) || header->type != HANDOVER_COMPLETE_REQUEST ) {
+    warn( "The new process did not complete the takeover. Continuing to reflect." );
+    return;
+  }
+
+  handover_complete_reply reply;
+  memset( &reply, 0, sizeof( reply ) );
+  reply.header.xid = header->xid;
+  reply.header.type = HANDOVER_COMPLETE_REPLY;
+  reply.header.status = STATUS_OK;
+  reply.header.reason = SUCCEEDED;
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) sizeof( reply );
+  send_command_with_fds( fd, &reply, sizeof( reply ), NULL, 0 );
+
+  handed_over = true;
+  running = false;
+  info( "Handed over to a new process." );
+}
+
+
+bool
+reflector_handed_over() {
+  return handed_over;
+}
+
+
+static bool
+store_record( handover_reply *reply, size_t length, int *fds, int n_fds, const char *interface, uint16_t port,
+              ethdev **dev ) {
+  assert( reply != NULL );
+
+  size_t entry_size = 0;
+  switch ( reply->record ) {
+    case HANDOVER_SOCKETS:
+      entry_size = sizeof( handover_sockets );
+      break;
+    case HANDOVER_TEPS:
+      entry_size = sizeof( handover_tep );
+      break;
+    case HANDOVER_END:
+      return n_fds == 0;
+    default:
+      error( "Unknown handover record ( record = %u ).", reply->record );
+      return false;
+  }
+  if ( length < offsetof( handover_reply, entries ) + entry_size * reply->n_entries ) {
+    error( "Invalid handover record ( record = %u, length = %u ).", reply->record, ( unsigned int ) length );
+    return false;
+  }
+
+  if ( reply->record == HANDOVER_SOCKETS ) {
+    const handover_sockets *sockets = ( const handover_sockets * ) reply->entries;
+    if ( reply->n_entries != 1 || n_fds != 2 || *dev != NULL ) {
+      error( "Sockets are not handed over ( n_fds = %d ).", n_fds );
+      return false;
+    }
+    if ( sockets->port != port || strncmp( sockets->interface, interface, IFNAMSIZ ) != 0 ) {
+      error( "Interface and port must be the same as the previous process "
+             "( interface = %s, port = %u, previous = %s/%u ).", interface, port, sockets->interface, sockets->port );
+      return false;
+    }
+    return adopt_ethdev( interface, fds[ 0 ], fds[ 1 ], dev );
+  }
+
+  if ( n_fds != 0 ) {
+    return false;
+  }
+  const handover_tep *entries = ( const handover_tep * ) reply->entries;
+  for ( int i = 0; i < reply->n_entries; i++ ) {
+    handover_tep *tep = malloc( sizeof( handover_tep ) );
+    assert( tep != NULL );
+    memcpy( tep, &entries[ i ], sizeof( handover_tep ) );
+    append_to_tail( teps, tep );
+  }
+
+  return true;
+}
+
+
+// Connects to the running process and adopts its sockets in place of
+// init_ethdev(). Tunnel endpoints are restored by
+// restore_handed_over_tunnel_endpoints() once the table is created.
+bool
+take_over_reflector( const char *interface, uint16_t port, ethdev **dev ) {
+  assert( interface != NULL );
+  assert( dev != NULL );
+  assert( handover_fd < 0 );
+
+  *dev = NULL;
+  if ( !init_ctrl_client( &handover_fd ) ) {
+    return false;
+  }
+  if ( !connect_ctrl_server( handover_fd, CTRL_SERVER_SOCK_FILE ) ) {
+    error( "No process to take over from." );
+    goto error;
+  }
+
+  handover_request request;
+  memset( &request, 0, sizeof( request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = HANDOVER_REQUEST;
+  request.header.length = ( uint16_t ) sizeof( request );
+  request.version = HANDOVER_VERSION;
+  size_t length = sizeof( request );
+  if ( send_command( handover_fd, &request, &length ) <= 0 ) {
+    goto error;
+  }
+
+  teps = create_list();
+  uint8_t buf[ COMMAND_MESSAGE_LENGTH ];
+  bool more = true;
+  while ( more ) {
+    int fds[ MAX_COMMAND_FDS ];
+    int n_fds = 0;
+    length = sizeof( buf );
+    ssize_t ret = recv_command_with_fds( handover_fd, buf, &length, fds, &n_fds, HANDOVER_TIMEOUT );
+    handover_reply *reply = ( void * ) buf;
+    bool ok = ret > 0 && length >= offsetof( handover_reply, entries ) && reply->header.type == HANDOVER_REPLY &&
+              reply->header.status == STATUS_OK;
+    if ( ok ) {
+      ok = store_record( reply, length, fds, n_fds, interface, port, dev );
+    }
+    else if ( ret > 0 && length >= sizeof( command_reply_header ) ) {
+      error( "Handover is rejected ( status = %u, reason = %u ).", reply->header.status, reply->header.reason );
+    }
+    if ( !ok ) {
+      for ( int i = 0; i < n_fds; i++ ) {
+        close( fds[ i ] );
+      }
+      goto error;
+    }
+    more = ( reply->header.flags & FLAG_MORE ) != 0;
+  }
+  if ( *dev == NULL ) {
+    error( "Sockets are not handed over." );
+    goto error;
+  }
+
+  return true;
+
+error:
+  if ( *dev != NULL ) {
+    close_ethdev( *dev );
+    *dev = NULL;
+  }
+  abort_reflector_takeover();
+
+  return false;
+}
+
+
+bool
+restore_handed_over_tunnel_endpoints() {
+  assert( teps != NULL );
+
+  int n_teps = 0;
+  for ( list_element *e = teps->head; e != NULL; e = e->next ) {
+    handover_tep *tep = e->data;
+    if ( add_tunnel_endpoint( tep->vni, tep->ip_addr, tep->port ) ) {
+      n_teps++;
+    }
+  }
+
+  info( "Took over %d tunnel endpoints from the previous process.", n_teps );
+
+  return true;
+}
+
+
+// Tells the previous process to exit.
+bool
+complete_reflector_takeover() {
+  assert( handover_fd >= 0 );
+
+  handover_complete_request request;
+  memset( &request, 0, sizeof( request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = HANDOVER_COMPLETE_REQUEST;
+  request.header.length = ( uint16_t ) sizeof( request );
+  size_t length = sizeof( request );
+  bool ret = send_command( handover_fd, &request, &length ) > 0;
+
+  if ( ret ) {
+    handover_complete_reply reply;
+    int fds[ MAX_COMMAND_FDS ];
+    int n_fds = 0;
+    length = sizeof( reply );
+    if ( recv_command_with_fds( handover_fd, &reply, &length, fds, &n_fds, HANDOVER_TIMEOUT ) <= 0 ||
+         reply.header.type != HANDOVER_COMPLETE_REPLY || reply.header.status != STATUS_OK ) {
+      warn( "The previous process did not acknowledge the takeover." );
+    }
+    for ( int i = 0; i < n_fds; i++ ) {
+      close( fds[ i ] );
+    }
+  }
+  else {
+    error( "Failed to complete the takeover. Leaving everything to the previous process." );
+  }
+
+  abort_reflector_takeover();
+
+  return ret;
+}
+
+
+void
+abort_reflector_takeover() {
+  if ( handover_fd >= 0 ) {
+    finalize_ctrl_client( handover_fd );
+    handover_fd = -1;
+  }
+  if ( teps != NULL ) {
+    delete_list_totally( teps );
+    teps = NULL;
+  }
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
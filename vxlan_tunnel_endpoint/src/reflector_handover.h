@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef REFLECTOR_HANDOVER_H
+#define REFLECTOR_HANDOVER_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ethdev.h"
+#include "reflector_ctrl_common.h"
+
+
+void hand_over_reflector( int fd, handover_request *request, ethdev *dev );
+bool reflector_handed_over();
+bool take_over_reflector( const char *interface, uint16_t port, ethdev **dev );
+bool restore_handed_over_tunnel_endpoints();
+bool complete_reflector_takeover();
+void abort_reflector_takeover();
+
+
+#endif // REFLECTOR_HANDOVER_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
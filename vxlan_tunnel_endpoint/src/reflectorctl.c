@@ -20,6 +20,7 @@
 
 #include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
 #include <getopt.h>
 #include <libgen.h>
 #include <netinet/in.h>
@@ -29,6 +30,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <unistd.h>
 #include "reflector_ctrl_client.h"
 #include "log.h"
 
@@ -41,20 +43,40 @@ typedef struct {
   uint32_t vni;
   struct in_addr ip_addr;
   uint16_t port;
+  bool cursor;
+  uint32_t cursor_vni;
+  struct in_addr cursor_ip_addr;
+  uint32_t max_entries;
+  bool replace;
+  const char *file;
   uint16_t set_bitmap;
 } command_options;
 
 
-static char short_options[] = "asdln:i:p:h";
+#ifdef LATENCY_STATS
+static char short_options[] = "asdlucPSXn:i:p:C:M:F:h";
+#else
+static char short_options[] = "asdluPSXn:i:p:C:M:F:h";
+#endif
 
 static struct option long_options[] = {
   { "add_tep", no_argument, NULL, 'a' },
   { "set_tep", no_argument, NULL, 's' },
   { "del_tep", no_argument, NULL, 'd' },
   { "list_tep", no_argument, NULL, 'l' },
+  { "update_tep", no_argument, NULL, 'u' },
+#ifdef LATENCY_STATS
+  { "show_stats", no_argument, NULL, 'c' },
+#endif
+  { "dump_capture", no_argument, NULL, 'P' },
+  { "start_replay", no_argument, NULL, 'S' },
   { "vni", required_argument, NULL, 'n' },
   { "ip", required_argument, NULL, 'i' },
   { "port", required_argument, NULL, 'p' },
+  { "cursor", required_argument, NULL, 'C' },
+  { "max_entries", required_argument, NULL, 'M' },
+  { "replace", no_argument, NULL, 'X' },
+  { "file", required_argument, NULL, 'F' },
   { "help", no_argument, NULL, 'h' },
   { NULL, 0, NULL, 0  },
 };
@@ -68,11 +90,21 @@ usage() {
           "    -d, --del_tep       Delete a tunnel endpoint\n"
           "    -s, --set_tep       Set tunnel endpoint parameters\n"
           "    -l, --list_tep      List tunnel endpoints\n"
+          "    -u, --update_tep    Add/delete tunnel endpoints read from stdin or a file\n"
+#ifdef LATENCY_STATS
+          "    -c, --show_stats    Show per-VNI reflection latency\n"
+#endif
+          "    -P, --dump_capture  Write recently received packets to a pcapng file\n"
+          "    -S, --start_replay  Start replaying packets in replay mode\n"
           "    -h, --help          Show this help and exit\n"
           "  OPTIONS:\n"
           "    -n, --vni           Virtual Network Identifier\n"
           "    -i, --ip            IP address\n"
           "    -p, --port          Destination UDP port\n"
+          "    -C, --cursor        List tunnel endpoints after this one (VNI/IP address)\n"
+          "    -M, --max_entries   Maximum number of tunnel endpoints to list\n"
+          "    -X, --replace       Replace all tunnel endpoints of the VNI with the ones added by the updates\n"
+          "    -F, --file          Read updates from a file instead of stdin, or a file to dump packets to\n"
     );
 }
 
@@ -111,6 +143,24 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
         options->type = LIST_TEP_REQUEST;
         break;
 
+      case 'u':
+        options->type = UPDATE_TEPS_REQUEST;
+        break;
+
+#ifdef LATENCY_STATS
+      case 'c':
+        options->type = SHOW_STATS_REQUEST;
+        break;
+#endif
+
+      case 'P':
+        options->type = DUMP_CAPTURE_REQUEST;
+        break;
+
+      case 'S':
+        options->type = START_REPLAY_REQUEST;
+        break;
+
       case 'n':
         if ( optarg != NULL ) {
           char *endp = NULL;
@@ -163,6 +213,54 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
         }
         break;
 
+      case 'C':
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long int vni = strtoul( optarg, &endp, 0 );
+          if ( *endp == '/' && vni <= 0x00ffffff && inet_aton( endp + 1, &options->cursor_ip_addr ) != 0 ) {
+            options->cursor = true;
+            options->cursor_vni = ( uint32_t ) vni;
+          }
+          else {
+            printf( "Invalid cursor ( %s ).\n", optarg );
+            ret &= false;
+          }
+        }
+        else {
+          ret &= false;
+        }
+        break;
+
+      case 'M':
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long int max_entries = strtoul( optarg, &endp, 0 );
+          if ( *endp == '\0' && max_entries > 0 && max_entries <= UINT32_MAX ) {
+            options->max_entries = ( uint32_t ) max_entries;
+          }
+          else {
+            printf( "Invalid maximum number of entries ( %s ).\n", optarg );
+            ret &= false;
+          }
+        }
+        else {
+          ret &= false;
+        }
+        break;
+
+      case 'X':
+        options->replace = true;
+        break;
+
+      case 'F':
+        if ( optarg != NULL ) {
+          options->file = optarg;
+        }
+        else {
+          ret &= false;
+        }
+        break;
+
       case 'h':
         usage();
         exit( SUCCEEDED );
@@ -207,6 +305,7 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
     break;
 
     case LIST_TEP_REQUEST:
+    case SHOW_STATS_REQUEST:
     {
       uint16_t mask = SET_TEP_VNI;
       if ( ( options->set_bitmap & mask ) != mask ) {
@@ -215,6 +314,30 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
     }
     break;
 
+    case UPDATE_TEPS_REQUEST:
+    {
+      if ( options->set_bitmap != SET_TEP_VNI ) {
+        ret &= false;
+      }
+    }
+    break;
+
+    case DUMP_CAPTURE_REQUEST:
+    {
+      if ( options->set_bitmap != 0 || options->file == NULL ) {
+        ret &= false;
+      }
+    }
+    break;
+
+    case START_REPLAY_REQUEST:
+    {
+      if ( options->set_bitmap != 0 ) {
+        ret &= false;
+      }
+    }
+    break;
+
     default:
     {
       ret &= false;
@@ -222,10 +345,85 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
     break;
   }
 
+  if ( options->type != LIST_TEP_REQUEST && ( options->cursor || options->max_entries > 0 ) ) {
+    ret &= false;
+  }
+  if ( options->type != UPDATE_TEPS_REQUEST && options->replace ) {
+    ret &= false;
+  }
+  if ( options->type != UPDATE_TEPS_REQUEST && options->type != DUMP_CAPTURE_REQUEST && options->file != NULL ) {
+    ret &= false;
+  }
+
   return ret;
 }
 
 
+/*
+ * Reads tunnel endpoint updates, one per line, in the form of
+ * "add IP [PORT]" or "del IP". Empty lines and lines starting with '#'
+ * are ignored.
+ */
+static bool
+read_tep_updates( FILE *stream, tep_update **updates, unsigned int *n_updates ) {
+  assert( stream != NULL );
+  assert( updates != NULL );
+  assert( n_updates != NULL );
+
+  *updates = NULL;
+  *n_updates = 0;
+  unsigned int n_allocated = 0;
+  unsigned int line_number = 0;
+  char line[ 256 ];
+  while ( fgets( line, sizeof( line ), stream ) != NULL ) {
+    line_number++;
+    char *saveptr = NULL;
+    char *op = strtok_r( line, " \t\r\n", &saveptr );
+    if ( op == NULL || op[ 0 ] == '#' ) {
+      continue;
+    }
+    char *ip = strtok_r( NULL, " \t\r\n", &saveptr );
+    char *port = strtok_r( NULL, " \t\r\n", &saveptr );
+    char *extra = strtok_r( NULL, " \t\r\n", &saveptr );
+
+    tep_update update;
+    memset( &update, 0, sizeof( update ) );
+    if ( strcmp( op, "add" ) == 0 && ip != NULL && extra == NULL ) {
+      update.op = TEP_UPDATE_ADD;
+    }
+    else if ( strcmp( op, "del" ) == 0 && ip != NULL && port == NULL ) {
+      update.op = TEP_UPDATE_DELETE;
+    }
+    else {
+      printf( "Invalid tunnel endpoint update ( line = %u ).\n", line_number );
+      return false;
+    }
+    if ( inet_aton( ip, &update.ip_addr ) == 0 ) {
+      printf( "Invalid IP address ( line = %u, ip = %s ).\n", line_number, ip );
+      return false;
+    }
+    if ( port != NULL ) {
+      char *endp = NULL;
+      unsigned long int value = strtoul( port, &endp, 0 );
+      if ( *endp != '\0' || value > UINT16_MAX ) {
+        printf( "Invalid UDP port value ( line = %u, port = %s ).\n", line_number, port );
+        return false;
+      }
+      update.port = ( uint16_t ) value;
+    }
+
+    if ( *n_updates == n_allocated ) {
+      n_allocated = n_allocated > 0 ? n_allocated * 2 : 1024;
+      *updates = realloc( *updates, sizeof( tep_update ) * n_allocated );
+      assert( *updates != NULL );
+    }
+    ( *updates )[ ( *n_updates )++ ] = update;
+  }
+
+  return true;
+}
+
+
 int
 main( int argc, char *argv[] ) {
   command_options options;
@@ -261,7 +459,66 @@ main( int argc, char *argv[] ) {
 
     case LIST_TEP_REQUEST:
     {
-      ret = list_tep( options.vni, &status );
+      ret = list_tep( options.vni, options.cursor ? &options.cursor_vni : NULL,
+                      options.cursor ? &options.cursor_ip_addr : NULL, options.max_entries, &status );
+    }
+    break;
+
+#ifdef LATENCY_STATS
+    case SHOW_STATS_REQUEST:
+    {
+      ret = show_stats( options.vni, &status );
+    }
+    break;
+#endif
+
+    case UPDATE_TEPS_REQUEST:
+    {
+      tep_update *updates = NULL;
+      unsigned int n_updates = 0;
+      FILE *stream = stdin;
+      if ( options.file != NULL ) {
+        stream = fopen( options.file, "r" );
+        if ( stream == NULL ) {
+          printf( "Failed to open %s ( errno = %s [%d] ).\n", options.file, strerror( errno ), errno );
+        }
+      }
+      if ( stream != NULL && read_tep_updates( stream, &updates, &n_updates ) ) {
+        ret = update_teps( options.vni, updates, n_updates, options.replace, &status );
+      }
+      else {
+        status = INVALID_ARGUMENT;
+      }
+      if ( stream != NULL && stream != stdin ) {
+        fclose( stream );
+      }
+      if ( updates != NULL ) {
+        free( updates );
+      }
+    }
+    break;
+
+    case DUMP_CAPTURE_REQUEST:
+    {
+      // The daemon does not share our working directory.
+      char file[ CAPTURE_FILE_LENGTH ];
+      char cwd[ CAPTURE_FILE_LENGTH ];
+      if ( options.file[ 0 ] == '/' ) {
+        snprintf( file, sizeof( file ), "%s", options.file );
+      }
+      else if ( getcwd( cwd, sizeof( cwd ) ) == NULL ||
+                snprintf( file, sizeof( file ), "%s/%s", cwd, options.file ) >= ( int ) sizeof( file ) ) {
+        printf( "Invalid file name ( %s ).\n", options.file );
+        status = INVALID_ARGUMENT;
+        break;
+      }
+      ret = dump_capture( file, &status );
+    }
+    break;
+
+    case START_REPLAY_REQUEST:
+    {
+      ret = start_replaying( &status );
     }
     break;
 
@@ -23,6 +23,7 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
@@ -47,6 +48,7 @@
 #include "queue.h"
 #include "receiver.h"
 #include "reflector_common.h"
+#include "reflector_handover.h"
 
 
 struct {
@@ -54,6 +56,12 @@ struct {
   uint16_t port;
   uint8_t log_output;
   bool daemonize;
+  bool handover;
+  unsigned int capture_packets;
+  unsigned int capture_length;
+  char *replay_file;
+  int replay_speed;
+  unsigned int replay_loops;
 } config;
 
 
@@ -113,13 +121,19 @@ set_signal_handler() {
 }
 
 
-static char short_options[] = "i:p:sdh";
+static char short_options[] = "i:p:sdHc:C:R:S:L:h";
 
 static struct option long_options[] = {
   { "interface", required_argument, NULL, 'i' },
   { "port", required_argument, NULL, 'p' },
   { "syslog", no_argument, NULL, 's' },
   { "daemonize", no_argument, NULL, 'd' },
+  { "handover", no_argument, NULL, 'H' },
+  { "capture_size", required_argument, NULL, 'c' },
+  { "capture_length", required_argument, NULL, 'C' },
+  { "replay", required_argument, NULL, 'R' },
+  { "replay_speed", required_argument, NULL, 'S' },
+  { "replay_loops", required_argument, NULL, 'L' },
   { "help", no_argument, NULL, 'h' },
   { NULL, 0, NULL, 0  },
 };
@@ -129,10 +143,16 @@ static void
 usage() {
   printf( "Usage: reflectord -i INTERFACE [OPTION]...\n"
           "  OPTIONS:\n"
-          "    -p, --port       UDP port for receiving VXLAN packets\n"
-          "    -s, --syslog     Output log messages to syslog\n"
-          "    -d, --daemonize  Daemonize\n"
-          "    -h, --help       Display this help and exit\n"
+          "    -p, --port            UDP port for receiving VXLAN packets\n"
+          "    -s, --syslog          Output log messages to syslog\n"
+          "    -d, --daemonize       Daemonize\n"
+          "    -H, --handover        Take over sockets and tunnel endpoints from a running reflectord\n"
+          "    -c, --capture_size    Number of received packets kept for dumping ( 0 to disable )\n"
+          "    -C, --capture_length  Maximum number of octets kept per packet\n"
+          "    -R, --replay          Read packets from a pcap or pcapng file instead of the network\n"
+          "    -S, --replay_speed    Replay speed ( recorded or max )\n"
+          "    -L, --replay_loops    Number of times the file is replayed ( 0 for no limit )\n"
+          "    -h, --help            Display this help and exit\n"
     );
 }
 
@@ -148,7 +168,13 @@ parse_arguments( int argc, char *argv[] ) {
   memset( config.interface, '\0', sizeof( config.interface ) );
   config.log_output = LOG_OUTPUT_STDOUT;
   config.daemonize = false;
+  config.handover = false;
   config.port = VXLAN_DEFAULT_UDP_PORT;
+  config.capture_packets = 0;
+  config.capture_length = PACKET_SIZE;
+  config.replay_file = NULL;
+  config.replay_speed = REPLAY_SPEED_RECORDED;
+  config.replay_loops = 1;
 
   bool ret = true;
   int c;
@@ -188,6 +214,83 @@ parse_arguments( int argc, char *argv[] ) {
         config.daemonize = true;
         break;
 
+      case 'H':
+        config.handover = true;
+        break;
+
+      case 'c':
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long capture_packets = strtoul( optarg, &endp, 0 );
+          if ( *endp != '\0' || capture_packets > VXLAN_MAX_CAPTURE_FRAMES ) {
+            printf( "Invalid capture size ( %s ).\n", optarg );
+            ret &= false;
+          }
+          else {
+            config.capture_packets = ( unsigned int ) capture_packets;
+          }
+        }
+        else {
+          ret &= false;
+        }
+        break;
+
+      case 'C':
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long capture_length = strtoul( optarg, &endp, 0 );
+          if ( *endp != '\0' || capture_length < CAPTURE_MIN_LENGTH || capture_length > PACKET_SIZE ) {
+            printf( "Invalid capture length ( %s ).\n", optarg );
+            ret &= false;
+          }
+          else {
+            config.capture_length = ( unsigned int ) capture_length;
+          }
+        }
+        else {
+          ret &= false;
+        }
+        break;
+
+      case 'R':
+        if ( optarg != NULL ) {
+          config.replay_file = optarg;
+        }
+        else {
+          ret &= false;
+        }
+        break;
+
+      case 'S':
+        if ( optarg != NULL && strcmp( optarg, "recorded" ) == 0 ) {
+          config.replay_speed = REPLAY_SPEED_RECORDED;
+        }
+        else if ( optarg != NULL && strcmp( optarg, "max" ) == 0 ) {
+          config.replay_speed = REPLAY_SPEED_MAX;
+        }
+        else {
+          printf( "Invalid replay speed ( %s ).\n", optarg != NULL ? optarg : "" );
+          ret &= false;
+        }
+        break;
+
+      case 'L':
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long replay_loops = strtoul( optarg, &endp, 0 );
+          if ( *endp != '\0' || replay_loops > UINT_MAX ) {
+            printf( "Invalid number of replay loops ( %s ).\n", optarg );
+            ret &= false;
+          }
+          else {
+            config.replay_loops = ( unsigned int ) replay_loops;
+          }
+        }
+        else {
+          ret &= false;
+        }
+        break;
+
       case 'h':
         usage();
         exit( SUCCEEDED );
@@ -207,6 +310,11 @@ parse_arguments( int argc, char *argv[] ) {
     ret &= false;
   }
 
+  if ( config.replay_file != NULL && config.handover ) {
+    printf( "Replay cannot be combined with handover.\n" );
+    ret &= false;
+  }
+
   return ret;
 }
 
@@ -232,26 +340,55 @@ init_reflector( const char *name, ethdev **dev ) {
     daemonize();
   }
 
-  init_log( program_name, config.log_output );
+  init_log( program_name, ( uint8_t ) ( config.log_output | LOG_OUTPUT_ASYNC ) );
 
   info( "Starting Jumper Wire - VXLAN packet reflector daemon ( pid = %u ).", getpid() );
 
-  bool ret = create_pid_file( program_name );
-  if ( !ret ) {
-    error( "Failed to create a pid file." );
-    return false;
+  // The pid file is replaced once the previous process hands over.
+  bool ret = true;
+  if ( !config.handover ) {
+    ret = create_pid_file( program_name );
+    if ( !ret ) {
+      error( "Failed to create a pid file." );
+      return false;
+    }
   }
 
   set_signal_handler();
 
+  if ( config.capture_packets > 0 ) {
+    capture = create_capture_ring( config.interface, config.capture_packets, config.capture_length );
+    if ( capture == NULL ) {
+      return false;
+    }
+  }
+
   *dev = NULL;
-  ret = init_ethdev( config.interface, config.port, dev );
+  if ( config.replay_file != NULL ) {
+    replay = open_replay( config.replay_file, config.port, config.replay_speed, config.replay_loops );
+    if ( replay == NULL ) {
+      return false;
+    }
+    info( "Replaying %s once started with a control command. Packets to tunnel endpoints are discarded.",
+          config.replay_file );
+    ret = init_discard_ethdev( config.interface, dev );
+  }
+  else if ( config.handover ) {
+    ret = take_over_reflector( config.interface, config.port, dev );
+  }
+  else {
+    ret = init_ethdev( config.interface, config.port, dev );
+  }
   if ( !ret ) {
     error( "Failed to initialize an Ethernet interface ( %s ).", config.interface );
     return false;
   }
 
   create_queues();
+  create_tunnel_endpoints();
+  if ( config.handover ) {
+    restore_handed_over_tunnel_endpoints();
+  }
 
   pthread_attr_t attr;
   pthread_attr_init( &attr );
@@ -275,7 +412,7 @@ init_reflector( const char *name, ethdev **dev ) {
     return false;
   }
 
-  ret = init_reflector_ctrl_server( *dev );
+  ret = init_reflector_ctrl_server( *dev, config.handover );
   if ( !ret ) {
     critical( "Failed to initialize control interface." );
     pthread_cancel( distributor_thread );
@@ -316,6 +453,15 @@ finalize_reflector( ethdev *dev ) {
 
   delete_queues();
 
+  if ( replay != NULL ) {
+    close_replay( replay );
+    replay = NULL;
+  }
+  if ( capture != NULL ) {
+    destroy_capture_ring( capture );
+    capture = NULL;
+  }
+
   finalize_log();
 
   ret = remove_pid_file( program_name );
@@ -347,7 +493,7 @@ main( int argc, char *argv[] ) {
     exit( INVALID_ARGUMENT );
   }
 
-  if ( pid_file_exists( basename( argv[ 0 ] ) ) ) {
+  if ( !config.handover && pid_file_exists( basename( argv[ 0 ] ) ) ) {
     printf( "Another %s is running.\n", basename( argv[ 0 ] ) );
     exit( ALREADY_RUNNING );
   }
@@ -359,8 +505,32 @@ main( int argc, char *argv[] ) {
     goto error;
   }
 
+  if ( config.handover ) {
+    if ( complete_reflector_takeover() ) {
+      remove_pid_file( basename( argv[ 0 ] ) );
+      create_pid_file( basename( argv[ 0 ] ) );
+      if ( !publish_reflector_ctrl_server() ) {
+        // Forwarding already belongs to this process, so keep running.
+        critical( "Control requests are only accepted at the temporary socket path until restarted." );
+      }
+    }
+    else {
+      // Sockets and the control socket path still belong to the previous process.
+      finalize_reflector_ctrl_server();
+      finalize_log();
+      exit( OTHER_ERROR );
+    }
+  }
+
   start_reflector();
 
+  if ( reflector_handed_over() ) {
+    // Sockets belong to the new process now.
+    info( "Terminating Jumper Wire - VXLAN packet reflector daemon ( pid = %u ) after handover.", getpid() );
+    finalize_log();
+    return SUCCEEDED;
+  }
+
   ret = finalize_reflector( dev );
   if ( !ret ) {
     status = OTHER_ERROR;
@@ -370,7 +540,14 @@ main( int argc, char *argv[] ) {
   return SUCCEEDED;
 
 error:
-  remove_pid_file( basename( argv[ 0 ] ) );
+  if ( config.handover ) {
+    abort_reflector_takeover();
+  }
+  else {
+    remove_pid_file( basename( argv[ 0 ] ) );
+  }
+  // Messages are only in per-thread rings until flushed.
+  finalize_log();
   exit( status );
 }
 
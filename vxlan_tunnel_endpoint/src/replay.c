@@ -0,0 +1,684 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <byteswap.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log.h"
+#include "replay.h"
+#include "wrapper.h"
+
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_NSEC_MAGIC 0xa1b23c4d
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+enum {
+  PCAPNG_INTERFACE_DESCRIPTION_BLOCK = 0x00000001,
+  PCAPNG_SIMPLE_PACKET_BLOCK = 0x00000003,
+  PCAPNG_ENHANCED_PACKET_BLOCK = 0x00000006,
+  PCAPNG_SECTION_HEADER_BLOCK = 0x0A0D0D0A,
+};
+
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_IF_TSRESOL 9
+
+enum {
+  LINKTYPE_ETHERNET = 1,
+  LINKTYPE_RAW = 101,
+  LINKTYPE_LINUX_SLL = 113,
+  LINKTYPE_IPV4 = 228,
+  LINKTYPE_LINUX_SLL2 = 276,
+};
+
+// Timestamps are in microseconds unless an interface tells otherwise.
+#define DEFAULT_TSRESOL 6
+#define REPLAY_MAX_INTERFACES 64
+#define REPLAY_MAX_RECORD_LENGTH ( 1024 * 1024 )
+// How often an idle replay checks whether it is started.
+#define REPLAY_IDLE_WAIT 10000000
+
+enum {
+  REPLAY_IDLE,
+  REPLAY_REQUESTED,
+  REPLAY_RUNNING,
+};
+
+enum {
+  RECORD_PACKET,
+  RECORD_END,
+  RECORD_ERROR,
+};
+
+
+struct replay_interface {
+  uint16_t link_type;
+  uint8_t resolution;
+};
+
+/*
+ * Reads a pcap or pcapng file and hands out IPv4 packets to a UDP port one
+ * by one. All but the state are only touched by the thread that replays.
+ */
+struct replay {
+  char *file;
+  FILE *stream;
+  uint16_t port;
+  int speed;
+  unsigned int n_loops;
+  int state;
+  bool pcapng;
+  bool swapped;
+  struct replay_interface interfaces[ REPLAY_MAX_INTERFACES ];
+  unsigned int n_interfaces;
+  uint8_t *record;
+  size_t record_size;
+  uint64_t last_timestamp;
+  bool pending;
+  uint64_t timestamp;
+  size_t packet_length;
+  uint8_t packet[ REPLAY_PACKET_SIZE ];
+  unsigned int loop;
+  uint64_t n_packets_in_loop;
+  uint64_t first_timestamp;
+  uint64_t loop_started_at;
+  struct {
+    uint64_t started_at;
+    uint64_t packets;
+    uint64_t octets;
+    uint64_t skipped;
+  } stats;
+};
+
+
+static uint64_t
+monotonic_clock() {
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+
+  return ( uint64_t ) now.tv_sec * 1000000000 + ( uint64_t ) now.tv_nsec;
+}
+
+
+static uint16_t
+get16( const struct replay *replay, const uint8_t *p ) {
+  uint16_t value;
+  memcpy( &value, p, sizeof( value ) );
+
+  return replay->swapped ? bswap_16( value ) : value;
+}
+
+
+static uint32_t
+get32( const struct replay *replay, const uint8_t *p ) {
+  uint32_t value;
+  memcpy( &value, p, sizeof( value ) );
+
+  return replay->swapped ? bswap_32( value ) : value;
+}
+
+
+// Resolutions are negative powers of ten, or of two if the top bit is set.
+static uint64_t
+to_nanoseconds( uint64_t timestamp, uint8_t resolution ) {
+  if ( resolution & 0x80 ) {
+    unsigned int shift = resolution & 0x7f;
+    if ( shift >= 64 ) {
+      return 0;
+    }
+    uint64_t seconds = timestamp >> shift;
+    uint64_t fraction = timestamp - ( seconds << shift );
+    return seconds * 1000000000 + ( uint64_t ) ( ( ( unsigned __int128 ) fraction * 1000000000 ) >> shift );
+  }
+
+  for ( unsigned int i = resolution; i < 9; i++ ) {
+    timestamp *= 10;
+  }
+  for ( unsigned int i = 9; i < resolution; i++ ) {
+    timestamp /= 10;
+  }
+
+  return timestamp;
+}
+
+
+static bool
+read_bytes( struct replay *replay, void *data, size_t length ) {
+  return length == 0 || fread( data, length, 1, replay->stream ) == 1;
+}
+
+
+// Reads length octets into the record buffer.
+static bool
+read_record_bytes( struct replay *replay, size_t length ) {
+  if ( length > replay->record_size ) {
+    uint8_t *record = realloc( replay->record, length );
+    if ( record == NULL ) {
+      return false;
+    }
+    replay->record = record;
+    replay->record_size = length;
+  }
+
+  return read_bytes( replay, replay->record, length );
+}
+
+
+// Tells pcap from pcapng and reads the global header of pcap. A pcapng
+// section header is read with the blocks that follow.
+static bool
+read_file_header( struct replay *replay ) {
+  uint8_t header[ 24 ];
+  if ( fseek( replay->stream, 0, SEEK_SET ) != 0 || !read_bytes( replay, header, sizeof( uint32_t ) ) ) {
+    return false;
+  }
+
+  uint32_t magic;
+  memcpy( &magic, header, sizeof( magic ) );
+  if ( magic == PCAPNG_SECTION_HEADER_BLOCK ) {
+    replay->pcapng = true;
+    replay->n_interfaces = 0;
+    return fseek( replay->stream, 0, SEEK_SET ) == 0;
+  }
+
+  uint8_t resolution = 0;
+  if ( magic == PCAP_MAGIC || magic == bswap_32( PCAP_MAGIC ) ) {
+    resolution = 6;
+  }
+  else if ( magic == PCAP_NSEC_MAGIC || magic == bswap_32( PCAP_NSEC_MAGIC ) ) {
+    resolution = 9;
+  }
+  else {
+    return false;
+  }
+  if ( !read_bytes( replay, header + sizeof( uint32_t ), sizeof( header ) - sizeof( uint32_t ) ) ) {
+    return false;
+  }
+  replay->pcapng = false;
+  replay->swapped = magic != PCAP_MAGIC && magic != PCAP_NSEC_MAGIC;
+  replay->interfaces[ 0 ].link_type = ( uint16_t ) get32( replay, header + 20 );
+  replay->interfaces[ 0 ].resolution = resolution;
+  replay->n_interfaces = 1;
+
+  return true;
+}
+
+
+static int
+read_pcap_record( struct replay *replay, const uint8_t **data, uint32_t *captured, uint32_t *length ) {
+  uint8_t header[ 16 ];
+  if ( !read_bytes( replay, header, sizeof( header ) ) ) {
+    return feof( replay->stream ) ? RECORD_END : RECORD_ERROR;
+  }
+
+  uint64_t seconds = get32( replay, header );
+  uint64_t fraction = get32( replay, header + 4 );
+  *captured = get32( replay, header + 8 );
+  *length = get32( replay, header + 12 );
+  if ( *captured > REPLAY_MAX_RECORD_LENGTH || !read_record_bytes( replay, *captured ) ) {
+    return feof( replay->stream ) ? RECORD_END : RECORD_ERROR;
+  }
+
+  uint8_t resolution = replay->interfaces[ 0 ].resolution;
+  replay->timestamp = to_nanoseconds( seconds, 0 ) + to_nanoseconds( fraction, resolution );
+  *data = replay->record;
+
+  return RECORD_PACKET;
+}
+
+
+static void
+add_interface( struct replay *replay, size_t length ) {
+  if ( replay->n_interfaces >= REPLAY_MAX_INTERFACES || length < 8 ) {
+    return;
+  }
+
+  struct replay_interface *interface = &replay->interfaces[ replay->n_interfaces++ ];
+  interface->link_type = get16( replay, replay->record );
+  interface->resolution = DEFAULT_TSRESOL;
+
+  size_t offset = 8;
+  while ( offset + 4 <= length ) {
+    uint16_t code = get16( replay, replay->record + offset );
+    uint16_t option_length = get16( replay, replay->record + offset + 2 );
+    if ( code == PCAPNG_OPT_ENDOFOPT ) {
+      break;
+    }
+    if ( code == PCAPNG_IF_TSRESOL && option_length >= 1 && offset + 5 <= length ) {
+      interface->resolution = replay->record[ offset + 4 ];
+    }
+    offset += 4 + ( ( ( size_t ) option_length + 3 ) & ~( size_t ) 3 );
+  }
+}
+
+
+// Reads blocks until a packet is found. Packets on interfaces not described
+// are left out.
+static int
+read_pcapng_record( struct replay *replay, uint16_t *link_type, const uint8_t **data, uint32_t *captured,
+                    uint32_t *length ) {
+  while ( true ) {
+    uint8_t header[ 12 ];
+    if ( !read_bytes( replay, header, 8 ) ) {
+      return feof( replay->stream ) ? RECORD_END : RECORD_ERROR;
+    }
+    uint32_t type;
+    memcpy( &type, header, sizeof( type ) );
+    size_t header_length = 8;
+    if ( type == PCAPNG_SECTION_HEADER_BLOCK ) {
+      // The byte order of a section is known only from its header.
+      if ( !read_bytes( replay, header + 8, sizeof( uint32_t ) ) ) {
+        return RECORD_ERROR;
+      }
+      uint32_t magic;
+      memcpy( &magic, header + 8, sizeof( magic ) );
+      if ( magic != PCAPNG_BYTE_ORDER_MAGIC && magic != bswap_32( PCAPNG_BYTE_ORDER_MAGIC ) ) {
+        return RECORD_ERROR;
+      }
+      replay->swapped = magic != PCAPNG_BYTE_ORDER_MAGIC;
+      replay->n_interfaces = 0;
+      header_length = 12;
+    }
+    type = get32( replay, header );
+    uint32_t block_length = get32( replay, header + 4 );
+    if ( block_length < 12 + header_length - 8 || block_length % 4 != 0 || block_length > REPLAY_MAX_RECORD_LENGTH ) {
+      return RECORD_ERROR;
+    }
+    if ( !read_record_bytes( replay, block_length - header_length ) ) {
+      return feof( replay->stream ) ? RECORD_END : RECORD_ERROR;
+    }
+    // Without the trailing length
+    size_t body_length = block_length - header_length - sizeof( uint32_t );
+
+    if ( type == PCAPNG_INTERFACE_DESCRIPTION_BLOCK ) {
+      add_interface( replay, body_length );
+    }
+    else if ( type == PCAPNG_ENHANCED_PACKET_BLOCK && body_length >= 20 ) {
+      uint32_t id = get32( replay, replay->record );
+      *captured = get32( replay, replay->record + 12 );
+      *length = get32( replay, replay->record + 16 );
+      if ( *captured > body_length - 20 ) {
+        return RECORD_ERROR;
+      }
+      if ( id >= replay->n_interfaces ) {
+        continue;
+      }
+      uint64_t timestamp = ( uint64_t ) get32( replay, replay->record + 4 ) << 32 | get32( replay, replay->record + 8 );
+      replay->timestamp = to_nanoseconds( timestamp, replay->interfaces[ id ].resolution );
+      *link_type = replay->interfaces[ id ].link_type;
+      *data = replay->record + 20;
+      return RECORD_PACKET;
+    }
+    else if ( type == PCAPNG_SIMPLE_PACKET_BLOCK && body_length >= 4 && replay->n_interfaces > 0 ) {
+      // No timestamp. The packet goes out right after the previous one.
+      *length = get32( replay, replay->record );
+      *captured = *length < body_length - 4 ? *length : ( uint32_t ) ( body_length - 4 );
+      replay->timestamp = replay->last_timestamp;
+      *link_type = replay->interfaces[ 0 ].link_type;
+      *data = replay->record + 4;
+      return RECORD_PACKET;
+    }
+  }
+}
+
+
+// Finds an IPv4 header behind the link layer header.
+static bool
+find_ipv4_header( uint16_t link_type, const uint8_t *data, size_t length, size_t *offset ) {
+  uint16_t protocol = 0;
+  switch ( link_type ) {
+    case LINKTYPE_ETHERNET:
+    {
+      size_t type_offset = 12;
+      while ( type_offset + 2 <= length ) {
+        protocol = ( uint16_t ) ( data[ type_offset ] << 8 | data[ type_offset + 1 ] );
+        if ( protocol != 0x8100 && protocol != 0x88a8 ) {
+          break;
+        }
+        type_offset += 4;
+      }
+      *offset = type_offset + 2;
+    }
+    break;
+
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    {
+      protocol = 0x0800;
+      *offset = 0;
+    }
+    break;
+
+    case LINKTYPE_LINUX_SLL:
+    {
+      if ( length >= 16 ) {
+        protocol = ( uint16_t ) ( data[ 14 ] << 8 | data[ 15 ] );
+      }
+      *offset = 16;
+    }
+    break;
+
+    case LINKTYPE_LINUX_SLL2:
+    {
+      if ( length >= 20 ) {
+        protocol = ( uint16_t ) ( data[ 0 ] << 8 | data[ 1 ] );
+      }
+      *offset = 20;
+    }
+    break;
+
+    default:
+      return false;
+  }
+
+  return protocol == 0x0800 && *offset + sizeof( struct iphdr ) <= length && ( data[ *offset ] >> 4 ) == 4;
+}
+
+
+/*
+ * Keeps an unfragmented UDP packet to the port. Octets cut off when the
+ * packet was captured are filled with zeros so that the data path sees
+ * packets of the sizes on the wire.
+ */
+static bool
+load_packet( struct replay *replay, uint16_t link_type, const uint8_t *data, uint32_t captured, uint32_t length ) {
+  size_t offset = 0;
+  if ( !find_ipv4_header( link_type, data, captured, &offset ) ) {
+    return false;
+  }
+
+  struct iphdr ip;
+  memcpy( &ip, data + offset, sizeof( ip ) );
+  size_t header_length = ( size_t ) ip.ihl * 4;
+  size_t ip_length = ntohs( ip.tot_len );
+  size_t wire_length = ( length > captured ? length : captured ) - offset;
+  if ( ip.protocol != IPPROTO_UDP || ( ntohs( ip.frag_off ) & ( IP_MF | IP_OFFMASK ) ) != 0 ||
+       header_length < sizeof( struct iphdr ) || ip_length < header_length + sizeof( struct udphdr ) ||
+       ip_length > wire_length || offset + header_length + sizeof( struct udphdr ) > captured ) {
+    return false;
+  }
+
+  struct udphdr udp;
+  memcpy( &udp, data + offset + header_length, sizeof( udp ) );
+  if ( ntohs( udp.dest ) != replay->port ) {
+    return false;
+  }
+
+  size_t copied = captured - offset < ip_length ? captured - offset : ip_length;
+  memcpy( replay->packet, data + offset, copied );
+  memset( replay->packet + copied, 0, ip_length - copied );
+  replay->packet_length = ip_length;
+
+  return true;
+}
+
+
+static int
+load_next_packet( struct replay *replay ) {
+  while ( true ) {
+    uint16_t link_type = 0;
+    const uint8_t *data = NULL;
+    uint32_t captured = 0;
+    uint32_t length = 0;
+    int ret = RECORD_ERROR;
+    if ( replay->pcapng ) {
+      ret = read_pcapng_record( replay, &link_type, &data, &captured, &length );
+    }
+    else {
+      link_type = replay->interfaces[ 0 ].link_type;
+      ret = read_pcap_record( replay, &data, &captured, &length );
+    }
+    if ( ret != RECORD_PACKET ) {
+      return ret;
+    }
+    replay->last_timestamp = replay->timestamp;
+
+    if ( !load_packet( replay, link_type, data, captured, length ) ) {
+      replay->stats.skipped++;
+      continue;
+    }
+    if ( replay->n_packets_in_loop++ == 0 ) {
+      replay->first_timestamp = replay->timestamp;
+      replay->loop_started_at = monotonic_clock();
+    }
+    replay->pending = true;
+
+    return RECORD_PACKET;
+  }
+}
+
+
+static bool
+rewind_replay( struct replay *replay ) {
+  clearerr( replay->stream );
+  replay->pending = false;
+  replay->n_packets_in_loop = 0;
+  replay->last_timestamp = 0;
+
+  return read_file_header( replay );
+}
+
+
+static bool
+begin_replay( struct replay *replay ) {
+  memset( &replay->stats, 0, sizeof( replay->stats ) );
+  replay->stats.started_at = monotonic_clock();
+  replay->loop = 0;
+  if ( !rewind_replay( replay ) ) {
+    error( "Failed to rewind %s.", replay->file );
+    return false;
+  }
+
+  info( "Replaying %s ( speed = %s, loops = %u ).", replay->file,
+        replay->speed == REPLAY_SPEED_MAX ? "max" : "recorded", replay->n_loops );
+
+  return true;
+}
+
+
+static void
+end_replay( struct replay *replay ) {
+  double seconds = ( double ) ( monotonic_clock() - replay->stats.started_at ) / 1e9;
+  info( "Replayed %" PRIu64 " packets ( %" PRIu64 " octets ) from %s in %.3f seconds "
+        "( %.0f packets/s, %" PRIu64 " records skipped ).",
+        replay->stats.packets, replay->stats.octets, replay->file, seconds,
+        seconds > 0 ? ( double ) replay->stats.packets / seconds : 0, replay->stats.skipped );
+
+  __atomic_store_n( &replay->state, REPLAY_IDLE, __ATOMIC_RELEASE );
+}
+
+
+/*
+ * Returns true with the next packet in buffer. Otherwise no packet is due
+ * yet, and the caller is expected to come back after wait nanoseconds. A
+ * replay idles until started, and goes back to idle after the last loop.
+ */
+bool
+next_replayed_packet( struct replay *replay, void *buffer, size_t size, size_t *length, uint64_t *wait ) {
+  assert( replay != NULL );
+  assert( buffer != NULL );
+  assert( length != NULL );
+  assert( wait != NULL );
+
+  *wait = REPLAY_IDLE_WAIT;
+  int state = __atomic_load_n( &replay->state, __ATOMIC_ACQUIRE );
+  if ( state == REPLAY_IDLE ) {
+    return false;
+  }
+  if ( state == REPLAY_REQUESTED ) {
+    if ( !begin_replay( replay ) ) {
+      __atomic_store_n( &replay->state, REPLAY_IDLE, __ATOMIC_RELEASE );
+      return false;
+    }
+    __atomic_store_n( &replay->state, REPLAY_RUNNING, __ATOMIC_RELEASE );
+  }
+
+  while ( !replay->pending ) {
+    int ret = load_next_packet( replay );
+    if ( ret == RECORD_ERROR ) {
+      error( "Failed to read %s. The file may be corrupted.", replay->file );
+      end_replay( replay );
+      return false;
+    }
+    if ( ret == RECORD_END ) {
+      replay->loop++;
+      if ( replay->n_packets_in_loop == 0 ) {
+        warn( "No UDP packets to port %u in %s.", replay->port, replay->file );
+        end_replay( replay );
+        return false;
+      }
+      if ( ( replay->n_loops > 0 && replay->loop >= replay->n_loops ) || !rewind_replay( replay ) ) {
+        end_replay( replay );
+        return false;
+      }
+    }
+  }
+
+  if ( replay->speed == REPLAY_SPEED_RECORDED ) {
+    // Packets out of order are sent at once.
+    uint64_t offset = replay->timestamp > replay->first_timestamp ? replay->timestamp - replay->first_timestamp : 0;
+    uint64_t now = monotonic_clock();
+    if ( replay->loop_started_at + offset > now ) {
+      *wait = replay->loop_started_at + offset - now;
+      return false;
+    }
+  }
+
+  replay->pending = false;
+  if ( replay->packet_length > size ) {
+    replay->stats.skipped++;
+    *wait = 0;
+    return false;
+  }
+  memcpy( buffer, replay->packet, replay->packet_length );
+  *length = replay->packet_length;
+  replay->stats.packets++;
+  replay->stats.octets += replay->packet_length;
+
+  return true;
+}
+
+
+// Called from the control thread. Fails if a replay is in progress.
+bool
+start_replay( struct replay *replay ) {
+  assert( replay != NULL );
+
+  int idle = REPLAY_IDLE;
+  return __atomic_compare_exchange_n( &replay->state, &idle, REPLAY_REQUESTED, false, __ATOMIC_ACQ_REL,
+                                      __ATOMIC_ACQUIRE );
+}
+
+
+bool
+get_replayed_udp_payload( const void *packet, size_t length, struct sockaddr_in *source, size_t *offset,
+                          size_t *payload_length ) {
+  assert( packet != NULL );
+  assert( source != NULL );
+  assert( offset != NULL );
+  assert( payload_length != NULL );
+
+  if ( length < sizeof( struct iphdr ) ) {
+    return false;
+  }
+  struct iphdr ip;
+  memcpy( &ip, packet, sizeof( ip ) );
+  size_t header_length = ( size_t ) ip.ihl * 4;
+  if ( length < header_length + sizeof( struct udphdr ) ) {
+    return false;
+  }
+  struct udphdr udp;
+  memcpy( &udp, ( const uint8_t * ) packet + header_length, sizeof( udp ) );
+  size_t udp_length = ntohs( udp.len );
+  if ( udp_length < sizeof( struct udphdr ) ) {
+    return false;
+  }
+
+  memset( source, 0, sizeof( struct sockaddr_in ) );
+  source->sin_family = AF_INET;
+  source->sin_addr.s_addr = ip.saddr;
+  source->sin_port = udp.source;
+  *offset = header_length + sizeof( struct udphdr );
+  *payload_length = udp_length - sizeof( struct udphdr );
+  if ( *payload_length > length - *offset ) {
+    *payload_length = length - *offset;
+  }
+
+  return true;
+}
+
+
+struct replay *
+open_replay( const char *file, uint16_t port, int speed, unsigned int n_loops ) {
+  assert( file != NULL );
+
+  FILE *stream = fopen( file, "r" );
+  if ( stream == NULL ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to open %s ( errno = %s [%d] ).", file, error_string, errno );
+    return NULL;
+  }
+
+  struct replay *replay = malloc( sizeof( struct replay ) );
+  assert( replay != NULL );
+  memset( replay, 0, sizeof( struct replay ) );
+  replay->file = strdup( file );
+  replay->stream = stream;
+  replay->port = port;
+  replay->speed = speed;
+  replay->n_loops = n_loops;
+  replay->state = REPLAY_IDLE;
+  if ( !read_file_header( replay ) ) {
+    error( "%s is not a pcap or pcapng file.", file );
+    close_replay( replay );
+    return NULL;
+  }
+
+  return replay;
+}
+
+
+void
+close_replay( struct replay *replay ) {
+  assert( replay != NULL );
+
+  fclose( replay->stream );
+  if ( replay->record != NULL ) {
+    free( replay->record );
+  }
+  free( replay->file );
+  free( replay );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
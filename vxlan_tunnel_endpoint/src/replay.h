@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum {
+  REPLAY_SPEED_RECORDED,
+  REPLAY_SPEED_MAX,
+};
+
+// Largest IPv4 packet handed out by next_replayed_packet().
+#define REPLAY_PACKET_SIZE 65535
+
+
+struct replay;
+
+
+struct replay *open_replay( const char *file, uint16_t port, int speed, unsigned int n_loops );
+void close_replay( struct replay *replay );
+bool start_replay( struct replay *replay );
+bool next_replayed_packet( struct replay *replay, void *buffer, size_t size, size_t *length, uint64_t *wait );
+bool get_replayed_udp_payload( const void *packet, size_t length, struct sockaddr_in *source, size_t *offset,
+                               size_t *payload_length );
+
+
+#endif // REPLAY_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Hierarchical timer wheel with one second resolution. Level 0 holds
+ * timers that expire within TIMER_WHEEL_SLOTS seconds, and each upper
+ * level covers TIMER_WHEEL_SLOTS times the range of the one below it.
+ * Timers in upper levels are cascaded down as the wheel turns, so the
+ * cost of advancing the wheel is proportional to the number of timers
+ * that actually fire.
+ *
+ * The wheel itself is not thread-safe. Callers must serialize access,
+ * and an expiry callback may only reschedule the entry passed to it.
+ */
+
+
+#include <assert.h>
+#include <string.h>
+#include "timer_wheel.h"
+
+
+void
+init_timer_wheel( struct timer_wheel *wheel, time_t now ) {
+  assert( wheel != NULL );
+
+  memset( wheel, 0, sizeof( struct timer_wheel ) );
+  wheel->current = now;
+}
+
+
+static int
+slot_index( time_t expires, int level ) {
+  return ( int ) ( ( expires >> ( TIMER_WHEEL_BITS * level ) ) & TIMER_WHEEL_MASK );
+}
+
+
+static void
+link_entry( struct timer_wheel *wheel, struct timer_wheel_entry *entry ) {
+  time_t expires = entry->expires;
+  time_t delta = expires - wheel->current;
+
+  struct timer_wheel_entry **head = NULL;
+  if ( delta < 0 ) {
+    head = &wheel->slots[ 0 ][ slot_index( wheel->current, 0 ) ];
+  }
+  else {
+    int level = 0;
+    while ( level < TIMER_WHEEL_LEVELS - 1 && delta >= ( ( time_t ) 1 << ( TIMER_WHEEL_BITS * ( level + 1 ) ) ) ) {
+      level++;
+    }
+    head = &wheel->slots[ level ][ slot_index( expires, level ) ];
+  }
+
+  entry->next = *head;
+  if ( *head != NULL ) {
+    ( *head )->pprev = &entry->next;
+  }
+  entry->pprev = head;
+  *head = entry;
+}
+
+
+void
+add_timer_wheel_entry( struct timer_wheel *wheel, struct timer_wheel_entry *entry, time_t expires ) {
+  assert( wheel != NULL );
+  assert( entry != NULL );
+
+  delete_timer_wheel_entry( entry );
+
+  if ( expires - wheel->current > TIMER_WHEEL_MAX_DELTA ) {
+    // Fires early. The owner is expected to check and reschedule.
+    expires = wheel->current + TIMER_WHEEL_MAX_DELTA;
+  }
+  entry->expires = expires;
+  link_entry( wheel, entry );
+}
+
+
+void
+delete_timer_wheel_entry( struct timer_wheel_entry *entry ) {
+  assert( entry != NULL );
+
+  if ( entry->pprev == NULL ) {
+    return;
+  }
+
+  *entry->pprev = entry->next;
+  if ( entry->next != NULL ) {
+    entry->next->pprev = entry->pprev;
+  }
+  entry->next = NULL;
+  entry->pprev = NULL;
+}
+
+
+bool
+timer_wheel_entry_pending( struct timer_wheel_entry *entry ) {
+  assert( entry != NULL );
+
+  return entry->pprev != NULL ? true : false;
+}
+
+
+static struct timer_wheel_entry *
+detach_slot( struct timer_wheel *wheel, int level, int index ) {
+  struct timer_wheel_entry *head = wheel->slots[ level ][ index ];
+  wheel->slots[ level ][ index ] = NULL;
+
+  return head;
+}
+
+
+static int
+cascade( struct timer_wheel *wheel, int level ) {
+  int index = slot_index( wheel->current, level );
+
+  struct timer_wheel_entry *entry = detach_slot( wheel, level, index );
+  while ( entry != NULL ) {
+    struct timer_wheel_entry *next = entry->next;
+    link_entry( wheel, entry );
+    entry = next;
+  }
+
+  return index;
+}
+
+
+void
+advance_timer_wheel( struct timer_wheel *wheel, time_t now,
+                     void ( *function )( struct timer_wheel_entry *entry, void *user_data ), void *user_data ) {
+  assert( wheel != NULL );
+  assert( function != NULL );
+
+  while ( wheel->current <= now ) {
+    int index = slot_index( wheel->current, 0 );
+    if ( index == 0 ) {
+      for ( int level = 1; level < TIMER_WHEEL_LEVELS; level++ ) {
+        if ( cascade( wheel, level ) != 0 ) {
+          break;
+        }
+      }
+    }
+
+    struct timer_wheel_entry *expired = detach_slot( wheel, 0, index );
+    // Timers added by the callback must land in a later slot.
+    wheel->current++;
+
+    while ( expired != NULL ) {
+      struct timer_wheel_entry *entry = expired;
+      expired = entry->next;
+      entry->next = NULL;
+      entry->pprev = NULL;
+      function( entry, user_data );
+    }
+  }
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+
+#include <stdbool.h>
+#include <time.h>
+
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS ( 1 << TIMER_WHEEL_BITS )
+#define TIMER_WHEEL_MASK ( TIMER_WHEEL_SLOTS - 1 )
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_MAX_DELTA ( ( ( time_t ) 1 << ( TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS ) ) - 1 )
+
+
+struct timer_wheel_entry {
+  struct timer_wheel_entry *next;
+  struct timer_wheel_entry **pprev;
+  time_t expires;
+};
+
+struct timer_wheel {
+  time_t current;
+  struct timer_wheel_entry *slots[ TIMER_WHEEL_LEVELS ][ TIMER_WHEEL_SLOTS ];
+};
+
+
+void init_timer_wheel( struct timer_wheel *wheel, time_t now );
+void add_timer_wheel_entry( struct timer_wheel *wheel, struct timer_wheel_entry *entry, time_t expires );
+void delete_timer_wheel_entry( struct timer_wheel_entry *entry );
+bool timer_wheel_entry_pending( struct timer_wheel_entry *entry );
+void advance_timer_wheel( struct timer_wheel *wheel, time_t now,
+                          void ( *function )( struct timer_wheel_entry *entry, void *user_data ), void *user_data );
+
+
+#endif // TIMER_WHEEL_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
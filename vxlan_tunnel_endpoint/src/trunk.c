@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * A trunk is a single tap interface which carries frames of many VXLAN
+ * instances. Each instance attached to the trunk is identified by an
+ * 802.1Q tag or by a pair of 802.1ad (S-tag) and 802.1Q (C-tag) tags.
+ * Tags are stripped before encapsulation and pushed back after
+ * decapsulation, so instances see the same untagged frames as with
+ * their own tap interfaces.
+ */
+
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+#include "checks.h"
+#include "iftap.h"
+#include "latency.h"
+#include "log.h"
+#include "net.h"
+#include "qsbr.h"
+#include "trunk.h"
+#include "vni_table.h"
+#include "wrapper.h"
+
+
+#define ETHERTYPE_QINQ 0x88a8
+#define VLAN_VID_MASK 0x0fff
+#define TRUNK_MAINTENANCE_INTERVAL 5
+
+
+static struct vxlan *vxlan = NULL;
+static struct vni_table *vlans = NULL;
+static queue *egress = NULL;
+static int egress_event = -1;
+static pthread_t trunk_tid;
+static bool trunk_thread_started = false;
+
+
+// Single tags are mapped to keys below 4096 and double tags to keys above,
+// so that both share one table.
+static uint32_t
+get_vlan_key( uint16_t vlan, uint16_t inner_vlan ) {
+  if ( inner_vlan == 0 ) {
+    return vlan;
+  }
+
+  return ( ( uint32_t ) vlan << 12 ) | inner_vlan;
+}
+
+
+bool
+trunk_enabled() {
+  return vxlan != NULL && vxlan->trunk_sock >= 0;
+}
+
+
+bool
+trunk_vlan_available( uint16_t vlan, uint16_t inner_vlan ) {
+  if ( !trunk_enabled() ) {
+    return false;
+  }
+  if ( vlan == 0 || vlan > VXLAN_MAX_VLAN_ID || inner_vlan > VXLAN_MAX_VLAN_ID ) {
+    return false;
+  }
+
+  return search_vni_table( vlans, get_vlan_key( vlan, inner_vlan ) ) == NULL;
+}
+
+
+bool
+attach_vxlan_instance_to_trunk( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+  assert( instance->vlan != 0 );
+
+  if ( !trunk_enabled() ) {
+    return false;
+  }
+
+  instance->tap_sock = vxlan->trunk_sock;
+  instance->egress = egress;
+  instance->egress_event = egress_event;
+  instance->activated = true;
+
+  return insert_vni_table( vlans, get_vlan_key( instance->vlan, instance->inner_vlan ), instance );
+}
+
+
+void
+detach_vxlan_instance_from_trunk( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  if ( !trunk_enabled() ) {
+    return;
+  }
+
+  delete_vni_table( vlans, get_vlan_key( instance->vlan, instance->inner_vlan ) );
+}
+
+
+static uint16_t
+get_vlan_id( const uint8_t *tag ) {
+  uint16_t tci = 0;
+  memcpy( &tci, tag + 2, sizeof( tci ) );
+
+  return ntohs( tci ) & VLAN_VID_MASK;
+}
+
+
+// Looks up an instance with the tags of a frame read from the trunk and strips them in place.
+// A double tagged frame is mapped with the outer tag only if no instance has both tags.
+struct vxlan_instance *
+pop_vlan_tags( struct ether_header **ether, size_t *len ) {
+  assert( vlans != NULL );
+  assert( ether != NULL && *ether != NULL );
+  assert( len != NULL );
+
+  if ( *len < sizeof( struct ether_header ) + VLAN_TAG_LENGTH ) {
+    return NULL;
+  }
+  uint16_t type = ntohs( ( *ether )->ether_type );
+  if ( type != ETHERTYPE_VLAN && type != ETHERTYPE_QINQ ) {
+    return NULL;
+  }
+
+  uint8_t *frame = ( uint8_t * ) *ether;
+  uint8_t *tag = frame + ETH_ALEN * 2;
+  uint16_t vlan = get_vlan_id( tag );
+  size_t tags_length = VLAN_TAG_LENGTH;
+  struct vxlan_instance *instance = NULL;
+
+  uint16_t inner_type = 0;
+  memcpy( &inner_type, tag + VLAN_TAG_LENGTH, sizeof( inner_type ) );
+  if ( ntohs( inner_type ) == ETHERTYPE_VLAN && *len >= sizeof( struct ether_header ) + VLAN_MAX_TAGS_LENGTH ) {
+    uint16_t inner_vlan = get_vlan_id( tag + VLAN_TAG_LENGTH );
+    if ( inner_vlan != 0 ) {
+      instance = search_vni_table( vlans, get_vlan_key( vlan, inner_vlan ) );
+      tags_length = VLAN_MAX_TAGS_LENGTH;
+    }
+  }
+  if ( instance == NULL ) {
+    instance = search_vni_table( vlans, get_vlan_key( vlan, 0 ) );
+    tags_length = VLAN_TAG_LENGTH;
+  }
+  if ( instance == NULL ) {
+    return NULL;
+  }
+
+  memmove( frame + tags_length, frame, ETH_ALEN * 2 );
+  *ether = ( struct ether_header * ) ( void * ) ( frame + tags_length );
+  *len -= tags_length;
+
+  return instance;
+}
+
+
+static size_t
+write_vlan_tags( struct vxlan_instance *instance, uint8_t *tags ) {
+  uint16_t values[ 4 ];
+  size_t length = 0;
+  if ( instance->inner_vlan != 0 ) {
+    values[ 0 ] = htons( ETHERTYPE_QINQ );
+    values[ 1 ] = htons( instance->vlan );
+    values[ 2 ] = htons( ETHERTYPE_VLAN );
+    values[ 3 ] = htons( instance->inner_vlan );
+    length = VLAN_MAX_TAGS_LENGTH;
+  }
+  else {
+    values[ 0 ] = htons( ETHERTYPE_VLAN );
+    values[ 1 ] = htons( instance->vlan );
+    length = VLAN_TAG_LENGTH;
+  }
+  memcpy( tags, values, length );
+
+  return length;
+}
+
+
+// Pushes tags in place. The caller must have VLAN_MAX_TAGS_LENGTH bytes of headroom before the frame.
+struct ether_header *
+push_vlan_tags( struct vxlan_instance *instance, struct ether_header *ether, size_t *len ) {
+  assert( instance != NULL );
+  assert( ether != NULL );
+  assert( len != NULL );
+
+  size_t tags_length = instance->inner_vlan != 0 ? VLAN_MAX_TAGS_LENGTH : VLAN_TAG_LENGTH;
+  uint8_t *frame = ( uint8_t * ) ether - tags_length;
+  memmove( frame, ether, ETH_ALEN * 2 );
+  write_vlan_tags( instance, frame + ETH_ALEN * 2 );
+  *len += tags_length;
+
+  return ( struct ether_header * ) ( void * ) frame;
+}
+
+
+size_t
+copy_etherframe_with_vlan_tags( struct vxlan_instance *instance, void *dst, struct ether_header *ether, size_t len ) {
+  assert( instance != NULL );
+  assert( dst != NULL );
+  assert( ether != NULL );
+  assert( len >= ETH_ALEN * 2 );
+
+  uint8_t *p = dst;
+  memcpy( p, ether, ETH_ALEN * 2 );
+  size_t tags_length = write_vlan_tags( instance, p + ETH_ALEN * 2 );
+  memcpy( p + ETH_ALEN * 2 + tags_length, ( uint8_t * ) ether + ETH_ALEN * 2, len - ETH_ALEN * 2 );
+
+  return len + tags_length;
+}
+
+
+void
+maintain_trunk() {
+  assert( vlans != NULL );
+
+  int n_instances = 0;
+  struct vxlan_instance **instances = ( struct vxlan_instance ** ) create_list_from_vni_table( vlans, &n_instances );
+  if ( instances == NULL ) {
+    return;
+  }
+  for ( int i = 0; i < n_instances; i++ ) {
+    maintain_vxlan_instance( instances[ i ] );
+  }
+  free( instances );
+}
+
+
+static void *
+process_trunk( void *param ) {
+  UNUSED( param );
+
+  char buf[ VXLAN_PACKET_BUF_LEN ];
+  char error_buf[ 256 ];
+
+  qsbr_register_thread();
+
+  bool tap_writable = true;
+  time_t last_maintained = 0;
+  while ( running ) {
+    qsbr_quiescent_state();
+
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    if ( now.tv_sec - last_maintained >= TRUNK_MAINTENANCE_INTERVAL ) {
+      maintain_trunk();
+      last_maintained = now.tv_sec;
+    }
+
+    if ( tap_writable ) {
+      tap_writable = drain_egress_queue( egress, vxlan->trunk_sock );
+    }
+
+    fd_set fds;
+    FD_ZERO( &fds );
+    FD_SET( vxlan->trunk_sock, &fds );
+    FD_SET( egress_event, &fds );
+    int fd_max = vxlan->trunk_sock > egress_event ? vxlan->trunk_sock : egress_event;
+
+    fd_set write_fds;
+    FD_ZERO( &write_fds );
+    if ( !tap_writable ) {
+      FD_SET( vxlan->trunk_sock, &write_fds );
+    }
+
+    struct timespec timeout = { 1, 0 };
+
+    qsbr_thread_offline();
+    int ret = pselect( fd_max + 1, &fds, &write_fds, NULL, &timeout, NULL );
+    qsbr_thread_online();
+    if ( ret < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      char *error_string = safe_strerror_r( errno, error_buf, sizeof( error_buf ) );
+      error( "Failed to select ( ret = %d, errno = %s [%d] ).", ret, error_string, errno );
+      break;
+    }
+    else if ( ret == 0 ) {
+      continue;
+    }
+
+    if ( FD_ISSET( egress_event, &fds ) ) {
+      uint64_t count = 0;
+      read( egress_event, &count, sizeof( count ) );
+    }
+    if ( FD_ISSET( vxlan->trunk_sock, &write_fds ) ) {
+      tap_writable = true;
+    }
+
+    if ( FD_ISSET( vxlan->trunk_sock, &fds ) ) {
+      ssize_t len = read( vxlan->trunk_sock, buf, sizeof( buf ) );
+      uint64_t received_at = LATENCY_TIMESTAMP();
+      if ( len < 0 ) {
+        if ( errno == EAGAIN || errno == EINTR ) {
+          continue;
+        }
+        char *error_string = safe_strerror_r( errno, error_buf, sizeof( error_buf ) );
+        warn( "Failed to read data from a tap device ( fd = %d, len = %d, errno = %s [%d] ).",
+              vxlan->trunk_sock, len, error_string, errno );
+        continue;
+      }
+
+      struct ether_header *ether = ( struct ether_header * ) ( void * ) buf;
+      size_t length = ( size_t ) len;
+      struct vxlan_instance *instance = pop_vlan_tags( &ether, &length );
+      if ( instance == NULL ) {
+        continue;
+      }
+      send_etherframe_from_local_to_vxlan( instance, ether, length, received_at );
+    }
+  }
+
+  qsbr_unregister_thread();
+
+  return NULL;
+}
+
+
+bool
+init_trunk( struct vxlan *_vxlan ) {
+  assert( _vxlan != NULL );
+
+  vxlan = _vxlan;
+  if ( vxlan->trunk_name[ 0 ] == '\0' ) {
+    return true;
+  }
+
+  vlans = create_vni_table();
+  // A trunk handed over from a previous process is adopted as it is.
+  int sock = vxlan->trunk_sock >= 0 ? vxlan->trunk_sock : tap_alloc( vxlan->trunk_name );
+  vxlan->trunk_sock = -1;
+  if ( sock < 0 ) {
+    return false;
+  }
+  tap_up( vxlan->trunk_name );
+
+  if ( vxlan->io_engine == IO_ENGINE_IO_URING ) {
+    // The io_uring engine reads and writes the trunk by itself.
+    vxlan->trunk_sock = sock;
+    return true;
+  }
+
+  int flags = fcntl( sock, F_GETFL );
+  if ( flags < 0 || fcntl( sock, F_SETFL, flags | O_NONBLOCK ) < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to make a tap interface non-blocking ( fd = %d, errno = %s [%d] ).",
+           sock, error_string, errno );
+    close( sock );
+    return false;
+  }
+  egress_event = eventfd( 0, EFD_NONBLOCK );
+  if ( egress_event < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to create an eventfd ( errno = %s [%d] ).", error_string, errno );
+    close( sock );
+    return false;
+  }
+  egress = create_queue();
+  vxlan->trunk_sock = sock;
+
+  int ret = pthread_create( &trunk_tid, NULL, process_trunk, NULL );
+  if ( ret != 0 ) {
+    error( "Failed to create a trunk thread ( ret = %d ).", ret );
+    return false;
+  }
+  pthread_setname_np( trunk_tid, "trunk" );
+  trunk_thread_started = true;
+
+  return true;
+}
+
+
+bool
+finalize_trunk() {
+  if ( vxlan == NULL || vxlan->trunk_sock < 0 ) {
+    return true;
+  }
+
+  if ( trunk_thread_started ) {
+    pthread_join( trunk_tid, NULL );
+    trunk_thread_started = false;
+  }
+
+  tap_down( vxlan->trunk_name );
+  close( vxlan->trunk_sock );
+  vxlan->trunk_sock = -1;
+  if ( egress_event >= 0 ) {
+    close( egress_event );
+    egress_event = -1;
+  }
+  if ( egress != NULL ) {
+    delete_queue( egress );
+    egress = NULL;
+  }
+  destroy_vni_table( vlans );
+  vlans = NULL;
+
+  return true;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
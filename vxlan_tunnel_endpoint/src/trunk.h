@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef TRUNK_H
+#define TRUNK_H
+
+
+#include <net/ethernet.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "vxlan_common.h"
+#include "vxlan_instance.h"
+
+
+#define VLAN_TAG_LENGTH 4
+#define VLAN_MAX_TAGS_LENGTH ( VLAN_TAG_LENGTH * 2 )
+
+
+bool trunk_enabled();
+bool trunk_vlan_available( uint16_t vlan, uint16_t inner_vlan );
+bool attach_vxlan_instance_to_trunk( struct vxlan_instance *instance );
+void detach_vxlan_instance_from_trunk( struct vxlan_instance *instance );
+struct vxlan_instance *pop_vlan_tags( struct ether_header **ether, size_t *len );
+struct ether_header *push_vlan_tags( struct vxlan_instance *instance, struct ether_header *ether, size_t *len );
+size_t copy_etherframe_with_vlan_tags( struct vxlan_instance *instance, void *dst,
+                                       struct ether_header *ether, size_t len );
+void maintain_trunk();
+bool init_trunk( struct vxlan *vxlan );
+bool finalize_trunk();
+
+
+#endif // TRUNK_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
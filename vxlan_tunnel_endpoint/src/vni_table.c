@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * A two-level table directly indexed by 24-bit VNIs. The upper bits of
+ * a VNI select a block and the lower bits select a slot in the block.
+ * Blocks are allocated on first use and never released until the table
+ * is destroyed, so readers only follow two pointers and take no locks.
+ * Writers are serialized with a mutex and publish new slots and blocks
+ * after a write memory barrier.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory_barrier.h"
+#include "vni_table.h"
+#include "vxlan.h"
+
+
+struct vni_table *
+create_vni_table() {
+  struct vni_table *table = malloc( sizeof( struct vni_table ) );
+  assert( table != NULL );
+
+  memset( table, 0, sizeof( struct vni_table ) );
+  pthread_mutex_init( &table->mutex, NULL );
+  table->count = 0;
+
+  return table;
+}
+
+
+bool
+insert_vni_table( struct vni_table *table, uint32_t vni, void *data ) {
+  assert( table != NULL );
+  assert( data != NULL );
+
+  if ( !valid_vni( vni ) ) {
+    return false;
+  }
+
+  pthread_mutex_lock( &table->mutex );
+
+  void **block = table->blocks[ vni >> VNI_TABLE_BLOCK_BITS ];
+  if ( block == NULL ) {
+    block = malloc( VNI_TABLE_BLOCK_SIZE * sizeof( void * ) );
+    assert( block != NULL );
+    memset( block, 0, VNI_TABLE_BLOCK_SIZE * sizeof( void * ) );
+    write_memory_barrier();
+    table->blocks[ vni >> VNI_TABLE_BLOCK_BITS ] = block;
+  }
+
+  void **slot = &block[ vni & ( VNI_TABLE_BLOCK_SIZE - 1 ) ];
+  if ( *slot != NULL ) {
+    pthread_mutex_unlock( &table->mutex );
+    return false;
+  }
+
+  write_memory_barrier();
+  *slot = data;
+  table->count++;
+
+  pthread_mutex_unlock( &table->mutex );
+
+  return true;
+}
+
+
+void *
+delete_vni_table( struct vni_table *table, uint32_t vni ) {
+  assert( table != NULL );
+
+  if ( !valid_vni( vni ) ) {
+    return NULL;
+  }
+
+  pthread_mutex_lock( &table->mutex );
+
+  void **block = table->blocks[ vni >> VNI_TABLE_BLOCK_BITS ];
+  if ( block == NULL ) {
+    pthread_mutex_unlock( &table->mutex );
+    return NULL;
+  }
+
+  void **slot = &block[ vni & ( VNI_TABLE_BLOCK_SIZE - 1 ) ];
+  void *data = *slot;
+  if ( data != NULL ) {
+    *slot = NULL;
+    table->count--;
+  }
+
+  pthread_mutex_unlock( &table->mutex );
+
+  return data;
+}
+
+
+void *
+search_vni_table( struct vni_table *table, uint32_t vni ) {
+  assert( table != NULL );
+
+  if ( !valid_vni( vni ) ) {
+    return NULL;
+  }
+
+  void **block = table->blocks[ vni >> VNI_TABLE_BLOCK_BITS ];
+  if ( block == NULL ) {
+    return NULL;
+  }
+
+  return block[ vni & ( VNI_TABLE_BLOCK_SIZE - 1 ) ];
+}
+
+
+void
+destroy_vni_table( struct vni_table *table ) {
+  assert( table != NULL );
+
+  pthread_mutex_lock( &table->mutex );
+  for ( int n = 0; n < VNI_TABLE_N_BLOCKS; n++ ) {
+    if ( table->blocks[ n ] != NULL ) {
+      free( table->blocks[ n ] );
+      table->blocks[ n ] = NULL;
+    }
+  }
+  table->count = 0;
+  pthread_mutex_unlock( &table->mutex );
+
+  pthread_mutex_destroy( &table->mutex );
+  free( table );
+}
+
+
+void **
+create_list_from_vni_table( struct vni_table *table, int *num ) {
+  assert( table != NULL );
+  assert( num != NULL );
+
+  pthread_mutex_lock( &table->mutex );
+
+  *num = 0;
+  if ( table->count == 0 ) {
+    pthread_mutex_unlock( &table->mutex );
+    return NULL;
+  }
+
+  void **list = malloc( ( size_t ) table->count * sizeof( void * ) );
+  assert( list != NULL );
+  for ( int n = 0; n < VNI_TABLE_N_BLOCKS; n++ ) {
+    void **block = table->blocks[ n ];
+    if ( block == NULL ) {
+      continue;
+    }
+    for ( int i = 0; i < VNI_TABLE_BLOCK_SIZE; i++ ) {
+      if ( block[ i ] != NULL ) {
+        list[ ( *num )++ ] = block[ i ];
+      }
+    }
+  }
+
+  pthread_mutex_unlock( &table->mutex );
+
+  return list;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
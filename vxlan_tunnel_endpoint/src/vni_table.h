@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef VNI_TABLE_H
+#define VNI_TABLE_H
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define VNI_TABLE_BLOCK_BITS 12
+#define VNI_TABLE_BLOCK_SIZE ( 1 << VNI_TABLE_BLOCK_BITS )
+#define VNI_TABLE_N_BLOCKS ( 1 << ( 24 - VNI_TABLE_BLOCK_BITS ) )
+
+
+struct vni_table {
+  void **blocks[ VNI_TABLE_N_BLOCKS ];
+  int count;
+  pthread_mutex_t mutex;
+};
+
+
+struct vni_table *create_vni_table();
+bool insert_vni_table( struct vni_table *table, uint32_t vni, void *data );
+void *delete_vni_table( struct vni_table *table, uint32_t vni );
+void *search_vni_table( struct vni_table *table, uint32_t vni );
+void destroy_vni_table( struct vni_table *table );
+void **create_list_from_vni_table( struct vni_table *table, int *num );
+
+
+#endif // VNI_TABLE_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
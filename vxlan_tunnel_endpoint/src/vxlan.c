@@ -34,6 +34,18 @@ valid_vni( uint32_t vni ) {
 }
 
 
+uint32_t
+get_vni_value( const uint8_t *vni ) {
+  uint32_t value = 0;
+
+  value |= ( uint32_t ) ( vni[ 0 ] << 16 );
+  value |= ( uint32_t ) ( vni[ 1 ] << 8 );
+  value |= ( uint32_t ) vni[ 2 ];
+
+  return value;
+}
+
+
 /*
  * Local variables:
  * c-basic-offset: 2
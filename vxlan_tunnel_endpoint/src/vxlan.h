@@ -31,6 +31,18 @@
 #define VXLAN_MCAST_TTL 16
 #define VXLAN_DEFAULT_AGING_TIME 300
 #define VXLAN_MAX_AGING_TIME 86400
+#define VXLAN_DEFAULT_MAX_FDB_ENTRIES 65536
+#define VXLAN_MAX_FDB_ENTRIES 1048576
+#define VXLAN_DEFAULT_FLOOD_RATE 100
+#define VXLAN_MAX_FLOOD_RATE 1000000
+#define VXLAN_MAX_REMOTES 4096
+#define VXLAN_EGRESS_QUEUE_LENGTH 1024
+#define VXLAN_DEFAULT_SOURCE_PORT_MIN 49152
+#define VXLAN_DEFAULT_SOURCE_PORT_MAX 65535
+#define VXLAN_MAX_VLAN_ID 4094
+#define VXLAN_DEFAULT_IDLE_TIMEOUT 600
+#define VXLAN_MAX_IDLE_TIMEOUT 86400
+#define VXLAN_MAX_CAPTURE_FRAMES 1048576
 
 
 #define VXLAN_VNISIZE 3
@@ -46,6 +58,7 @@ struct vxlanhdr {
 
 
 bool valid_vni( uint32_t vni );
+uint32_t get_vni_value( const uint8_t *vni );
 
 
 #endif // VXLAN_H
@@ -27,11 +27,15 @@
 #include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include "hash.h"
+#include "capture.h"
+#include "replay.h"
+#include "vni_table.h"
 #include "wrapper.h"
 
 
 #define VXLAN_PACKET_BUF_LEN 9216
+// Whole datagrams with IPv4 and UDP headers
+#define VXLAN_CAPTURE_LENGTH ( VXLAN_PACKET_BUF_LEN + 28 )
 
 
 enum {
@@ -42,24 +46,49 @@ enum {
   SOURCE_PORTS_NOT_ALLOCATED = 4,
   DUPLICATED_INSTANCE = 5,
   INSTANCE_NOT_FOUND = 6,
+  CAPTURE_DISABLED = 7,
+  REPLAY_UNAVAILABLE = 8,
   OTHER_ERROR = 255,
 };
 
 
+enum {
+  IO_ENGINE_SELECT = 0,
+  IO_ENGINE_IO_URING = 1,
+};
+
+
 struct vxlan {
   int udp_sock;
+  int raw_sock;
+  int trunk_sock;
   int timerfd;
   bool active;
   char ifname[ IFNAMSIZ ];
+  char trunk_name[ IFNAMSIZ ];
   uint16_t port;
+  uint16_t source_port_min;
+  uint16_t source_port_max;
   struct in_addr flooding_addr;
   uint16_t flooding_port;
   time_t aging_time;
+  uint32_t max_fdb_entries;
+  time_t idle_timeout;
   int n_instances;
-  struct hash instances;
+  struct vni_table *instances;
   pthread_t control_tid;
   bool daemonize;
   uint8_t log_output;
+  int io_engine;
+  bool handover; // Take over from a running process on startup
+  bool handed_over; // Handed over to a new process and exiting
+  unsigned int capture_frames; // Number of received datagrams kept for dumping ( 0 to disable )
+  unsigned int capture_length;
+  struct capture_ring *capture;
+  char *replay_file; // Datagrams are read from the file instead of the network if set
+  int replay_speed;
+  unsigned int replay_loops;
+  struct replay *replay;
 };
 
 
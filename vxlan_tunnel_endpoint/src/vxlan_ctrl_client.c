@@ -45,6 +45,11 @@
 
 
 static int fd = -1;
+static bool connected = false; // Requests on a connection are served in order
+static char last_record[ 18 ]; // VNI or MAC address of the last record shown
+static vxlan_ctrl_record_handler record_handler = NULL; // Records are printed unless set
+static void *record_handler_data = NULL;
+static bool truncated = false;
 
 
 static ssize_t
@@ -54,17 +59,30 @@ send_request( void *reply, size_t *length ) {
   assert( length != NULL );
   assert( *length > 0 );
 
-  struct sockaddr_un saddr;
-  memset( &saddr, 0, sizeof( saddr ) );
-  saddr.sun_family = AF_UNIX;
-  memset( saddr.sun_path, '\0', sizeof( saddr.sun_path ) );
-  strncpy( saddr.sun_path, CTRL_SERVER_SOCK_FILE, sizeof( saddr.sun_path ) - 1 );
-  int ret = connect( fd, ( const struct sockaddr * ) &saddr, ( socklen_t ) sizeof( saddr ) );
-  if ( ret < 0 ) {
-    char buf[ 256 ];
-    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-    error( "Failed to connect ( ret = %d, errno = %s [%d] ).", ret, error_string, errno );
-    return -1;
+  // Reconnect if the daemon went away since the last request, e.g. when
+  // it was restarted while a client kept the connection open.
+  if ( connected && ctrl_connection_closed( fd ) ) {
+    finalize_ctrl_client( fd );
+    connected = false;
+    if ( !init_ctrl_client( &fd ) ) {
+      return -1;
+    }
+  }
+
+  if ( !connected ) {
+    struct sockaddr_un saddr;
+    memset( &saddr, 0, sizeof( saddr ) );
+    saddr.sun_family = AF_UNIX;
+    memset( saddr.sun_path, '\0', sizeof( saddr.sun_path ) );
+    strncpy( saddr.sun_path, CTRL_SERVER_SOCK_FILE, sizeof( saddr.sun_path ) - 1 );
+    int ret = connect( fd, ( const struct sockaddr * ) &saddr, ( socklen_t ) sizeof( saddr ) );
+    if ( ret < 0 ) {
+      char buf[ 256 ];
+      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+      error( "Failed to connect ( ret = %d, errno = %s [%d] ).", ret, error_string, errno );
+      return -1;
+    }
+    connected = true;
   }
 
   return send_command( fd, reply, length );
@@ -73,8 +91,10 @@ send_request( void *reply, size_t *length ) {
 
 static void
 print_dump_vxlan_global_header() {
-  printf( "   IF   | UDP port | Flooding address | Flooding port | Aging time \n");
-  printf( "--------+----------+------------------+---------------+------------\n");
+  printf( "   IF   | UDP port |  Source ports  | Flooding address | Flooding port | Aging time | Max FDB entries "
+          "| Idle timeout \n");
+  printf( "--------+----------+----------------+------------------+---------------+------------+-----------------"
+          "+--------------\n");
 }
 
 static void
@@ -85,16 +105,24 @@ dump_vxlan_global( struct vxlan *vxlan ) {
   memset( buf, '\0', sizeof( buf ) );
   const char *addr = inet_ntop( AF_INET, &vxlan->flooding_addr.s_addr, buf, sizeof( buf ) );
 
-  printf( " %6s | %8u | %16s | %13u | %9u \n",
-          vxlan->ifname, vxlan->port,
+  char source_ports[ 16 ];
+  if ( vxlan->source_port_min > 0 ) {
+    snprintf( source_ports, sizeof( source_ports ), "%u-%u", vxlan->source_port_min, vxlan->source_port_max );
+  }
+  else {
+    snprintf( source_ports, sizeof( source_ports ), "%u", vxlan->port );
+  }
+
+  printf( " %6s | %8u | %14s | %16s | %13u | %10u | %15u | %12u \n",
+          vxlan->ifname, vxlan->port, source_ports,
           addr, vxlan->flooding_port,
-          ( int ) vxlan->aging_time );
+          ( int ) vxlan->aging_time, vxlan->max_fdb_entries, ( int ) vxlan->idle_timeout );
 }
 
 static void
 print_dump_vxlan_instance_header() {
-  printf( "   VNI    | Flooding address | UDP port | Aging time |  State\n" );
-  printf( "----------+------------------+----------+------------+----------\n" );
+  printf( "   VNI    | Flooding address | UDP port | Aging time |  State   |    FDB entries    | FDB memory |   VLAN\n" );
+  printf( "----------+------------------+----------+------------+----------+-------------------+------------+-----------\n" );
 }
 
 
@@ -111,9 +139,95 @@ dump_vxlan_instance( struct vxlan_instance *instance ) {
   memset( buf, '\0', sizeof( buf ) );
   const char *addr = inet_ntop( AF_INET, &instance->addr.sin_addr, buf, sizeof( buf ) );
 
-  printf( " %#8x | %16s | %8u | %10u | %8s\n",
-          vni, addr, instance->port, ( int ) instance->aging_time,
-          instance->activated ? "Active" : "Inactive" );
+  char entries[ 24 ];
+  memset( entries, '\0', sizeof( entries ) );
+  snprintf( entries, sizeof( entries ), "%u/%u", instance->fdb_stats.n_entries, instance->fdb_stats.max_entries );
+
+  char vlan[ 12 ];
+  memset( vlan, '\0', sizeof( vlan ) );
+  if ( instance->vlan == 0 ) {
+    snprintf( vlan, sizeof( vlan ), "-" );
+  }
+  else if ( instance->inner_vlan == 0 ) {
+    snprintf( vlan, sizeof( vlan ), "%u", instance->vlan );
+  }
+  else {
+    snprintf( vlan, sizeof( vlan ), "%u.%u", instance->vlan, instance->inner_vlan );
+  }
+
+  // Dormant instances have neither tables nor a thread until they see traffic.
+  const char *state = "Inactive";
+  if ( instance->activated ) {
+    state = instance->fdb == NULL && !instance->worker_started ? "Dormant" : "Active";
+  }
+
+  printf( " %#8x | %16s | %8u | %10u | %8s | %17s | %9uKB | %9s\n",
+          vni, addr, instance->port, ( int ) instance->aging_time, state,
+          entries, ( unsigned int ) ( ( instance->fdb_stats.memory_usage + 1023 ) / 1024 ), vlan );
+}
+
+
+static void
+print_dump_vxlan_instance_stats_header() {
+#ifdef LATENCY_STATS
+  printf( "   VNI    |  FDB mode  | Flood rate | Unknown unicast flooded | Unknown unicast dropped "
+          "| ARP/ND suppressed | ARP/ND missed | Egress dropped | Encap p50/p99/max (us) "
+          "| Decap p50/p99/max (us)\n" );
+  printf( "----------+------------+------------+-------------------------+-------------------------"
+          "+-------------------+---------------+----------------+------------------------"
+          "+------------------------\n" );
+#else
+  printf( "   VNI    |  FDB mode  | Flood rate | Unknown unicast flooded | Unknown unicast dropped "
+          "| ARP/ND suppressed | ARP/ND missed | Egress dropped \n" );
+  printf( "----------+------------+------------+-------------------------+-------------------------"
+          "+-------------------+---------------+----------------\n" );
+#endif
+}
+
+
+#ifdef LATENCY_STATS
+static void
+format_latency( char *buf, size_t size, const struct latency_summary *latency ) {
+  assert( buf != NULL );
+  assert( latency != NULL );
+
+  if ( latency->count == 0 ) {
+    snprintf( buf, size, "-" );
+    return;
+  }
+  snprintf( buf, size, "%.1f/%.1f/%.1f", ( double ) latency->p50 / 1000,
+            ( double ) latency->p99 / 1000, ( double ) latency->max / 1000 );
+}
+#endif
+
+
+static void
+dump_vxlan_instance_stats( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  uint32_t vni = 0;
+  vni = ( uint32_t ) instance->vni[ 2 ];
+  vni |= ( uint32_t ) ( instance->vni[ 1 ] << 8 );
+  vni |= ( uint32_t ) ( instance->vni[ 0 ] << 16 );
+
+#ifdef LATENCY_STATS
+  char encap[ 64 ];
+  char decap[ 64 ];
+  format_latency( encap, sizeof( encap ), &instance->stats.encap_latency );
+  format_latency( decap, sizeof( decap ), &instance->stats.decap_latency );
+  printf( " %#8x | %10s | %10d | %23" PRIu64 " | %23" PRIu64 " | %17" PRIu64 " | %13" PRIu64 " | %14" PRIu64
+          " | %22s | %22s\n",
+          vni, instance->learning ? "Learning" : "Controller", instance->flood_rate,
+          instance->stats.unknown_unicast_flooded, instance->stats.unknown_unicast_dropped,
+          instance->stats.neighbor_suppression_hits, instance->stats.neighbor_suppression_misses,
+          instance->stats.egress_dropped, encap, decap );
+#else
+  printf( " %#8x | %10s | %10d | %23" PRIu64 " | %23" PRIu64 " | %17" PRIu64 " | %13" PRIu64 " | %14" PRIu64 " \n",
+          vni, instance->learning ? "Learning" : "Controller", instance->flood_rate,
+          instance->stats.unknown_unicast_flooded, instance->stats.unknown_unicast_dropped,
+          instance->stats.neighbor_suppression_hits, instance->stats.neighbor_suppression_misses,
+          instance->stats.egress_dropped );
+#endif
 }
 
 
@@ -125,21 +239,33 @@ print_dump_fdb_entry_header() {
 
 
 static void
-dump_fdb_entry( struct fdb_entry *entry ) {
+dump_fdb_entry( fdb_entry_record *entry ) {
   assert( entry != NULL );
 
   char addr[ INET_ADDRSTRLEN ];
   memset( addr, '\0', sizeof( addr ) );
-  struct sockaddr_in *saddr = &entry->vtep_addr;
-  inet_ntop( AF_INET, ( const void * ) &saddr->sin_addr, addr, sizeof( addr ) );
+  inet_ntop( AF_INET, ( const void * ) &entry->ip_addr, addr, sizeof( addr ) );
 
+  // Timestamps in FDB entries are seconds on the coarse monotonic clock.
   struct timespec now = { 0, 0 };
-  int ret = clock_gettime( CLOCK_MONOTONIC, &now );
+  int ret = clock_gettime( CLOCK_MONOTONIC_COARSE, &now );
   if ( ret < 0 ) {
     error( "Failed to retrieve monotonic time." );
     return;
   }
-  time_t diff = now.tv_sec - entry->created_at.tv_sec;
+  time_t diff = now.tv_sec - ( time_t ) entry->created_at;
+  if ( diff < 0 ) {
+    diff = 0;
+  }
+
+  time_t expire_in = 0;
+  if ( entry->aging_time > 0 ) {
+    expire_in = ( time_t ) entry->last_seen + ( time_t ) entry->aging_time - now.tv_sec;
+    if ( expire_in < 0 ) {
+      expire_in = 0;
+    }
+  }
+
   char total_time[ 17 ];
   memset( total_time, '\0', sizeof( total_time ) );
   time_t week = diff / 604800;
@@ -154,15 +280,35 @@ dump_fdb_entry( struct fdb_entry *entry ) {
   snprintf( total_time, sizeof( total_time ) - 1, "%dw%dd%dh%dm%ds",
             ( int ) week, ( int ) day, ( int ) hour, ( int ) minute, ( int ) second );
 
+  const uint8_t *mac = entry->eth_addr.ether_addr_octet;
   printf( " %02x:%02x:%02x:%02x:%02x:%02x | %15s | %7s | %16s | %8ds\n",
-          entry->mac[ 0 ], entry->mac[ 1 ], entry->mac[ 2 ], entry->mac[ 3 ], entry->mac[ 4 ], entry->mac[ 5 ],
+          mac[ 0 ], mac[ 1 ], mac[ 2 ], mac[ 3 ], mac[ 4 ], mac[ 5 ],
           addr, entry->type == FDB_ENTRY_TYPE_DYNAMIC ? "Dynamic" : "Static", total_time,
-          entry->ttl > 0 ? ( int ) entry->ttl : 0 );
+          ( int ) expire_in );
+}
+
+
+static void
+print_dump_remote_header() {
+  printf( " Remote address  \n" );
+  printf( "-----------------\n" );
+}
+
+
+static void
+dump_remote( struct in_addr *remote ) {
+  assert( remote != NULL );
+
+  char addr[ INET_ADDRSTRLEN ];
+  memset( addr, '\0', sizeof( addr ) );
+  inet_ntop( AF_INET, ( const void * ) remote, addr, sizeof( addr ) );
+
+  printf( " %15s \n", addr );
 }
 
 
 static bool
-handle_reply( void *reply, size_t length, uint8_t *reason ) {
+handle_reply( void *reply, size_t length, uint16_t set_bitmap, uint8_t *reason ) {
   assert( reply != NULL );
   assert( length >= sizeof( command_reply_header ) );
   assert( reason != NULL );
@@ -196,6 +342,10 @@ handle_reply( void *reply, size_t length, uint8_t *reason ) {
     case SHOW_GLOBAL_REPLY:
     {
       struct vxlan *vxlan = ( ( show_global_reply * ) reply )->vxlan;
+      if ( record_handler != NULL ) {
+        record_handler( type, vxlan, record_handler_data );
+        break;
+      }
       dump_vxlan_global( vxlan ) ;
     }
     break;
@@ -205,7 +355,17 @@ handle_reply( void *reply, size_t length, uint8_t *reason ) {
       unsigned int count = ( unsigned int ) ( header->length - offsetof( list_instances_reply, instances ) ) / sizeof( struct vxlan_instance );
       struct vxlan_instance *instance = ( ( list_instances_reply * ) reply )->instances;
       for ( unsigned int i = 0; i < count; i++ ) {
-        dump_vxlan_instance( instance );
+        if ( record_handler != NULL ) {
+          record_handler( type, instance, record_handler_data );
+        }
+        else if ( set_bitmap & SHOW_STATS ) {
+          dump_vxlan_instance_stats( instance );
+        }
+        else {
+          dump_vxlan_instance( instance );
+        }
+        snprintf( last_record, sizeof( last_record ), "%#x",
+                  ( uint32_t ) ( instance->vni[ 0 ] << 16 | instance->vni[ 1 ] << 8 | instance->vni[ 2 ] ) );
         instance++;
       }
     }
@@ -213,15 +373,50 @@ handle_reply( void *reply, size_t length, uint8_t *reason ) {
 
     case SHOW_FDB_REPLY:
     {
-      unsigned int count = ( unsigned int ) ( header->length - offsetof( show_fdb_reply, entries ) ) / sizeof( struct fdb_entry );
-      struct fdb_entry *entry = ( ( show_fdb_reply * ) reply )->entries;
+      unsigned int count = ( unsigned int ) ( header->length - offsetof( show_fdb_reply, entries ) ) / sizeof( fdb_entry_record );
+      fdb_entry_record *entry = ( ( show_fdb_reply * ) reply )->entries;
       for ( unsigned int i = 0; i < count; i++ ) {
-        dump_fdb_entry( entry );
+        if ( record_handler != NULL ) {
+          record_handler( type, entry, record_handler_data );
+        }
+        else {
+          dump_fdb_entry( entry );
+        }
+        const uint8_t *mac = entry->eth_addr.ether_addr_octet;
+        snprintf( last_record, sizeof( last_record ), "%02x:%02x:%02x:%02x:%02x:%02x",
+                  mac[ 0 ], mac[ 1 ], mac[ 2 ], mac[ 3 ], mac[ 4 ], mac[ 5 ] );
         entry++;
       }
     }
     break;
 
+    case DUMP_CAPTURE_REPLY:
+    {
+      uint32_t *n_packets = &( ( dump_capture_reply * ) reply )->n_packets;
+      if ( record_handler != NULL ) {
+        record_handler( type, n_packets, record_handler_data );
+        break;
+      }
+      printf( "%u packets are written.\n", *n_packets );
+    }
+    break;
+
+    case SHOW_REMOTES_REPLY:
+    {
+      unsigned int count = ( unsigned int ) ( header->length - offsetof( show_remotes_reply, remotes ) ) / sizeof( struct in_addr );
+      struct in_addr *remote = ( ( show_remotes_reply * ) reply )->remotes;
+      for ( unsigned int i = 0; i < count; i++ ) {
+        if ( record_handler != NULL ) {
+          record_handler( type, remote, record_handler_data );
+        }
+        else {
+          dump_remote( remote );
+        }
+        remote++;
+      }
+    }
+    break;
+
     default:
       break;
   }
@@ -237,6 +432,8 @@ recv_reply( uint32_t xid, uint16_t set_bitmap, uint8_t *reason ) {
   bool ret = true;
   uint8_t flags = FLAG_MORE;
   int n_replies = 0;
+  memset( last_record, '\0', sizeof( last_record ) );
+  truncated = false;
 
   while ( flags & FLAG_MORE ) {
     char reply[ COMMAND_MESSAGE_LENGTH ];
@@ -255,33 +452,48 @@ recv_reply( uint32_t xid, uint16_t set_bitmap, uint8_t *reason ) {
     }
 
     if ( n_replies == 0 && header->reason == SUCCEEDED &&
-         ( set_bitmap & DISABLE_HEADER ) == 0) {
+         ( set_bitmap & DISABLE_HEADER ) == 0 && record_handler == NULL ) {
       switch ( header->type ) {
         case SHOW_GLOBAL_REPLY:
           print_dump_vxlan_global_header();
           break;
         case LIST_INSTANCES_REPLY:
-          print_dump_vxlan_instance_header();
+          if ( set_bitmap & SHOW_STATS ) {
+            print_dump_vxlan_instance_stats_header();
+          }
+          else {
+            print_dump_vxlan_instance_header();
+          }
           break;
         case SHOW_FDB_REPLY:
           print_dump_fdb_entry_header();
           break;
+        case SHOW_REMOTES_REPLY:
+          print_dump_remote_header();
+          break;
         default:
           break;
       }
     }
 
-    ret &= handle_reply( ( void * ) reply, length, reason );
+    ret &= handle_reply( ( void * ) reply, length, set_bitmap, reason );
     flags = header->flags;
     n_replies++;
   }
 
+  truncated = ret && ( flags & FLAG_TRUNCATED ) != 0;
+  if ( truncated && strlen( last_record ) > 0 && record_handler == NULL ) {
+    printf( "More entries follow. Continue with --cursor %s.\n", last_record );
+  }
+
   return ret;
 }
 
 
 bool
-add_instance( uint32_t vni, struct in_addr addr, uint16_t port, time_t aging_time, uint8_t *reason ) {
+add_instance( uint32_t vni, struct in_addr addr, uint16_t port, time_t aging_time, int max_fdb_entries,
+              bool learning, int flood_rate, bool neighbor_suppression, uint16_t vlan, uint16_t inner_vlan,
+              uint8_t *reason ) {
   assert( fd >= 0 );
   assert( reason != NULL );
 
@@ -296,6 +508,12 @@ add_instance( uint32_t vni, struct in_addr addr, uint16_t port, time_t aging_tim
   request.instance.addr.sin_addr = addr;
   request.instance.port = port;
   request.instance.aging_time = aging_time;
+  request.instance.max_fdb_entries = max_fdb_entries;
+  request.instance.learning = learning;
+  request.instance.flood_rate = flood_rate;
+  request.instance.neighbor_suppression = neighbor_suppression;
+  request.instance.vlan = vlan;
+  request.instance.inner_vlan = inner_vlan;
   size_t length = sizeof( add_instance_request );
 
   ssize_t ret = send_request( ( void * ) &request, &length );
@@ -310,7 +528,7 @@ add_instance( uint32_t vni, struct in_addr addr, uint16_t port, time_t aging_tim
 
 bool
 set_instance( uint32_t vni, uint16_t set_bitmap, struct in_addr addr, uint16_t port, time_t aging_time,
-              uint8_t *reason ) {
+              int max_fdb_entries, bool learning, int flood_rate, bool neighbor_suppression, uint8_t *reason ) {
   assert( fd >= 0 );
   assert( reason != NULL );
 
@@ -326,6 +544,10 @@ set_instance( uint32_t vni, uint16_t set_bitmap, struct in_addr addr, uint16_t p
   request.instance.addr.sin_addr = addr;
   request.instance.port = port;
   request.instance.aging_time = aging_time;
+  request.instance.max_fdb_entries = max_fdb_entries;
+  request.instance.learning = learning;
+  request.instance.flood_rate = flood_rate;
+  request.instance.neighbor_suppression = neighbor_suppression;
   size_t length = sizeof( set_instance_request );
 
   ssize_t ret = send_request( ( void * ) &request, &length );
@@ -430,15 +652,13 @@ show_global( uint16_t set_bitmap, uint8_t *reason ) {
 
 
 bool
-list_instances( uint32_t vni, uint16_t set_bitmap, uint8_t *reason ) {
+list_instances( uint32_t vni, uint16_t set_bitmap, const uint32_t *cursor, uint32_t max_instances,
+                uint8_t *reason ) {
   assert( fd >= 0 );
   assert( reason != NULL );
 
   if ( set_bitmap & SHOW_GLOBAL ) {
     show_global( set_bitmap, reason );
-    finalize_vxlan_ctrl_client();
-    fd = -1;
-    init_vxlan_ctrl_client();
   }
 
   list_instances_request request;
@@ -447,6 +667,11 @@ list_instances( uint32_t vni, uint16_t set_bitmap, uint8_t *reason ) {
   request.header.type = LIST_INSTANCES_REQUEST;
   request.header.length = ( uint32_t ) sizeof( list_instances_request );
   request.vni = vni;
+  if ( cursor != NULL ) {
+    request.filter |= DUMP_CURSOR;
+    request.cursor = *cursor;
+  }
+  request.max_instances = max_instances;
   size_t length = sizeof( list_instances_request );
 
   ssize_t ret = send_request( ( void * ) &request, &length );
@@ -460,7 +685,8 @@ list_instances( uint32_t vni, uint16_t set_bitmap, uint8_t *reason ) {
 
 
 bool
-show_fdb( uint32_t vni, uint8_t *reason ) {
+show_fdb( uint32_t vni, const struct ether_addr *eth_addr, const struct ether_addr *cursor, uint32_t max_entries,
+          uint8_t *reason ) {
   assert( fd >= 0 );
   assert( reason != NULL );
 
@@ -470,6 +696,15 @@ show_fdb( uint32_t vni, uint8_t *reason ) {
   request.header.type = SHOW_FDB_REQUEST;
   request.header.length = ( uint32_t ) sizeof( show_fdb_request );
   request.vni = vni;
+  if ( eth_addr != NULL ) {
+    request.filter |= DUMP_FILTER_ETH_ADDR;
+    request.eth_addr = *eth_addr;
+  }
+  if ( cursor != NULL ) {
+    request.filter |= DUMP_CURSOR;
+    request.cursor = *cursor;
+  }
+  request.max_entries = max_entries;
   size_t length = sizeof( show_fdb_request );
 
   ssize_t ret = send_request( ( void * ) &request, &length );
@@ -533,6 +768,200 @@ delete_fdb_entry( uint32_t vni, struct ether_addr eth_addr, uint8_t *reason ) {
 }
 
 
+static bool
+send_remote_request( uint8_t type, uint32_t vni, struct in_addr ip_addr, uint8_t *reason ) {
+  assert( fd >= 0 );
+  assert( reason != NULL );
+
+  add_remote_request request;
+  memset( &request, 0, sizeof( add_remote_request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = type;
+  request.header.length = ( uint32_t ) sizeof( add_remote_request );
+  request.vni = vni;
+  request.ip_addr = ip_addr;
+  size_t length = sizeof( add_remote_request );
+
+  ssize_t ret = send_request( ( void * ) &request, &length );
+  if ( ret < 0 ) {
+    *reason = OTHER_ERROR;
+    return false;
+  }
+
+  return recv_reply( request.header.xid, 0, reason );
+}
+
+
+bool
+add_remote( uint32_t vni, struct in_addr ip_addr, uint8_t *reason ) {
+  return send_remote_request( ADD_REMOTE_REQUEST, vni, ip_addr, reason );
+}
+
+
+bool
+delete_remote( uint32_t vni, struct in_addr ip_addr, uint8_t *reason ) {
+  return send_remote_request( DEL_REMOTE_REQUEST, vni, ip_addr, reason );
+}
+
+
+bool
+show_remotes( uint32_t vni, uint8_t *reason ) {
+  assert( fd >= 0 );
+  assert( reason != NULL );
+
+  show_remotes_request request;
+  memset( &request, 0, sizeof( show_remotes_request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = SHOW_REMOTES_REQUEST;
+  request.header.length = ( uint32_t ) sizeof( show_remotes_request );
+  request.vni = vni;
+  size_t length = sizeof( show_remotes_request );
+
+  ssize_t ret = send_request( ( void * ) &request, &length );
+  if ( ret < 0 ) {
+    *reason = OTHER_ERROR;
+    return false;
+  }
+
+  return recv_reply( request.header.xid, 0, reason );
+}
+
+
+// Dumps recently received packets to a pcapng file. The file is written by
+// the daemon, so the path is absolute on its host.
+bool
+dump_capture( const char *file, uint8_t *reason ) {
+  assert( fd >= 0 );
+  assert( file != NULL );
+  assert( reason != NULL );
+
+  if ( strlen( file ) >= CAPTURE_FILE_LENGTH ) {
+    *reason = INVALID_ARGUMENT;
+    return false;
+  }
+
+  dump_capture_request request;
+  memset( &request, 0, sizeof( dump_capture_request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = DUMP_CAPTURE_REQUEST;
+  request.header.length = ( uint32_t ) sizeof( dump_capture_request );
+  strncpy( request.file, file, sizeof( request.file ) - 1 );
+  size_t length = sizeof( dump_capture_request );
+
+  ssize_t ret = send_request( ( void * ) &request, &length );
+  if ( ret < 0 ) {
+    *reason = OTHER_ERROR;
+    return false;
+  }
+
+  return recv_reply( request.header.xid, 0, reason );
+}
+
+
+bool
+start_replaying( uint8_t *reason ) {
+  assert( fd >= 0 );
+  assert( reason != NULL );
+
+  start_replay_request request;
+  memset( &request, 0, sizeof( start_replay_request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = START_REPLAY_REQUEST;
+  request.header.length = ( uint32_t ) sizeof( start_replay_request );
+  size_t length = sizeof( start_replay_request );
+
+  ssize_t ret = send_request( ( void * ) &request, &length );
+  if ( ret < 0 ) {
+    *reason = OTHER_ERROR;
+    return false;
+  }
+
+  return recv_reply( request.header.xid, 0, reason );
+}
+
+
+// Sends updates in as many requests as needed on a single connection. The
+// daemon applies the batch when the last request arrives and replies once.
+// Update requests share the layout of update_fdb_request.
+static bool
+send_updates( uint8_t type, uint32_t vni, uint8_t flags, const void *updates, size_t update_length,
+              unsigned int n_updates, size_t header_length, uint8_t *reason ) {
+  assert( fd >= 0 );
+  assert( updates != NULL || n_updates == 0 );
+  assert( reason != NULL );
+
+  unsigned int max_updates = ( unsigned int ) ( ( COMMAND_MESSAGE_LENGTH - header_length ) / update_length );
+  update_fdb_request *request = malloc( COMMAND_MESSAGE_LENGTH );
+  assert( request != NULL );
+  uint32_t xid = ( uint32_t ) rand();
+  unsigned int offset = 0;
+  do {
+    unsigned int n = n_updates - offset;
+    if ( n > max_updates ) {
+      n = max_updates;
+    }
+
+    size_t length = header_length + update_length * n;
+    memset( request, 0, length );
+    request->header.xid = xid;
+    request->header.type = type;
+    request->header.length = ( uint16_t ) length;
+    request->vni = vni;
+    request->flags = flags;
+    if ( offset + n < n_updates ) {
+      request->flags |= UPDATE_MORE;
+    }
+    request->n_updates = ( uint16_t ) n;
+    if ( n > 0 ) {
+      memcpy( ( char * ) request + header_length, ( const char * ) updates + update_length * offset,
+              update_length * n );
+    }
+
+    ssize_t retval = send_request( ( void * ) request, &length );
+    if ( retval <= 0 ) {
+      free( request );
+      *reason = OTHER_ERROR;
+      return false;
+    }
+    offset += n;
+  } while ( offset < n_updates );
+  free( request );
+
+  return recv_reply( xid, 0, reason );
+}
+
+
+bool
+update_fdb( uint32_t vni, fdb_update *updates, unsigned int n_updates, bool replace, uint8_t *reason ) {
+  return send_updates( UPDATE_FDB_REQUEST, vni, replace ? UPDATE_REPLACE : 0, updates, sizeof( fdb_update ), n_updates,
+                       offsetof( update_fdb_request, updates ), reason );
+}
+
+
+bool
+update_neighbors( uint32_t vni, neighbor_update *updates, unsigned int n_updates, uint8_t *reason ) {
+  return send_updates( UPDATE_NEIGHBORS_REQUEST, vni, 0, updates, sizeof( neighbor_update ), n_updates,
+                       offsetof( update_neighbors_request, updates ), reason );
+}
+
+
+// Passes records in replies to a handler instead of printing them. Used
+// by the client library, which converts them into its own structures.
+void
+set_vxlan_ctrl_record_handler( vxlan_ctrl_record_handler handler, void *user_data ) {
+  record_handler = handler;
+  record_handler_data = user_data;
+}
+
+
+// Returns true if the records of the last reply were cut at the requested
+// maximum.
+bool
+vxlan_ctrl_reply_truncated() {
+  return truncated;
+}
+
+
 bool
 init_vxlan_ctrl_client() {
   assert( fd < 0 );
@@ -545,7 +974,11 @@ bool
 finalize_vxlan_ctrl_client() {
   assert( fd >= 0 );
 
-  return finalize_ctrl_client( fd );
+  bool ret = finalize_ctrl_client( fd );
+  fd = -1;
+  connected = false;
+
+  return ret;
 }
 
 
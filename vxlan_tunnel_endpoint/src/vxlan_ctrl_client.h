@@ -27,18 +27,35 @@
 #include "vxlan_ctrl_common.h"
 
 
-bool add_instance( uint32_t vni, struct in_addr flooding_addr, uint16_t port, time_t aging_time, uint8_t *reason );
+typedef void ( *vxlan_ctrl_record_handler )( uint8_t type, const void *record, void *user_data );
+
+
+bool add_instance( uint32_t vni, struct in_addr flooding_addr, uint16_t port, time_t aging_time, int max_fdb_entries,
+                   bool learning, int flood_rate, bool neighbor_suppression, uint16_t vlan, uint16_t inner_vlan,
+                   uint8_t *reason );
 bool set_instance( uint32_t vni, uint16_t set_bitmap, struct in_addr flooding_addr, uint16_t port, time_t aging_time,
+                   int max_fdb_entries, bool learning, int flood_rate, bool neighbor_suppression,
                    uint8_t *reason );
 bool inactivate_instance( uint32_t vni, uint8_t *reason );
 bool activate_instance( uint32_t vni, uint8_t *reason );
 bool delete_instance( uint32_t vni, uint8_t *reason );
 bool show_global( uint16_t set_bitmap, uint8_t *reason );
-bool list_instances( uint32_t vni, uint16_t set_bitmap, uint8_t *reason );
-bool show_fdb( uint32_t vni, uint8_t *reason );
+bool list_instances( uint32_t vni, uint16_t set_bitmap, const uint32_t *cursor, uint32_t max_instances,
+                     uint8_t *reason );
+bool show_fdb( uint32_t vni, const struct ether_addr *eth_addr, const struct ether_addr *cursor, uint32_t max_entries,
+               uint8_t *reason );
 bool add_fdb_entry( uint32_t vni, struct ether_addr eth_addr, struct in_addr ip_addr, time_t aging_time,
                     uint8_t *reason );
 bool delete_fdb_entry( uint32_t vni, struct ether_addr eth_addr, uint8_t *reason );
+bool update_fdb( uint32_t vni, fdb_update *updates, unsigned int n_updates, bool replace, uint8_t *reason );
+bool add_remote( uint32_t vni, struct in_addr ip_addr, uint8_t *reason );
+bool delete_remote( uint32_t vni, struct in_addr ip_addr, uint8_t *reason );
+bool show_remotes( uint32_t vni, uint8_t *reason );
+bool update_neighbors( uint32_t vni, neighbor_update *updates, unsigned int n_updates, uint8_t *reason );
+bool dump_capture( const char *file, uint8_t *reason );
+bool start_replaying( uint8_t *reason );
+void set_vxlan_ctrl_record_handler( vxlan_ctrl_record_handler handler, void *user_data );
+bool vxlan_ctrl_reply_truncated();
 bool init_vxlan_ctrl_client();
 bool finalize_vxlan_ctrl_client();
 
@@ -23,8 +23,10 @@
 
 
 #include <netinet/in.h>
+#include <stddef.h>
 #include "ctrl_if.h"
 #include "fdb.h"
+#include "neighbor.h"
 #include "vxlan_common.h"
 #include "vxlan_instance.h"
 
@@ -53,6 +55,24 @@ enum {
   ADD_FDB_ENTRY_REPLY,
   DEL_FDB_ENTRY_REQUEST,
   DEL_FDB_ENTRY_REPLY,
+  UPDATE_FDB_REQUEST,
+  UPDATE_FDB_REPLY,
+  UPDATE_NEIGHBORS_REQUEST,
+  UPDATE_NEIGHBORS_REPLY,
+  ADD_REMOTE_REQUEST,
+  ADD_REMOTE_REPLY,
+  DEL_REMOTE_REQUEST,
+  DEL_REMOTE_REPLY,
+  SHOW_REMOTES_REQUEST,
+  SHOW_REMOTES_REPLY,
+  HANDOVER_REQUEST,
+  HANDOVER_REPLY,
+  HANDOVER_COMPLETE_REQUEST,
+  HANDOVER_COMPLETE_REPLY,
+  DUMP_CAPTURE_REQUEST,
+  DUMP_CAPTURE_REPLY,
+  START_REPLAY_REQUEST,
+  START_REPLAY_REPLY,
   MESSAGE_TYPE_MAX,
 };
 
@@ -64,8 +84,113 @@ enum {
   SET_AGING_TIME = 0x0010,
   SHOW_GLOBAL = 0x0020,
   DISABLE_HEADER = 0x0040,
+  SET_MAX_FDB_ENTRIES = 0x0080,
+  SET_LEARNING = 0x0100,
+  SET_FLOOD_RATE = 0x0200,
+  SHOW_STATS = 0x0400,
+  SET_NEIGHBOR_SUPPRESSION = 0x0800,
+  SET_VLAN = 0x1000,
+  SET_CURSOR = 0x2000,
+  SET_MAX_ENTRIES = 0x4000,
+  SET_REPLACE = 0x8000,
 };
 
+// Filters on list_instances and show_fdb. Records are returned in order of
+// VNI or MAC address so that a cursor can resume a truncated dump.
+enum {
+  DUMP_FILTER_ETH_ADDR = 0x01,
+  DUMP_CURSOR = 0x02,
+};
+
+// Records in a handover reply. Tap and socket descriptors ride on the
+// message that carries HANDOVER_SOCKETS or HANDOVER_INSTANCE.
+enum {
+  HANDOVER_SOCKETS,
+  HANDOVER_INSTANCE,
+  HANDOVER_FDB,
+  HANDOVER_NEIGHBORS,
+  HANDOVER_REMOTES,
+  HANDOVER_END,
+};
+
+enum {
+  HANDOVER_UDP_SOCK = 0x01,
+  HANDOVER_RAW_SOCK = 0x02,
+  HANDOVER_TRUNK_SOCK = 0x04,
+};
+
+#define HANDOVER_VERSION 1
+#define HANDOVER_TIMEOUT 30
+
+enum {
+  FDB_UPDATE_ADD = 0x01,
+  FDB_UPDATE_DELETE = 0x02,
+};
+
+// Flags on update requests. A batch may span several requests on a single
+// connection; all but the last carry UPDATE_MORE and the batch is applied
+// when the last one arrives. With UPDATE_REPLACE, static entries of the
+// instance that are not added by the batch are removed.
+enum {
+  UPDATE_REPLACE = 0x01,
+  UPDATE_MORE = 0x02,
+};
+
+
+typedef struct {
+  uint8_t op;
+  struct ether_addr eth_addr;
+  struct in_addr ip_addr;
+} fdb_update;
+
+typedef struct {
+  uint8_t op;
+  uint8_t family;
+  struct ether_addr eth_addr;
+  uint8_t addr[ NEIGHBOR_ADDR_LENGTH ];
+} neighbor_update;
+
+typedef struct {
+  struct ether_addr eth_addr;
+  uint8_t type;
+  struct in_addr ip_addr;
+  uint32_t last_seen;
+  uint32_t created_at;
+  uint32_t aging_time;
+} fdb_entry_record;
+
+typedef struct {
+  uint16_t port;
+  char trunk_name[ IFNAMSIZ ];
+  uint8_t sockets; // Descriptors follow in the order of the bits
+} handover_sockets;
+
+typedef struct {
+  struct in_addr addr;
+  uint16_t port;
+  uint16_t vlan;
+  uint16_t inner_vlan;
+  uint32_t aging_time;
+  int32_t max_fdb_entries;
+  int32_t flood_rate;
+  bool learning;
+  bool neighbor_suppression;
+  bool activated;
+} handover_instance;
+
+typedef struct {
+  struct ether_addr eth_addr;
+  uint8_t type;
+  struct in_addr ip_addr;
+  uint32_t aging_time;
+} handover_fdb_entry;
+
+typedef struct {
+  uint8_t addr[ NEIGHBOR_ADDR_LENGTH ];
+  struct ether_addr eth_addr;
+  uint8_t type;
+} handover_neighbor;
+
 
 typedef struct {
   command_request_header header;
@@ -90,15 +215,26 @@ typedef struct {
 typedef struct {
   command_request_header header;
   uint32_t vni;
+  uint8_t filter;
+  uint32_t cursor; // Instances with greater VNIs are returned
+  uint32_t max_instances; // 0 means no limit
 } list_instances_request;
 
 typedef struct {
   command_request_header header;
   uint32_t vni;
+  uint8_t filter;
+  struct ether_addr eth_addr;
+  struct ether_addr cursor; // Entries with greater MAC addresses are returned
+  uint32_t max_entries; // 0 means no limit
 } show_fdb_request;
 
-typedef show_fdb_request inactivate_instance_request;
-typedef show_fdb_request activate_instance_request;
+typedef struct {
+  command_request_header header;
+  uint32_t vni;
+} inactivate_instance_request;
+
+typedef inactivate_instance_request activate_instance_request;
 
 typedef struct {
   command_request_header header;
@@ -114,6 +250,49 @@ typedef struct {
   struct ether_addr eth_addr;
 } del_fdb_entry_request;
 
+typedef struct {
+  command_request_header header;
+  uint32_t vni;
+  struct in_addr ip_addr;
+} add_remote_request;
+
+typedef add_remote_request del_remote_request;
+typedef inactivate_instance_request show_remotes_request;
+
+typedef struct {
+  command_request_header header;
+  uint32_t vni;
+  uint8_t flags;
+  uint16_t n_updates;
+  fdb_update updates[ 0 ];
+} update_fdb_request;
+
+typedef struct {
+  command_request_header header;
+  uint32_t vni;
+  uint8_t flags;
+  uint16_t n_updates;
+  neighbor_update updates[ 0 ];
+} update_neighbors_request;
+
+typedef struct {
+  command_request_header header;
+  uint32_t version;
+} handover_request;
+
+typedef struct {
+  command_request_header header;
+} handover_complete_request;
+
+typedef struct {
+  command_request_header header;
+  char file[ CAPTURE_FILE_LENGTH ]; // Absolute path on the host of the daemon
+} dump_capture_request;
+
+typedef struct {
+  command_request_header header;
+} start_replay_request;
+
 typedef struct {
   command_reply_header header;
 } add_instance_reply;
@@ -141,12 +320,44 @@ typedef struct {
 
 typedef struct {
   command_reply_header header;
-  struct fdb_entry entries[ 0 ];
+  fdb_entry_record entries[ 0 ];
 } show_fdb_reply;
 
 typedef del_instance_reply add_fdb_entry_reply;
 typedef del_instance_reply del_fdb_entry_reply;
 
+typedef struct {
+  command_reply_header header;
+  uint32_t n_failed;
+} update_fdb_reply;
+
+typedef update_fdb_reply update_neighbors_reply;
+
+typedef del_instance_reply add_remote_reply;
+typedef del_instance_reply del_remote_reply;
+
+typedef struct {
+  command_reply_header header;
+  struct in_addr remotes[ 0 ];
+} show_remotes_reply;
+
+typedef struct {
+  command_reply_header header;
+  uint8_t record;
+  uint32_t vni;
+  uint16_t n_entries;
+  uint8_t entries[ 0 ];
+} handover_reply;
+
+typedef del_instance_reply handover_complete_reply;
+
+typedef struct {
+  command_reply_header header;
+  uint32_t n_packets;
+} dump_capture_reply;
+
+typedef del_instance_reply start_replay_reply;
+
 
 #endif // VXLAN_CTRL_COMMON_H
 
@@ -24,6 +24,7 @@
 #include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -36,24 +37,22 @@
 #include "fdb.h"
 #include "vxlan_instance.h"
 #include "vxlan_ctrl_server.h"
+#include "vxlan_handover.h"
 #include "linked_list.h"
 #include "log.h"
+#include "probes.h"
+#include "trunk.h"
 #include "wrapper.h"
 
 
 static struct vxlan *vxlan = NULL;
 static int listen_fd = -1;
+static char sock_file[ sizeof( ( ( struct sockaddr_un * ) NULL )->sun_path ) ];
 
 
 static ssize_t
 send_reply( int fd, void *reply, size_t *length ) {
-  return send_command( fd, reply, length );
-}
-
-
-static ssize_t
-recv_request( int fd, void *request, size_t *length ) {
-  return recv_command( fd, request, length );
+  return send_ctrl_reply( fd, reply, *length ) ? ( ssize_t ) *length : -1;
 }
 
 
@@ -70,21 +69,35 @@ add_instance( int fd, add_instance_request *request ) {
   reply.header.reason = SUCCEEDED;
 
   bool ret = true;
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, request->instance.vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( request->instance.vni ) );
   if ( instance != NULL ) {
     reply.header.reason = DUPLICATED_INSTANCE;
     ret = false;
   }
+  else if ( request->instance.vlan != 0 &&
+            !trunk_vlan_available( request->instance.vlan, request->instance.inner_vlan ) ) {
+    reply.header.reason = INVALID_ARGUMENT;
+    ret = false;
+  }
   else {
     instance = create_vxlan_instance( request->instance.vni,
                                       request->instance.addr.sin_addr,
                                       request->instance.port,
-                                      request->instance.aging_time );
-    if ( instance == NULL ) {
-      reply.header.reason = INVALID_ARGUMENT;
-      ret = false;
-    }
-    insert_hash( &vxlan->instances, instance, request->instance.vni );
+                                      request->instance.aging_time,
+                                      request->instance.max_fdb_entries,
+                                      request->instance.learning,
+                                      request->instance.flood_rate,
+                                      request->instance.neighbor_suppression,
+                                      request->instance.vlan,
+                                      request->instance.inner_vlan,
+                                      -1 );
+  }
+  if ( ret && instance == NULL ) {
+    reply.header.reason = INVALID_ARGUMENT;
+    ret = false;
+  }
+  else if ( ret ) {
+    insert_vni_table( vxlan->instances, get_vni_value( request->instance.vni ), instance );
     start_vxlan_instance( instance );
     vxlan->n_instances++;
 
@@ -120,7 +133,7 @@ set_instance( int fd, set_instance_request *request ) {
   reply.header.reason = SUCCEEDED;
 
   bool ret = true;
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, request->instance.vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( request->instance.vni ) );
   if ( instance != NULL ) {
     if ( request->set_bitmap & SET_IP_ADDR ) {
       ret &= set_vxlan_instance_flooding_addr( request->instance.vni, request->instance.addr.sin_addr );
@@ -131,6 +144,18 @@ set_instance( int fd, set_instance_request *request ) {
     if ( ret && ( request->set_bitmap & SET_AGING_TIME ) != 0 ) {
       ret &= set_vxlan_instance_aging_time( request->instance.vni, request->instance.aging_time );
     }
+    if ( ret && ( request->set_bitmap & SET_MAX_FDB_ENTRIES ) != 0 ) {
+      ret &= set_vxlan_instance_max_fdb_entries( request->instance.vni, request->instance.max_fdb_entries );
+    }
+    if ( ret && ( request->set_bitmap & SET_LEARNING ) != 0 ) {
+      ret &= set_vxlan_instance_learning( request->instance.vni, request->instance.learning );
+    }
+    if ( ret && ( request->set_bitmap & SET_FLOOD_RATE ) != 0 ) {
+      ret &= set_vxlan_instance_flood_rate( request->instance.vni, request->instance.flood_rate );
+    }
+    if ( ret && ( request->set_bitmap & SET_NEIGHBOR_SUPPRESSION ) != 0 ) {
+      ret &= set_vxlan_instance_neighbor_suppression( request->instance.vni, request->instance.neighbor_suppression );
+    }
     if ( !ret ) {
       reply.header.reason = INVALID_ARGUMENT;
     }
@@ -170,7 +195,7 @@ inactivate_instance( int fd, inactivate_instance_request *request ) {
   vni[ 2 ] = ( uint8_t ) ( request->vni & 0xff );
 
   bool ret = true;
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
   if ( instance == NULL ) {
     reply.header.reason = INSTANCE_NOT_FOUND;
     ret = false;
@@ -216,7 +241,7 @@ activate_instance( int fd, activate_instance_request *request ) {
   vni[ 2 ] = ( uint8_t ) ( request->vni & 0xff );
 
   bool ret = true;
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
   if ( instance == NULL ) {
     reply.header.reason = INSTANCE_NOT_FOUND;
     ret = false;
@@ -262,7 +287,7 @@ delete_instance( int fd, del_instance_request *request ) {
   vni[ 2 ] = ( uint8_t ) ( request->vni & 0xff );
 
   bool ret = true;
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
   if ( instance == NULL ) {
     reply.header.reason = INSTANCE_NOT_FOUND;
     ret = false;
@@ -311,12 +336,20 @@ show_global( int fd, show_global_request *request ) {
 }
 
 
+static int
+compare_instances( const void *x, const void *y ) {
+  uint32_t a = get_vni_value( ( *( struct vxlan_instance * const * ) x )->vni );
+  uint32_t b = get_vni_value( ( *( struct vxlan_instance * const * ) y )->vni );
+
+  return a < b ? -1 : ( a > b ? 1 : 0 );
+}
+
+
 static void
 list_instances( int fd, list_instances_request *request ) {
   assert( fd >= 0 );
   assert( request != NULL );
 
-  bool ret = true;
   int n_instances = 0;
   struct vxlan_instance **instances = NULL;
   if ( request->vni == 0xffffffff ) {
@@ -326,58 +359,67 @@ list_instances( int fd, list_instances_request *request ) {
     vni[ 0 ] = ( uint8_t ) ( ( request->vni >> 16 ) & 0xff );
     vni[ 1 ] = ( uint8_t ) ( ( request->vni >> 8 ) & 0xff );
     vni[ 2 ] = ( uint8_t ) ( request->vni & 0xff );
-    struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+    struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
     if ( instance ) {
       n_instances = 1;
       instances = malloc( sizeof( struct vxlan_instance * ) );
       *instances = instance;
     }
   }
-  if ( instances == NULL || n_instances == 0 ) {
-    size_t length = offsetof( list_instances_reply, instances );
-    list_instances_reply *reply = malloc( length );
-    memset( reply, 0, length );
-    reply->header.xid = request->header.xid;
-    reply->header.type = LIST_INSTANCES_REPLY;
-    if ( ret ) {
-      reply->header.status = STATUS_OK;
-      reply->header.reason = SUCCEEDED;
+  if ( n_instances > 1 ) {
+    qsort( instances, ( size_t ) n_instances, sizeof( struct vxlan_instance * ), compare_instances );
+  }
+
+  struct vxlan_instance *records = NULL;
+  int n_records = 0;
+  bool truncated = false;
+  if ( n_instances > 0 ) {
+    records = malloc( sizeof( struct vxlan_instance ) * ( size_t ) n_instances );
+    assert( records != NULL );
+  }
+  for ( int i = 0; i < n_instances; i++ ) {
+    if ( ( request->filter & DUMP_CURSOR ) != 0 && get_vni_value( instances[ i ]->vni ) <= request->cursor ) {
+      continue;
     }
-    else {
-      reply->header.status = STATUS_NG;
-      reply->header.reason = OTHER_ERROR;
+    if ( request->max_instances > 0 && n_records == ( int ) request->max_instances ) {
+      truncated = true;
+      break;
     }
-    reply->header.flags = FLAG_NONE;
-    reply->header.length = ( uint16_t ) length;
-    send_reply( fd, ( void * ) reply, &length );
-    if ( instances != NULL ) {
-      free( instances );
+    memcpy( &records[ n_records ], instances[ i ], sizeof( struct vxlan_instance ) );
+    if ( instances[ i ]->fdb != NULL ) {
+      get_fdb_stats( instances[ i ]->fdb, &records[ n_records ].fdb_stats );
     }
-    free( reply );
-    return;
+#ifdef LATENCY_STATS
+    summarize_latency( &instances[ i ]->latency->encap, &records[ n_records ].stats.encap_latency );
+    summarize_latency( &instances[ i ]->latency->decap, &records[ n_records ].stats.decap_latency );
+#endif
+    n_records++;
   }
 
-  for ( int n = 0; n < n_instances; n++ ) {
-    size_t length = offsetof( list_instances_reply, instances ) + sizeof( struct vxlan_instance );
-    list_instances_reply *reply = malloc( length );
-    memset( reply, 0, length );
-    reply->header.xid = request->header.xid;
-    reply->header.type = LIST_INSTANCES_REPLY;
-    reply->header.status = STATUS_OK;
-    reply->header.reason = SUCCEEDED;
-    reply->header.flags = ( n == ( n_instances - 1 ) ) ? FLAG_NONE : FLAG_MORE;
-    reply->header.length = ( uint16_t ) length;
-    memcpy( reply->instances, instances[ n ], sizeof( struct vxlan_instance ) );
-    send_reply( fd, ( void * ) reply, &length );
-    free( reply );
-  }
+  list_instances_reply reply;
+  memset( &reply, 0, sizeof( reply ) );
+  reply.header.xid = request->header.xid;
+  reply.header.type = LIST_INSTANCES_REPLY;
+  reply.header.status = STATUS_OK;
+  reply.header.reason = SUCCEEDED;
+  send_packed_replies( fd, &reply, offsetof( list_instances_reply, instances ), records,
+                       sizeof( struct vxlan_instance ), n_records, truncated ? FLAG_TRUNCATED : FLAG_NONE );
 
+  if ( records != NULL ) {
+    free( records );
+  }
   if ( instances != NULL ) {
     free( instances );
   }
 }
 
 
+static int
+compare_fdb_entries( const void *x, const void *y ) {
+  return memcmp( ( ( const struct fdb_entry * ) x )->mac, ( ( const struct fdb_entry * ) y )->mac, ETH_ALEN );
+}
+
+
 static void
 show_fdb( int fd, show_fdb_request *request ) {
   assert( fd >= 0 );
@@ -389,63 +431,68 @@ show_fdb( int fd, show_fdb_request *request ) {
   vni[ 1 ] = ( uint8_t ) ( ( request->vni >> 8 ) & 0xff );
   vni[ 2 ] = ( uint8_t ) ( request->vni & 0xff );
 
-  bool ret = true;
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
-  uint8_t reason = SUCCEEDED;
-  list *entries = NULL;
-  if ( instance != NULL ) {
-    if ( instance->fdb != NULL ) {
-      entries = get_fdb_entries( instance->fdb );
-    }
-    else {
-      reason = OTHER_ERROR;
-      ret = false;
-    }
+  show_fdb_reply reply;
+  memset( &reply, 0, sizeof( reply ) );
+  reply.header.xid = request->header.xid;
+  reply.header.type = SHOW_FDB_REPLY;
+  reply.header.status = STATUS_OK;
+  reply.header.reason = SUCCEEDED;
+
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance == NULL ) {
+    reply.header.status = STATUS_NG;
+    reply.header.reason = INSTANCE_NOT_FOUND;
+    send_packed_replies( fd, &reply, offsetof( show_fdb_reply, entries ), NULL, sizeof( fdb_entry_record ), 0,
+                         FLAG_NONE );
+    return;
   }
-  else {
-    reason = INSTANCE_NOT_FOUND;
-    ret = false;
+
+  // Tables released while idle hold no entries.
+  int n_entries = 0;
+  struct fdb_entry *entries = instance->fdb != NULL ? get_fdb_entries( instance->fdb, &n_entries ) : NULL;
+  if ( n_entries > 1 ) {
+    qsort( entries, ( size_t ) n_entries, sizeof( struct fdb_entry ), compare_fdb_entries );
   }
-  if ( !ret || entries == NULL || ( entries != NULL && entries->head == NULL ) ) {
-    size_t length = offsetof( show_fdb_reply, entries );
-    show_fdb_reply *reply = malloc( length );
-    memset( reply, 0, length );
-    reply->header.xid = request->header.xid;
-    reply->header.type = SHOW_FDB_REPLY;
-    if ( ret ) {
-      reply->header.status = STATUS_OK;
+
+  fdb_entry_record *records = NULL;
+  int n_records = 0;
+  bool truncated = false;
+  if ( n_entries > 0 ) {
+    records = malloc( sizeof( fdb_entry_record ) * ( size_t ) n_entries );
+    assert( records != NULL );
+    memset( records, 0, sizeof( fdb_entry_record ) * ( size_t ) n_entries );
+  }
+  for ( int i = 0; i < n_entries; i++ ) {
+    struct fdb_entry *entry = &entries[ i ];
+    if ( ( request->filter & DUMP_FILTER_ETH_ADDR ) != 0 &&
+         memcmp( entry->mac, request->eth_addr.ether_addr_octet, ETH_ALEN ) != 0 ) {
+      continue;
     }
-    else {
-      reply->header.status = STATUS_NG;
+    if ( ( request->filter & DUMP_CURSOR ) != 0 &&
+         memcmp( entry->mac, request->cursor.ether_addr_octet, ETH_ALEN ) <= 0 ) {
+      continue;
     }
-    reply->header.reason = reason;
-    reply->header.flags = FLAG_NONE;
-    reply->header.length = ( uint16_t ) length;
-    send_reply( fd, ( void * ) reply, &length );
-    if ( entries != NULL ) {
-      delete_list( entries );
+    if ( request->max_entries > 0 && n_records == ( int ) request->max_entries ) {
+      truncated = true;
+      break;
     }
-    free( reply );
-    return;
+    fdb_entry_record *record = &records[ n_records++ ];
+    memcpy( record->eth_addr.ether_addr_octet, entry->mac, ETH_ALEN );
+    record->type = entry->type;
+    record->ip_addr = entry->vtep_addr;
+    record->last_seen = entry->last_seen;
+    record->created_at = entry->created_at;
+    record->aging_time = entry->aging_time;
   }
 
-  for ( list_element *e = entries->head; e != NULL; e = e->next ) {
-    size_t length = offsetof( show_fdb_reply, entries ) + sizeof( struct fdb_entry );
-    show_fdb_reply *reply = malloc( length );
-    memset( reply, 0, length );
-    reply->header.xid = request->header.xid;
-    reply->header.type = SHOW_FDB_REPLY;
-    reply->header.status = STATUS_OK;
-    reply->header.reason = SUCCEEDED;
-    reply->header.flags = ( e->next == NULL ) ? FLAG_NONE : FLAG_MORE;
-    reply->header.length = ( uint16_t ) length;
-    memcpy( reply->entries, e->data, sizeof( struct fdb_entry ) );
-    send_reply( fd, ( void * ) reply, &length );
-    free( reply );
-  }
+  send_packed_replies( fd, &reply, offsetof( show_fdb_reply, entries ), records, sizeof( fdb_entry_record ),
+                       n_records, truncated ? FLAG_TRUNCATED : FLAG_NONE );
 
+  if ( records != NULL ) {
+    free( records );
+  }
   if ( entries != NULL ) {
-    delete_list_totally( entries );
+    free( entries );
   }
 }
 
@@ -469,12 +516,14 @@ add_fdb_entry( int fd, add_fdb_entry_request *request ) {
   vni[ 2 ] = ( uint8_t ) ( request->vni & 0xff );
 
   bool ret = true;
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
   if ( instance == NULL ) {
     reply.header.reason = INSTANCE_NOT_FOUND;
     ret = false;
   }
   else {
+    // Tables of an instance which has not forwarded any frame yet are allocated on demand.
+    allocate_vxlan_instance_tables( instance );
     if ( instance->fdb != NULL ) {
       ret = fdb_add_static_entry( instance->fdb, request->eth_addr, request->ip_addr, request->aging_time );
       if ( ret ) {
@@ -522,12 +571,14 @@ delete_fdb_entry( int fd, del_fdb_entry_request *request ) {
   vni[ 2 ] = ( uint8_t ) ( request->vni & 0xff );
 
   bool ret = true;
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
   if ( instance == NULL ) {
     reply.header.reason = INSTANCE_NOT_FOUND;
     ret = false;
   }
   else {
+    // Tables of an instance which has not forwarded any frame yet are allocated on demand.
+    allocate_vxlan_instance_tables( instance );
     if ( instance->fdb != NULL ) {
       uint8_t zero[ ETH_ALEN ] = { 0, 0, 0, 0, 0, 0 };
       if ( memcmp( request->eth_addr.ether_addr_octet, zero, ETH_ALEN ) != 0 ) {
@@ -569,6 +620,464 @@ delete_fdb_entry( int fd, del_fdb_entry_request *request ) {
 }
 
 
+// Gathers the updates of a batch that may span several requests on the
+// connection. Update requests share the layout of update_fdb_request. All
+// but the last request carry UPDATE_MORE and are staged until the last one
+// arrives. Returns CTRL_BATCH_COMPLETE with all updates of the batch, which
+// the caller frees.
+static int
+collect_updates( int fd, update_fdb_request *request, size_t length, size_t header_length, size_t update_length,
+                 void **updates, unsigned int *n_updates ) {
+  assert( fd >= 0 );
+  assert( request != NULL );
+  assert( updates != NULL );
+  assert( n_updates != NULL );
+
+  const void *records = NULL;
+  if ( length >= header_length && request->n_updates <= ( length - header_length ) / update_length ) {
+    records = ( char * ) request + header_length;
+  }
+  size_t batch_length = 0;
+  int ret = collect_ctrl_batch( fd, request->header.xid, ( request->flags & UPDATE_MORE ) != 0, records,
+                                records != NULL ? update_length * request->n_updates : 0, updates, &batch_length );
+  *n_updates = ( unsigned int ) ( batch_length / update_length );
+
+  return ret;
+}
+
+
+// Applies a batch of forwarding database updates. Entries that already point
+// at the requested address are left untouched, so that frames to them are
+// never flooded while a batch is applied. With replace, static entries that
+// the batch does not add are removed at the end.
+static uint32_t
+apply_fdb_updates( struct fdb *fdb, fdb_update *updates, unsigned int n_updates, bool replace ) {
+  assert( fdb != NULL );
+  assert( updates != NULL || n_updates == 0 );
+
+  int n_entries = 0;
+  struct fdb_entry *entries = get_fdb_entries( fdb, &n_entries );
+  if ( n_entries > 1 ) {
+    qsort( entries, ( size_t ) n_entries, sizeof( struct fdb_entry ), compare_fdb_entries );
+  }
+  bool *added = NULL;
+  if ( replace && n_entries > 0 ) {
+    added = calloc( ( size_t ) n_entries, sizeof( bool ) );
+    assert( added != NULL );
+  }
+
+  uint32_t n_failed = 0;
+  for ( unsigned int i = 0; i < n_updates; i++ ) {
+    fdb_update *update = &updates[ i ];
+    struct fdb_entry key;
+    memcpy( key.mac, update->eth_addr.ether_addr_octet, ETH_ALEN );
+    struct fdb_entry *entry = NULL;
+    if ( n_entries > 0 ) {
+      entry = bsearch( &key, entries, ( size_t ) n_entries, sizeof( struct fdb_entry ), compare_fdb_entries );
+    }
+    // The snapshot follows the batch so that later updates of an address see earlier ones.
+    switch ( update->op ) {
+      case FDB_UPDATE_ADD:
+        if ( entry != NULL && added != NULL ) {
+          added[ entry - entries ] = true;
+        }
+        if ( entry != NULL && entry->type == FDB_ENTRY_TYPE_STATIC && entry->aging_time == 0 &&
+             entry->vtep_addr.s_addr == update->ip_addr.s_addr ) {
+          break;
+        }
+        if ( !fdb_add_static_entry( fdb, update->eth_addr, update->ip_addr, 0 ) ) {
+          n_failed++;
+          break;
+        }
+        if ( entry != NULL ) {
+          entry->type = FDB_ENTRY_TYPE_STATIC;
+          entry->aging_time = 0;
+          entry->vtep_addr = update->ip_addr;
+        }
+        break;
+
+      case FDB_UPDATE_DELETE:
+        // Deleting an absent entry is not an error so that updates can be replayed.
+        fdb_delete_entry( fdb, update->eth_addr );
+        if ( entry != NULL ) {
+          entry->type = FDB_ENTRY_TYPE_DYNAMIC;
+          if ( added != NULL ) {
+            added[ entry - entries ] = false;
+          }
+        }
+        break;
+
+      default:
+        n_failed++;
+        break;
+    }
+  }
+
+  if ( added != NULL ) {
+    for ( int i = 0; i < n_entries; i++ ) {
+      if ( !added[ i ] && entries[ i ].type == FDB_ENTRY_TYPE_STATIC ) {
+        struct ether_addr eth_addr;
+        memcpy( eth_addr.ether_addr_octet, entries[ i ].mac, ETH_ALEN );
+        fdb_delete_entry( fdb, eth_addr );
+      }
+    }
+    free( added );
+  }
+  if ( entries != NULL ) {
+    free( entries );
+  }
+
+  return n_failed;
+}
+
+
+static void
+update_fdb( int fd, update_fdb_request *request, size_t length ) {
+  assert( fd >= 0 );
+  assert( vxlan != NULL );
+  assert( request != NULL );
+
+  update_fdb_reply reply;
+  size_t reply_length = sizeof( update_fdb_reply );
+  memset( &reply, 0, reply_length );
+  reply.header.xid = request->header.xid;
+  reply.header.type = UPDATE_FDB_REPLY;
+  reply.header.reason = SUCCEEDED;
+
+  uint32_t vni_value = request->vni;
+  uint8_t vni[ VXLAN_VNISIZE ];
+  vni[ 0 ] = ( uint8_t ) ( ( vni_value >> 16 ) & 0xff );
+  vni[ 1 ] = ( uint8_t ) ( ( vni_value >> 8 ) & 0xff );
+  vni[ 2 ] = ( uint8_t ) ( vni_value & 0xff );
+
+  void *updates = NULL;
+  unsigned int n_updates = 0;
+  uint8_t flags = request->flags;
+  int collected = collect_updates( fd, request, length, offsetof( update_fdb_request, updates ), sizeof( fdb_update ),
+                                   &updates, &n_updates );
+  if ( collected == CTRL_BATCH_STAGED ) {
+    return;
+  }
+  bool ret = collected == CTRL_BATCH_COMPLETE;
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance != NULL ) {
+    allocate_vxlan_instance_tables( instance );
+  }
+  if ( !ret ) {
+    reply.header.reason = INVALID_ARGUMENT;
+  }
+  else if ( instance == NULL ) {
+    reply.header.reason = INSTANCE_NOT_FOUND;
+    ret = false;
+  }
+  else if ( instance->fdb == NULL ) {
+    reply.header.reason = OTHER_ERROR;
+    ret = false;
+  }
+  else {
+    reply.n_failed = apply_fdb_updates( instance->fdb, updates, n_updates, ( flags & UPDATE_REPLACE ) != 0 );
+    debug( "%u fdb updates are applied ( vni = %#x, replace = %s, failed = %u ).",
+           n_updates, vni_value, ( flags & UPDATE_REPLACE ) != 0 ? "true" : "false", reply.n_failed );
+    if ( reply.n_failed > 0 ) {
+      reply.header.reason = OTHER_ERROR;
+      ret = false;
+    }
+  }
+  if ( updates != NULL ) {
+    free( updates );
+  }
+
+  if ( ret ) {
+    reply.header.status = STATUS_OK;
+  }
+  else {
+    reply.header.status = STATUS_NG;
+  }
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) reply_length;
+  send_reply( fd, ( void * ) &reply, &reply_length );
+}
+
+
+static void
+update_neighbors( int fd, update_neighbors_request *request, size_t length ) {
+  assert( fd >= 0 );
+  assert( vxlan != NULL );
+  assert( request != NULL );
+
+  update_neighbors_reply reply;
+  size_t reply_length = sizeof( update_neighbors_reply );
+  memset( &reply, 0, reply_length );
+  reply.header.xid = request->header.xid;
+  reply.header.type = UPDATE_NEIGHBORS_REPLY;
+  reply.header.reason = SUCCEEDED;
+
+  uint32_t vni_value = request->vni;
+  uint8_t vni[ VXLAN_VNISIZE ];
+  vni[ 0 ] = ( uint8_t ) ( ( vni_value >> 16 ) & 0xff );
+  vni[ 1 ] = ( uint8_t ) ( ( vni_value >> 8 ) & 0xff );
+  vni[ 2 ] = ( uint8_t ) ( vni_value & 0xff );
+
+  void *collected = NULL;
+  unsigned int n_updates = 0;
+  uint8_t flags = request->flags;
+  int result = collect_updates( fd, ( update_fdb_request * ) request, length,
+                                offsetof( update_neighbors_request, updates ), sizeof( neighbor_update ),
+                                &collected, &n_updates );
+  if ( result == CTRL_BATCH_STAGED ) {
+    return;
+  }
+  bool ret = result == CTRL_BATCH_COMPLETE;
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance != NULL ) {
+    allocate_vxlan_instance_tables( instance );
+  }
+  if ( !ret || ( flags & UPDATE_REPLACE ) != 0 ) {
+    reply.header.reason = INVALID_ARGUMENT;
+    ret = false;
+  }
+  else if ( instance == NULL ) {
+    reply.header.reason = INSTANCE_NOT_FOUND;
+    ret = false;
+  }
+  else if ( instance->neighbors == NULL ) {
+    reply.header.reason = OTHER_ERROR;
+    ret = false;
+  }
+  else {
+    neighbor_update *updates = collected;
+    for ( unsigned int i = 0; i < n_updates; i++ ) {
+      neighbor_update *update = &updates[ i ];
+      if ( update->family != AF_INET && update->family != AF_INET6 ) {
+        reply.n_failed++;
+        continue;
+      }
+      switch ( update->op ) {
+        case FDB_UPDATE_ADD:
+          if ( !add_neighbor( instance->neighbors, update->family, update->addr, update->eth_addr ) ) {
+            reply.n_failed++;
+          }
+          break;
+
+        case FDB_UPDATE_DELETE:
+          delete_neighbor( instance->neighbors, update->family, update->addr );
+          break;
+
+        default:
+          reply.n_failed++;
+          break;
+      }
+    }
+    debug( "%u neighbor updates are applied ( vni = %#x, failed = %u ).", n_updates, vni_value, reply.n_failed );
+    if ( reply.n_failed > 0 ) {
+      reply.header.reason = OTHER_ERROR;
+      ret = false;
+    }
+  }
+  if ( collected != NULL ) {
+    free( collected );
+  }
+
+  if ( ret ) {
+    reply.header.status = STATUS_OK;
+  }
+  else {
+    reply.header.status = STATUS_NG;
+  }
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) reply_length;
+  send_reply( fd, ( void * ) &reply, &reply_length );
+}
+
+
+static void
+add_remote( int fd, add_remote_request *request ) {
+  assert( fd >= 0 );
+  assert( vxlan != NULL );
+  assert( request != NULL );
+
+  add_remote_reply reply;
+  size_t length = sizeof( add_remote_reply );
+  memset( &reply, 0, length );
+  reply.header.xid = request->header.xid;
+  reply.header.type = ADD_REMOTE_REPLY;
+  reply.header.reason = SUCCEEDED;
+
+  uint8_t vni[ VXLAN_VNISIZE ];
+  vni[ 0 ] = ( uint8_t ) ( ( request->vni >> 16 ) & 0xff );
+  vni[ 1 ] = ( uint8_t ) ( ( request->vni >> 8 ) & 0xff );
+  vni[ 2 ] = ( uint8_t ) ( request->vni & 0xff );
+
+  bool ret = true;
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance == NULL ) {
+    reply.header.reason = INSTANCE_NOT_FOUND;
+    ret = false;
+  }
+  else {
+    ret = add_vxlan_instance_remote( vni, request->ip_addr );
+    if ( ret ) {
+      debug( "A remote end point is added ( vni = %#x ).", request->vni );
+    }
+    else {
+      reply.header.reason = INVALID_ARGUMENT;
+    }
+  }
+
+  if ( ret ) {
+    reply.header.status = STATUS_OK;
+  }
+  else {
+    reply.header.status = STATUS_NG;
+  }
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) length;
+  send_reply( fd, ( void * ) &reply, &length );
+}
+
+
+static void
+delete_remote( int fd, del_remote_request *request ) {
+  assert( fd >= 0 );
+  assert( vxlan != NULL );
+  assert( request != NULL );
+
+  del_remote_reply reply;
+  size_t length = sizeof( del_remote_reply );
+  memset( &reply, 0, length );
+  reply.header.xid = request->header.xid;
+  reply.header.type = DEL_REMOTE_REPLY;
+  reply.header.reason = SUCCEEDED;
+
+  uint8_t vni[ VXLAN_VNISIZE ];
+  vni[ 0 ] = ( uint8_t ) ( ( request->vni >> 16 ) & 0xff );
+  vni[ 1 ] = ( uint8_t ) ( ( request->vni >> 8 ) & 0xff );
+  vni[ 2 ] = ( uint8_t ) ( request->vni & 0xff );
+
+  bool ret = true;
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance == NULL ) {
+    reply.header.reason = INSTANCE_NOT_FOUND;
+    ret = false;
+  }
+  else {
+    ret = delete_vxlan_instance_remote( vni, request->ip_addr );
+    if ( ret ) {
+      debug( "Remote end points are deleted ( vni = %#x ).", request->vni );
+    }
+    else {
+      reply.header.reason = OTHER_ERROR;
+    }
+  }
+
+  if ( ret ) {
+    reply.header.status = STATUS_OK;
+  }
+  else {
+    reply.header.status = STATUS_NG;
+  }
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) length;
+  send_reply( fd, ( void * ) &reply, &length );
+}
+
+
+static void
+show_remotes( int fd, show_remotes_request *request ) {
+  assert( fd >= 0 );
+  assert( vxlan != NULL );
+  assert( request != NULL );
+
+  uint8_t vni[ VXLAN_VNISIZE ];
+  vni[ 0 ] = ( uint8_t ) ( ( request->vni >> 16 ) & 0xff );
+  vni[ 1 ] = ( uint8_t ) ( ( request->vni >> 8 ) & 0xff );
+  vni[ 2 ] = ( uint8_t ) ( request->vni & 0xff );
+
+  struct vxlan_remote_list *list = get_vxlan_instance_remotes( vni );
+
+  show_remotes_reply reply;
+  memset( &reply, 0, sizeof( reply ) );
+  reply.header.xid = request->header.xid;
+  reply.header.type = SHOW_REMOTES_REPLY;
+  if ( list != NULL ) {
+    reply.header.status = STATUS_OK;
+    reply.header.reason = SUCCEEDED;
+  }
+  else {
+    reply.header.status = STATUS_NG;
+    reply.header.reason = INSTANCE_NOT_FOUND;
+  }
+  send_packed_replies( fd, &reply, offsetof( show_remotes_reply, remotes ), list != NULL ? list->remotes : NULL,
+                       sizeof( struct in_addr ), list != NULL ? list->n_remotes : 0, FLAG_NONE );
+
+  if ( list != NULL ) {
+    free( list );
+  }
+}
+
+
+static void
+dump_capture( int fd, dump_capture_request *request ) {
+  assert( fd >= 0 );
+  assert( vxlan != NULL );
+  assert( request != NULL );
+
+  dump_capture_reply reply;
+  size_t length = sizeof( dump_capture_reply );
+  memset( &reply, 0, length );
+  reply.header.xid = request->header.xid;
+  reply.header.type = DUMP_CAPTURE_REPLY;
+  reply.header.status = STATUS_NG;
+  reply.header.reason = SUCCEEDED;
+
+  request->file[ CAPTURE_FILE_LENGTH - 1 ] = '\0';
+  if ( vxlan->capture == NULL ) {
+    reply.header.reason = CAPTURE_DISABLED;
+  }
+  else if ( request->file[ 0 ] != '/' ) {
+    reply.header.reason = INVALID_ARGUMENT;
+  }
+  else if ( !dump_capture_ring( vxlan->capture, request->file, "vxland", &reply.n_packets ) ) {
+    reply.header.reason = OTHER_ERROR;
+  }
+  else {
+    reply.header.status = STATUS_OK;
+    info( "%u packets are written to %s.", reply.n_packets, request->file );
+  }
+
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) length;
+  send_reply( fd, ( void * ) &reply, &length );
+}
+
+
+static void
+start_replaying( int fd, start_replay_request *request ) {
+  assert( fd >= 0 );
+  assert( vxlan != NULL );
+  assert( request != NULL );
+
+  start_replay_reply reply;
+  size_t length = sizeof( start_replay_reply );
+  memset( &reply, 0, length );
+  reply.header.xid = request->header.xid;
+  reply.header.type = START_REPLAY_REPLY;
+  if ( vxlan->replay != NULL && start_replay( vxlan->replay ) ) {
+    reply.header.status = STATUS_OK;
+    reply.header.reason = SUCCEEDED;
+  }
+  else {
+    // Not in replay mode or a replay is in progress
+    reply.header.status = STATUS_NG;
+    reply.header.reason = REPLAY_UNAVAILABLE;
+  }
+
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) length;
+  send_reply( fd, ( void * ) &reply, &length );
+}
+
+
 static bool
 handle_request( int fd, void *request, size_t *length ) {
   assert( fd >= 0 );
@@ -578,6 +1087,7 @@ handle_request( int fd, void *request, size_t *length ) {
 
   command_request_header *header = request;
   uint8_t type = header->type;
+  PROBE3( vxland, ctrl_request, type, header->xid, *length );
   switch ( type ) {
     case ADD_INSTANCE_REQUEST:
       add_instance( fd, request );
@@ -619,11 +1129,46 @@ handle_request( int fd, void *request, size_t *length ) {
       delete_fdb_entry( fd, request );
       break;
 
+    case UPDATE_FDB_REQUEST:
+      update_fdb( fd, request, *length );
+      break;
+
+    case UPDATE_NEIGHBORS_REQUEST:
+      update_neighbors( fd, request, *length );
+      break;
+
+    case ADD_REMOTE_REQUEST:
+      add_remote( fd, request );
+      break;
+
+    case DEL_REMOTE_REQUEST:
+      delete_remote( fd, request );
+      break;
+
+    case SHOW_REMOTES_REQUEST:
+      show_remotes( fd, request );
+      break;
+
+    case HANDOVER_REQUEST:
+      hand_over_vxlan( fd, request, vxlan );
+      break;
+
+    case DUMP_CAPTURE_REQUEST:
+      dump_capture( fd, request );
+      break;
+
+    case START_REPLAY_REQUEST:
+      start_replaying( fd, request );
+      break;
+
     default:
       error( "Unhandled message type ( %#x ).", type );
+      PROBE2( vxland, ctrl_request_done, type, header->xid );
       return false;
   }
 
+  PROBE2( vxland, ctrl_request_done, type, header->xid );
+
   return true;
 }
 
@@ -633,50 +1178,9 @@ run_vxlan_ctrl_server( void *param ) {
   UNUSED( param );
   assert( listen_fd >= 0 );
 
-  uint8_t request[ COMMAND_MESSAGE_LENGTH ];
-  size_t length = COMMAND_MESSAGE_LENGTH;
-
-  char buf[ 256 ];
-
-  while ( running ) {
-    fd_set fds;
-    FD_ZERO( &fds );
-    FD_SET( listen_fd, &fds );
-    struct timespec timeout = { 1, 0 };
-    int ret = pselect( listen_fd + 1, &fds, NULL, NULL, &timeout, NULL );
-    if ( ret < 0 ) {
-      if ( errno == EINTR ) {
-        continue;
-      }
-      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-      error( "Failed to select ( listen_fd = %d, errno = %s [%d] ).", listen_fd, error_string, errno );
-      break;
-    }
-    else if ( ret == 0 ) {
-      continue;
-    }
-
-    if ( !FD_ISSET( listen_fd, &fds ) ) {
-      continue;
-    }
-
-    int fd = accept( listen_fd, NULL, NULL );
-    if ( fd < 0 ) {
-      if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) {
-        continue;
-      }
-      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
-      error( "Failed to accept ( listen_fd = %d, errno = %s [%d] ).", listen_fd, error_string, errno );
-      break;
-    }
-    memset( &request, 0, ( size_t ) sizeof( request ) );
-    length = COMMAND_MESSAGE_LENGTH;
-    ssize_t retval = recv_request( fd, request, &length );
-    if ( retval > 0 ) {
-      handle_request( fd, ( void * ) request, &length );
-    }
-    close( fd );
-  }
+  // Requests are never served concurrently with hibernation, so that handlers
+  // may use tables of instances without taking a lock.
+  run_ctrl_server( listen_fd, handle_request, hibernate_idle_vxlan_instances );
 
   return NULL;
 }
@@ -699,8 +1203,7 @@ start_vxlan_ctrl_server( ) {
     critical( "Failed to create a control thread." );
     return false;
   }
-
-  pthread_create( &vxlan->control_tid, &attr, run_vxlan_ctrl_server, NULL );
+  pthread_setname_np( vxlan->control_tid, "ctrl_server" );
 
   return true;
 }
@@ -713,7 +1216,31 @@ init_vxlan_ctrl_server( struct vxlan *_vxlan ){
 
   vxlan = _vxlan;
 
-  return init_ctrl_server( &listen_fd, CTRL_SERVER_SOCK_FILE );
+  // The running process keeps CTRL_SERVER_SOCK_FILE until the takeover completes.
+  if ( vxlan->handover ) {
+    snprintf( sock_file, sizeof( sock_file ), "%s.%u", CTRL_SERVER_SOCK_FILE, getpid() );
+  }
+  else {
+    snprintf( sock_file, sizeof( sock_file ), "%s", CTRL_SERVER_SOCK_FILE );
+  }
+
+  return init_ctrl_server( &listen_fd, sock_file );
+}
+
+
+bool
+publish_vxlan_ctrl_server() {
+  assert( listen_fd >= 0 );
+
+  if ( strcmp( sock_file, CTRL_SERVER_SOCK_FILE ) == 0 ) {
+    return true;
+  }
+  if ( !publish_ctrl_server( sock_file, CTRL_SERVER_SOCK_FILE ) ) {
+    return false;
+  }
+  snprintf( sock_file, sizeof( sock_file ), "%s", CTRL_SERVER_SOCK_FILE );
+
+  return true;
 }
 
 
@@ -722,7 +1249,7 @@ finalize_vxlan_ctrl_server() {
   assert( listen_fd >= 0 );
   assert( vxlan != NULL );
 
-  return finalize_ctrl_server( listen_fd, CTRL_SERVER_SOCK_FILE );
+  return finalize_ctrl_server( listen_fd, sock_file );
 }
 
 
@@ -28,6 +28,7 @@
 
 bool start_vxlan_ctrl_server();
 bool init_vxlan_ctrl_server();
+bool publish_vxlan_ctrl_server();
 bool finalize_vxlan_ctrl_server();
 
 
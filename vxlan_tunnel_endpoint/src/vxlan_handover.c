@@ -0,0 +1,638 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fdb.h"
+#include "linked_list.h"
+#include "log.h"
+#include "neighbor.h"
+#include "netlink.h"
+#include "trunk.h"
+#include "vxlan_handover.h"
+#include "vxlan_instance.h"
+#include "wrapper.h"
+
+
+// A record received from the previous process, kept until instances can be
+// restored.
+typedef struct {
+  uint8_t record;
+  uint32_t vni;
+  uint16_t n_entries;
+  int fd;
+  uint8_t entries[ 0 ];
+} handover_record;
+
+
+static struct vxlan *vxlan = NULL;
+static int handover_fd = -1;
+static list *records = NULL;
+
+
+static void
+set_vni( uint8_t *vni, uint32_t value ) {
+  vni[ 0 ] = ( uint8_t ) ( ( value >> 16 ) & 0xff );
+  vni[ 1 ] = ( uint8_t ) ( ( value >> 8 ) & 0xff );
+  vni[ 2 ] = ( uint8_t ) ( value & 0xff );
+}
+
+
+static int
+count_entries( list *entries ) {
+  int n = 0;
+  for ( list_element *e = entries->head; e != NULL; e = e->next ) {
+    n++;
+  }
+
+  return n;
+}
+
+
+static bool
+send_records( int fd, uint32_t xid, uint8_t record, uint32_t vni, const void *entries, size_t entry_size,
+              int n_entries, const int *fds, int n_fds ) {
+  assert( entry_size > 0 );
+
+  int max_entries = ( int ) ( ( COMMAND_MESSAGE_LENGTH - offsetof( handover_reply, entries ) ) / entry_size );
+  int offset = 0;
+  do {
+    int n = n_entries - offset;
+    if ( n > max_entries ) {
+      n = max_entries;
+    }
+    size_t length = offsetof( handover_reply, entries ) + entry_size * ( size_t ) n;
+    handover_reply *reply = malloc( length );
+    memset( reply, 0, length );
+    reply->header.xid = xid;
+    reply->header.type = HANDOVER_REPLY;
+    reply->header.status = STATUS_OK;
+    reply->header.reason = SUCCEEDED;
+    reply->header.flags = record != HANDOVER_END ? FLAG_MORE : FLAG_NONE;
+    reply->header.length = ( uint16_t ) length;
+    reply->record = record;
+    reply->vni = vni;
+    reply->n_entries = ( uint16_t ) n;
+    if ( n > 0 ) {
+      memcpy( reply->entries, ( const uint8_t * ) entries + entry_size * ( size_t ) offset, entry_size * ( size_t ) n );
+    }
+    // Descriptors go with the first message only.
+    ssize_t ret = send_command_with_fds( fd, reply, length, fds, offset == 0 ? n_fds : 0 );
+    free( reply );
+    if ( ret < 0 ) {
+      return false;
+    }
+    offset += n;
+  } while ( offset < n_entries );
+
+  return true;
+}
+
+
+static bool
+send_instance( int fd, uint32_t xid, struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  uint32_t vni = get_vni_value( instance->vni );
+
+  handover_instance config;
+  memset( &config, 0, sizeof( config ) );
+  config.addr = instance->addr.sin_addr;
+  config.port = instance->port;
+  config.vlan = instance->vlan;
+  config.inner_vlan = instance->inner_vlan;
+  config.aging_time = ( uint32_t ) instance->aging_time;
+  config.max_fdb_entries = instance->max_fdb_entries;
+  config.flood_rate = instance->flood_rate;
+  config.learning = instance->learning;
+  config.neighbor_suppression = instance->neighbor_suppression;
+  config.activated = instance->activated;
+  int n_fds = instance->vlan == 0 && instance->tap_sock >= 0 ? 1 : 0;
+  if ( !send_records( fd, xid, HANDOVER_INSTANCE, vni, &config, sizeof( config ), 1, &instance->tap_sock, n_fds ) ) {
+    return false;
+  }
+
+  bool ret = true;
+  int n_entries = 0;
+  struct fdb_entry *entries = instance->fdb != NULL ? get_fdb_entries( instance->fdb, &n_entries ) : NULL;
+  if ( entries != NULL ) {
+    handover_fdb_entry *fdb_entries = malloc( sizeof( handover_fdb_entry ) * ( size_t ) n_entries );
+    memset( fdb_entries, 0, sizeof( handover_fdb_entry ) * ( size_t ) n_entries );
+    for ( int i = 0; i < n_entries; i++ ) {
+      memcpy( fdb_entries[ i ].eth_addr.ether_addr_octet, entries[ i ].mac, ETH_ALEN );
+      fdb_entries[ i ].type = entries[ i ].type;
+      fdb_entries[ i ].ip_addr = entries[ i ].vtep_addr;
+      fdb_entries[ i ].aging_time = entries[ i ].aging_time;
+    }
+    ret &= send_records( fd, xid, HANDOVER_FDB, vni, fdb_entries, sizeof( handover_fdb_entry ), n_entries, NULL, 0 );
+    free( fdb_entries );
+    free( entries );
+  }
+
+  list *neighbor_list = instance->neighbors != NULL ? get_neighbor_entries( instance->neighbors ) : NULL;
+  if ( neighbor_list != NULL ) {
+    n_entries = count_entries( neighbor_list );
+    handover_neighbor *neighbors = malloc( sizeof( handover_neighbor ) * ( size_t ) n_entries );
+    memset( neighbors, 0, sizeof( handover_neighbor ) * ( size_t ) n_entries );
+    int n = 0;
+    for ( list_element *e = neighbor_list->head; e != NULL; e = e->next ) {
+      struct neighbor_entry *entry = e->data;
+      memcpy( neighbors[ n ].addr, entry->addr, sizeof( neighbors[ n ].addr ) );
+      memcpy( neighbors[ n ].eth_addr.ether_addr_octet, entry->mac, ETH_ALEN );
+      neighbors[ n ].type = entry->type;
+      n++;
+    }
+    ret &= send_records( fd, xid, HANDOVER_NEIGHBORS, vni, neighbors, sizeof( handover_neighbor ), n, NULL, 0 );
+    free( neighbors );
+    delete_list_totally( neighbor_list );
+  }
+
+  struct vxlan_remote_list *remotes = get_vxlan_instance_remotes( instance->vni );
+  if ( remotes != NULL ) {
+    if ( remotes->n_remotes > 0 ) {
+      ret &= send_records( fd, xid, HANDOVER_REMOTES, vni, remotes->remotes, sizeof( struct in_addr ),
+                           remotes->n_remotes, NULL, 0 );
+    }
+    free( remotes );
+  }
+
+  return ret;
+}
+
+
+static void
+send_handover_error( int fd, uint32_t xid, uint8_t reason ) {
+  handover_reply reply;
+  memset( &reply, 0, sizeof( reply ) );
+  reply.header.xid = xid;
+  reply.header.type = HANDOVER_REPLY;
+  reply.header.status = STATUS_NG;
+  reply.header.reason = reason;
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) sizeof( reply );
+  reply.record = HANDOVER_END;
+  send_command_with_fds( fd, &reply, sizeof( reply ), NULL, 0 );
+}
+
+
+// Sends sockets, taps and tables to a new process. Forwarding goes on until
+// the new process completes the takeover, then this process exits without
+// tearing down taps or leaving multicast groups, which now belong to the new
+// process.
+void
+hand_over_vxlan( int fd, handover_request *request, struct vxlan *_vxlan ) {
+  assert( fd >= 0 );
+  assert( request != NULL );
+  assert( _vxlan != NULL );
+
+  vxlan = _vxlan;
+  uint32_t xid = request->header.xid;
+  if ( request->version != HANDOVER_VERSION ) {
+    error( "Unsupported handover version ( version = %u, expected = %u ).", request->version, HANDOVER_VERSION );
+    send_handover_error( fd, xid, INVALID_ARGUMENT );
+    return;
+  }
+
+  info( "Handing over to a new process." );
+
+  handover_sockets sockets;
+  memset( &sockets, 0, sizeof( sockets ) );
+  sockets.port = vxlan->port;
+  strncpy( sockets.trunk_name, vxlan->trunk_name, sizeof( sockets.trunk_name ) - 1 );
+  int fds[ MAX_COMMAND_FDS ];
+  int n_fds = 0;
+  sockets.sockets |= HANDOVER_UDP_SOCK;
+  fds[ n_fds++ ] = vxlan->udp_sock;
+  if ( vxlan->raw_sock >= 0 ) {
+    sockets.sockets |= HANDOVER_RAW_SOCK;
+    fds[ n_fds++ ] = vxlan->raw_sock;
+  }
+  if ( vxlan->trunk_sock >= 0 ) {
+    sockets.sockets |= HANDOVER_TRUNK_SOCK;
+    fds[ n_fds++ ] = vxlan->trunk_sock;
+  }
+  bool ret = send_records( fd, xid, HANDOVER_SOCKETS, 0, &sockets, sizeof( sockets ), 1, fds, n_fds );
+
+  int n_instances = 0;
+  struct vxlan_instance **instances = get_all_vxlan_instances( &n_instances );
+  for ( int i = 0; ret && i < n_instances; i++ ) {
+    ret = send_instance( fd, xid, instances[ i ] );
+  }
+  if ( instances != NULL ) {
+    free( instances );
+  }
+  if ( ret ) {
+    ret = send_records( fd, xid, HANDOVER_END, 0, NULL, 1, 0, NULL, 0 );
+  }
+  if ( !ret ) {
+    warn( "Failed to hand over. Continuing to forward." );
+    return;
+  }
+
+  uint8_t buf[ COMMAND_MESSAGE_LENGTH ];
+  size_t length = sizeof( buf );
+  n_fds = 0;
+  ssize_t retval = recv_command_with_fds( fd, buf, &length, fds, &n_fds, HANDOVER_TIMEOUT );
+  for ( int i = 0; i < n_fds; i++ ) {
+    close( fds[ i ] );
+  }
+  command_request_header *header = ( void * ) buf;
+  if ( retval <= 0 || length < sizeof( command_request_header ) || header->type != HANDOVER_COMPLETE_REQUEST ) {
+    warn( "The new process did not complete the takeover. Continuing to forward." );
+    return;
+  }
+
+  handover_complete_reply reply;
+  memset( &reply, 0, sizeof( reply ) );
+  reply.header.xid = header->xid;
+  reply.header.type = HANDOVER_COMPLETE_REPLY;
+  reply.header.status = STATUS_OK;
+  reply.header.reason = SUCCEEDED;
+  reply.header.flags = FLAG_NONE;
+  reply.header.length = ( uint16_t ) sizeof( reply );
+  send_command_with_fds( fd, &reply, sizeof( reply ), NULL, 0 );
+
+  vxlan->handed_over = true;
+  running = false;
+  info( "Handed over %d instances to a new process.", n_instances );
+}
+
+
+static void
+delete_records() {
+  if ( records == NULL ) {
+    return;
+  }
+  for ( list_element *e = records->head; e != NULL; e = e->next ) {
+    handover_record *record = e->data;
+    if ( record->fd >= 0 ) {
+      close( record->fd );
+    }
+  }
+  delete_list_totally( records );
+  records = NULL;
+}
+
+
+static bool
+adopt_sockets( const handover_sockets *sockets, const int *fds, int n_fds ) {
+  assert( sockets != NULL );
+  assert( fds != NULL );
+
+  int expected = 0;
+  for ( uint8_t bit = HANDOVER_UDP_SOCK; bit <= HANDOVER_TRUNK_SOCK; bit = ( uint8_t ) ( bit << 1 ) ) {
+    if ( ( sockets->sockets & bit ) != 0 ) {
+      expected++;
+    }
+  }
+  if ( n_fds != expected || ( sockets->sockets & HANDOVER_UDP_SOCK ) == 0 ) {
+    error( "Sockets are not handed over ( sockets = %#x, n_fds = %d ).", sockets->sockets, n_fds );
+    return false;
+  }
+  if ( sockets->port != vxlan->port ) {
+    error( "UDP port must be the same as the previous process ( port = %u, previous = %u ).",
+           vxlan->port, sockets->port );
+    return false;
+  }
+  if ( strncmp( sockets->trunk_name, vxlan->trunk_name, IFNAMSIZ ) != 0 ) {
+    error( "Trunk interface must be the same as the previous process ( trunk = %s, previous = %s ).",
+           vxlan->trunk_name, sockets->trunk_name );
+    return false;
+  }
+
+  int n = 0;
+  vxlan->udp_sock = fds[ n++ ];
+  if ( ( sockets->sockets & HANDOVER_RAW_SOCK ) != 0 ) {
+    vxlan->raw_sock = fds[ n++ ];
+  }
+  if ( ( sockets->sockets & HANDOVER_TRUNK_SOCK ) != 0 ) {
+    vxlan->trunk_sock = fds[ n++ ];
+  }
+
+  return true;
+}
+
+
+static size_t
+get_entry_size( uint8_t record ) {
+  switch ( record ) {
+    case HANDOVER_SOCKETS:
+      return sizeof( handover_sockets );
+    case HANDOVER_INSTANCE:
+      return sizeof( handover_instance );
+    case HANDOVER_FDB:
+      return sizeof( handover_fdb_entry );
+    case HANDOVER_NEIGHBORS:
+      return sizeof( handover_neighbor );
+    case HANDOVER_REMOTES:
+      return sizeof( struct in_addr );
+    case HANDOVER_END:
+      return 0;
+    default:
+      break;
+  }
+
+  return SIZE_MAX;
+}
+
+
+static bool
+store_record( handover_reply *reply, size_t length, int *fds, int n_fds ) {
+  assert( reply != NULL );
+
+  size_t entry_size = get_entry_size( reply->record );
+  size_t entries_length = entry_size * reply->n_entries;
+  if ( entry_size == SIZE_MAX || length < offsetof( handover_reply, entries ) + entries_length ) {
+    error( "Invalid handover record ( record = %u, length = %u ).", reply->record, ( unsigned int ) length );
+    return false;
+  }
+
+  switch ( reply->record ) {
+    case HANDOVER_SOCKETS:
+    {
+      if ( reply->n_entries != 1 ) {
+        return false;
+      }
+      return adopt_sockets( ( handover_sockets * ) reply->entries, fds, n_fds );
+    }
+
+    case HANDOVER_INSTANCE:
+    {
+      const handover_instance *config = ( const handover_instance * ) reply->entries;
+      if ( reply->n_entries != 1 || n_fds != ( config->vlan == 0 ? 1 : 0 ) ) {
+        error( "A tap interface is not handed over ( vni = %#x, n_fds = %d ).", reply->vni, n_fds );
+        return false;
+      }
+    }
+    break;
+
+    case HANDOVER_END:
+      return true;
+
+    default:
+      if ( n_fds != 0 ) {
+        return false;
+      }
+      break;
+  }
+
+  handover_record *record = malloc( offsetof( handover_record, entries ) + entries_length );
+  assert( record != NULL );
+  record->record = reply->record;
+  record->vni = reply->vni;
+  record->n_entries = reply->n_entries;
+  record->fd = n_fds > 0 ? fds[ 0 ] : -1;
+  memcpy( record->entries, reply->entries, entries_length );
+  append_to_tail( records, record );
+
+  return true;
+}
+
+
+// Connects to the running process and receives everything it hands over.
+// Sockets are adopted here so that init_net() and init_trunk() do not create
+// new ones. Instances are restored by restore_handed_over_instances().
+bool
+take_over_vxlan( struct vxlan *_vxlan ) {
+  assert( _vxlan != NULL );
+  assert( handover_fd < 0 );
+
+  vxlan = _vxlan;
+  if ( !init_ctrl_client( &handover_fd ) ) {
+    return false;
+  }
+  if ( !connect_ctrl_server( handover_fd, CTRL_SERVER_SOCK_FILE ) ) {
+    error( "No process to take over from." );
+    goto error;
+  }
+
+  handover_request request;
+  memset( &request, 0, sizeof( request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = HANDOVER_REQUEST;
+  request.header.length = ( uint16_t ) sizeof( request );
+  request.version = HANDOVER_VERSION;
+  size_t length = sizeof( request );
+  if ( send_command( handover_fd, &request, &length ) <= 0 ) {
+    goto error;
+  }
+
+  records = create_list();
+  uint8_t buf[ COMMAND_MESSAGE_LENGTH ];
+  bool more = true;
+  while ( more ) {
+    int fds[ MAX_COMMAND_FDS ];
+    int n_fds = 0;
+    length = sizeof( buf );
+    ssize_t ret = recv_command_with_fds( handover_fd, buf, &length, fds, &n_fds, HANDOVER_TIMEOUT );
+    handover_reply *reply = ( void * ) buf;
+    bool ok = ret > 0 && length >= offsetof( handover_reply, entries ) && reply->header.type == HANDOVER_REPLY &&
+              reply->header.status == STATUS_OK;
+    if ( ok ) {
+      ok = store_record( reply, length, fds, n_fds );
+    }
+    else if ( ret > 0 && length >= sizeof( command_reply_header ) ) {
+      error( "Handover is rejected ( status = %u, reason = %u ).", reply->header.status, reply->header.reason );
+    }
+    if ( !ok ) {
+      for ( int i = 0; i < n_fds; i++ ) {
+        if ( fds[ i ] != vxlan->udp_sock && fds[ i ] != vxlan->raw_sock && fds[ i ] != vxlan->trunk_sock ) {
+          close( fds[ i ] );
+        }
+      }
+      goto error;
+    }
+    more = ( reply->header.flags & FLAG_MORE ) != 0;
+  }
+
+  return true;
+
+error:
+  abort_vxlan_takeover();
+
+  return false;
+}
+
+
+static bool
+restore_instance( handover_record *record, uint8_t *vni ) {
+  assert( record != NULL );
+
+  const handover_instance *config = ( const handover_instance * ) record->entries;
+  if ( search_vni_table( vxlan->instances, record->vni ) != NULL ||
+       ( config->vlan != 0 && !trunk_vlan_available( config->vlan, config->inner_vlan ) ) ) {
+    error( "Failed to restore an instance ( vni = %#x, vlan = %u ).", record->vni, config->vlan );
+    return false;
+  }
+
+  struct vxlan_instance *instance = create_vxlan_instance( vni, config->addr, config->port,
+                                                           ( time_t ) config->aging_time,
+                                                           config->max_fdb_entries, config->learning,
+                                                           config->flood_rate, config->neighbor_suppression,
+                                                           config->vlan, config->inner_vlan, record->fd );
+  record->fd = -1;
+  insert_vni_table( vxlan->instances, record->vni, instance );
+  start_vxlan_instance( instance );
+  vxlan->n_instances++;
+  if ( !config->activated ) {
+    inactivate_vxlan_instance( vni );
+  }
+
+  return true;
+}
+
+
+static void
+restore_tables( handover_record *record, uint8_t *vni ) {
+  assert( record != NULL );
+
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, record->vni );
+  if ( instance == NULL ) {
+    return;
+  }
+
+  if ( record->record == HANDOVER_REMOTES ) {
+    const struct in_addr *remotes = ( const struct in_addr * ) record->entries;
+    for ( int i = 0; i < record->n_entries; i++ ) {
+      add_vxlan_instance_remote( vni, remotes[ i ] );
+    }
+    return;
+  }
+
+  allocate_vxlan_instance_tables( instance );
+  if ( record->record == HANDOVER_FDB ) {
+    const handover_fdb_entry *entries = ( const handover_fdb_entry * ) record->entries;
+    for ( int i = 0; i < record->n_entries; i++ ) {
+      if ( entries[ i ].type == FDB_ENTRY_TYPE_STATIC ) {
+        fdb_add_static_entry( instance->fdb, entries[ i ].eth_addr, entries[ i ].ip_addr,
+                              ( time_t ) entries[ i ].aging_time );
+      }
+      else {
+        struct ether_addr eth_addr = entries[ i ].eth_addr;
+        fdb_add_entry( instance->fdb, eth_addr.ether_addr_octet, entries[ i ].ip_addr );
+      }
+    }
+  }
+  else if ( record->record == HANDOVER_NEIGHBORS ) {
+    const handover_neighbor *entries = ( const handover_neighbor * ) record->entries;
+    for ( int i = 0; i < record->n_entries; i++ ) {
+      struct neighbor_entry entry;
+      memset( &entry, 0, sizeof( entry ) );
+      memcpy( entry.addr, entries[ i ].addr, sizeof( entry.addr ) );
+      memcpy( entry.mac, entries[ i ].eth_addr.ether_addr_octet, ETH_ALEN );
+      entry.type = entries[ i ].type;
+      add_neighbor_entry( instance->neighbors, &entry );
+    }
+  }
+}
+
+
+bool
+restore_handed_over_instances() {
+  assert( vxlan != NULL );
+  assert( records != NULL );
+
+  // Taps of all restored instances are brought up in as few netlink round
+  // trips as possible.
+  begin_link_batch();
+  int n_instances = 0;
+  for ( list_element *e = records->head; e != NULL; e = e->next ) {
+    handover_record *record = e->data;
+    uint8_t vni[ VXLAN_VNISIZE ];
+    set_vni( vni, record->vni );
+    if ( record->record == HANDOVER_INSTANCE ) {
+      if ( restore_instance( record, vni ) ) {
+        n_instances++;
+      }
+    }
+    else {
+      restore_tables( record, vni );
+    }
+  }
+  if ( !commit_link_batch() ) {
+    warn( "Failed to bring some tap interfaces up." );
+  }
+
+  info( "Took over %d instances from the previous process.", n_instances );
+
+  return true;
+}
+
+
+// Tells the previous process to exit. Forwarding is taken over as soon as the
+// caller starts its engine.
+bool
+complete_vxlan_takeover() {
+  assert( handover_fd >= 0 );
+
+  handover_complete_request request;
+  memset( &request, 0, sizeof( request ) );
+  request.header.xid = ( uint32_t ) rand();
+  request.header.type = HANDOVER_COMPLETE_REQUEST;
+  request.header.length = ( uint16_t ) sizeof( request );
+  size_t length = sizeof( request );
+  bool ret = send_command( handover_fd, &request, &length ) > 0;
+
+  if ( ret ) {
+    // The previous process stops as soon as it receives the request, so a
+    // missing reply does not leave two processes forwarding.
+    handover_complete_reply reply;
+    int fds[ MAX_COMMAND_FDS ];
+    int n_fds = 0;
+    length = sizeof( reply );
+    if ( recv_command_with_fds( handover_fd, &reply, &length, fds, &n_fds, HANDOVER_TIMEOUT ) <= 0 ||
+         reply.header.type != HANDOVER_COMPLETE_REPLY || reply.header.status != STATUS_OK ) {
+      warn( "The previous process did not acknowledge the takeover." );
+    }
+    for ( int i = 0; i < n_fds; i++ ) {
+      close( fds[ i ] );
+    }
+  }
+  else {
+    error( "Failed to complete the takeover. Leaving everything to the previous process." );
+  }
+
+  finalize_ctrl_client( handover_fd );
+  handover_fd = -1;
+  delete_records();
+
+  return ret;
+}
+
+
+void
+abort_vxlan_takeover() {
+  if ( handover_fd >= 0 ) {
+    finalize_ctrl_client( handover_fd );
+    handover_fd = -1;
+  }
+  delete_records();
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2012-2013 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef VXLAN_HANDOVER_H
+#define VXLAN_HANDOVER_H
+
+
+#include <stdbool.h>
+#include "vxlan_common.h"
+#include "vxlan_ctrl_common.h"
+
+
+void hand_over_vxlan( int fd, handover_request *request, struct vxlan *vxlan );
+bool take_over_vxlan( struct vxlan *vxlan );
+bool restore_handed_over_instances();
+bool complete_vxlan_takeover();
+void abort_vxlan_takeover();
+
+
+#endif // VXLAN_HANDOVER_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -25,26 +25,50 @@
 #include <netdb.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/select.h>
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <syslog.h>
 #include <unistd.h>
+#include "checks.h"
 #include "fdb.h"
 #include "iftap.h"
+#include "io_uring_engine.h"
+#include "latency.h"
 #include "log.h"
 #include "net.h"
+#include "netlink.h"
+#include "probes.h"
+#include "qsbr.h"
+#include "trunk.h"
 #include "vxlan_instance.h"
 #include "wrapper.h"
 
 
+#define DORMANT_MAX_EVENTS 64
+#define DORMANT_MAINTENANCE_INTERVAL 5
+
+
 static struct vxlan *vxlan = NULL;
+// Serializes allocation and release of per-instance tables and worker threads.
+// Never held across qsbr_synchronize() since data path threads may wait for it.
+static pthread_mutex_t resource_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int dormant_fd = -1;
+static pthread_t dormant_tid;
+static bool dormant_thread_started = false;
+static uint32_t last_hibernation_check = 0;
 
 
 struct vxlan_instance *
-create_vxlan_instance( uint8_t *vni, struct in_addr addr, uint16_t port, time_t aging_time ) {
+create_vxlan_instance( uint8_t *vni, struct in_addr addr, uint16_t port, time_t aging_time,
+                       int max_fdb_entries, bool learning, int flood_rate, bool neighbor_suppression,
+                       uint16_t vlan, uint16_t inner_vlan, int tap_sock ) {
   assert( vxlan != NULL );
   assert( vni != NULL );
 
@@ -72,8 +96,28 @@ create_vxlan_instance( uint8_t *vni, struct in_addr addr, uint16_t port, time_t
   else {
     instance->aging_time = vxlan->aging_time;
   }
+  if ( max_fdb_entries > 0 && max_fdb_entries <= VXLAN_MAX_FDB_ENTRIES ) {
+    instance->max_fdb_entries = max_fdb_entries;
+  }
+  else {
+    instance->max_fdb_entries = ( int ) vxlan->max_fdb_entries;
+  }
+  instance->learning = learning;
+  if ( flood_rate >= 0 && flood_rate <= VXLAN_MAX_FLOOD_RATE ) {
+    instance->flood_rate = flood_rate;
+  }
+  else {
+    instance->flood_rate = VXLAN_DEFAULT_FLOOD_RATE;
+  }
+  instance->neighbor_suppression = neighbor_suppression;
   instance->tap_sock = -1;
   instance->activated = false;
+  instance->io_slot = -1;
+#ifdef LATENCY_STATS
+  instance->latency = malloc( sizeof( struct vxlan_instance_latency ) );
+  assert( instance->latency != NULL );
+  memset( instance->latency, 0, sizeof( struct vxlan_instance_latency ) );
+#endif
 
   instance->udp_sock = vxlan->udp_sock;
   if ( !IN_MULTICAST( ntohl( instance->addr.sin_addr.s_addr ) ) ) {
@@ -87,10 +131,24 @@ create_vxlan_instance( uint8_t *vni, struct in_addr addr, uint16_t port, time_t
   vni32 |= ( uint32_t ) ( instance->vni[ 1 ] << 8 );
   vni32 |= ( uint32_t ) instance->vni[ 2 ];
   memset( instance->vxlan_tap_name, '\0', sizeof( instance->vxlan_tap_name ) );
-  snprintf( instance->vxlan_tap_name, sizeof( instance->vxlan_tap_name ) - 1, "vxlan%u", vni32 );
+  instance->vlan = vlan;
+  instance->inner_vlan = vlan != 0 ? inner_vlan : 0;
+  if ( instance->vlan != 0 ) {
+    strncpy( instance->vxlan_tap_name, vxlan->trunk_name, sizeof( instance->vxlan_tap_name ) - 1 );
+  }
+  else {
+    snprintf( instance->vxlan_tap_name, sizeof( instance->vxlan_tap_name ) - 1, "vxlan%u", vni32 );
+  }
 
   instance->fdb = NULL;
-  instance->tap_sock = tap_alloc( instance->vxlan_tap_name );
+  instance->neighbors = NULL;
+  instance->remotes = NULL;
+  instance->egress = NULL;
+  instance->egress_event = -1;
+  if ( instance->vlan == 0 ) {
+    // A tap handed over from a previous process is adopted as it is.
+    instance->tap_sock = tap_sock >= 0 ? tap_sock : tap_alloc( instance->vxlan_tap_name );
+  }
 
   return instance;
 }
@@ -132,7 +190,7 @@ set_vxlan_instance_flooding_addr( uint8_t *vni, struct in_addr addr ) {
   assert( vxlan != NULL );
   assert( vni != NULL );
 
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
   if ( instance == NULL ) {
     return false;
   }
@@ -168,7 +226,7 @@ set_vxlan_instance_port( uint8_t *vni, uint16_t port ) {
   assert( vxlan != NULL );
   assert( vni != NULL );
 
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
   if ( instance == NULL ) {
     return false;
   }
@@ -191,7 +249,7 @@ set_vxlan_instance_aging_time( uint8_t *vni, time_t aging_time ) {
   assert( vxlan != NULL );
   assert( vni != NULL );
 
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
   if ( instance == NULL ) {
     return false;
   }
@@ -203,7 +261,235 @@ set_vxlan_instance_aging_time( uint8_t *vni, time_t aging_time ) {
     instance->aging_time = vxlan->aging_time;
   }
 
-  return set_aging_time( instance->fdb, instance->aging_time );
+  bool ret = true;
+  pthread_mutex_lock( &resource_mutex );
+  if ( instance->fdb != NULL ) {
+    set_neighbor_aging_time( instance->neighbors, instance->aging_time );
+    ret = set_aging_time( instance->fdb, instance->aging_time );
+  }
+  pthread_mutex_unlock( &resource_mutex );
+
+  return ret;
+}
+
+
+bool
+set_vxlan_instance_max_fdb_entries( uint8_t *vni, int max_fdb_entries ) {
+  assert( vxlan != NULL );
+  assert( vni != NULL );
+
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance == NULL ) {
+    return false;
+  }
+
+  if ( max_fdb_entries > 0 && max_fdb_entries <= VXLAN_MAX_FDB_ENTRIES ) {
+    instance->max_fdb_entries = max_fdb_entries;
+  }
+  else {
+    instance->max_fdb_entries = ( int ) vxlan->max_fdb_entries;
+  }
+
+  bool ret = true;
+  pthread_mutex_lock( &resource_mutex );
+  if ( instance->fdb != NULL ) {
+    set_max_neighbors( instance->neighbors, ( uint32_t ) instance->max_fdb_entries );
+    ret = set_max_fdb_entries( instance->fdb, ( uint32_t ) instance->max_fdb_entries );
+  }
+  pthread_mutex_unlock( &resource_mutex );
+
+  return ret;
+}
+
+
+bool
+set_vxlan_instance_learning( uint8_t *vni, bool learning ) {
+  assert( vxlan != NULL );
+  assert( vni != NULL );
+
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance == NULL ) {
+    return false;
+  }
+
+  if ( instance->learning == learning ) {
+    return true;
+  }
+
+  instance->learning = learning;
+  if ( learning ) {
+    return true;
+  }
+
+  // Entries learned so far must not outlive the switch to controller-populated mode.
+  bool ret = true;
+  pthread_mutex_lock( &resource_mutex );
+  if ( instance->fdb != NULL ) {
+    delete_all_neighbors( instance->neighbors, NEIGHBOR_ENTRY_TYPE_DYNAMIC );
+    ret = fdb_delete_all_entries( instance->fdb, FDB_ENTRY_TYPE_DYNAMIC );
+  }
+  pthread_mutex_unlock( &resource_mutex );
+
+  return ret;
+}
+
+
+bool
+set_vxlan_instance_flood_rate( uint8_t *vni, int flood_rate ) {
+  assert( vxlan != NULL );
+  assert( vni != NULL );
+
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance == NULL ) {
+    return false;
+  }
+
+  if ( flood_rate >= 0 && flood_rate <= VXLAN_MAX_FLOOD_RATE ) {
+    instance->flood_rate = flood_rate;
+  }
+  else {
+    instance->flood_rate = VXLAN_DEFAULT_FLOOD_RATE;
+  }
+
+  return true;
+}
+
+
+bool
+set_vxlan_instance_neighbor_suppression( uint8_t *vni, bool neighbor_suppression ) {
+  assert( vxlan != NULL );
+  assert( vni != NULL );
+
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance == NULL ) {
+    return false;
+  }
+
+  instance->neighbor_suppression = neighbor_suppression;
+
+  return true;
+}
+
+
+static struct vxlan_remote_list *
+allocate_remote_list( int n_remotes ) {
+  size_t length = offsetof( struct vxlan_remote_list, remotes ) + sizeof( struct in_addr ) * ( size_t ) n_remotes;
+  struct vxlan_remote_list *list = malloc( length );
+  assert( list != NULL );
+  memset( list, 0, length );
+  list->n_remotes = n_remotes;
+
+  return list;
+}
+
+
+static void
+replace_remote_list( struct vxlan_instance *instance, struct vxlan_remote_list *list ) {
+  struct vxlan_remote_list *old = instance->remotes;
+  __atomic_store_n( &instance->remotes, list, __ATOMIC_RELEASE );
+  if ( old != NULL ) {
+    qsbr_retire( old, free );
+  }
+}
+
+
+bool
+add_vxlan_instance_remote( uint8_t *vni, struct in_addr addr ) {
+  assert( vxlan != NULL );
+  assert( vni != NULL );
+
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance == NULL ) {
+    return false;
+  }
+
+  if ( ntohl( addr.s_addr ) == INADDR_ANY || IN_MULTICAST( ntohl( addr.s_addr ) ) ) {
+    return false;
+  }
+
+  // Only the control thread updates the list.
+  struct vxlan_remote_list *old = instance->remotes;
+  int n_remotes = old != NULL ? old->n_remotes : 0;
+  for ( int i = 0; i < n_remotes; i++ ) {
+    if ( old->remotes[ i ].s_addr == addr.s_addr ) {
+      return true;
+    }
+  }
+  if ( n_remotes >= VXLAN_MAX_REMOTES ) {
+    return false;
+  }
+
+  struct vxlan_remote_list *list = allocate_remote_list( n_remotes + 1 );
+  if ( n_remotes > 0 ) {
+    memcpy( list->remotes, old->remotes, sizeof( struct in_addr ) * ( size_t ) n_remotes );
+  }
+  list->remotes[ n_remotes ] = addr;
+  replace_remote_list( instance, list );
+
+  return true;
+}
+
+
+bool
+delete_vxlan_instance_remote( uint8_t *vni, struct in_addr addr ) {
+  assert( vxlan != NULL );
+  assert( vni != NULL );
+
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance == NULL ) {
+    return false;
+  }
+
+  struct vxlan_remote_list *old = instance->remotes;
+  if ( old == NULL ) {
+    return ntohl( addr.s_addr ) == INADDR_ANY;
+  }
+  if ( ntohl( addr.s_addr ) == INADDR_ANY ) {
+    replace_remote_list( instance, NULL );
+    return true;
+  }
+
+  int found = -1;
+  for ( int i = 0; i < old->n_remotes; i++ ) {
+    if ( old->remotes[ i ].s_addr == addr.s_addr ) {
+      found = i;
+      break;
+    }
+  }
+  if ( found < 0 ) {
+    return false;
+  }
+
+  struct vxlan_remote_list *list = NULL;
+  if ( old->n_remotes > 1 ) {
+    list = allocate_remote_list( old->n_remotes - 1 );
+    memcpy( list->remotes, old->remotes, sizeof( struct in_addr ) * ( size_t ) found );
+    memcpy( list->remotes + found, old->remotes + found + 1,
+            sizeof( struct in_addr ) * ( size_t ) ( old->n_remotes - found - 1 ) );
+  }
+  replace_remote_list( instance, list );
+
+  return true;
+}
+
+
+struct vxlan_remote_list *
+get_vxlan_instance_remotes( uint8_t *vni ) {
+  assert( vxlan != NULL );
+  assert( vni != NULL );
+
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
+  if ( instance == NULL ) {
+    return NULL;
+  }
+
+  int n_remotes = instance->remotes != NULL ? instance->remotes->n_remotes : 0;
+  struct vxlan_remote_list *list = allocate_remote_list( n_remotes );
+  if ( n_remotes > 0 ) {
+    memcpy( list->remotes, instance->remotes->remotes, sizeof( struct in_addr ) * ( size_t ) n_remotes );
+  }
+
+  return list;
 }
 
 
@@ -212,7 +498,7 @@ inactivate_vxlan_instance( uint8_t *vni ) {
   assert( vxlan != NULL );
   assert( vni != NULL );
 
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
   if ( instance == NULL ) {
     return false;
   }
@@ -222,7 +508,9 @@ inactivate_vxlan_instance( uint8_t *vni ) {
   }
 
   instance->activated = false;
-  tap_down( instance->vxlan_tap_name );
+  if ( instance->vlan == 0 ) {
+    tap_down( instance->vxlan_tap_name );
+  }
 
   return true;
 }
@@ -233,7 +521,7 @@ activate_vxlan_instance( uint8_t *vni ) {
   assert( vxlan != NULL );
   assert( vni != NULL );
 
-  struct vxlan_instance *instance = search_hash( &vxlan->instances, vni );
+  struct vxlan_instance *instance = search_vni_table( vxlan->instances, get_vni_value( vni ) );
   if ( instance == NULL ) {
     return false;
   }
@@ -243,12 +531,222 @@ activate_vxlan_instance( uint8_t *vni ) {
   }
 
   instance->activated = true;
-  tap_up( instance->vxlan_tap_name );
+  if ( instance->vlan == 0 ) {
+    tap_up( instance->vxlan_tap_name );
+  }
 
   return true;
 }
 
 
+static void *process_vxlan_instance( void *param );
+
+
+void
+allocate_vxlan_instance_tables( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  pthread_mutex_lock( &resource_mutex );
+  if ( instance->fdb == NULL ) {
+    struct neighbor_table *neighbors = create_neighbor_table( ( uint32_t ) instance->max_fdb_entries,
+                                                              instance->aging_time );
+    assert( neighbors != NULL );
+    struct fdb *fdb = init_fdb( instance->aging_time, ( uint32_t ) instance->max_fdb_entries );
+    assert( fdb != NULL );
+    __atomic_store_n( &instance->neighbors, neighbors, __ATOMIC_RELEASE );
+    __atomic_store_n( &instance->fdb, fdb, __ATOMIC_RELEASE );
+  }
+  pthread_mutex_unlock( &resource_mutex );
+
+  touch_vxlan_instance( instance );
+}
+
+
+// Tables holding static or not yet aged out entries are kept as they are.
+static void
+release_vxlan_instance_tables( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  pthread_mutex_lock( &resource_mutex );
+  struct fdb *fdb = instance->fdb;
+  struct neighbor_table *neighbors = instance->neighbors;
+  if ( fdb == NULL ) {
+    pthread_mutex_unlock( &resource_mutex );
+    return;
+  }
+  struct fdb_stats stats;
+  get_fdb_stats( fdb, &stats );
+  if ( stats.n_entries > 0 || neighbors->neighbors.count > 0 ) {
+    pthread_mutex_unlock( &resource_mutex );
+    return;
+  }
+  __atomic_store_n( &instance->fdb, NULL, __ATOMIC_RELEASE );
+  __atomic_store_n( &instance->neighbors, NULL, __ATOMIC_RELEASE );
+  pthread_mutex_unlock( &resource_mutex );
+
+  qsbr_synchronize();
+  destroy_fdb( fdb );
+  destroy_neighbor_table( neighbors );
+}
+
+
+// Must be called with resource_mutex held.
+static bool
+start_worker( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  if ( instance->worker_started ) {
+    return true;
+  }
+
+  int egress_event = eventfd( 0, EFD_NONBLOCK );
+  if ( egress_event < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to create an eventfd ( errno = %s [%d] ).", error_string, errno );
+    return false;
+  }
+  instance->egress_event = egress_event;
+  __atomic_store_n( &instance->egress, create_queue(), __ATOMIC_RELEASE );
+
+  pthread_attr_t attr;
+  pthread_attr_init( &attr );
+  int retval = pthread_attr_setstacksize( &attr, 4 * 1024 * 1024 );
+  if ( retval != 0 ) {
+    critical( "Failed to set stack size for a VXLAN instance thread." );
+    return false;
+  }
+  retval = pthread_create( &instance->tid, &attr, process_vxlan_instance, instance );
+  if ( retval != 0 ) {
+    error( "Failed to create a VXLAN instance thread ( errno = %d ).", errno );
+    return false;
+  }
+  // Threads are named after taps so that they can be told apart in top and /proc.
+  pthread_setname_np( instance->tid, instance->vxlan_tap_name );
+  instance->worker_started = true;
+  touch_vxlan_instance( instance );
+
+  return true;
+}
+
+
+static bool
+stop_worker( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  pthread_mutex_lock( &resource_mutex );
+  if ( !instance->worker_started ) {
+    pthread_mutex_unlock( &resource_mutex );
+    return true;
+  }
+  instance->worker_started = false;
+  queue *egress = instance->egress;
+  // Decapsulated frames are written to the tap directly from now on.
+  __atomic_store_n( &instance->egress, NULL, __ATOMIC_RELEASE );
+  pthread_mutex_unlock( &resource_mutex );
+
+  qsbr_synchronize();
+
+  bool ret = true;
+  void *retval = NULL;
+  if ( pthread_tryjoin_np( instance->tid, &retval ) == EBUSY ) {
+    int err = pthread_cancel( instance->tid );
+    if ( err != 0 ) {
+      warn( "Failed to terminate a vxlan instance ( ret = %d, tid = %u, tap = %s ).",
+            err, instance->tid, instance->vxlan_tap_name );
+      ret = false;
+    }
+    while ( pthread_tryjoin_np( instance->tid, &retval ) == EBUSY ) {
+      struct timespec req = { 0, 50000000 };
+      nanosleep( &req, NULL );
+    }
+  }
+
+  delete_queue( egress );
+  close( instance->egress_event );
+  instance->egress_event = -1;
+
+  return ret;
+}
+
+
+// Must be called with resource_mutex held.
+static void
+watch_dormant_tap( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+  assert( dormant_fd >= 0 );
+
+  struct epoll_event event;
+  memset( &event, 0, sizeof( event ) );
+  event.events = EPOLLIN;
+  event.data.u32 = get_vni_value( instance->vni );
+  if ( epoll_ctl( dormant_fd, EPOLL_CTL_ADD, instance->tap_sock, &event ) < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    warn( "Failed to watch a tap interface ( fd = %d, errno = %s [%d] ).", instance->tap_sock, error_string, errno );
+    start_worker( instance );
+    return;
+  }
+  instance->watched = true;
+}
+
+
+// Must be called with resource_mutex held.
+static void
+unwatch_dormant_tap( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  if ( !instance->watched ) {
+    return;
+  }
+  epoll_ctl( dormant_fd, EPOLL_CTL_DEL, instance->tap_sock, NULL );
+  instance->watched = false;
+}
+
+
+static void
+hibernate_vxlan_instance( struct vxlan_instance *instance ) {
+  assert( instance != NULL );
+
+  if ( instance->worker_started ) {
+    stop_worker( instance );
+    pthread_mutex_lock( &resource_mutex );
+    watch_dormant_tap( instance );
+    pthread_mutex_unlock( &resource_mutex );
+    debug( "A VXLAN instance thread is stopped ( vni = %#x ).", get_vni_value( instance->vni ) );
+  }
+  release_vxlan_instance_tables( instance );
+}
+
+
+void
+hibernate_idle_vxlan_instances() {
+  assert( vxlan != NULL );
+
+  if ( vxlan->idle_timeout == 0 ) {
+    return;
+  }
+  uint32_t now = __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED );
+  if ( now == last_hibernation_check ) {
+    return;
+  }
+  last_hibernation_check = now;
+
+  int n_instances = 0;
+  struct vxlan_instance **instances = get_all_vxlan_instances( &n_instances );
+  if ( instances == NULL ) {
+    return;
+  }
+  for ( int n = 0; n < n_instances; n++ ) {
+    uint32_t last_used = __atomic_load_n( &instances[ n ]->last_used, __ATOMIC_RELAXED );
+    if ( now - last_used >= ( uint32_t ) vxlan->idle_timeout ) {
+      hibernate_vxlan_instance( instances[ n ] );
+    }
+  }
+  free( instances );
+}
+
+
 bool
 destroy_vxlan_instance( struct vxlan_instance *instance ) {
   assert( vxlan != NULL );
@@ -266,26 +764,39 @@ destroy_vxlan_instance( struct vxlan_instance *instance ) {
     }
   }
 
-  tap_down( instance->vxlan_tap_name );
-  instance->activated = false;
-
-  int ret = -1;
-  void *retval = NULL;
+  if ( instance->vlan != 0 ) {
+    // The trunk is shared with other instances and stays as it is.
+    instance->activated = false;
+    delete_vni_table( vxlan->instances, get_vni_value( instance->vni ) );
+    detach_vxlan_instance_from_trunk( instance );
+    instance->egress = NULL;
+    instance->egress_event = -1;
+    instance->tap_sock = -1;
+  }
+  else {
+    if ( instance->activated ) {
+      tap_down( instance->vxlan_tap_name );
+    }
+    instance->activated = false;
+    delete_vni_table( vxlan->instances, get_vni_value( instance->vni ) );
+  }
 
-  if ( pthread_tryjoin_np( instance->tid, &retval ) == EBUSY ) {
-    ret = pthread_cancel( instance->tid );
-    if ( ret != 0 ) {
-      warn( "Failed to terminate a vxlan instance ( ret = %d, tid = %u, tap = %s ).",
-            ret, instance->tid, instance->vxlan_tap_name );
+  if ( instance->vlan != 0 ) {
+    // No thread nor io_uring slot is dedicated to an instance on the trunk.
+  }
+  else if ( vxlan->io_engine == IO_ENGINE_IO_URING ) {
+    delete_instance_from_io_uring_engine( instance );
+  }
+  else {
+    pthread_mutex_lock( &resource_mutex );
+    unwatch_dormant_tap( instance );
+    pthread_mutex_unlock( &resource_mutex );
+    if ( !stop_worker( instance ) ) {
       errors++;
     }
-    while ( pthread_tryjoin_np( instance->tid, &retval ) == EBUSY ) {
-      struct timespec req = { 0, 50000000 };
-      nanosleep( &req, NULL );
-    }
   }
 
-  ret = close( instance->tap_sock );
+  int ret = instance->tap_sock >= 0 ? close( instance->tap_sock ) : 0;
   if ( ret < 0 ) {
     char buf[ 256 ];
     char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
@@ -293,11 +804,27 @@ destroy_vxlan_instance( struct vxlan_instance *instance ) {
           ret, instance->vxlan_tap_name, error_string, errno );
     errors++;
   }
-  destroy_fdb( instance->fdb );
-  free( instance->fdb );
+  // Wait until no data path thread holds a reference to the instance or its FDB entries.
+  qsbr_synchronize();
+  if ( instance->fdb != NULL ) {
+    destroy_fdb( instance->fdb );
+    destroy_neighbor_table( instance->neighbors );
+  }
+  if ( instance->remotes != NULL ) {
+    free( instance->remotes );
+  }
+  if ( instance->egress != NULL ) {
+    delete_queue( instance->egress );
+  }
+  if ( instance->egress_event >= 0 ) {
+    close( instance->egress_event );
+  }
+
+#ifdef LATENCY_STATS
+  free( instance->latency );
+#endif
 
   vxlan->n_instances--;
-  delete_hash( &vxlan->instances, instance->vni );
   free( instance );
 
   return errors == 0 ? true : false;
@@ -308,7 +835,7 @@ struct vxlan_instance **
 get_all_vxlan_instances( int *n_instances ) {
   assert( vxlan != NULL );
 
-  return ( struct vxlan_instance ** ) create_list_from_hash( &vxlan->instances, n_instances );
+  return ( struct vxlan_instance ** ) create_list_from_vni_table( vxlan->instances, n_instances );
 }
 
 
@@ -318,13 +845,27 @@ destroy_all_vxlan_instances() {
   
   int n_instances = 0;
   struct vxlan_instance **instances = get_all_vxlan_instances( &n_instances ); 
+
+  // Bring all dedicated taps down with as few netlink round trips as possible.
+  begin_link_batch();
+  for ( int n = 0; n < n_instances; n++ ) {
+    if ( instances[ n ]->vlan == 0 && instances[ n ]->activated ) {
+      tap_down( instances[ n ]->vxlan_tap_name );
+      instances[ n ]->activated = false;
+    }
+  }
+  if ( !commit_link_batch() ) {
+    warn( "Failed to bring some tap interfaces down." );
+  }
+
   for ( int n = 0; n < n_instances; n++ ) {
     destroy_vxlan_instance( instances[ n ] );
   }
   if ( instances != NULL ) {
     free( instances );
   }
-  destroy_hash( &vxlan->instances );
+  destroy_vni_table( vxlan->instances );
+  vxlan->instances = NULL;
 
   return true;
 }
@@ -332,29 +873,59 @@ destroy_all_vxlan_instances() {
 
 void
 process_fdb_etherframe_from_vxlan( struct vxlan_instance *instance,
-                                   struct ether_header *ether,
+                                   struct ether_header *ether, size_t length,
                                    struct sockaddr_in *vtep_addr ) {
   assert( vxlan != NULL );
   assert( instance != NULL );
   assert( ether != NULL );
   assert( vtep_addr != NULL );
 
-  struct fdb_entry *entry = fdb_search_entry( instance->fdb, ( uint8_t * ) ether->ether_shost );
+  PROBE4( vxland, frame_received, PROBE_VNI( instance->vni ), ether, length, vtep_addr->sin_addr.s_addr );
+
+  touch_vxlan_instance( instance );
+
+  if ( !instance->learning ) {
+    return;
+  }
+
+  struct fdb *fdb = __atomic_load_n( &instance->fdb, __ATOMIC_ACQUIRE );
+  if ( fdb == NULL ) {
+    allocate_vxlan_instance_tables( instance );
+    fdb = __atomic_load_n( &instance->fdb, __ATOMIC_ACQUIRE );
+  }
+  struct neighbor_table *neighbors = __atomic_load_n( &instance->neighbors, __ATOMIC_ACQUIRE );
+  if ( fdb == NULL || neighbors == NULL ) {
+    return;
+  }
+
+  if ( instance->neighbor_suppression ) {
+    learn_neighbor( neighbors, ether, length );
+  }
+
+  struct fdb_entry *entry = fdb_search_entry( fdb, ( uint8_t * ) ether->ether_shost );
   if ( entry == NULL ) {
-    vtep_addr->sin_port = htons( instance->port );
-    fdb_add_entry( instance->fdb, ( uint8_t * ) ether->ether_shost, *vtep_addr );
+    fdb_add_entry( fdb, ( uint8_t * ) ether->ether_shost, vtep_addr->sin_addr );
   }
   else { 
     if ( entry->type == FDB_ENTRY_TYPE_DYNAMIC ) {
-      if ( vtep_addr->sin_addr.s_addr != entry->vtep_addr.sin_addr.s_addr ) {
-        entry->vtep_addr = *vtep_addr;
+      // The entry may be read concurrently by the encapsulation path.
+      if ( vtep_addr->sin_addr.s_addr != __atomic_load_n( &entry->vtep_addr.s_addr, __ATOMIC_RELAXED ) ) {
+        __atomic_store_n( &entry->vtep_addr.s_addr, vtep_addr->sin_addr.s_addr, __ATOMIC_RELAXED );
       }
-      entry->ttl = instance->fdb->aging_time;
+      refresh_fdb_entry( entry );
     }
   }
 }
 
 
+static void
+unregister_from_qsbr( void *param ) {
+  UNUSED( param );
+
+  qsbr_unregister_thread();
+}
+
+
 static void *
 process_vxlan_instance( void *param ) {
   assert( vxlan != NULL );
@@ -365,18 +936,33 @@ process_vxlan_instance( void *param ) {
   char error_buf[ 256 ];
 
   struct vxlan_instance *instance = ( struct vxlan_instance * ) param;
+  // The queue is unpublished before the thread is stopped, so keep our own references.
+  queue *egress = instance->egress;
+  int egress_event = instance->egress_event;
 
-  instance->activated = true;
-  tap_up( instance->vxlan_tap_name );
+  qsbr_register_thread();
+  pthread_cleanup_push( unregister_from_qsbr, NULL );
 
   int tfd = -1;
-  int fd_max = instance->tap_sock;
+  bool tap_writable = true;
   while ( running ) {
-    fdb_collect_garbage( instance->fdb );
+    qsbr_quiescent_state();
+
+    if ( tap_writable ) {
+      tap_writable = drain_egress_queue( egress, instance->tap_sock );
+    }
 
     fd_set fds;
     FD_ZERO( &fds );
     FD_SET( instance->tap_sock, &fds );
+    FD_SET( egress_event, &fds );
+    int fd_max = instance->tap_sock > egress_event ? instance->tap_sock : egress_event;
+
+    fd_set write_fds;
+    FD_ZERO( &write_fds );
+    if ( !tap_writable ) {
+      FD_SET( instance->tap_sock, &write_fds );
+    }
 
     if ( !instance->multicast_joined ) {
       if ( tfd < 0 ) {
@@ -390,20 +976,18 @@ process_vxlan_instance( void *param ) {
         timer.it_value.tv_sec = 5;
         timer.it_interval.tv_sec = 5;
         timerfd_settime( tfd, 0, &timer, 0 );
-
-        if ( instance->tap_sock > tfd ) {
-          fd_max = instance->tap_sock;
-        }
-        else {
-          fd_max = tfd;
-        }
       }
       FD_SET( tfd, &fds );
+      if ( tfd > fd_max ) {
+        fd_max = tfd;
+      }
     }
 
     struct timespec timeout = { 1, 0 };
 
-    int ret = pselect( fd_max + 1, &fds, NULL, NULL, &timeout, NULL );
+    qsbr_thread_offline();
+    int ret = pselect( fd_max + 1, &fds, &write_fds, NULL, &timeout, NULL );
+    qsbr_thread_online();
     if ( ret < 0 ) {
       if ( errno == EINTR ) {
         continue;
@@ -424,14 +1008,25 @@ process_vxlan_instance( void *param ) {
         if ( instance->multicast_joined ) {
           close( tfd );
           tfd = -1;
-          fd_max = instance->tap_sock;
         }
       }
     }
 
+    if ( FD_ISSET( egress_event, &fds ) ) {
+      uint64_t count = 0;
+      read( egress_event, &count, sizeof( count ) );
+    }
+    if ( FD_ISSET( instance->tap_sock, &write_fds ) ) {
+      tap_writable = true;
+    }
+
     if ( FD_ISSET( instance->tap_sock, &fds ) ) {
       ssize_t len = read( instance->tap_sock, buf, sizeof( buf ) );
+      uint64_t received_at = LATENCY_TIMESTAMP();
       if ( len < 0 ) {
+        if ( errno == EAGAIN || errno == EINTR ) {
+          continue;
+        }
         char *error_string = safe_strerror_r( errno, error_buf, sizeof( error_buf ) );
         warn( "Failed to read data from a tap device ( fd = %d, len = %d, errno = %s [%d] ).",
               instance->tap_sock, len, error_string, errno );
@@ -446,50 +1041,176 @@ process_vxlan_instance( void *param ) {
         continue;
       }
 
-      send_etherframe_from_local_to_vxlan( instance, ( struct ether_header * ) buf, ( size_t ) len );
+      send_etherframe_from_local_to_vxlan( instance, ( struct ether_header * ) buf, ( size_t ) len, received_at );
     }
   }
 
+  pthread_cleanup_pop( 1 );
+
   return NULL;
 }
 
 
+void
+maintain_vxlan_instance( struct vxlan_instance *instance ) {
+  assert( vxlan != NULL );
+  assert( instance != NULL );
+
+  if ( !instance->multicast_joined ) {
+    multicast_join( instance );
+  }
+}
+
+
 bool
 start_vxlan_instance( struct vxlan_instance *instance ) {
   assert( vxlan != NULL );
   assert( instance != NULL );
 
-  instance->fdb = init_fdb( instance->aging_time );
-  assert( instance->fdb != NULL );
+  // Tables and the instance thread are allocated on first traffic, so that
+  // idle instances cost little more than their tap interfaces.
+  instance->last_used = __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED );
 
   bool ret = multicast_join( instance );
   if ( !ret ) {
     return false;
   }
 
-  pthread_attr_t attr;
-  pthread_attr_init( &attr );
-  int retval = pthread_attr_setstacksize( &attr, 4 * 1024 * 1024 );
-  if ( retval != 0 ) {
-    critical( "Failed to set stack size for a VXLAN instance thread." );
-    return false;
+  if ( instance->vlan != 0 ) {
+    return attach_vxlan_instance_to_trunk( instance );
   }
-  retval = pthread_create( &instance->tid, &attr, process_vxlan_instance, instance );
-  if ( retval != 0 ) {
-    error( "Failed to create a VXLAN instance thread ( errno = %d ).", errno );
+
+  if ( vxlan->io_engine == IO_ENGINE_IO_URING ) {
+    instance->activated = true;
+    tap_up( instance->vxlan_tap_name );
+    return add_instance_to_io_uring_engine( instance );
+  }
+
+  int flags = fcntl( instance->tap_sock, F_GETFL );
+  if ( flags < 0 || fcntl( instance->tap_sock, F_SETFL, flags | O_NONBLOCK ) < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to make a tap interface non-blocking ( fd = %d, errno = %s [%d] ).",
+           instance->tap_sock, error_string, errno );
     return false;
   }
 
+  instance->activated = true;
+  tap_up( instance->vxlan_tap_name );
+
+  pthread_mutex_lock( &resource_mutex );
+  watch_dormant_tap( instance );
+  pthread_mutex_unlock( &resource_mutex );
+
   return true;
 }
 
 
+static void
+maintain_dormant_instances() {
+  int n_instances = 0;
+  struct vxlan_instance **instances = get_all_vxlan_instances( &n_instances );
+  if ( instances == NULL ) {
+    return;
+  }
+  for ( int n = 0; n < n_instances; n++ ) {
+    if ( instances[ n ]->watched ) {
+      maintain_vxlan_instance( instances[ n ] );
+    }
+  }
+  free( instances );
+}
+
+
+// Watches tap interfaces of instances without threads and starts a thread
+// when the first frame arrives from a local host.
+static void *
+watch_dormant_instances( void *param ) {
+  UNUSED( param );
+
+  struct epoll_event events[ DORMANT_MAX_EVENTS ];
+  char buf[ 256 ];
+
+  qsbr_register_thread();
+  pthread_cleanup_push( unregister_from_qsbr, NULL );
+
+  uint32_t last_maintained = 0;
+  while ( running ) {
+    qsbr_quiescent_state();
+
+    uint32_t now = __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED );
+    if ( now - last_maintained >= DORMANT_MAINTENANCE_INTERVAL ) {
+      maintain_dormant_instances();
+      last_maintained = now;
+    }
+
+    qsbr_thread_offline();
+    int n_events = epoll_wait( dormant_fd, events, DORMANT_MAX_EVENTS, 1000 );
+    qsbr_thread_online();
+    if ( n_events < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+      error( "Failed to wait for events ( fd = %d, errno = %s [%d] ).", dormant_fd, error_string, errno );
+      break;
+    }
+
+    for ( int i = 0; i < n_events; i++ ) {
+      struct vxlan_instance *instance = search_vni_table( vxlan->instances, events[ i ].data.u32 );
+      if ( instance == NULL ) {
+        continue;
+      }
+      pthread_mutex_lock( &resource_mutex );
+      if ( instance->watched ) {
+        unwatch_dormant_tap( instance );
+        start_worker( instance );
+        debug( "A VXLAN instance thread is started ( vni = %#x ).", events[ i ].data.u32 );
+      }
+      pthread_mutex_unlock( &resource_mutex );
+    }
+  }
+
+  pthread_cleanup_pop( 1 );
+
+  return NULL;
+}
+
+
 bool
 init_vxlan_instances( struct vxlan *_vxlan ) {
   assert( _vxlan != NULL );
 
   vxlan = _vxlan;
 
+  // Instance threads are started on demand only with the select engine.
+  if ( vxlan->io_engine == IO_ENGINE_IO_URING ) {
+    return true;
+  }
+
+  dormant_fd = epoll_create1( EPOLL_CLOEXEC );
+  if ( dormant_fd < 0 ) {
+    char buf[ 256 ];
+    char *error_string = safe_strerror_r( errno, buf, sizeof( buf ) );
+    error( "Failed to create an epoll instance ( errno = %s [%d] ).", error_string, errno );
+    return false;
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init( &attr );
+  int ret = pthread_attr_setstacksize( &attr, 128 * 1024 );
+  if ( ret != 0 ) {
+    error( "Failed to set stack size for a dormant instance thread." );
+    return false;
+  }
+  ret = pthread_create( &dormant_tid, &attr, watch_dormant_instances, NULL );
+  if ( ret != 0 ) {
+    error( "Failed to create a dormant instance thread ( ret = %d ).", ret );
+    return false;
+  }
+  pthread_setname_np( dormant_tid, "dormant" );
+  dormant_thread_started = true;
+
   return true;
 }
 
@@ -498,8 +1219,22 @@ bool
 finalize_vxlan_instances() {
   assert( vxlan != NULL );
 
+  if ( dormant_thread_started ) {
+    void *retval = NULL;
+    if ( pthread_tryjoin_np( dormant_tid, &retval ) == EBUSY ) {
+      pthread_cancel( dormant_tid );
+      pthread_join( dormant_tid, &retval );
+    }
+    dormant_thread_started = false;
+  }
+
   destroy_all_vxlan_instances();
 
+  if ( dormant_fd >= 0 ) {
+    close( dormant_fd );
+    dormant_fd = -1;
+  }
+
   return true;
 }
 
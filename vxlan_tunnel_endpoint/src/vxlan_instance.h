@@ -23,37 +23,128 @@
 
 #include <net/ethernet.h>
 #include <netinet/in.h>
+#include "fdb.h"
+#include "latency.h"
+#include "neighbor.h"
+#include "queue.h"
 #include "vxlan_common.h"
 #include "vxlan.h"
 
 
+struct vxlan_instance_stats {
+  uint64_t unknown_unicast_flooded;
+  uint64_t unknown_unicast_dropped;
+  uint64_t neighbor_suppression_hits;
+  uint64_t neighbor_suppression_misses;
+  uint64_t egress_dropped;
+#ifdef LATENCY_STATS
+  struct latency_summary encap_latency; // Filled in only when listing instances
+  struct latency_summary decap_latency; // Filled in only when listing instances
+#endif
+};
+
+
+#ifdef LATENCY_STATS
+// From reading a frame from the tap interface until its vxlan message is
+// sent, and from receiving a vxlan message until its frame is written to
+// the tap interface.
+struct vxlan_instance_latency {
+  struct latency_histogram encap;
+  struct latency_histogram decap;
+};
+#endif
+
+
+// A decapsulated frame waiting to be written to a tap interface by the instance thread.
+struct egress_frame {
+  size_t length;
+#ifdef LATENCY_STATS
+  uint32_t vni; // The instance is looked up again since frames on the trunk may outlive it
+  uint64_t received_at;
+#endif
+  char data[ 0 ];
+};
+
+
+// Remote end points for head-end replication. Replaced as a whole and
+// reclaimed with QSBR, so that the data path can read it without locks.
+struct vxlan_remote_list {
+  int n_remotes;
+  struct in_addr remotes[ 0 ];
+};
+
+
 struct vxlan_instance {
   uint8_t vni[ VXLAN_VNISIZE ];
   struct sockaddr_in addr;
   uint16_t port;
   int udp_sock;
   char vxlan_tap_name[ IFNAMSIZ ];
+  uint16_t vlan; // Non-zero if attached to the trunk
+  uint16_t inner_vlan;
   bool multicast_joined;
-  struct fdb *fdb;
+  struct fdb *fdb; // Allocated on first use and released while idle
   pthread_t tid;
+  bool worker_started;
+  bool watched; // Waiting for the first frame from the tap to start the worker
+  uint32_t last_used;
   int tap_sock;
   time_t aging_time;
+  int max_fdb_entries;
+  bool learning;
+  int flood_rate;
+  uint32_t flood_window;
+  uint32_t n_flooded_in_window;
+  bool neighbor_suppression;
+  struct neighbor_table *neighbors;
+  struct vxlan_remote_list *remotes;
+  queue *egress;
+  int egress_event;
   bool activated;
+  int io_slot;
+  struct fdb_stats fdb_stats; // Filled in only when listing instances
+  struct vxlan_instance_stats stats;
+#ifdef LATENCY_STATS
+  struct vxlan_instance_latency *latency;
+#endif
 };
 
 
-struct vxlan_instance *create_vxlan_instance( uint8_t *vni, struct in_addr addr, uint16_t port, time_t aging_time );
+// Marks the instance as used so that it is not hibernated.
+static inline void
+touch_vxlan_instance( struct vxlan_instance *instance ) {
+  uint32_t now = __atomic_load_n( &fdb_clock, __ATOMIC_RELAXED );
+  if ( __atomic_load_n( &instance->last_used, __ATOMIC_RELAXED ) != now ) {
+    __atomic_store_n( &instance->last_used, now, __ATOMIC_RELAXED );
+  }
+}
+
+
+struct vxlan_instance *create_vxlan_instance( uint8_t *vni, struct in_addr addr, uint16_t port, time_t aging_time,
+                                              int max_fdb_entries, bool learning, int flood_rate,
+                                              bool neighbor_suppression, uint16_t vlan, uint16_t inner_vlan,
+                                              int tap_sock );
 struct vxlan_instance **get_all_vxlan_instances( int *n_instances );
 bool start_vxlan_instance( struct vxlan_instance *vins );
 bool set_vxlan_instance_flooding_addr( uint8_t *vni, struct in_addr addr );
 bool set_vxlan_instance_port( uint8_t *vni, uint16_t port );
 bool set_vxlan_instance_aging_time( uint8_t *vni, time_t aging_time );
+bool set_vxlan_instance_max_fdb_entries( uint8_t *vni, int max_fdb_entries );
+bool set_vxlan_instance_learning( uint8_t *vni, bool learning );
+bool set_vxlan_instance_flood_rate( uint8_t *vni, int flood_rate );
+bool set_vxlan_instance_neighbor_suppression( uint8_t *vni, bool neighbor_suppression );
+bool add_vxlan_instance_remote( uint8_t *vni, struct in_addr addr );
+bool delete_vxlan_instance_remote( uint8_t *vni, struct in_addr addr );
+struct vxlan_remote_list *get_vxlan_instance_remotes( uint8_t *vni );
 bool inactivate_vxlan_instance( uint8_t *vni );
 bool activate_vxlan_instance( uint8_t *vni );
 bool destroy_vxlan_instance( struct vxlan_instance *vins );
 void process_fdb_etherframe_from_vxlan( struct vxlan_instance *vins,
-                                        struct ether_header *ether,
+                                        struct ether_header *ether, size_t length,
                                         struct sockaddr_in *vtep_addr );
+void maintain_vxlan_instance( struct vxlan_instance *vins );
+void allocate_vxlan_instance_tables( struct vxlan_instance *vins );
+void hibernate_idle_vxlan_instances();
 bool init_vxlan_instances( struct vxlan *vxlan );
 bool finalize_vxlan_instances();
 
@@ -20,6 +20,7 @@
 
 #include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
 #include <getopt.h>
 #include <limits.h>
 #include <netinet/ether.h>
@@ -29,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "log.h"
 #include "vxlan_ctrl_client.h"
 
@@ -43,11 +45,20 @@ typedef struct {
   uint16_t port;
   struct ether_addr eth_addr;
   time_t aging_time;
+  int max_fdb_entries;
+  bool learning;
+  int flood_rate;
+  bool neighbor_suppression;
+  uint16_t vlan;
+  uint16_t inner_vlan;
+  const char *cursor;
+  uint32_t max_entries;
+  const char *file;
   uint16_t set_bitmap;
 } command_options;
 
 
-static char short_options[] = "asdlfwoebgqn:i:p:m:t:h";
+static char short_options[] = "asdlfwoebuUADRcgqXPSn:i:p:m:t:x:L:r:N:v:C:M:F:h";
 
 static struct option long_options[] = {
   { "add_instance", no_argument, NULL, 'a' },
@@ -60,12 +71,29 @@ static struct option long_options[] = {
   { "show_fdb", no_argument, NULL, 'f' },
   { "add_fdb_entry", no_argument, NULL, 'e' },
   { "delete_fdb_entry", no_argument, NULL, 'b' },
+  { "update_fdb", no_argument, NULL, 'u' },
+  { "update_neighbors", no_argument, NULL, 'U' },
+  { "add_remote", no_argument, NULL, 'A' },
+  { "del_remote", no_argument, NULL, 'D' },
+  { "show_remotes", no_argument, NULL, 'R' },
+  { "show_stats", no_argument, NULL, 'c' },
+  { "dump_capture", no_argument, NULL, 'P' },
+  { "start_replay", no_argument, NULL, 'S' },
   { "quiet", no_argument, NULL, 'q'},
   { "vni", required_argument, NULL, 'n' },
   { "ip", required_argument, NULL, 'i' },
   { "port", required_argument, NULL, 'p' },
   { "mac", required_argument, NULL, 'm' },
   { "aging_time", required_argument, NULL, 't' },
+  { "max_fdb_entries", required_argument, NULL, 'x' },
+  { "learning", required_argument, NULL, 'L' },
+  { "flood_rate", required_argument, NULL, 'r' },
+  { "neighbor_suppression", required_argument, NULL, 'N' },
+  { "vlan", required_argument, NULL, 'v' },
+  { "cursor", required_argument, NULL, 'C' },
+  { "max_entries", required_argument, NULL, 'M' },
+  { "replace", no_argument, NULL, 'X' },
+  { "file", required_argument, NULL, 'F' },
   { "help", no_argument, NULL, 'h' },
   { NULL, 0, NULL, 0  },
 };
@@ -85,6 +113,14 @@ usage() {
           "    -f, --show_fdb             Show forwarding database\n"
           "    -e, --add_fdb_entry        Add a static forwarding database entry\n"
           "    -b, --delete_fdb_entry     Delete a static forwarding database entry\n"
+          "    -u, --update_fdb           Add/delete forwarding database entries read from stdin or a file\n"
+          "    -U, --update_neighbors     Add/delete ARP/ND suppression entries read from stdin or a file\n"
+          "    -A, --add_remote           Add a remote end point for head-end replication\n"
+          "    -D, --del_remote           Delete a remote end point (all if no IP address given)\n"
+          "    -R, --show_remotes         Show remote end points for head-end replication\n"
+          "    -c, --show_stats           Show per-instance flooding statistics\n"
+          "    -P, --dump_capture         Write recently received packets to a pcapng file\n"
+          "    -S, --start_replay         Start replaying packets in replay mode\n"
           "    -h, --help                 Show this help and exit\n"
           "  OPTIONS:\n"
           "    -n, --vni                  Virtual Network Identifier\n"
@@ -92,6 +128,15 @@ usage() {
           "    -p, --port                 UDP port\n"
           "    -m, --mac                  MAC address\n"
           "    -t, --aging_time           Aging time\n"
+          "    -x, --max_fdb_entries      Maximum number of forwarding database entries\n"
+          "    -L, --learning             Learn MAC addresses from received frames (on/off)\n"
+          "    -r, --flood_rate           Unknown unicast flooding rate limit without learning (frames/s)\n"
+          "    -N, --neighbor_suppression Answer ARP requests and neighbor solicitations locally (on/off)\n"
+          "    -v, --vlan                 VLAN ID (or S-VLAN.C-VLAN) on the trunk interface\n"
+          "    -C, --cursor               Show instances (VNI) or FDB entries (MAC address) after this one\n"
+          "    -M, --max_entries          Maximum number of instances or FDB entries to show\n"
+          "    -X, --replace              Replace all static FDB entries with the ones added by the updates\n"
+          "    -F, --file                 Read updates from a file instead of stdin, or a file to dump packets to\n"
           "    -q, --quiet                Disable the output of the header.\n"
     );
 }
@@ -102,7 +147,7 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
   assert( argv != NULL );
   assert( options != NULL );
 
-  if ( argc <= 1 || argc >= 11 ) {
+  if ( argc <= 1 || argc >= 21 ) {
     return false;
   }
 
@@ -110,6 +155,9 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
   options->type = MESSAGE_TYPE_MAX;
   options->port = 0;
   options->aging_time = -1;
+  options->max_fdb_entries = -1;
+  options->learning = true;
+  options->flood_rate = -1;
 
   bool ret = true;
   int c = -1;
@@ -150,6 +198,39 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
         options->type = DEL_FDB_ENTRY_REQUEST;
         break;
 
+      case 'u':
+        options->type = UPDATE_FDB_REQUEST;
+        break;
+
+      case 'U':
+        options->type = UPDATE_NEIGHBORS_REQUEST;
+        break;
+
+      case 'A':
+        options->type = ADD_REMOTE_REQUEST;
+        break;
+
+      case 'D':
+        options->type = DEL_REMOTE_REQUEST;
+        break;
+
+      case 'R':
+        options->type = SHOW_REMOTES_REQUEST;
+        break;
+
+      case 'c':
+        options->type = LIST_INSTANCES_REQUEST;
+        options->set_bitmap |= SHOW_STATS;
+        break;
+
+      case 'P':
+        options->type = DUMP_CAPTURE_REQUEST;
+        break;
+
+      case 'S':
+        options->type = START_REPLAY_REQUEST;
+        break;
+
       case 'w':
         options->type = INACTIVATE_INSTANCE_REQUEST;
         break;
@@ -249,6 +330,142 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
         }
         break;
 
+      case 'x':
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          long long int max_fdb_entries = strtoll( optarg, &endp, 0 );
+          if ( *endp == '\0' && max_fdb_entries > 0 && max_fdb_entries <= VXLAN_MAX_FDB_ENTRIES ) {
+            options->max_fdb_entries = ( int ) max_fdb_entries;
+            options->set_bitmap |= SET_MAX_FDB_ENTRIES;
+          }
+          else {
+            printf( "Invalid maximum number of FDB entries ( %s ).\n", optarg );
+            ret &= false;
+          }
+        }
+        else {
+          printf( "A maximum number of FDB entries must be specified.\n" );
+          ret &= false;
+        }
+        break;
+
+      case 'L':
+        if ( optarg != NULL && strcmp( optarg, "on" ) == 0 ) {
+          options->learning = true;
+          options->set_bitmap |= SET_LEARNING;
+        }
+        else if ( optarg != NULL && strcmp( optarg, "off" ) == 0 ) {
+          options->learning = false;
+          options->set_bitmap |= SET_LEARNING;
+        }
+        else {
+          printf( "Learning must be either on or off.\n" );
+          ret &= false;
+        }
+        break;
+
+      case 'N':
+        if ( optarg != NULL && strcmp( optarg, "on" ) == 0 ) {
+          options->neighbor_suppression = true;
+          options->set_bitmap |= SET_NEIGHBOR_SUPPRESSION;
+        }
+        else if ( optarg != NULL && strcmp( optarg, "off" ) == 0 ) {
+          options->neighbor_suppression = false;
+          options->set_bitmap |= SET_NEIGHBOR_SUPPRESSION;
+        }
+        else {
+          printf( "Neighbor suppression must be either on or off.\n" );
+          ret &= false;
+        }
+        break;
+
+      case 'v':
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long vlan = strtoul( optarg, &endp, 0 );
+          unsigned long inner_vlan = 0;
+          if ( *endp == '.' ) {
+            inner_vlan = strtoul( endp + 1, &endp, 0 );
+            if ( inner_vlan == 0 ) {
+              endp = optarg;
+            }
+          }
+          if ( *endp == '\0' && vlan > 0 && vlan <= VXLAN_MAX_VLAN_ID && inner_vlan <= VXLAN_MAX_VLAN_ID ) {
+            options->vlan = ( uint16_t ) vlan;
+            options->inner_vlan = ( uint16_t ) inner_vlan;
+            options->set_bitmap |= SET_VLAN;
+          }
+          else {
+            printf( "Invalid VLAN ID ( %s ).\n", optarg );
+            ret &= false;
+          }
+        }
+        else {
+          printf( "A VLAN ID must be specified.\n" );
+          ret &= false;
+        }
+        break;
+
+      case 'r':
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          long long int flood_rate = strtoll( optarg, &endp, 0 );
+          if ( *endp == '\0' && flood_rate >= 0 && flood_rate <= VXLAN_MAX_FLOOD_RATE ) {
+            options->flood_rate = ( int ) flood_rate;
+            options->set_bitmap |= SET_FLOOD_RATE;
+          }
+          else {
+            printf( "Invalid flooding rate ( %s ).\n", optarg );
+            ret &= false;
+          }
+        }
+        else {
+          printf( "A flooding rate must be specified.\n" );
+          ret &= false;
+        }
+        break;
+
+      case 'C':
+        if ( optarg != NULL ) {
+          options->cursor = optarg;
+          options->set_bitmap |= SET_CURSOR;
+        }
+        else {
+          ret &= false;
+        }
+        break;
+
+      case 'M':
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long max_entries = strtoul( optarg, &endp, 0 );
+          if ( *endp == '\0' && max_entries > 0 && max_entries <= UINT32_MAX ) {
+            options->max_entries = ( uint32_t ) max_entries;
+            options->set_bitmap |= SET_MAX_ENTRIES;
+          }
+          else {
+            printf( "Invalid maximum number of entries ( %s ).\n", optarg );
+            ret &= false;
+          }
+        }
+        else {
+          ret &= false;
+        }
+        break;
+
+      case 'X':
+        options->set_bitmap |= SET_REPLACE;
+        break;
+
+      case 'F':
+        if ( optarg != NULL ) {
+          options->file = optarg;
+        }
+        else {
+          ret &= false;
+        }
+        break;
+
       case 'q':
         options->set_bitmap |= DISABLE_HEADER;
         break;
@@ -271,7 +488,8 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
       if ( ( options->set_bitmap & mask ) != mask ) {
         ret &= false;
       }
-      mask = SET_VNI | SET_IP_ADDR | SET_UDP_PORT | SET_AGING_TIME;
+      mask = SET_VNI | SET_IP_ADDR | SET_UDP_PORT | SET_AGING_TIME | SET_MAX_FDB_ENTRIES |
+             SET_LEARNING | SET_FLOOD_RATE | SET_NEIGHBOR_SUPPRESSION | SET_VLAN;
       if ( ( options->set_bitmap & ~mask ) != 0 ) {
         ret &= false;
       }
@@ -284,11 +502,13 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
       if ( ( options->set_bitmap & mask ) != mask ) {
         ret &= false;
       }
-      mask = SET_IP_ADDR | SET_UDP_PORT | SET_AGING_TIME;
+      mask = SET_IP_ADDR | SET_UDP_PORT | SET_AGING_TIME | SET_MAX_FDB_ENTRIES |
+             SET_LEARNING | SET_FLOOD_RATE | SET_NEIGHBOR_SUPPRESSION;
       if ( ( options->set_bitmap & mask ) == 0 ) {
         ret &= false;
       }
-      mask = SET_VNI | SET_IP_ADDR | SET_UDP_PORT | SET_AGING_TIME;
+      mask = SET_VNI | SET_IP_ADDR | SET_UDP_PORT | SET_AGING_TIME | SET_MAX_FDB_ENTRIES |
+             SET_LEARNING | SET_FLOOD_RATE | SET_NEIGHBOR_SUPPRESSION;
       if ( ( options->set_bitmap & ~mask ) != 0 ) {
         ret &= false;
       }
@@ -334,16 +554,25 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
       if ( ( options-> set_bitmap & mask ) == 0 )  {
         options->vni = 0xffffffff;
       }
-      mask = SET_VNI | SHOW_GLOBAL | DISABLE_HEADER;
+      mask = SET_VNI | SHOW_GLOBAL | SHOW_STATS | DISABLE_HEADER | SET_CURSOR | SET_MAX_ENTRIES;
       if ( ( options->set_bitmap & ~mask ) != 0 ) {
         ret &= false;
       }
+      mask = SHOW_GLOBAL | SHOW_STATS;
+      if ( ( options->set_bitmap & mask ) == mask ) {
+        ret &= false;
+      }
     }
     break;
 
     case SHOW_FDB_REQUEST:
     {
-      if ( options->set_bitmap != SET_VNI ) {
+      uint16_t mask = SET_VNI;
+      if ( ( options->set_bitmap & mask ) != mask ) {
+        ret &= false;
+      }
+      mask = SET_VNI | SET_MAC_ADDR | SET_CURSOR | SET_MAX_ENTRIES | DISABLE_HEADER;
+      if ( ( options->set_bitmap & ~mask ) != 0 ) {
         ret &= false;
       }
     }
@@ -375,6 +604,65 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
     }
     break;
 
+    case ADD_REMOTE_REQUEST:
+    {
+      if ( options->set_bitmap != ( SET_VNI | SET_IP_ADDR ) ) {
+        ret &= false;
+      }
+    }
+    break;
+
+    case DEL_REMOTE_REQUEST:
+    {
+      uint16_t mask = SET_VNI;
+      if ( ( options->set_bitmap & mask ) != mask ) {
+        ret &= false;
+      }
+      mask = SET_VNI | SET_IP_ADDR;
+      if ( ( options->set_bitmap & ~mask ) != 0 ) {
+        ret &= false;
+      }
+    }
+    break;
+
+    case UPDATE_FDB_REQUEST:
+    {
+      uint16_t mask = SET_VNI;
+      if ( ( options->set_bitmap & mask ) != mask ) {
+        ret &= false;
+      }
+      mask = SET_VNI | SET_REPLACE;
+      if ( ( options->set_bitmap & ~mask ) != 0 ) {
+        ret &= false;
+      }
+    }
+    break;
+
+    case UPDATE_NEIGHBORS_REQUEST:
+    case SHOW_REMOTES_REQUEST:
+    {
+      if ( options->set_bitmap != SET_VNI ) {
+        ret &= false;
+      }
+    }
+    break;
+
+    case DUMP_CAPTURE_REQUEST:
+    {
+      if ( options->set_bitmap != 0 || options->file == NULL ) {
+        ret &= false;
+      }
+    }
+    break;
+
+    case START_REPLAY_REQUEST:
+    {
+      if ( options->set_bitmap != 0 ) {
+        ret &= false;
+      }
+    }
+    break;
+
     default:
     {
       ret &= false;
@@ -382,10 +670,162 @@ parse_arguments( int argc, char *argv[], command_options *options ) {
     break;
   }
 
+  if ( options->file != NULL && options->type != UPDATE_FDB_REQUEST && options->type != UPDATE_NEIGHBORS_REQUEST &&
+       options->type != DUMP_CAPTURE_REQUEST ) {
+    ret &= false;
+  }
+
   return ret;
 }
 
 
+/*
+ * Reads forwarding database updates, one per line, in the form of
+ * "add MAC IP" or "del MAC". Empty lines and lines starting with '#'
+ * are ignored.
+ */
+static bool
+read_fdb_updates( FILE *stream, fdb_update **updates, unsigned int *n_updates ) {
+  assert( stream != NULL );
+  assert( updates != NULL );
+  assert( n_updates != NULL );
+
+  *updates = NULL;
+  *n_updates = 0;
+  unsigned int n_allocated = 0;
+  unsigned int line_number = 0;
+  char line[ 256 ];
+  while ( fgets( line, sizeof( line ), stream ) != NULL ) {
+    line_number++;
+    char *saveptr = NULL;
+    char *op = strtok_r( line, " \t\r\n", &saveptr );
+    if ( op == NULL || op[ 0 ] == '#' ) {
+      continue;
+    }
+    char *mac = strtok_r( NULL, " \t\r\n", &saveptr );
+    char *ip = strtok_r( NULL, " \t\r\n", &saveptr );
+
+    fdb_update update;
+    memset( &update, 0, sizeof( update ) );
+    if ( strcmp( op, "add" ) == 0 && mac != NULL && ip != NULL ) {
+      update.op = FDB_UPDATE_ADD;
+    }
+    else if ( strcmp( op, "del" ) == 0 && mac != NULL && ip == NULL ) {
+      update.op = FDB_UPDATE_DELETE;
+    }
+    else {
+      printf( "Invalid FDB update ( line = %u ).\n", line_number );
+      return false;
+    }
+    if ( ether_aton_r( mac, &update.eth_addr ) == NULL ) {
+      printf( "Invalid MAC address ( line = %u, mac = %s ).\n", line_number, mac );
+      return false;
+    }
+    if ( update.op == FDB_UPDATE_ADD && inet_aton( ip, &update.ip_addr ) == 0 ) {
+      printf( "Invalid IP address ( line = %u, ip = %s ).\n", line_number, ip );
+      return false;
+    }
+
+    if ( *n_updates == n_allocated ) {
+      n_allocated = n_allocated > 0 ? n_allocated * 2 : 1024;
+      *updates = realloc( *updates, sizeof( fdb_update ) * n_allocated );
+      assert( *updates != NULL );
+    }
+    ( *updates )[ ( *n_updates )++ ] = update;
+  }
+
+  return true;
+}
+
+
+/*
+ * Reads ARP/ND suppression entries, one per line, in the form of
+ * "add IP MAC" or "del IP" where IP is an IPv4 or IPv6 address.
+ */
+static bool
+read_neighbor_updates( FILE *stream, neighbor_update **updates, unsigned int *n_updates ) {
+  assert( stream != NULL );
+  assert( updates != NULL );
+  assert( n_updates != NULL );
+
+  *updates = NULL;
+  *n_updates = 0;
+  unsigned int n_allocated = 0;
+  unsigned int line_number = 0;
+  char line[ 256 ];
+  while ( fgets( line, sizeof( line ), stream ) != NULL ) {
+    line_number++;
+    char *saveptr = NULL;
+    char *op = strtok_r( line, " \t\r\n", &saveptr );
+    if ( op == NULL || op[ 0 ] == '#' ) {
+      continue;
+    }
+    char *ip = strtok_r( NULL, " \t\r\n", &saveptr );
+    char *mac = strtok_r( NULL, " \t\r\n", &saveptr );
+
+    neighbor_update update;
+    memset( &update, 0, sizeof( update ) );
+    if ( strcmp( op, "add" ) == 0 && ip != NULL && mac != NULL ) {
+      update.op = FDB_UPDATE_ADD;
+    }
+    else if ( strcmp( op, "del" ) == 0 && ip != NULL && mac == NULL ) {
+      update.op = FDB_UPDATE_DELETE;
+    }
+    else {
+      printf( "Invalid neighbor update ( line = %u ).\n", line_number );
+      return false;
+    }
+    if ( inet_pton( AF_INET, ip, update.addr ) == 1 ) {
+      update.family = AF_INET;
+    }
+    else if ( inet_pton( AF_INET6, ip, update.addr ) == 1 ) {
+      update.family = AF_INET6;
+    }
+    else {
+      printf( "Invalid IP address ( line = %u, ip = %s ).\n", line_number, ip );
+      return false;
+    }
+    if ( update.op == FDB_UPDATE_ADD && ether_aton_r( mac, &update.eth_addr ) == NULL ) {
+      printf( "Invalid MAC address ( line = %u, mac = %s ).\n", line_number, mac );
+      return false;
+    }
+
+    if ( *n_updates == n_allocated ) {
+      n_allocated = n_allocated > 0 ? n_allocated * 2 : 1024;
+      *updates = realloc( *updates, sizeof( neighbor_update ) * n_allocated );
+      assert( *updates != NULL );
+    }
+    ( *updates )[ ( *n_updates )++ ] = update;
+  }
+
+  return true;
+}
+
+
+// Opens the file that updates are read from. Updates are read from stdin if no file is given.
+static FILE *
+open_updates( const char *file ) {
+  if ( file == NULL ) {
+    return stdin;
+  }
+
+  FILE *stream = fopen( file, "r" );
+  if ( stream == NULL ) {
+    printf( "Failed to open %s ( errno = %s [%d] ).\n", file, strerror( errno ), errno );
+  }
+
+  return stream;
+}
+
+
+static void
+close_updates( FILE *stream ) {
+  if ( stream != NULL && stream != stdin ) {
+    fclose( stream );
+  }
+}
+
+
 int
 main( int argc, char *argv[] ) {
   command_options options;
@@ -403,14 +843,17 @@ main( int argc, char *argv[] ) {
   switch ( options.type ) {
     case ADD_INSTANCE_REQUEST:
     {
-      ret = add_instance( options.vni, options.ip_addr, options.port, options.aging_time, &status );
+      ret = add_instance( options.vni, options.ip_addr, options.port, options.aging_time,
+                          options.max_fdb_entries, options.learning, options.flood_rate,
+                          options.neighbor_suppression, options.vlan, options.inner_vlan, &status );
     }
     break;
 
     case SET_INSTANCE_REQUEST:
     {
       ret = set_instance( options.vni, options.set_bitmap, options.ip_addr, options.port,
-                          options.aging_time, &status );
+                          options.aging_time, options.max_fdb_entries, options.learning, options.flood_rate,
+                          options.neighbor_suppression, &status );
     }
     break;
 
@@ -440,13 +883,32 @@ main( int argc, char *argv[] ) {
 
     case LIST_INSTANCES_REQUEST:
     {
-      ret = list_instances( options.vni, options.set_bitmap, &status );
+      uint32_t cursor = 0;
+      if ( options.cursor != NULL ) {
+        char *endp = NULL;
+        unsigned long value = strtoul( options.cursor, &endp, 0 );
+        if ( *endp != '\0' || value > 0x00ffffff ) {
+          printf( "Invalid VNI value ( %s ).\n", options.cursor );
+          status = INVALID_ARGUMENT;
+          break;
+        }
+        cursor = ( uint32_t ) value;
+      }
+      ret = list_instances( options.vni, options.set_bitmap, options.cursor != NULL ? &cursor : NULL,
+                            options.max_entries, &status );
     }
     break;
 
     case SHOW_FDB_REQUEST:
     {
-      ret = show_fdb( options.vni, &status );
+      struct ether_addr cursor;
+      if ( options.cursor != NULL && ether_aton_r( options.cursor, &cursor ) == NULL ) {
+        printf( "Invalid MAC address ( %s ).\n", options.cursor );
+        status = INVALID_ARGUMENT;
+        break;
+      }
+      ret = show_fdb( options.vni, ( options.set_bitmap & SET_MAC_ADDR ) != 0 ? &options.eth_addr : NULL,
+                      options.cursor != NULL ? &cursor : NULL, options.max_entries, &status );
     }
     break;
 
@@ -462,6 +924,84 @@ main( int argc, char *argv[] ) {
     }
     break;
 
+    case UPDATE_FDB_REQUEST:
+    {
+      fdb_update *updates = NULL;
+      unsigned int n_updates = 0;
+      FILE *stream = open_updates( options.file );
+      if ( stream != NULL && read_fdb_updates( stream, &updates, &n_updates ) ) {
+        ret = update_fdb( options.vni, updates, n_updates, ( options.set_bitmap & SET_REPLACE ) != 0, &status );
+      }
+      else {
+        status = INVALID_ARGUMENT;
+      }
+      close_updates( stream );
+      if ( updates != NULL ) {
+        free( updates );
+      }
+    }
+    break;
+
+    case UPDATE_NEIGHBORS_REQUEST:
+    {
+      neighbor_update *updates = NULL;
+      unsigned int n_updates = 0;
+      FILE *stream = open_updates( options.file );
+      if ( stream != NULL && read_neighbor_updates( stream, &updates, &n_updates ) ) {
+        ret = update_neighbors( options.vni, updates, n_updates, &status );
+      }
+      else {
+        status = INVALID_ARGUMENT;
+      }
+      close_updates( stream );
+      if ( updates != NULL ) {
+        free( updates );
+      }
+    }
+    break;
+
+    case ADD_REMOTE_REQUEST:
+    {
+      ret = add_remote( options.vni, options.ip_addr, &status );
+    }
+    break;
+
+    case DEL_REMOTE_REQUEST:
+    {
+      ret = delete_remote( options.vni, options.ip_addr, &status );
+    }
+    break;
+
+    case SHOW_REMOTES_REQUEST:
+    {
+      ret = show_remotes( options.vni, &status );
+    }
+    break;
+
+    case DUMP_CAPTURE_REQUEST:
+    {
+      // The daemon does not share our working directory.
+      char file[ CAPTURE_FILE_LENGTH ];
+      char cwd[ CAPTURE_FILE_LENGTH ];
+      if ( options.file[ 0 ] == '/' ) {
+        snprintf( file, sizeof( file ), "%s", options.file );
+      }
+      else if ( getcwd( cwd, sizeof( cwd ) ) == NULL ||
+                snprintf( file, sizeof( file ), "%s/%s", cwd, options.file ) >= ( int ) sizeof( file ) ) {
+        printf( "Invalid file name ( %s ).\n", options.file );
+        status = INVALID_ARGUMENT;
+        break;
+      }
+      ret = dump_capture( file, &status );
+    }
+    break;
+
+    case START_REPLAY_REQUEST:
+    {
+      ret = start_replaying( &status );
+    }
+    break;
+
     default:
     {
       printf( "Undefined command ( %#x ).\n", options.type );
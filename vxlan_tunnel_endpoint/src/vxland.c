@@ -40,10 +40,17 @@
 #include "daemon.h"
 #include "fdb.h"
 #include "iftap.h"
+#include "latency.h"
+#include "io_uring_engine.h"
 #include "log.h"
 #include "net.h"
+#include "netlink.h"
+#include "probes.h"
+#include "qsbr.h"
+#include "trunk.h"
 #include "vxlan_common.h"
 #include "vxlan_ctrl_server.h"
+#include "vxlan_handover.h"
 #include "vxlan_instance.h"
 #include "wrapper.h"
 
@@ -52,6 +59,79 @@ volatile bool running = true;
 static struct vxlan vxlan;
 static char *program_name = NULL;
 
+// Datagrams replayed at most before checking timers and the link monitor
+#define REPLAY_BATCH_SIZE 64
+
+
+static void
+handle_vxlan_datagram( char *buf, size_t len, struct sockaddr_in *addr, uint64_t received_at ) {
+  if ( vxlan.capture != NULL ) {
+    uint32_t vni = len >= sizeof( struct vxlanhdr ) ?
+                   get_vni_value( ( ( struct vxlanhdr * ) buf )->vni ) : CAPTURE_NO_VNI;
+    capture_udp_payload( vxlan.capture, vni, addr, vxlan.port, buf, len );
+  }
+
+  if ( !vxlan.active || len < sizeof( struct vxlanhdr ) + sizeof( struct ether_header ) ) {
+    PROBE3( vxland, frame_dropped, PROBE_NO_VNI, vxlan.active ? PROBE_DROP_MALFORMED : PROBE_DROP_INACTIVE, len );
+    return;
+  }
+
+  struct vxlanhdr *vhdr = ( struct vxlanhdr * ) buf;
+  struct vxlan_instance *instance = NULL;
+  if ( ( instance = search_vni_table( vxlan.instances, get_vni_value( vhdr->vni ) ) ) == NULL ) {
+    PROBE3( vxland, frame_dropped, PROBE_VNI( vhdr->vni ), PROBE_DROP_UNKNOWN_VNI, len );
+    return;
+  }
+
+  if ( !instance->activated ) {
+    PROBE3( vxland, frame_dropped, PROBE_VNI( vhdr->vni ), PROBE_DROP_INACTIVE, len );
+    return;
+  }
+
+  struct ether_header *ether = ( struct ether_header * ) ( buf + sizeof( struct vxlanhdr ) );
+  process_fdb_etherframe_from_vxlan( instance, ether, len - sizeof( struct vxlanhdr ), addr );
+  send_etherframe_from_vxlan_to_local( instance, ether, len - sizeof( struct vxlanhdr ), received_at );
+}
+
+
+/*
+ * Feeds due datagrams of the replay into the data path. Returns how long
+ * to wait for the next one.
+ */
+static struct timespec
+replay_vxlan_datagrams( void ) {
+  static char packet[ REPLAY_PACKET_SIZE ];
+
+  uint64_t wait = 0;
+  for ( int i = 0; i < REPLAY_BATCH_SIZE; i++ ) {
+    size_t length = 0;
+    if ( !next_replayed_packet( vxlan.replay, packet, sizeof( packet ), &length, &wait ) ) {
+      if ( wait == 0 ) {
+        continue;
+      }
+      break;
+    }
+    wait = 0;
+
+    struct sockaddr_in addr;
+    size_t offset = 0;
+    size_t payload_length = 0;
+    if ( !get_replayed_udp_payload( packet, length, &addr, &offset, &payload_length ) ||
+         payload_length > VXLAN_PACKET_BUF_LEN ) {
+      continue;
+    }
+    handle_vxlan_datagram( packet + offset, payload_length, &addr, LATENCY_TIMESTAMP() );
+  }
+
+  struct timespec timeout = { 1, 0 };
+  if ( wait < 1000000000 ) {
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = ( long ) wait;
+  }
+
+  return timeout;
+}
+
 
 static void
 process_vxlan( void ) {
@@ -61,6 +141,7 @@ process_vxlan( void ) {
   vxlan.timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
   if ( vxlan.timerfd < 0 ) {
     error( "Failed to create timerfd." );
+    finalize_log();
     exit( OTHER_ERROR );
   }
   struct itimerspec timer;
@@ -69,6 +150,7 @@ process_vxlan( void ) {
   timer.it_interval.tv_sec = 5;
   timerfd_settime( vxlan.timerfd, 0, &timer, 0 );
 
+  int link_monitor_fd = get_link_monitor_fd();
   int fd_max = -1;
   if ( vxlan.udp_sock > vxlan.timerfd ) {
     fd_max = vxlan.udp_sock;
@@ -76,16 +158,34 @@ process_vxlan( void ) {
   else {
     fd_max = vxlan.timerfd;
   }
+  if ( link_monitor_fd > fd_max ) {
+    fd_max = link_monitor_fd;
+  }
+
+  qsbr_register_thread();
 
   // From Internet
   while ( running ) {
+    qsbr_quiescent_state();
+
+    struct timespec timeout = { 1, 0 };
+    if ( vxlan.replay != NULL ) {
+      timeout = replay_vxlan_datagrams();
+    }
+
     fd_set fds;
     FD_ZERO( &fds );
-    FD_SET( vxlan.udp_sock, &fds );
+    if ( vxlan.replay == NULL ) {
+      FD_SET( vxlan.udp_sock, &fds );
+    }
     FD_SET( vxlan.timerfd, &fds );
+    if ( link_monitor_fd >= 0 ) {
+      FD_SET( link_monitor_fd, &fds );
+    }
 
-    struct timespec timeout = { 1, 0 };
+    qsbr_thread_offline();
     int ret = pselect( fd_max + 1, &fds, NULL, NULL, &timeout, NULL );
+    qsbr_thread_online();
     if ( ret < 0 ) {
       if ( errno == EINTR ) {
         continue;
@@ -100,7 +200,11 @@ process_vxlan( void ) {
     if ( FD_ISSET( vxlan.timerfd, &fds ) ) {
       uint64_t timer_count = 0;
       read( vxlan.timerfd, &timer_count, sizeof( timer_count ) );
-      update_interface_state();
+      qsbr_reclaim();
+    }
+
+    if ( link_monitor_fd >= 0 && FD_ISSET( link_monitor_fd, &fds ) ) {
+      handle_interface_events();
     }
 
     if ( !FD_ISSET( vxlan.udp_sock, &fds ) ) {
@@ -115,26 +219,13 @@ process_vxlan( void ) {
                            ( struct sockaddr * ) &addr, &socklen ) ) < 0 ) {
       continue;
     }
+    uint64_t received_at = LATENCY_TIMESTAMP();
 
-    if ( !vxlan.active ) {
-      continue;
-    }
-
-    struct vxlanhdr *vhdr = ( struct vxlanhdr * ) buf;
-    struct vxlan_instance *instance = NULL;
-    if ( ( instance = search_hash( &vxlan.instances, vhdr->vni ) ) == NULL ) {
-      continue;
-    }
-
-    if ( !instance->activated ) {
-      continue;
-    }
-
-    struct ether_header *ether = ( struct ether_header * ) ( buf + sizeof( struct vxlanhdr ) );
-    process_fdb_etherframe_from_vxlan( instance, ether, &addr );
-    send_etherframe_from_vxlan_to_local( instance, ether, ( size_t ) len - sizeof( struct vxlanhdr ) );
+    handle_vxlan_datagram( buf, ( size_t ) len, &addr, received_at );
   }
 
+  qsbr_unregister_thread();
+
   close( vxlan.timerfd );
 }
 
@@ -164,7 +255,7 @@ set_signal_handler() {
 }
 
 
-static char short_options[] = "shm:di:p:a:f:t:";
+static char short_options[] = "shHm:di:p:a:f:t:e:r:T:I:c:C:R:S:L:";
 
 static struct option long_options[] = {
   { "syslog", no_argument, NULL, 's' },
@@ -175,6 +266,17 @@ static struct option long_options[] = {
   { "flooding_address", required_argument, NULL, 'a' },
   { "flooding_port", required_argument, NULL, 'f' },
   { "aging_time", required_argument, NULL, 't' },
+  { "max_fdb_entries", required_argument, NULL, 'm' },
+  { "io_engine", required_argument, NULL, 'e' },
+  { "source_port_range", required_argument, NULL, 'r' },
+  { "trunk", required_argument, NULL, 'T' },
+  { "idle_timeout", required_argument, NULL, 'I' },
+  { "handover", no_argument, NULL, 'H' },
+  { "capture_size", required_argument, NULL, 'c' },
+  { "capture_length", required_argument, NULL, 'C' },
+  { "replay", required_argument, NULL, 'R' },
+  { "replay_speed", required_argument, NULL, 'S' },
+  { "replay_loops", required_argument, NULL, 'L' },
   { NULL, 0, NULL, 0  },
 };
 
@@ -187,6 +289,17 @@ usage() {
           "  -a, --flooding_address  Default destination IP address for sending flooding packets\n"
           "  -f, --flooding_port     Default destination UDP port for sending flooding packets\n"
           "  -t, --aging_time        Default aging time\n"
+          "  -m, --max_fdb_entries   Default maximum number of forwarding database entries\n"
+          "  -e, --io_engine         I/O engine ( select or io_uring )\n"
+          "  -r, --source_port_range UDP source port range for sending VXLAN packets ( MIN-MAX or 0 )\n"
+          "  -T, --trunk             Tap interface which carries VLAN tagged frames of many instances\n"
+          "  -I, --idle_timeout      Idle time before releasing resources of an instance ( 0 to disable )\n"
+          "  -H, --handover          Take over instances and sockets from a running vxland\n"
+          "  -c, --capture_size      Number of received datagrams kept for dumping ( 0 to disable )\n"
+          "  -C, --capture_length    Maximum number of octets kept per datagram\n"
+          "  -R, --replay            Read datagrams from a pcap or pcapng file instead of the network\n"
+          "  -S, --replay_speed      Replay speed ( recorded or max )\n"
+          "  -L, --replay_loops      Number of times the file is replayed ( 0 for no limit )\n"
           "  -s, --syslog            Output log messages to syslog\n"
           "  -d, --daemonize         Daemonize\n"
           "  -h, --help              Show this help and exit.\n" );
@@ -202,14 +315,29 @@ parse_arguments( int argc, char *argv[] ) {
   }
 
   memset( &vxlan, 0, sizeof( vxlan ) );
-  init_hash( &vxlan.instances, VXLAN_VNISIZE );
+  vxlan.instances = create_vni_table();
   vxlan.log_output = LOG_OUTPUT_STDOUT;
   vxlan.port = VXLAN_DEFAULT_UDP_PORT;
   vxlan.daemonize = false; 
   memset( vxlan.ifname, '\0', sizeof( vxlan.ifname ) );
+  memset( vxlan.trunk_name, '\0', sizeof( vxlan.trunk_name ) );
   inet_pton( AF_INET, VXLAN_DEFAULT_FLOODING_ADDR, &vxlan.flooding_addr );
   vxlan.flooding_port = vxlan.port;
   vxlan.aging_time = VXLAN_DEFAULT_AGING_TIME;
+  vxlan.max_fdb_entries = VXLAN_DEFAULT_MAX_FDB_ENTRIES;
+  vxlan.idle_timeout = VXLAN_DEFAULT_IDLE_TIMEOUT;
+  vxlan.io_engine = IO_ENGINE_SELECT;
+  vxlan.source_port_min = VXLAN_DEFAULT_SOURCE_PORT_MIN;
+  vxlan.source_port_max = VXLAN_DEFAULT_SOURCE_PORT_MAX;
+  vxlan.udp_sock = -1;
+  vxlan.raw_sock = -1;
+  vxlan.trunk_sock = -1;
+  vxlan.handover = false;
+  vxlan.capture_frames = 0;
+  vxlan.capture_length = VXLAN_CAPTURE_LENGTH;
+  vxlan.replay_file = NULL;
+  vxlan.replay_speed = REPLAY_SPEED_RECORDED;
+  vxlan.replay_loops = 1;
 
   bool flooding_port_specified = false;
 
@@ -307,12 +435,193 @@ parse_arguments( int argc, char *argv[] ) {
       }
       break;
 
+      case 'm':
+      {
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long max_fdb_entries = strtoul( optarg, &endp, 0 );
+          if ( *endp != '\0' || max_fdb_entries == 0 || max_fdb_entries > VXLAN_MAX_FDB_ENTRIES ) {
+            printf( "Invalid maximum number of FDB entries ( %s ).\n", optarg );
+            ret &= false;
+          }
+          else {
+            vxlan.max_fdb_entries = ( uint32_t ) max_fdb_entries;
+          }
+        }
+        else {
+          ret &= false;
+        }
+      }
+      break;
+
+      case 'e':
+      {
+        if ( optarg != NULL && strcmp( optarg, "select" ) == 0 ) {
+          vxlan.io_engine = IO_ENGINE_SELECT;
+        }
+        else if ( optarg != NULL && strcmp( optarg, "io_uring" ) == 0 ) {
+          vxlan.io_engine = IO_ENGINE_IO_URING;
+        }
+        else {
+          printf( "Invalid I/O engine ( %s ).\n", optarg != NULL ? optarg : "" );
+          ret &= false;
+        }
+      }
+      break;
+
+      case 'r':
+      {
+        if ( optarg != NULL && strcmp( optarg, "0" ) == 0 ) {
+          vxlan.source_port_min = 0;
+          vxlan.source_port_max = 0;
+        }
+        else if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long min = strtoul( optarg, &endp, 0 );
+          unsigned long max = 0;
+          if ( *endp == '-' ) {
+            max = strtoul( endp + 1, &endp, 0 );
+          }
+          if ( *endp != '\0' || min == 0 || max > UINT16_MAX || min > max ) {
+            printf( "Invalid source port range ( %s ).\n", optarg );
+            ret &= false;
+          }
+          else {
+            vxlan.source_port_min = ( uint16_t ) min;
+            vxlan.source_port_max = ( uint16_t ) max;
+          }
+        }
+        else {
+          ret &= false;
+        }
+      }
+      break;
+
+      case 'I':
+      {
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long idle_timeout = strtoul( optarg, &endp, 0 );
+          if ( *endp != '\0' || idle_timeout > VXLAN_MAX_IDLE_TIMEOUT ) {
+            printf( "Invalid idle timeout value ( %s ).\n", optarg );
+            ret &= false;
+          }
+          else {
+            vxlan.idle_timeout = ( time_t ) idle_timeout;
+          }
+        }
+        else {
+          ret &= false;
+        }
+      }
+      break;
+
+      case 'T':
+      {
+        if ( optarg != NULL ) {
+          strncpy( vxlan.trunk_name, optarg, sizeof( vxlan.trunk_name ) - 1 );
+        }
+        else {
+          ret &= false;
+        }
+      }
+      break;
+
       case 'd':
       {
         vxlan.daemonize = true;
       }
       break;
 
+      case 'H':
+      {
+        vxlan.handover = true;
+      }
+      break;
+
+      case 'c':
+      {
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long capture_frames = strtoul( optarg, &endp, 0 );
+          if ( *endp != '\0' || capture_frames > VXLAN_MAX_CAPTURE_FRAMES ) {
+            printf( "Invalid capture size ( %s ).\n", optarg );
+            ret &= false;
+          }
+          else {
+            vxlan.capture_frames = ( unsigned int ) capture_frames;
+          }
+        }
+        else {
+          ret &= false;
+        }
+      }
+      break;
+
+      case 'C':
+      {
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long capture_length = strtoul( optarg, &endp, 0 );
+          if ( *endp != '\0' || capture_length < CAPTURE_MIN_LENGTH || capture_length > VXLAN_CAPTURE_LENGTH ) {
+            printf( "Invalid capture length ( %s ).\n", optarg );
+            ret &= false;
+          }
+          else {
+            vxlan.capture_length = ( unsigned int ) capture_length;
+          }
+        }
+        else {
+          ret &= false;
+        }
+      }
+      break;
+
+      case 'R':
+      {
+        if ( optarg != NULL ) {
+          vxlan.replay_file = optarg;
+        }
+        else {
+          ret &= false;
+        }
+      }
+      break;
+
+      case 'S':
+      {
+        if ( optarg != NULL && strcmp( optarg, "recorded" ) == 0 ) {
+          vxlan.replay_speed = REPLAY_SPEED_RECORDED;
+        }
+        else if ( optarg != NULL && strcmp( optarg, "max" ) == 0 ) {
+          vxlan.replay_speed = REPLAY_SPEED_MAX;
+        }
+        else {
+          printf( "Invalid replay speed ( %s ).\n", optarg != NULL ? optarg : "" );
+          ret &= false;
+        }
+      }
+      break;
+
+      case 'L':
+      {
+        if ( optarg != NULL ) {
+          char *endp = NULL;
+          unsigned long replay_loops = strtoul( optarg, &endp, 0 );
+          if ( *endp != '\0' || replay_loops > UINT_MAX ) {
+            printf( "Invalid number of replay loops ( %s ).\n", optarg );
+            ret &= false;
+          }
+          else {
+            vxlan.replay_loops = ( unsigned int ) replay_loops;
+          }
+        }
+        else {
+          ret &= false;
+        }
+      }
+      break;
+
       case 'h':
       {
         usage();
@@ -340,6 +649,11 @@ parse_arguments( int argc, char *argv[] ) {
     ret &= false;
   }
 
+  if ( vxlan.replay_file != NULL && vxlan.handover ) {
+    printf( "Replay cannot be combined with handover.\n" );
+    ret &= false;
+  }
+
   return ret;
 }
 
@@ -353,26 +667,82 @@ init_vxland( const char *name ) {
   if ( vxlan.daemonize ) {
     finalize_log();
     daemonize();
-    init_log( name, vxlan.log_output );
+    init_log( name, ( uint8_t ) ( vxlan.log_output | LOG_OUTPUT_ASYNC ) );
   }
 
-  bool ret = create_pid_file( program_name );
+  bool ret = true;
+  if ( vxlan.handover ) {
+    // The pid file is replaced once the previous process agrees to exit.
+    ret = take_over_vxlan( &vxlan );
+  }
+  else {
+    ret = create_pid_file( program_name );
+  }
   if ( !ret ) {
     return false;
   }
 
   set_signal_handler();
 
+  ret = init_qsbr();
+  if ( !ret ) {
+    return false;
+  }
+
   ret = init_net( &vxlan );
   if ( !ret ) {
     return false;
   }
 
+  ret = init_fdb_aging();
+  if ( !ret ) {
+    return false;
+  }
+
+  if ( vxlan.capture_frames > 0 ) {
+    vxlan.capture = create_capture_ring( vxlan.ifname, vxlan.capture_frames, vxlan.capture_length );
+    if ( vxlan.capture == NULL ) {
+      return false;
+    }
+  }
+
+  if ( vxlan.replay_file != NULL ) {
+    vxlan.replay = open_replay( vxlan.replay_file, vxlan.port, vxlan.replay_speed, vxlan.replay_loops );
+    if ( vxlan.replay == NULL ) {
+      return false;
+    }
+    if ( vxlan.io_engine == IO_ENGINE_IO_URING ) {
+      warn( "Datagrams are replayed with the select engine." );
+      vxlan.io_engine = IO_ENGINE_SELECT;
+    }
+    info( "Replaying %s once started with a control command. Frames to taps and remotes are discarded.",
+          vxlan.replay_file );
+  }
+
+  if ( vxlan.io_engine == IO_ENGINE_IO_URING ) {
+    if ( !init_io_uring_engine( &vxlan ) ) {
+      warn( "io_uring is not available. Falling back to select." );
+      vxlan.io_engine = IO_ENGINE_SELECT;
+    }
+  }
+
+  ret = init_trunk( &vxlan );
+  if ( !ret ) {
+    return false;
+  }
+
   ret = init_vxlan_instances( &vxlan );
   if ( !ret ) {
     return false;
   }
 
+  if ( vxlan.handover ) {
+    ret = restore_handed_over_instances();
+    if ( !ret ) {
+      return false;
+    }
+  }
+
   ret = init_vxlan_ctrl_server( &vxlan );
   if ( !ret ) {
     return false;
@@ -387,8 +757,23 @@ finalize_vxland() {
   bool ret = true;
 
   ret &= finalize_vxlan_ctrl_server();
+  if ( vxlan.io_engine == IO_ENGINE_IO_URING ) {
+    ret &= finalize_io_uring_engine();
+  }
   ret &= finalize_vxlan_instances();
+  ret &= finalize_trunk();
+  ret &= finalize_fdb_aging();
   ret &= finalize_net();
+  ret &= finalize_qsbr();
+
+  if ( vxlan.replay != NULL ) {
+    close_replay( vxlan.replay );
+    vxlan.replay = NULL;
+  }
+  if ( vxlan.capture != NULL ) {
+    destroy_capture_ring( vxlan.capture );
+    vxlan.capture = NULL;
+  }
 
   if ( program_name != NULL ) {
     ret &= remove_pid_file( program_name );
@@ -414,12 +799,12 @@ main( int argc, char *argv[] ) {
     exit( INVALID_ARGUMENT );
   }
 
-  if ( pid_file_exists( basename( argv[ 0 ] ) ) ) {
+  if ( !vxlan.handover && pid_file_exists( basename( argv[ 0 ] ) ) ) {
     printf( "Another %s is running.\n", basename( argv[ 0 ] ) );
     exit( ALREADY_RUNNING );
   }
 
-  init_log( basename( argv[ 0 ] ), vxlan.log_output );
+  init_log( basename( argv[ 0 ] ), ( uint8_t ) ( vxlan.log_output | LOG_OUTPUT_ASYNC ) );
 
   info( "Starting Jumper Wire - VXLAN daemon ( pid = %u ).", getpid() );
 
@@ -431,7 +816,37 @@ main( int argc, char *argv[] ) {
   }
 
   start_vxlan_ctrl_server();
-  process_vxlan();
+  if ( vxlan.handover ) {
+    if ( complete_vxlan_takeover() ) {
+      remove_pid_file( program_name );
+      create_pid_file( program_name );
+      if ( !publish_vxlan_ctrl_server() ) {
+        // Forwarding already belongs to this process, so keep running.
+        critical( "Control requests are only accepted at the temporary socket path until restarted." );
+      }
+    }
+    else {
+      // Everything still belongs to the previous process. Only the control
+      // socket bound to a temporary path is ours to remove.
+      finalize_vxlan_ctrl_server();
+      vxlan.handed_over = true;
+      running = false;
+    }
+  }
+  if ( vxlan.io_engine == IO_ENGINE_IO_URING ) {
+    run_io_uring_engine();
+  }
+  else {
+    process_vxlan();
+  }
+
+  if ( vxlan.handed_over ) {
+    // Taps, sockets, the pid file and the control socket belong to the other
+    // process. Exit without tearing any of them down.
+    info( "Terminating Jumper Wire - VXLAN daemon after handover ( pid = %u ).", getpid() );
+    finalize_log();
+    return SUCCEEDED;
+  }
 
   info( "Terminating Jumper Wire - VXLAN daemon ( pid = %u ).", getpid() );
 
@@ -441,7 +856,14 @@ main( int argc, char *argv[] ) {
   return SUCCEEDED;
 
 error:
-  remove_pid_file( basename( argv[ 0 ] ) );
+  if ( vxlan.handover ) {
+    abort_vxlan_takeover();
+  }
+  else {
+    remove_pid_file( basename( argv[ 0 ] ) );
+  }
+  // Messages are only in per-thread rings until flushed.
+  finalize_log();
   exit( status );
 }
 